@@ -1241,7 +1241,8 @@ static HRESULT CreateD3DResources12(
     _In_ bool isCubeMap,
     _In_reads_opt_(mipCount* arraySize) D3D12_SUBRESOURCE_DATA* initData,
     ComPtr<ID3D12Resource>& texture,
-    ComPtr<ID3D12Resource>& textureUploadHeap
+    const UploadAllocator12& upload,
+    const TextureAllocator12& allocator
 )
 {
     if (device == nullptr)
@@ -1269,14 +1270,7 @@ static HRESULT CreateD3DResources12(
         texDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
         texDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
 
-        hr = device->CreateCommittedResource(
-            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-            D3D12_HEAP_FLAG_NONE,
-            &texDesc,
-            D3D12_RESOURCE_STATE_COMMON,
-            nullptr,
-            IID_PPV_ARGS(&texture)
-        );
+        hr = allocator.create(allocator.user, &texDesc, D3D12_RESOURCE_STATE_COMMON, texture.ReleaseAndGetAddressOf());
 
         if (FAILED(hr))
         {
@@ -1288,28 +1282,32 @@ static HRESULT CreateD3DResources12(
             const UINT num2DSubresources = texDesc.DepthOrArraySize * texDesc.MipLevels;
             const UINT64 uploadBufferSize = GetRequiredIntermediateSize(texture.Get(), 0, num2DSubresources);
 
-            hr = device->CreateCommittedResource(
-                &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-                D3D12_HEAP_FLAG_NONE,
-                &CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
-                D3D12_RESOURCE_STATE_GENERIC_READ,
-                nullptr,
-                IID_PPV_ARGS(&textureUploadHeap));
-            if (FAILED(hr))
+            ID3D12Resource* uploadBuffer = nullptr;
+            UINT64 uploadOffset = 0;
+            if (!upload.allocate(upload.user, uploadBufferSize, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, &uploadBuffer, &uploadOffset))
             {
                 texture = nullptr;
-                return hr;
+                return E_OUTOFMEMORY;
             }
             else
             {
-                cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(),
-                    D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+                // Copy queues can not name shader states. There the texture is promoted from COMMON to COPY_DEST,
+                // decays back to COMMON when the copy finishes and is promoted again when a shader reads it.
+                const bool copyQueue = cmdList->GetType() == D3D12_COMMAND_LIST_TYPE_COPY;
+                if (!copyQueue)
+                {
+                    cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(),
+                        D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST));
+                }
 
                 // Use Heap-allocating UpdateSubresources implementation for variable number of subresources (which is the case for textures).
-                UpdateSubresources(cmdList, texture.Get(), textureUploadHeap.Get(), 0, 0, num2DSubresources, initData);
+                UpdateSubresources(cmdList, texture.Get(), uploadBuffer, uploadOffset, 0, num2DSubresources, initData);
 
-                cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(),
-                    D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+                if (!copyQueue)
+                {
+                    cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(),
+                        D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+                }
             }
         }
     } break;
@@ -1678,7 +1676,8 @@ static HRESULT CreateTextureFromDDS12(
     _In_ size_t maxsize,
     _In_ bool forceSRGB,
     ComPtr<ID3D12Resource>& texture,
-    ComPtr<ID3D12Resource>& textureUploadHeap)
+    const UploadAllocator12& upload,
+    const TextureAllocator12& allocator)
 {
     HRESULT hr = S_OK;
 
@@ -1867,7 +1866,8 @@ static HRESULT CreateTextureFromDDS12(
             isCubeMap,
             initData.get(),
             texture,
-            textureUploadHeap);
+            upload,
+            allocator);
     }
 
     return hr;
@@ -1924,7 +1924,8 @@ HRESULT DirectX::CreateDDSTextureFromMemory12(
     _In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
     _In_ size_t ddsDataSize,
     ComPtr<ID3D12Resource>& texture,
-    ComPtr<ID3D12Resource>& textureUploadHeap,
+    const UploadAllocator12& upload,
+    const TextureAllocator12& allocator,
     _In_ size_t maxsize,
     _Out_opt_ DDS_ALPHA_MODE* alphaMode
 )
@@ -1979,7 +1980,8 @@ HRESULT DirectX::CreateDDSTextureFromMemory12(
         maxsize,
         false,
         texture,
-        textureUploadHeap
+        upload,
+        allocator
     );
 
     if (SUCCEEDED(hr))
@@ -2138,7 +2140,8 @@ HRESULT DirectX::CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
     _In_ ID3D12GraphicsCommandList* cmdList,
     _In_z_ const wchar_t* szFileName,
     _Out_ ComPtr<ID3D12Resource>& texture,
-    _Out_ ComPtr<ID3D12Resource>& textureUploadHeap,
+    _In_ const UploadAllocator12& upload,
+    _In_ const TextureAllocator12& allocator,
     _In_ size_t maxsize,
     _Out_opt_ DDS_ALPHA_MODE* alphaMode)
 {
@@ -2146,10 +2149,6 @@ HRESULT DirectX::CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
     {
         texture = nullptr;
     }
-    if (textureUploadHeap)
-    {
-        textureUploadHeap = nullptr;
-    }
     if (alphaMode)
     {
         *alphaMode = DDS_ALPHA_MODE_UNKNOWN;
@@ -2172,7 +2171,7 @@ HRESULT DirectX::CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
     }
 
     hr = CreateTextureFromDDS12(device, cmdList, header,
-        bitData, bitSize, maxsize, false, texture, textureUploadHeap);
+        bitData, bitSize, maxsize, false, texture, upload, allocator);
 
     if (SUCCEEDED(hr))
     {
@@ -55,6 +55,22 @@ namespace DirectX
         DDS_ALPHA_MODE_CUSTOM = 4,
     };
 
+    // Upload memory for the 12 loaders. Texels are copied from buffer at offset into the texture by the command list,
+    // so the caller sub-allocates upload space instead of the loader creating a buffer per texture.
+    struct UploadAllocator12
+    {
+        bool (*allocate)(void* user, UINT64 size, UINT64 alignment, ID3D12Resource** buffer, UINT64* offset);
+        void* user;
+    };
+
+    // Texture memory for the 12 loaders, so the caller can place textures in heaps it manages. create makes the
+    // resource described by desc in the given state.
+    struct TextureAllocator12
+    {
+        HRESULT (*create)(void* user, const D3D12_RESOURCE_DESC* desc, D3D12_RESOURCE_STATES state, ID3D12Resource** texture);
+        void* user;
+    };
+
     // Standard version
     HRESULT CreateDDSTextureFromMemory(_In_ ID3D11Device* d3dDevice,
         _In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
@@ -70,7 +86,8 @@ namespace DirectX
         _In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
         _In_ size_t ddsDataSize,
         _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& texture,
-        _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& textureUploadHeap,
+        _In_ const UploadAllocator12& upload,
+        _In_ const TextureAllocator12& allocator,
         _In_ size_t maxsize = 0,
         _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
     );
@@ -87,7 +104,8 @@ namespace DirectX
         _In_ ID3D12GraphicsCommandList* cmdList,
         _In_z_ const wchar_t* szFileName,
         _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& texture,
-        _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& textureUploadHeap,
+        _In_ const UploadAllocator12& upload,
+        _In_ const TextureAllocator12& allocator,
         _In_ size_t maxsize = 0,
         _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
     );
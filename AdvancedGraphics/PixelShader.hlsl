@@ -1,15 +1,42 @@
-Texture2D texture_maps[2] : register(t1);
+#include "common.hlsl"
 
 SamplerState s1 : register(s0);
+SamplerState terrain_sampler : register(s2); // wraps, the terrain's texture coordinates run across the whole world
 
 struct VS_OUTPUT
 {
     float4 pos : SV_POSITION;
     float2 texCoord : TEXCOORD;
+    float3 normal : NORMAL;
+    float4 tangent : TANGENT;
 };
 
+static const float3 light_direction = float3(0.3f, 0.8f, -0.52f); // towards the light, unit length
+static const float ambient = 0.25f;
+
+float4 shade(VS_OUTPUT input, SamplerState map_sampler)
+{
+    // the draw's material picks its maps out of the bindless texture table
+    material_data material = materials[material_id];
+    float2 texCoord = mul(float4(input.texCoord, 0.0f, 1.0f), material.material_transformation).xy;
+
+    // interpolation shortens the frame, rebuild it before taking the map's normal out of tangent space
+    float3 normal = normalize(input.normal);
+    float3 tangent = normalize(input.tangent.xyz - normal * dot(input.tangent.xyz, normal));
+    float3 bitangent = cross(normal, tangent) * input.tangent.w;
+    float3 mapped = texture_map[material.normal_map_index].Sample(map_sampler, texCoord).xyz * 2.0f - 1.0f;
+    normal = normalize(mapped.x * tangent + mapped.y * bitangent + mapped.z * normal);
+
+    float4 diffuse = texture_map[material.diffuse_map_index].Sample(map_sampler, texCoord) * material.diffuse_albedo;
+    return float4(diffuse.rgb * (ambient + (1.0f - ambient) * saturate(dot(normal, light_direction))), diffuse.a);
+}
+
 float4 main(VS_OUTPUT input) : SV_TARGET
 {
-	// return interpolated color
-    return diffuse.Sample(s1, input.texCoord);
-}
\ No newline at end of file
+    return shade(input, s1);
+}
+
+float4 terrain_main(VS_OUTPUT input) : SV_TARGET
+{
+    return shade(input, terrain_sampler);
+}
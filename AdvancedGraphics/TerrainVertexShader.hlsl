@@ -0,0 +1,70 @@
+#include "common.hlsl"
+
+//One instance of the shared chunk grid, see terrain_chunk in terrain.h
+struct terrain_chunk
+{
+    float2 origin;
+    float size;
+    float morph_start;
+    float morph_end;
+};
+
+StructuredBuffer<terrain_chunk> terrain_chunks : register(t2, space1);
+Texture2D<float> heightmap : register(t0, space2);
+SamplerState heightmap_sampler : register(s1);
+
+//packed_vertex of the chunk grid, only its texture coordinates are used
+struct VS_INPUT
+{
+    float4 pos : POSITION;
+    float4 qtangent : TANGENT;
+    float2 texCoord : TEXCOORD;
+};
+
+struct VS_OUTPUT
+{
+    float4 pos : SV_POSITION;
+    float2 texCoord : TEXCOORD;
+    float3 normal : NORMAL;
+    float4 tangent : TANGENT;
+};
+
+float terrain_height(float2 world_xz)
+{
+    // the first and last samples sit on the terrain's edges
+    float2 uv = (world_xz - terrain_origin) / terrain_size;
+    uv = (uv * (terrain_heightmap_size - 1.0f) + 0.5f) / terrain_heightmap_size;
+    return terrain_base_height + heightmap.SampleLevel(heightmap_sampler, uv, 0) * terrain_height_scale;
+}
+
+VS_OUTPUT main(VS_INPUT input, uint instance_id : SV_InstanceID)
+{
+    VS_OUTPUT output;
+    terrain_chunk chunk = terrain_chunks[instance_id];
+
+    // the grid's texture coordinates run 0 to 1 in steps of 1 / terrain_chunk_quads, exact in half precision
+    float2 grid = input.texCoord * terrain_chunk_quads;
+    float2 world_xz = chunk.origin + input.texCoord * chunk.size;
+    float3 world_position = float3(world_xz.x, terrain_height(world_xz), world_xz.y);
+
+    // towards the end of the chunk's range the odd vertices slide onto the next coarser grid
+    float morph = saturate((distance(world_position, camera_position) - chunk.morph_start) / (chunk.morph_end - chunk.morph_start));
+    grid -= frac(grid * 0.5f) * 2.0f * morph;
+    world_xz = chunk.origin + grid / terrain_chunk_quads * chunk.size;
+    world_position = float3(world_xz.x, terrain_height(world_xz), world_xz.y);
+
+    // normal from the height differences one sample to either side
+    float spacing = terrain_size / (terrain_heightmap_size - 1.0f);
+    float left = terrain_height(world_xz - float2(spacing, 0.0f));
+    float right = terrain_height(world_xz + float2(spacing, 0.0f));
+    float back = terrain_height(world_xz - float2(0.0f, spacing));
+    float front = terrain_height(world_xz + float2(0.0f, spacing));
+    output.normal = normalize(float3(left - right, 2.0f * spacing, back - front));
+    // the texture's u runs along +x and its v along +z, which is mirrored against normal x tangent
+    float3 tangent = float3(2.0f * spacing, right - left, 0.0f);
+    output.tangent = float4(normalize(tangent - output.normal * dot(tangent, output.normal)), -1.0f);
+
+    output.pos = mul(float4(world_position, 1.0f), view_projection);
+    output.texCoord = world_xz * 0.125f;
+    return output;
+}
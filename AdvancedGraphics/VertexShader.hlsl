@@ -1,6 +1,10 @@
+#include "common.hlsl"
+
+//packed_vertex, the input assembler expands the snorm16 and half formats to floats
 struct VS_INPUT
 {
     float4 pos : POSITION;
+    float4 qtangent : TANGENT;
     float2 texCoord : TEXCOORD;
 };
 
@@ -8,12 +12,21 @@ struct VS_OUTPUT
 {
     float4 pos : SV_POSITION;
     float2 texCoord : TEXCOORD;
+    float3 normal : NORMAL;
+    float4 tangent : TANGENT;
 };
 
-VS_OUTPUT main(VS_INPUT input)
+VS_OUTPUT main(VS_INPUT input, uint instance_id : SV_InstanceID)
 {
     VS_OUTPUT output;
-    output.pos = mul(input.pos, wvpMat);
+    float4x4 world = objects[instance_objects[first_instance + instance_id]].world;
+    float4 world_position = mul(float4(decode_position(input.pos.xyz), 1.0f), world);
+    output.pos = mul(world_position, view_projection);
     output.texCoord = input.texCoord;
+    float3 normal;
+    float4 tangent;
+    decode_qtangent(input.qtangent, normal, tangent);
+    output.normal = normalize(mul(normal, (float3x3)world));
+    output.tangent = float4(normalize(mul(tangent.xyz, (float3x3)world)), tangent.w);
     return output;
 }
\ No newline at end of file
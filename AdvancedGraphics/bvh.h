@@ -0,0 +1,729 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "job_system.h"
+
+//Axis aligned bounding box
+struct aabb
+{
+	float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	void grow(const aabb& other)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			min[axis] = std::min(min[axis], other.min[axis]);
+			max[axis] = std::max(max[axis], other.max[axis]);
+		}
+	}
+
+	void grow(const float point[3])
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			min[axis] = std::min(min[axis], point[axis]);
+			max[axis] = std::max(max[axis], point[axis]);
+		}
+	}
+
+	bool empty() const { return min[0] > max[0]; }
+
+	float surface_area() const
+	{
+		if (empty())
+		{
+			return 0.0f;
+		}
+		float x = max[0] - min[0];
+		float y = max[1] - min[1];
+		float z = max[2] - min[2];
+		return 2.0f * (x * y + y * z + z * x);
+	}
+
+	float center(int axis) const { return (min[axis] + max[axis]) * 0.5f; }
+};
+
+//Plane stored as (normal, distance), a point is inside when dot(normal, point) + distance >= 0
+struct plane
+{
+	float normal[3];
+	float distance;
+};
+
+struct frustum
+{
+	plane planes[6];
+};
+
+//Slab test against a box, inverse is 1 / ray direction. Returns the entry distance or -1 on a miss.
+inline float intersect_ray_box(const float min[3], const float max[3], const float origin[3], const float inverse[3], float max_t)
+{
+	float t_min = 0.0f;
+	float t_max = max_t;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float t0 = (min[axis] - origin[axis]) * inverse[axis];
+		float t1 = (max[axis] - origin[axis]) * inverse[axis];
+		t_min = std::max(t_min, std::min(t0, t1));
+		t_max = std::min(t_max, std::max(t0, t1));
+	}
+	return t_min <= t_max ? t_min : -1.0f;
+}
+
+inline void ray_inverse(const float direction[3], float inverse[3])
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		inverse[axis] = direction[axis] != 0.0f ? 1.0f / direction[axis] : FLT_MAX;
+	}
+}
+
+//32 byte node, two per cache line. Children of an interior node are laid out depth first, so the left child
+//always directly follows its parent and only the right child index is stored.
+struct bvh_node
+{
+	float min[3];
+	int first; // leaf: first entry in item_indices, interior: index of the right child
+	float max[3];
+	int count; // leaf: number of items, interior: 0
+
+	bool is_leaf() const { return count > 0; }
+};
+
+//Bounding volume hierarchy over a set of item bounds (one per object, or one per triangle).
+//Built with binned SAH, refit in place when items move and rebuilt when refitting has degraded it too far.
+struct bvh
+{
+	static const int bin_count = 16;
+	//Relative costs of stepping into a node and testing an item, used by the SAH
+	static constexpr float traversal_cost = 1.0f;
+	static constexpr float intersection_cost = 1.0f;
+	//Refit quality threshold, once the SAH cost has grown this much a rebuild pays for itself
+	static constexpr float rebuild_ratio = 1.4f;
+	//Below this depth splits are chosen by SAH, past it by median so traversal stacks stay bounded
+	static const int sah_depth = 40;
+	static const int max_depth = 64;
+
+	//Leaves hold at most this many items. Items tested together (a SIMD packet) cost a single intersection,
+	//the triangle bvh sets both to its packet width so leaves fill whole packets.
+	int max_leaf_items = 4;
+	int items_per_test = 1;
+
+	void build(const std::vector<aabb>& item_bounds)
+	{
+		int item_count = (int)item_bounds.size();
+		nodes.clear();
+		item_indices.resize(item_count);
+		centroids.resize(item_count * 3);
+		for (int i = 0; i < item_count; i++)
+		{
+			item_indices[i] = i;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				centroids[i * 3 + axis] = item_bounds[i].center(axis);
+			}
+		}
+
+		if (item_count == 0)
+		{
+			built_cost = current_cost = 0.0f;
+			return;
+		}
+
+		nodes.reserve(item_count * 2);
+		nodes.emplace_back();
+		build_node(0, 0, item_count, 0, item_bounds);
+
+		built_cost = current_cost = sah_cost();
+	}
+
+	//Recomputes every node's bounds bottom up without changing the topology
+	void refit(const std::vector<aabb>& item_bounds)
+	{
+		float root_area = 0.0f;
+		float cost = 0.0f;
+
+		//Children always come after their parent, so walking backwards visits children first
+		for (int i = (int)nodes.size() - 1; i >= 0; i--)
+		{
+			bvh_node& node = nodes[i];
+			aabb bounds;
+			if (node.is_leaf())
+			{
+				for (int j = 0; j < node.count; j++)
+				{
+					bounds.grow(item_bounds[item_indices[node.first + j]]);
+				}
+			}
+			else
+			{
+				bounds.grow(node_bounds(i + 1));
+				bounds.grow(node_bounds(node.first));
+			}
+			set_bounds(node, bounds);
+
+			float area = bounds.surface_area();
+			cost += area * (node.is_leaf() ? leaf_cost(node.count) : traversal_cost);
+			root_area = area;
+		}
+
+		current_cost = root_area > 0.0f ? cost / root_area : 0.0f;
+	}
+
+	//True once refits have made the tree noticeably worse than a fresh build
+	bool needs_rebuild() const
+	{
+		return current_cost > built_cost * rebuild_ratio;
+	}
+
+	aabb node_bounds(int index) const
+	{
+		aabb bounds;
+		const bvh_node& node = nodes[index];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			bounds.min[axis] = node.min[axis];
+			bounds.max[axis] = node.max[axis];
+		}
+		return bounds;
+	}
+
+	//Calls visit(item) for every item whose bounds intersect the frustum. Subtrees fully inside skip the plane tests.
+	template <typename Visit>
+	void query_frustum(const frustum& view, const Visit& visit) const
+	{
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		struct entry
+		{
+			int node;
+			uint8_t plane_mask; // planes still straddled by the parent
+		};
+		entry stack[max_depth * 2];
+		int stack_size = 0;
+		stack[stack_size++] = { 0, 0x3f };
+
+		while (stack_size > 0)
+		{
+			entry current = stack[--stack_size];
+			const bvh_node& node = nodes[current.node];
+
+			uint8_t mask = current.plane_mask;
+			bool outside = false;
+			for (int p = 0; p < 6 && !outside; p++)
+			{
+				if ((mask & (1 << p)) == 0)
+				{
+					continue;
+				}
+				const plane& test = view.planes[p];
+				//Furthest and nearest corners along the plane normal
+				float far_distance = test.distance;
+				float near_distance = test.distance;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					float a = test.normal[axis] * node.min[axis];
+					float b = test.normal[axis] * node.max[axis];
+					far_distance += std::max(a, b);
+					near_distance += std::min(a, b);
+				}
+				if (far_distance < 0.0f)
+				{
+					outside = true;
+				}
+				else if (near_distance >= 0.0f)
+				{
+					mask &= ~(1 << p);
+				}
+			}
+			if (outside)
+			{
+				continue;
+			}
+
+			if (mask == 0)
+			{
+				visit_subtree(current.node, visit);
+				continue;
+			}
+			if (node.is_leaf())
+			{
+				for (int i = 0; i < node.count; i++)
+				{
+					visit(item_indices[node.first + i]);
+				}
+				continue;
+			}
+			stack[stack_size++] = { node.first, mask };
+			stack[stack_size++] = { current.node + 1, mask };
+		}
+	}
+
+	//Closest hit ray query. intersect(item, max_t) returns the hit distance or a negative value for a miss,
+	//returns the item hit (or -1) and its distance.
+	template <typename Intersect>
+	int query_ray(const float origin[3], const float direction[3], float max_t, const Intersect& intersect, float& hit_t) const
+	{
+		int hit_item = -1;
+		query_ray_leaves(origin, direction, max_t, [&](int leaf, float& closest)
+		{
+			const bvh_node& node = nodes[leaf];
+			for (int i = 0; i < node.count; i++)
+			{
+				int item = item_indices[node.first + i];
+				float t = intersect(item, closest);
+				if (t >= 0.0f && t < closest)
+				{
+					closest = t;
+					hit_item = item;
+				}
+			}
+		}, hit_t);
+		return hit_item;
+	}
+
+	//Closest hit traversal that hands whole leaves to the caller, for testing a leaf's items together.
+	//intersect_leaf(node_index, hit_t) lowers hit_t when it finds a closer hit.
+	template <typename IntersectLeaf>
+	void query_ray_leaves(const float origin[3], const float direction[3], float max_t, const IntersectLeaf& intersect_leaf, float& hit_t) const
+	{
+		hit_t = max_t;
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		float inverse[3];
+		ray_inverse(direction, inverse);
+
+		int stack[max_depth * 2];
+		int stack_size = 0;
+		if (ray_node(0, origin, inverse, hit_t) < 0.0f)
+		{
+			return;
+		}
+		stack[stack_size++] = 0;
+
+		while (stack_size > 0)
+		{
+			int index = stack[--stack_size];
+			const bvh_node& node = nodes[index];
+			if (node.is_leaf())
+			{
+				intersect_leaf(index, hit_t);
+				continue;
+			}
+
+			int left = index + 1;
+			int right = node.first;
+			float left_t = ray_node(left, origin, inverse, hit_t);
+			float right_t = ray_node(right, origin, inverse, hit_t);
+
+			//Push the further child first so the nearer one is visited next and shrinks hit_t sooner
+			if (left_t >= 0.0f && right_t >= 0.0f)
+			{
+				if (left_t < right_t)
+				{
+					stack[stack_size++] = right;
+					stack[stack_size++] = left;
+				}
+				else
+				{
+					stack[stack_size++] = left;
+					stack[stack_size++] = right;
+				}
+			}
+			else if (left_t >= 0.0f)
+			{
+				stack[stack_size++] = left;
+			}
+			else if (right_t >= 0.0f)
+			{
+				stack[stack_size++] = right;
+			}
+		}
+	}
+
+	//Calls visit(item) for every item whose bounds overlap the box
+	template <typename Visit>
+	void query_overlap(const aabb& box, const Visit& visit) const
+	{
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		int stack[max_depth * 2];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+		while (stack_size > 0)
+		{
+			int index = stack[--stack_size];
+			const bvh_node& node = nodes[index];
+			if (!overlaps(node, box))
+			{
+				continue;
+			}
+			if (node.is_leaf())
+			{
+				for (int i = 0; i < node.count; i++)
+				{
+					visit(item_indices[node.first + i]);
+				}
+				continue;
+			}
+			stack[stack_size++] = node.first;
+			stack[stack_size++] = index + 1;
+		}
+	}
+
+	//Proximity query, visits items whose bounds come within radius of the centre
+	template <typename Visit>
+	void query_sphere(const float centre[3], float radius, const Visit& visit) const
+	{
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		float radius_squared = radius * radius;
+		int stack[max_depth * 2];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+		while (stack_size > 0)
+		{
+			int index = stack[--stack_size];
+			const bvh_node& node = nodes[index];
+
+			//Squared distance from the centre to the closest point of the box
+			float distance_squared = 0.0f;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float closest = std::max(node.min[axis], std::min(centre[axis], node.max[axis]));
+				float delta = centre[axis] - closest;
+				distance_squared += delta * delta;
+			}
+			if (distance_squared > radius_squared)
+			{
+				continue;
+			}
+
+			if (node.is_leaf())
+			{
+				for (int i = 0; i < node.count; i++)
+				{
+					visit(item_indices[node.first + i]);
+				}
+				continue;
+			}
+			stack[stack_size++] = node.first;
+			stack[stack_size++] = index + 1;
+		}
+	}
+
+	std::vector<bvh_node> nodes;
+	std::vector<int> item_indices;
+	float built_cost = 0.0f;
+	float current_cost = 0.0f;
+
+private:
+	struct bin
+	{
+		aabb bounds;
+		int count = 0;
+	};
+
+	float leaf_cost(int count) const
+	{
+		return intersection_cost * ((count + items_per_test - 1) / items_per_test);
+	}
+
+	static void set_bounds(bvh_node& node, const aabb& bounds)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			node.min[axis] = bounds.min[axis];
+			node.max[axis] = bounds.max[axis];
+		}
+	}
+
+	static bool overlaps(const bvh_node& node, const aabb& box)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (node.max[axis] < box.min[axis] || node.min[axis] > box.max[axis])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	float ray_node(int index, const float origin[3], const float inverse[3], float max_t) const
+	{
+		return intersect_ray_box(nodes[index].min, nodes[index].max, origin, inverse, max_t);
+	}
+
+	template <typename Visit>
+	void visit_subtree(int index, const Visit& visit) const
+	{
+		//A subtree's items are contiguous in item_indices, they start at its leftmost leaf and end at its rightmost
+		int leftmost = index;
+		while (!nodes[leftmost].is_leaf())
+		{
+			leftmost++;
+		}
+		int rightmost = index;
+		while (!nodes[rightmost].is_leaf())
+		{
+			rightmost = nodes[rightmost].first;
+		}
+
+		int last = nodes[rightmost].first + nodes[rightmost].count;
+		for (int i = nodes[leftmost].first; i < last; i++)
+		{
+			visit(item_indices[i]);
+		}
+	}
+
+	float sah_cost() const
+	{
+		float root_area = node_bounds(0).surface_area();
+		if (root_area <= 0.0f)
+		{
+			return 0.0f;
+		}
+		float cost = 0.0f;
+		for (int i = 0; i < (int)nodes.size(); i++)
+		{
+			float area = node_bounds(i).surface_area();
+			cost += area * (nodes[i].is_leaf() ? leaf_cost(nodes[i].count) : traversal_cost);
+		}
+		return cost / root_area;
+	}
+
+	void build_node(int index, int begin, int end, int depth, const std::vector<aabb>& item_bounds)
+	{
+		aabb bounds;
+		aabb centroid_bounds;
+		for (int i = begin; i < end; i++)
+		{
+			int item = item_indices[i];
+			bounds.grow(item_bounds[item]);
+			centroid_bounds.grow(&centroids[item * 3]);
+		}
+		set_bounds(nodes[index], bounds);
+
+		int count = end - begin;
+		if (count <= 1)
+		{
+			make_leaf(index, begin, count);
+			return;
+		}
+
+		if (depth >= sah_depth)
+		{
+			split_median(index, begin, end, depth, centroid_bounds, item_bounds);
+			return;
+		}
+
+		//Find the cheapest binned split over all three axes
+		float best_cost = FLT_MAX;
+		int best_axis = -1;
+		int best_split = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+			if (extent <= 0.0f)
+			{
+				continue;
+			}
+
+			bin bins[bin_count];
+			float scale = bin_count / extent;
+			for (int i = begin; i < end; i++)
+			{
+				int item = item_indices[i];
+				int b = std::min(bin_count - 1, (int)((centroids[item * 3 + axis] - centroid_bounds.min[axis]) * scale));
+				bins[b].count++;
+				bins[b].bounds.grow(item_bounds[item]);
+			}
+
+			//Sweep from both sides to get the area and count left and right of each plane
+			float left_area[bin_count - 1];
+			int left_count[bin_count - 1];
+			aabb running;
+			int running_count = 0;
+			for (int b = 0; b < bin_count - 1; b++)
+			{
+				running.grow(bins[b].bounds);
+				running_count += bins[b].count;
+				left_area[b] = running.surface_area();
+				left_count[b] = running_count;
+			}
+			running = aabb();
+			running_count = 0;
+			for (int b = bin_count - 1; b > 0; b--)
+			{
+				running.grow(bins[b].bounds);
+				running_count += bins[b].count;
+				if (left_count[b - 1] == 0 || running_count == 0)
+				{
+					continue;
+				}
+				float cost = left_area[b - 1] * leaf_cost(left_count[b - 1]) + running.surface_area() * leaf_cost(running_count);
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_split = b;
+				}
+			}
+		}
+
+		float area = bounds.surface_area();
+		float split_cost = area > 0.0f ? traversal_cost + best_cost / area : FLT_MAX;
+		if (count <= max_leaf_items && (best_axis < 0 || leaf_cost(count) <= split_cost))
+		{
+			make_leaf(index, begin, count);
+			return;
+		}
+
+		if (best_axis < 0)
+		{
+			//All centroids coincide, split by count so the tree still terminates
+			split_children(index, begin, begin + count / 2, end, depth, item_bounds);
+			return;
+		}
+
+		float extent = centroid_bounds.max[best_axis] - centroid_bounds.min[best_axis];
+		float scale = bin_count / extent;
+		float minimum = centroid_bounds.min[best_axis];
+		int* split = std::partition(item_indices.data() + begin, item_indices.data() + end, [&](int item)
+		{
+			int b = std::min(bin_count - 1, (int)((centroids[item * 3 + best_axis] - minimum) * scale));
+			return b < best_split;
+		});
+		int middle = (int)(split - item_indices.data());
+		if (middle == begin || middle == end)
+		{
+			middle = begin + count / 2;
+		}
+		split_children(index, begin, middle, end, depth, item_bounds);
+	}
+
+	void split_median(int index, int begin, int end, int depth, const aabb& centroid_bounds, const std::vector<aabb>& item_bounds)
+	{
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+		{
+			if (centroid_bounds.max[i] - centroid_bounds.min[i] > centroid_bounds.max[axis] - centroid_bounds.min[axis])
+			{
+				axis = i;
+			}
+		}
+		int middle = begin + (end - begin) / 2;
+		std::nth_element(item_indices.data() + begin, item_indices.data() + middle, item_indices.data() + end, [&](int a, int b)
+		{
+			return centroids[a * 3 + axis] < centroids[b * 3 + axis];
+		});
+		split_children(index, begin, middle, end, depth, item_bounds);
+	}
+
+	void split_children(int index, int begin, int middle, int end, int depth, const std::vector<aabb>& item_bounds)
+	{
+		int left = (int)nodes.size();
+		nodes.emplace_back();
+		build_node(left, begin, middle, depth + 1, item_bounds);
+
+		int right = (int)nodes.size();
+		nodes.emplace_back();
+		build_node(right, middle, end, depth + 1, item_bounds);
+
+		nodes[index].first = right;
+		nodes[index].count = 0;
+	}
+
+	void make_leaf(int index, int begin, int count)
+	{
+		nodes[index].first = begin;
+		nodes[index].count = count;
+	}
+
+	std::vector<float> centroids;
+};
+
+//BVH over moving items. Every update refits the current tree, and once refitting has degraded it past
+//bvh::rebuild_ratio a fresh tree is built on the job system from a copy of the bounds and swapped in when ready.
+//The number of items is fixed between calls to build().
+struct dynamic_bvh
+{
+	~dynamic_bvh()
+	{
+		//The rebuild job reads our members, the owner has to finish() it while the job system is still running
+		assert(!rebuilding || rebuild_done.load(std::memory_order_acquire));
+	}
+
+	//Runs or waits for a rebuild still in flight, call before the job system is torn down
+	void finish(job_system* jobs)
+	{
+		if (rebuilding && !rebuild_done.load(std::memory_order_acquire))
+		{
+			// not done yet, so its job slot has not been recycled
+			jobs->wait(rebuild_job);
+		}
+	}
+
+	void build(const std::vector<aabb>& item_bounds)
+	{
+		tree.build(item_bounds);
+	}
+
+	void update(job_system* jobs, const std::vector<aabb>& item_bounds)
+	{
+		if (rebuilding && rebuild_done.load(std::memory_order_acquire))
+		{
+			std::swap(tree, rebuilt);
+			rebuilding = false;
+		}
+
+		//Items kept moving while the rebuild ran, so a freshly swapped tree needs a refit too
+		tree.refit(item_bounds);
+
+		if (!rebuilding && tree.needs_rebuild())
+		{
+			rebuild_bounds = item_bounds;
+			rebuild_done.store(false, std::memory_order_relaxed);
+			rebuilding = true;
+
+			dynamic_bvh* self = this;
+			rebuild_job = jobs->create_job([](job*, const void* data)
+			{
+				dynamic_bvh* owner = *static_cast<dynamic_bvh* const*>(data);
+				owner->rebuilt.build(owner->rebuild_bounds);
+				owner->rebuild_done.store(true, std::memory_order_release);
+			}, self);
+			jobs->run(rebuild_job);
+		}
+	}
+
+	bvh tree;
+
+private:
+	bvh rebuilt;
+	std::vector<aabb> rebuild_bounds;
+	std::atomic<bool> rebuild_done{ false };
+	bool rebuilding = false;
+	job* rebuild_job = nullptr;
+};
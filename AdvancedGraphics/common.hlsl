@@ -12,16 +12,52 @@ struct material_data
     uint material_padding_2;
 };
 
-//Stores array of textures
-Texture2D texture_map[2] : register(t1);
+//Every material, and every texture in one unbounded table, materials name their maps by index into it
+StructuredBuffer<material_data> materials : register(t3, space1);
+Texture2D texture_map[] : register(t0);
 
 
-cbuffer ObjectConstantBuffer : register(b0)
+struct object_data
 {
-    float4x4 wvpMat;
+    float4x4 world;
 };
 
+//World matrix of every object, and this frame's visible objects grouped into one run per draw batch
+StructuredBuffer<object_data> objects : register(t0, space1);
+StructuredBuffer<uint> instance_objects : register(t1, space1);
+
+cbuffer BatchConstants : register(b0)
+{
+    uint first_instance;
+    //Mesh position decode, see position_quantization
+    float3 position_offset; // packs into the rest of the first register, matching the c++ struct
+    float3 position_scale;
+    uint material_id; // into materials, the same for a whole draw so texture_map needs no NonUniformResourceIndex
+};
+
+float3 decode_position(float3 quantized)
+{
+    return position_offset + quantized * position_scale;
+}
+
+//Inverse of encode_qtangent in vertex_format.h, the rotated z and x axes. w of the tangent is the handedness,
+//bitangent = w * cross(normal, tangent).
+void decode_qtangent(float4 q, out float3 normal, out float4 tangent)
+{
+    q = normalize(q);
+    normal = float3(2.0f * (q.x * q.z + q.w * q.y), 2.0f * (q.y * q.z - q.w * q.x), 1.0f - 2.0f * (q.x * q.x + q.y * q.y));
+    tangent.xyz = float3(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.w * q.z), 2.0f * (q.x * q.z - q.w * q.y));
+    tangent.w = q.w < 0.0f ? -1.0f : 1.0f;
+}
+
 cbuffer DefaultConstantBuffer : register(b1)
 {
-    float4x4 mat;
+    float4x4 view_projection;
+    float3 camera_position;
+    float terrain_size;
+    float2 terrain_origin;
+    float terrain_height_scale;
+    float terrain_base_height;
+    float terrain_chunk_quads;
+    float terrain_heightmap_size;
 };
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "upload_ring.h"
+
+//Constant buffer memory for one frame resource. Allocations bump through a list of pages and are all dropped at
+//once by reset(), which the frame resource calls when its fence says the GPU is done with the frame, so there is
+//no per allocation bookkeeping at all. The first page is sized from what a frame is expected to need, and when a
+//frame needs more another page twice the size of the last is added and kept for the frames after it.
+//Pages come from the same kind of backend as upload_ring (create_page, release_page).
+
+const uint64_t constant_alignment = 256; // constant buffer views start on multiples of this
+
+template <typename Backend>
+struct constant_allocator
+{
+	typedef typename Backend::resource resource;
+
+	struct page
+	{
+		resource memory;
+		uint8_t* cpu;
+		uint64_t gpu;
+		uint64_t size;
+	};
+
+	//Makes the first page, big enough for bytes
+	bool reserve(uint64_t bytes)
+	{
+		return add_page(std::max(round_up(bytes, upload_page_alignment), upload_page_alignment));
+	}
+
+	//size bytes starting on a constant_alignment boundary, valid until the next reset()
+	bool allocate(uint64_t size, upload_allocation<resource>& allocation)
+	{
+		size = round_up(size, constant_alignment);
+		if (pages.empty() && !reserve(size))
+		{
+			return false;
+		}
+		while (head + size > pages[current].size)
+		{
+			// the rest of a full page is skipped, the next one is added if this frame is the first to need it
+			if (current + 1 == (int)pages.size() && !add_page(std::max(pages.back().size * 2, round_up(size, upload_page_alignment))))
+			{
+				return false;
+			}
+			used += pages[current].size - head;
+			current++;
+			head = 0;
+		}
+		const page& p = pages[current];
+		allocation = { p.memory, head, p.cpu + head, p.gpu + head };
+		head += size;
+		used += size;
+		peak = std::max(peak, used);
+		return true;
+	}
+
+	//Only once the GPU has finished with everything allocated since the last reset
+	void reset()
+	{
+		current = 0;
+		head = 0;
+		used = 0;
+	}
+
+	void release()
+	{
+		for (page& p : pages)
+		{
+			backend.release_page(p.memory);
+		}
+		pages.clear();
+		reset();
+	}
+
+	static uint64_t round_up(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	Backend backend;
+	std::vector<page> pages;
+	int current = 0;
+	uint64_t head = 0; // into pages[current]
+	uint64_t used = 0; // since the last reset, including what was skipped at the end of full pages
+	uint64_t peak = 0; // most used between two resets
+
+private:
+	bool add_page(uint64_t size)
+	{
+		page fresh = {};
+		if (!backend.create_page(size, fresh.memory, fresh.cpu, fresh.gpu))
+		{
+			return false;
+		}
+		fresh.size = size;
+		pages.push_back(fresh);
+		return true;
+	}
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//Asset uploads on a copy queue of their own, so loading runs alongside rendering instead of on the direct queue.
+//Uploads are recorded into one open list at a time, each submit() executes it and signals the copy fence with the
+//next value, and everything recorded before a submit carries that value as its ticket. The direct queue does not
+//wait for copies in general, acquire() makes it wait on the GPU for one ticket, and only when that ticket is
+//newer than the last one waited for and not already finished, so each upload costs at most one wait when the
+//first frame that uses it is submitted. Command allocators are reused once the fence passes their last submit.
+//The backend owns the queues, lists and fence, so the scheduling runs against a mock on any platform:
+//	typedef ... list;
+//	bool open(int slot, list& recording); // reset allocator slot (made on first use) and start a list on it
+//	bool execute(list recording, uint64_t fence_value); // close, execute on the copy queue, signal the copy fence
+//	uint64_t completed_value(); // the copy fence's value
+//	void wait(uint64_t fence_value); // the direct queue waits on the GPU for the copy fence to reach fence_value
+
+template <typename Backend>
+struct copy_scheduler
+{
+	typedef typename Backend::list list;
+
+	//The list to record uploads into, open until the next submit()
+	bool record(list& recording)
+	{
+		if (!open)
+		{
+			uint64_t completed = backend.completed_value();
+			slot = (int)slot_values.size();
+			for (int s = 0; s < (int)slot_values.size(); s++)
+			{
+				if (slot_values[s] <= completed)
+				{
+					slot = s;
+					break;
+				}
+			}
+			if (slot == (int)slot_values.size())
+			{
+				slot_values.push_back(0);
+			}
+			if (!backend.open(slot, current))
+			{
+				return false;
+			}
+			open = true;
+		}
+		recording = current;
+		return true;
+	}
+
+	//The fence value what is recorded now will be finished at
+	uint64_t ticket() const
+	{
+		return submitted + 1;
+	}
+
+	//Executes what was recorded since the last submit, nothing to do without an open list
+	bool submit()
+	{
+		if (!open)
+		{
+			return true;
+		}
+		open = false;
+		if (!backend.execute(current, submitted + 1))
+		{
+			return false;
+		}
+		submitted++;
+		slot_values[slot] = submitted;
+		return true;
+	}
+
+	//Before the direct queue executes anything reading uploads with this ticket
+	bool acquire(uint64_t value)
+	{
+		if (value <= waited)
+		{
+			return true;
+		}
+		if (value > submitted && !submit())
+		{
+			return false;
+		}
+		waited = value;
+		if (backend.completed_value() >= value)
+		{
+			// already copied, the direct queue has nothing to wait for
+			return true;
+		}
+		backend.wait(value);
+		waits++;
+		return true;
+	}
+
+	bool finished(uint64_t value)
+	{
+		return backend.completed_value() >= value;
+	}
+
+	Backend backend;
+	std::vector<uint64_t> slot_values; // value each allocator slot last executed with
+	list current = list();
+	int slot = 0; // of the open list
+	bool open = false;
+	uint64_t submitted = 0; // value of the last submit
+	uint64_t waited = 0; // newest value the direct queue has waited for, or seen finished
+	int waits = 0; // GPU waits issued
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ring_queue.h"
+
+//Descriptors in two tiers. Views are created once into CPU only staging heaps, where slots come off a free list
+//so creating or dropping one is O(1), and another heap is chained on when the list runs dry. Shaders only see one
+//shader visible heap, used as a ring: each frame copies the descriptors a table needs into a contiguous run, and
+//runs are reused once the fence passes the submission that read them, the same way upload_ring works.
+//The backend owns the real heaps and the fence, so both run against a mock on any platform:
+//	typedef ... heap;
+//	bool create_heap(int capacity, bool shader_visible, heap& created, uint64_t& cpu, uint64_t& gpu);
+//	void release_heap(heap released);
+//	uint64_t completed_value();
+
+const int descriptor_staging_heap_size = 1024; // descriptors per staging heap
+const int descriptor_ring_size = 16384; // shader visible descriptors, shared by every frame in flight
+
+template <typename Backend>
+struct descriptor_staging
+{
+	typedef typename Backend::heap heap;
+
+	struct page
+	{
+		heap memory;
+		uint64_t cpu;
+	};
+
+	//increment is the device's descriptor size for the heap type
+	void initialise(int descriptor_increment)
+	{
+		increment = descriptor_increment;
+	}
+
+	//A slot for one descriptor, -1 when no heap can be made
+	int allocate()
+	{
+		if (free_slots.empty() && !add_page())
+		{
+			return -1;
+		}
+		int slot = free_slots.back();
+		free_slots.pop_back();
+		in_use++;
+		return slot;
+	}
+
+	void free(int slot)
+	{
+		free_slots.push_back(slot);
+		in_use--;
+	}
+
+	uint64_t cpu(int slot) const
+	{
+		return pages[slot / descriptor_staging_heap_size].cpu + (uint64_t)(slot % descriptor_staging_heap_size) * increment;
+	}
+
+	void release()
+	{
+		for (page& p : pages)
+		{
+			backend.release_heap(p.memory);
+		}
+		pages.clear();
+		free_slots.clear();
+		in_use = 0;
+	}
+
+	Backend backend;
+	std::vector<page> pages;
+	std::vector<int> free_slots; // used as a stack, so freed slots are reused while they are still in cache
+	int increment = 0;
+	int in_use = 0;
+
+private:
+	bool add_page()
+	{
+		page fresh = {};
+		uint64_t gpu;
+		if (!backend.create_heap(descriptor_staging_heap_size, false, fresh.memory, fresh.cpu, gpu))
+		{
+			return false;
+		}
+		int first = (int)pages.size() * descriptor_staging_heap_size;
+		pages.push_back(fresh);
+		// pushed highest first so the heap fills from its start
+		for (int slot = first + descriptor_staging_heap_size - 1; slot >= first; slot--)
+		{
+			free_slots.push_back(slot);
+		}
+		return true;
+	}
+};
+
+template <typename Backend>
+struct descriptor_ring
+{
+	typedef typename Backend::heap heap;
+
+	//A pending run of descriptors at the tail, free once the fence passes fence_value
+	struct span
+	{
+		int count;
+		uint64_t fence_value;
+	};
+
+	bool create(int descriptor_capacity, int descriptor_increment)
+	{
+		capacity = descriptor_capacity;
+		increment = descriptor_increment;
+		return backend.create_heap(capacity, true, memory, cpu_start, gpu_start);
+	}
+
+	//First of count contiguous descriptors, -1 when the ring is full of descriptors still in flight
+	int allocate(int count)
+	{
+		int first = take(count);
+		if (first < 0)
+		{
+			retire();
+			first = take(count);
+		}
+		return first;
+	}
+
+	//Everything allocated since the last submit is free once the fence reaches fence_value
+	void submit(uint64_t fence_value)
+	{
+		if (open > 0)
+		{
+			pending.push_back({ open, fence_value });
+			open = 0;
+		}
+	}
+
+	void retire()
+	{
+		uint64_t completed = backend.completed_value();
+		while (!pending.empty() && pending.front().fence_value <= completed)
+		{
+			tail = (tail + pending.front().count) % capacity;
+			used -= pending.front().count;
+			pending.pop_front();
+		}
+		if (used == 0)
+		{
+			head = 0;
+			tail = 0;
+		}
+	}
+
+	uint64_t cpu(int index) const { return cpu_start + (uint64_t)index * increment; }
+	uint64_t gpu(int index) const { return gpu_start + (uint64_t)index * increment; }
+
+	void release()
+	{
+		backend.release_heap(memory);
+		pending.clear();
+		head = tail = used = open = 0;
+	}
+
+	Backend backend;
+	heap memory = heap();
+	uint64_t cpu_start = 0;
+	uint64_t gpu_start = 0;
+	int capacity = 0;
+	int increment = 0;
+	int head = 0; // next free descriptor
+	int tail = 0; // oldest descriptor still in flight
+	int used = 0; // from tail to head, including the end skipped when a run wraps
+	int open = 0; // allocated since the last submit
+	ring_queue<span> pending;
+
+private:
+	int take(int count)
+	{
+		bool wrapped = head < tail || (head == tail && used > 0);
+		int end = wrapped ? tail : capacity;
+		if (head + count <= end)
+		{
+			int first = head;
+			advance(count);
+			return first;
+		}
+		// tables have to be contiguous, so the end of the heap is skipped and the run starts over at 0
+		if (!wrapped && count <= tail)
+		{
+			advance(capacity - head);
+			advance(count);
+			return 0;
+		}
+		return -1;
+	}
+
+	void advance(int count)
+	{
+		head = (head + count) % capacity;
+		used += count;
+		open += count;
+	}
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+//Scratch memory for CPU data that lives for one frame, draw lists, sort keys and culling output. Allocating bumps
+//a pointer and nothing is freed on its own, reset() drops everything at once when the frame it belongs to is
+//retired. Blocks are kept across resets, so once the arena has grown to what a frame needs it stops taking new
+//ones; heap_allocations counts the blocks taken since the last reset. That covers the arena only, other code run
+//during a frame can still use the general heap.
+//Not thread safe, each thread writing frame data gets an arena of its own.
+
+const size_t frame_arena_block_size = 1 << 20; // the first block, later ones double
+
+struct frame_arena
+{
+	struct block
+	{
+		uint8_t* memory;
+		size_t size;
+	};
+
+	//bytes at a multiple of alignment (a power of two), valid until the next reset()
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		if (current < blocks.size())
+		{
+			uint8_t* start = blocks[current].memory;
+			size_t offset = align(start, head, alignment);
+			if (offset + bytes <= blocks[current].size)
+			{
+				head = offset + bytes;
+				allocations++;
+				used += bytes;
+				return start + offset;
+			}
+		}
+		return allocate_slow(bytes, alignment);
+	}
+
+	void reset()
+	{
+		peak = std::max(peak, used);
+		current = 0;
+		head = 0;
+		used = 0;
+		allocations = 0;
+		heap_allocations = 0;
+	}
+
+	void release()
+	{
+		for (block& b : blocks)
+		{
+			delete[] b.memory;
+		}
+		blocks.clear();
+		current = 0;
+		head = 0;
+	}
+
+	~frame_arena()
+	{
+		release();
+	}
+
+	std::vector<block> blocks;
+	size_t current = 0; // block being bumped through
+	size_t head = 0; // into blocks[current]
+	size_t used = 0; // bytes handed out since the last reset
+	size_t peak = 0; // most used between two resets
+	int allocations = 0; // since the last reset
+	int heap_allocations = 0; // blocks this arena took from the general heap since the last reset
+
+private:
+	static size_t align(const uint8_t* start, size_t offset, size_t alignment)
+	{
+		uintptr_t address = reinterpret_cast<uintptr_t>(start) + offset;
+		return offset + (((address + alignment - 1) & ~(uintptr_t)(alignment - 1)) - address);
+	}
+
+	void* allocate_slow(size_t bytes, size_t alignment)
+	{
+		// blocks kept from earlier frames come first, the rest of the current one is skipped
+		while (current + 1 < blocks.size())
+		{
+			current++;
+			head = 0;
+			size_t offset = align(blocks[current].memory, 0, alignment);
+			if (offset + bytes <= blocks[current].size)
+			{
+				head = offset + bytes;
+				allocations++;
+				used += bytes;
+				return blocks[current].memory + offset;
+			}
+		}
+
+		size_t size = std::max(blocks.empty() ? frame_arena_block_size : blocks.back().size * 2, bytes + alignment);
+		blocks.push_back({ new uint8_t[size], size });
+		heap_allocations++;
+		current = blocks.size() - 1;
+		size_t offset = align(blocks[current].memory, 0, alignment);
+		head = offset + bytes;
+		allocations++;
+		used += bytes;
+		return blocks[current].memory + offset;
+	}
+};
+
+//Standard library allocator over a frame_arena, deallocate does nothing. Containers using it must be rebuilt (or
+//reassigned to a fresh one) each frame, before the arena is reset under them. Without an arena (a default
+//constructed allocator, as in a global container before its first frame) it falls back to the general heap, since
+//some standard libraries allocate from a container's allocator as soon as it is constructed.
+template <typename T>
+struct arena_allocator
+{
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	arena_allocator() = default;
+	arena_allocator(frame_arena* arena) : arena(arena) {}
+	template <typename U>
+	arena_allocator(const arena_allocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count)
+	{
+		if (!arena)
+		{
+			return static_cast<T*>(::operator new(count * sizeof(T)));
+		}
+		return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* memory, size_t)
+	{
+		if (!arena)
+		{
+			::operator delete(memory);
+		}
+	}
+
+	frame_arena* arena = nullptr;
+};
+
+template <typename T, typename U>
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+	return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+	return a.arena != b.arena;
+}
+
+template <typename T>
+using frame_vector = std::vector<T, arena_allocator<T>>;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//Hands whole frames of simulation state from one producer thread to one consumer thread.
+//The simulation writes into its own slot and publishes it by swapping it with the shared slot, the render
+//thread picks up the shared slot by swapping it with the one it finished reading. A spare third slot means
+//the simulation never waits for the render thread and the render thread always reads a complete frame.
+template <typename T>
+struct snapshot_buffer
+{
+	snapshot_buffer()
+	{
+		write_slot = 0;
+		shared_slot.store(1);
+		read_slot = 2;
+	}
+
+	//Producer side, fill this then call publish()
+	T& write() { return slots[write_slot]; }
+
+	void publish()
+	{
+		write_slot = shared_slot.exchange(write_slot | fresh_bit, std::memory_order_acq_rel) & slot_mask;
+	}
+
+	//Consumer side, returns true if a newer snapshot than the last one was acquired
+	bool acquire()
+	{
+		if ((shared_slot.load(std::memory_order_relaxed) & fresh_bit) == 0)
+		{
+			return false;
+		}
+		read_slot = shared_slot.exchange(read_slot, std::memory_order_acq_rel) & slot_mask;
+		return true;
+	}
+
+	const T& read() const { return slots[read_slot]; }
+
+	//Only safe before the threads start, used to size every slot up front
+	template <typename Function>
+	void for_each_slot(const Function& function)
+	{
+		for (auto& slot : slots)
+		{
+			function(slot);
+		}
+	}
+
+private:
+	static const uint32_t slot_mask = 3;
+	static const uint32_t fresh_bit = 4;
+
+	T slots[3];
+	uint32_t write_slot;
+	alignas(64) std::atomic<uint32_t> shared_slot;
+	alignas(64) uint32_t read_slot;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//Input captured by WndProc, consumed by the simulation thread
+enum input_event_type : uint8_t
+{
+	input_key_down,
+	input_key_up,
+	input_mouse_delta,
+	input_mouse_click,
+};
+
+struct input_event
+{
+	input_event_type type;
+	uint8_t key;
+	//Mouse delta for input_mouse_delta, client position for input_mouse_click
+	int16_t x;
+	int16_t y;
+};
+
+//Single producer / single consumer lock free ring buffer.
+//The message thread pushes and the simulation thread pops, so neither side ever blocks the other.
+struct input_queue
+{
+	static const uint32_t capacity = 1024;
+	static const uint32_t mask = capacity - 1;
+
+	//Returns false when full, the event is dropped rather than stalling the message pump
+	bool push(const input_event& event)
+	{
+		uint32_t write = write_index.load(std::memory_order_relaxed);
+		uint32_t read = read_index.load(std::memory_order_acquire);
+		if (write - read >= capacity)
+		{
+			return false;
+		}
+		events[write & mask] = event;
+		write_index.store(write + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(input_event& event)
+	{
+		uint32_t read = read_index.load(std::memory_order_relaxed);
+		uint32_t write = write_index.load(std::memory_order_acquire);
+		if (read == write)
+		{
+			return false;
+		}
+		event = events[read & mask];
+		read_index.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	alignas(64) std::atomic<uint32_t> write_index{ 0 };
+	alignas(64) std::atomic<uint32_t> read_index{ 0 };
+	input_event events[capacity];
+};
@@ -0,0 +1,550 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+//Work stealing job system.
+//Every registered thread owns a Chase-Lev deque, it pushes and pops jobs at the bottom of its own deque
+//while idle threads steal from the top of other deques. Jobs form a tree through their parent pointer,
+//a job is only finished once it and all of its children have run, so waiting on a root waits on the whole tree.
+
+struct job;
+typedef void (*job_function)(job* current, const void* data);
+
+struct alignas(64) job
+{
+	job_function function;
+	job* parent;
+	std::atomic<int> unfinished_jobs;
+	//Small user payload stored inline so creating a job never touches the heap, aligned for the pointers it usually holds
+	static const size_t data_alignment = 8;
+	alignas(data_alignment) unsigned char data[128 - sizeof(job_function) - sizeof(job*) - data_alignment];
+};
+
+//Lock free work stealing deque (Chase-Lev, with the memory orderings from Le et al. 2013)
+//Only the owning thread may call push/pop, any thread may call steal.
+struct job_queue
+{
+	static const int64_t capacity = 4096;
+	static const int64_t mask = capacity - 1;
+
+	bool push(job* item)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= capacity)
+		{
+			return false;
+		}
+		jobs[b & mask].store(item, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	job* pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			//Deque was already empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		job* item = jobs[b & mask].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			//Last item, race against any thief for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				item = nullptr;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return item;
+	}
+
+	job* steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+		{
+			return nullptr;
+		}
+
+		job* item = jobs[t & mask].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			//Lost the race to the owner or another thief
+			return nullptr;
+		}
+		return item;
+	}
+
+	int64_t size() const
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+
+	alignas(64) std::atomic<int64_t> top{ 0 };
+	alignas(64) std::atomic<int64_t> bottom{ 0 };
+	alignas(64) std::atomic<job*> jobs[capacity];
+};
+
+struct job_system
+{
+	//Threads that are not workers (the message thread, render thread...) must register before creating jobs
+	static const int max_threads = 64;
+	//Jobs are allocated from a per thread ring, a thread must never have more than this many jobs in flight
+	static const int jobs_per_thread = 4096;
+
+	explicit job_system(int worker_count = -1)
+	{
+		if (worker_count < 0)
+		{
+			int hardware = (int)std::thread::hardware_concurrency();
+			worker_count = hardware > 1 ? hardware - 1 : 1;
+		}
+		if (worker_count > max_threads - 8)
+		{
+			worker_count = max_threads - 8;
+		}
+
+		for (int i = 0; i < max_threads; i++)
+		{
+			thread_data[i].store(nullptr);
+		}
+
+		//The constructing thread is always thread 0
+		register_thread();
+
+		running.store(true);
+		for (int i = 0; i < worker_count; i++)
+		{
+			workers.emplace_back([this]()
+			{
+				register_thread();
+				worker_loop();
+			});
+		}
+	}
+
+	~job_system()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			running.store(false);
+		}
+		sleep_condition.notify_all();
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		for (int i = 0; i < max_threads; i++)
+		{
+			delete thread_data[i].load();
+		}
+
+		// a system made later at the same address must not take the destroying thread's old registration
+		thread_slot& slot = current_thread_slot();
+		if (slot.system == this)
+		{
+			slot = thread_slot();
+		}
+	}
+
+	//Returns the index of the calling thread, registering it on first use
+	int register_thread()
+	{
+		thread_slot& slot = current_thread_slot();
+		if (slot.system == this)
+		{
+			return slot.index;
+		}
+
+		int index = thread_count.fetch_add(1);
+		if (index >= max_threads)
+		{
+			//Out of slots, max_threads is a hard limit
+			thread_count.fetch_sub(1);
+			return -1;
+		}
+		thread_data[index].store(new per_thread(), std::memory_order_release);
+		slot.system = this;
+		slot.index = index;
+		return index;
+	}
+
+	int worker_count() const { return (int)workers.size(); }
+
+	job* create_job(job_function function)
+	{
+		return allocate_job(function, nullptr);
+	}
+
+	job* create_job(job_function function, const void* data, size_t size)
+	{
+		job* created = allocate_job(function, nullptr);
+		store_data(created, data, size);
+		return created;
+	}
+
+	//Copies data into the job, checked at compile time to fit the inline payload
+	template <typename Data>
+	job* create_job(job_function function, const Data& data)
+	{
+		check_payload<Data>();
+		return create_job(function, &data, sizeof(Data));
+	}
+
+	//Child jobs keep their parent unfinished until they are complete
+	job* create_child_job(job* parent, job_function function)
+	{
+		parent->unfinished_jobs.fetch_add(1, std::memory_order_relaxed);
+		return allocate_job(function, parent);
+	}
+
+	job* create_child_job(job* parent, job_function function, const void* data, size_t size)
+	{
+		parent->unfinished_jobs.fetch_add(1, std::memory_order_relaxed);
+		job* created = allocate_job(function, parent);
+		store_data(created, data, size);
+		return created;
+	}
+
+	template <typename Data>
+	job* create_child_job(job* parent, job_function function, const Data& data)
+	{
+		check_payload<Data>();
+		return create_child_job(parent, function, &data, sizeof(Data));
+	}
+
+	void run(job* item)
+	{
+		per_thread* local = thread_data[register_thread()].load(std::memory_order_relaxed);
+		if (!local->queue.push(item))
+		{
+			//Queue is full, run it inline rather than drop it
+			execute(item);
+			return;
+		}
+
+		if (sleeping_workers.load(std::memory_order_relaxed) > 0)
+		{
+			sleep_condition.notify_one();
+		}
+	}
+
+	bool is_complete(const job* item) const
+	{
+		return item->unfinished_jobs.load(std::memory_order_acquire) == 0;
+	}
+
+	//Helps by executing other jobs until the given job (and its children) are finished
+	void wait(const job* item)
+	{
+		int index = register_thread();
+		while (!is_complete(item))
+		{
+			job* next = get_job(index);
+			if (next)
+			{
+				execute(next);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	//Splits [0, count) into ranges and runs function(begin, end, user) on each, returns once every range is done.
+	//The grain adapts to the amount of work and the worker count so small loops are not split into
+	//ranges cheaper than the cost of scheduling them.
+	typedef void (*range_function)(int begin, int end, void* user);
+
+	void parallel_for(int count, range_function function, void* user, int min_grain = 64)
+	{
+		if (count <= 0)
+		{
+			return;
+		}
+
+		int threads = worker_count() + 1;
+		//Aim for a few ranges per thread so stealing can balance uneven work
+		int grain = count / (threads * 4);
+		if (grain < min_grain)
+		{
+			grain = min_grain;
+		}
+		if (count <= grain || threads == 1)
+		{
+			function(0, count, user);
+			return;
+		}
+
+		parallel_for_data range = { this, function, user, 0, count, grain };
+		job* root = create_job(&parallel_for_job, range);
+		run(root);
+		wait(root);
+	}
+
+	//Helper for capturing lambdas, the lambda must be callable as f(begin, end)
+	template <typename Function>
+	void parallel_for(int count, const Function& function, int min_grain = 64)
+	{
+		parallel_for(count, [](int begin, int end, void* user)
+		{
+			(*static_cast<const Function*>(user))(begin, end);
+		}, (void*)&function, min_grain);
+	}
+
+private:
+	struct per_thread
+	{
+		per_thread()
+		{
+			for (auto& item : pool)
+			{
+				item.unfinished_jobs.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		//The queue and jobs are cache line aligned, which plain new only honours from C++17 on
+		static void* operator new(size_t size)
+		{
+#ifdef _MSC_VER
+			void* memory = _aligned_malloc(size, alignof(per_thread));
+#else
+			void* memory = nullptr;
+			if (posix_memalign(&memory, alignof(per_thread), size) != 0)
+			{
+				memory = nullptr;
+			}
+#endif
+			if (!memory)
+			{
+				throw std::bad_alloc();
+			}
+			return memory;
+		}
+
+		static void operator delete(void* memory)
+		{
+#ifdef _MSC_VER
+			_aligned_free(memory);
+#else
+			free(memory);
+#endif
+		}
+
+		job_queue queue;
+		job pool[jobs_per_thread];
+		uint32_t allocated = 0;
+		uint32_t random_state = 0x9E3779B9u;
+	};
+
+	struct parallel_for_data
+	{
+		job_system* system;
+		range_function function;
+		void* user;
+		int begin;
+		int end;
+		int grain;
+	};
+
+	struct thread_slot
+	{
+		job_system* system = nullptr;
+		int index = -1;
+	};
+
+	static thread_slot& current_thread_slot()
+	{
+		static thread_local thread_slot slot;
+		return slot;
+	}
+
+	template <typename Data>
+	static void check_payload()
+	{
+		static_assert(sizeof(Data) <= sizeof(job::data), "job payload does not fit inline, pass a pointer to it instead");
+		static_assert(alignof(Data) <= job::data_alignment, "job payload needs more alignment than the inline storage has");
+		static_assert(std::is_trivially_copyable<Data>::value, "job payloads are copied with memcpy");
+	}
+
+	static void store_data(job* item, const void* data, size_t size)
+	{
+		// a payload cut short would be read as garbage by the job
+		assert(size <= sizeof(item->data));
+		memcpy(item->data, data, size);
+	}
+
+	static void parallel_for_job(job* current, const void* data);
+
+	job* allocate_job(job_function function, job* parent)
+	{
+		int index = register_thread();
+		per_thread* local = thread_data[index].load(std::memory_order_relaxed);
+		for (;;)
+		{
+			//Skip slots still in flight, so a long running job (a background rebuild, an asset load) is never recycled
+			for (int scanned = 0; scanned < jobs_per_thread; scanned++)
+			{
+				job* item = &local->pool[local->allocated++ & (jobs_per_thread - 1)];
+				if (item->unfinished_jobs.load(std::memory_order_acquire) == 0)
+				{
+					item->function = function;
+					item->parent = parent;
+					item->unfinished_jobs.store(1, std::memory_order_relaxed);
+					return item;
+				}
+			}
+
+			//Every slot is in flight, help run jobs until some finish rather than spin on the pool
+			job* next = get_job(index);
+			if (next)
+			{
+				execute(next);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	job* get_job(int index)
+	{
+		per_thread* local = thread_data[index].load(std::memory_order_relaxed);
+		job* item = local->queue.pop();
+		if (item)
+		{
+			return item;
+		}
+
+		//Own deque is empty, try to steal starting from a random victim
+		int count = thread_count.load(std::memory_order_relaxed);
+		if (count > max_threads)
+		{
+			count = max_threads;
+		}
+		uint32_t& state = local->random_state;
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		int start = (int)(state % (uint32_t)count);
+		for (int i = 0; i < count; i++)
+		{
+			int victim = (start + i) % count;
+			per_thread* other = thread_data[victim].load(std::memory_order_acquire);
+			if (victim == index || other == nullptr)
+			{
+				continue;
+			}
+			item = other->queue.steal();
+			if (item)
+			{
+				return item;
+			}
+		}
+		return nullptr;
+	}
+
+	void execute(job* item)
+	{
+		item->function(item, item->data);
+		finish(item);
+	}
+
+	void finish(job* item)
+	{
+		//Read the parent first, once the counter hits zero a waiting thread may recycle this job
+		job* parent = item->parent;
+		if (item->unfinished_jobs.fetch_sub(1, std::memory_order_acq_rel) == 1 && parent)
+		{
+			finish(parent);
+		}
+	}
+
+	void worker_loop()
+	{
+		int index = current_thread_slot().index;
+		int idle_spins = 0;
+		while (running.load(std::memory_order_relaxed))
+		{
+			job* item = get_job(index);
+			if (item)
+			{
+				execute(item);
+				idle_spins = 0;
+				continue;
+			}
+
+			//Spin briefly before sleeping, jobs tend to arrive in bursts
+			if (++idle_spins < 64)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			sleeping_workers.fetch_add(1);
+			sleep_condition.wait_for(lock, std::chrono::milliseconds(1));
+			sleeping_workers.fetch_sub(1);
+			idle_spins = 0;
+		}
+	}
+
+	std::atomic<per_thread*> thread_data[max_threads];
+	std::atomic<int> thread_count{ 0 };
+	std::vector<std::thread> workers;
+
+	std::atomic<bool> running{ false };
+	std::atomic<int> sleeping_workers{ 0 };
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_condition;
+};
+
+inline void job_system::parallel_for_job(job* current, const void* data)
+{
+	parallel_for_data range = *static_cast<const parallel_for_data*>(data);
+	job_system* system = range.system;
+
+	//Keep halving the range, handing the upper half to a child another thread can steal
+	while (range.end - range.begin > range.grain)
+	{
+		int middle = range.begin + (range.end - range.begin) / 2;
+		parallel_for_data upper = range;
+		upper.begin = middle;
+		range.end = middle;
+
+		job* child = system->create_child_job(current, &parallel_for_job, upper);
+		system->run(child);
+	}
+
+	range.function(range.begin, range.end, range.user);
+}
@@ -1,10 +1,35 @@
 #include "pch.h"
 
 #include "camera.h"
+#include <chrono>
+#include <memory>
+#include <thread>
 
 
 Camera* g_pCamera;
 
+#ifdef _DEBUG
+//Every general heap allocation on every thread, so the statistics can show what frame code still allocates
+//outside the frame arenas. Debug builds only, it costs an atomic add per allocation.
+std::atomic<long long> heap_allocation_count{ 0 };
+long long heap_allocations_reported = 0;
+
+void* operator new(size_t size)
+{
+	heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = malloc(size ? size : 1))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+#endif
+
 
 int WINAPI WinMain(HINSTANCE hInstance,    //Main windows function
 	HINSTANCE hPrevInstance,
@@ -12,6 +37,14 @@ int WINAPI WinMain(HINSTANCE hInstance,    //Main windows function
 	int nShowCmd)
 
 {
+	// start the worker threads, the main thread is registered as thread 0
+	jobs = new job_system();
+
+	// the only argument is an optional model file, quoted when the path has spaces
+	model_path = lpCmdLine;
+	model_path.erase(0, model_path.find_first_not_of(" \t\""));
+	model_path.erase(model_path.find_last_not_of(" \t\"") + 1);
+
 	// create the window
 	if (!initialise_window(hInstance, nShowCmd, full_screen))
 	{
@@ -115,21 +148,108 @@ void mainloop() {
 	MSG msg;
 	ZeroMemory(&msg, sizeof(MSG));
 
+	// the message thread only gathers input, simulation and rendering run on their own threads
+	std::thread simulation_thread(simulation_loop);
+	std::thread render_thread(render_loop);
 
 	while (Running)
 	{
-		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+		// sleep until there is input, waking regularly so we notice if another thread stopped the app
+		MsgWaitForMultipleObjects(0, nullptr, FALSE, 10, QS_ALLINPUT);
+
+		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
 		{
 			if (msg.message == WM_QUIT)
+			{
+				Running = false;
 				break;
+			}
 
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
 		}
-		else {
-			// run game code
-			Update(); // update the game logic
-			Render(); // execute the command queue (rendering the scene is the result of the gpu executing the command lists)
+	}
+
+	simulation_thread.join();
+	render_thread.join();
+}
+
+void simulation_loop()
+{
+	auto previous = std::chrono::steady_clock::now();
+	float accumulator = 0.0f;
+
+	while (Running)
+	{
+		auto current = std::chrono::steady_clock::now();
+		accumulator += std::chrono::duration<float>(current - previous).count();
+		previous = current;
+
+		// never try to catch up on more than a quarter of a second, otherwise a stall snowballs
+		if (accumulator > 0.25f)
+		{
+			accumulator = 0.25f;
+		}
+
+		process_input();
+
+		if (accumulator < simulation_step)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<float>(simulation_step - accumulator));
+			continue;
+		}
+
+		while (accumulator >= simulation_step)
+		{
+			simulate(simulation_step);
+			accumulator -= simulation_step;
+		}
+
+		publish_snapshot();
+	}
+}
+
+void render_loop()
+{
+	while (Running)
+	{
+		// nothing new to draw yet, the simulation is running the next step
+		if (!frame_snapshots.acquire())
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		WaitForPreviousFrame(); // make sure the frame resource we are about to write is no longer in use by the gpu
+		Update(); // write the snapshot into this frame's constant buffers
+		Render(); // execute the command queue (rendering the scene is the result of the gpu executing the command lists)
+	}
+}
+
+void process_input()
+{
+	input_event event;
+	while (input_events.pop(event))
+	{
+		switch (event.type)
+		{
+		case input_key_down:
+			keys_down[event.key] = true;
+			break;
+		case input_key_up:
+			keys_down[event.key] = false;
+			break;
+		case input_mouse_delta:
+			g_pCamera->UpdateLookAt({ event.x, event.y });
+			break;
+		case input_mouse_click:
+		{
+			float distance;
+			selected_object = pick(event.x, event.y, distance);
+			break;
+		}
+		default:
+			break;
 		}
 	}
 }
@@ -140,35 +260,34 @@ LRESULT CALLBACK WndProc(HWND hwnd,
 	LPARAM lParam)
 
 {
-	float movement = 0.1f;
 	static bool mouseDown = false;
 
 	switch (msg)
 	{
 	case WM_KEYDOWN:
-		switch (wParam)
+		if (wParam == 27)
 		{
-		case 27:
 			Running = false;
 			PostQuitMessage(0);
 			break;
-		case 'W':
-			g_pCamera->MoveForward(movement);  // Adjust distance as needed
-			break;
-		case 'A':
-			g_pCamera->StrafeLeft(movement);  // Adjust distance as needed
-			break;
-		case 'S':
-			g_pCamera->MoveBackward(movement);  // Adjust distance as needed
-			break;
-		case 'D':
-			g_pCamera->StrafeRight(movement);  // Adjust distance as needed
-			break;
 		}
+		// only the transition matters, movement is applied per simulation step while the key is held
+		if ((lParam & (1 << 30)) == 0)
+		{
+			input_events.push({ input_key_down, static_cast<uint8_t>(wParam) });
+		}
+		break;
+	case WM_KEYUP:
+		input_events.push({ input_key_up, static_cast<uint8_t>(wParam) });
 		break;
 	case WM_LBUTTONDOWN:
+	{
 		mouseDown = true;
-		break;
+		// picking needs the scene, so the click position is handed to the simulation thread
+		POINTS clickPos = MAKEPOINTS(lParam);
+		input_events.push({ input_mouse_click, 0, clickPos.x, clickPos.y });
+	}
+	break;
 	case WM_LBUTTONUP:
 		mouseDown = false;
 		break;
@@ -200,9 +319,8 @@ LRESULT CALLBACK WndProc(HWND hwnd,
 		delta.x = cursorPos.x - windowCenter.x;
 		delta.y = cursorPos.y - windowCenter.y;
 
-		// Update the camera with the delta
-		// (You may need to convert POINT to POINTS or use the deltas as is)
-		g_pCamera->UpdateLookAt({ static_cast<short>(delta.x), static_cast<short>(delta.y) });
+		// Hand the delta to the simulation thread, it owns the camera
+		input_events.push({ input_mouse_delta, 0, static_cast<int16_t>(delta.x), static_cast<int16_t>(delta.y) });
 
 		// Recenter the cursor
 		SetCursorPos(windowCenter.x, windowCenter.y);
@@ -220,7 +338,6 @@ LRESULT CALLBACK WndProc(HWND hwnd,
 		lParam);
 }
 
-BYTE* imageData;
 
 bool init_d3d()
 {
@@ -244,26 +361,41 @@ bool init_d3d()
 	frame_index = swap_chain->GetCurrentBackBufferIndex();
 	load_texture();
 	build_root_signature();
-	build_shaders_and_input_layout();
+	if (!build_shaders_and_input_layout())
+	{
+		return false;
+	}
 
-	build_geometry();
-	build_materials();
+	build_materials(); // imported models append their own materials
+	if (!build_geometry())
+	{
+		Running = false;
+		return false;
+	}
+	build_material_buffer();
 	build_descriptor_heaps();
 
 
 	build_frame_resources();
-	build_constant_views();
 
-	build_pso();
+	if (!build_pso())
+	{
+		return false;
+	}
 	// load the image, create a texture resource and descriptor heap
 
 	
-	// Now we execute the command list to upload the initial assets (triangle data)
+	// the initial assets were recorded on the copy queue, they upload while the first frames are prepared and the
+	// first frame to read them waits for them on the GPU. The direct list recorded nothing, it only has to be closed
+	// before the first frame resets it.
 	command_list->Close();
-	ID3D12CommandList* ppCommandLists[] = { command_list };
-	command_queue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+	if (!copies.submit())
+	{
+		Running = false;
+		return false;
+	}
 
-	// increment the fence value now, otherwise the buffer might not be uploaded by the time we start drawing
+	// increment the fence value now, so the first wait on this frame's fence has something to wait for
 	fence_value[frame_index]++;
 	hr = command_queue->Signal(fence[frame_index], fence_value[frame_index]);
 	if (FAILED(hr))
@@ -271,9 +403,7 @@ bool init_d3d()
 		Running = false;
 		return false;
 	}
-
-	// we are done with image data now that we've uploaded it to the gpu, so free it up
-	delete imageData;
+	gpu_heaps.report();
 
 
 
@@ -286,13 +416,42 @@ bool init_d3d()
 	g_pCamera = new Camera(XMFLOAT3(0.0f, 0, -3), XMFLOAT3(0, 0, 1), XMFLOAT3(0.0f, 1.0f, 0.0f));
 
 	// set starting cubes position
-	// first cube
+	// first cube, the grid copies were positioned by build_geometry
 	objects.at(0)->position = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f); // set cube 1's position
-	XMVECTOR posVec = XMLoadFloat4(&objects.at(0)->position); // create xmvector for cube1's position
+	for (Geometry* object : objects)
+	{
+		XMVECTOR posVec = XMLoadFloat4(&object->position); // create xmvector for the cube's position
 
-	tmpMat = XMMatrixTranslationFromVector(posVec); // create translation matrix from cube1's position vector
-	XMStoreFloat4x4(&objects.at(0)->rotation, XMMatrixIdentity()); // initialize cube1's rotation matrix to identity matrix
-	XMStoreFloat4x4(&objects.at(0)->world, tmpMat); // store cube1's world matrix
+		tmpMat = XMMatrixTranslationFromVector(posVec); // create translation matrix from the cube's position vector
+		XMStoreFloat4x4(&object->rotation, XMMatrixIdentity()); // initialize the cube's rotation matrix to identity matrix
+		XMStoreFloat4x4(&object->world, tmpMat); // store the cube's world matrix
+	}
+
+	// every object starts as a root of the scene graph
+	object_bounds.resize(objects.size());
+	for (int i = 0; i < objects.size(); i++)
+	{
+		scene.add_node(-1, objects.at(i)->world, i);
+		object_bounds[i] = transform_bounds(objects.at(i)->bounds, objects.at(i)->world);
+	}
+	scene_bvh.build(object_bounds);
+
+	snapshot_stamp.assign(objects.size(), 0);
+	render_world.resize(objects.size());
+	lod_objects.resize((int)objects.size());
+	object_lods.assign(objects.size(), 0);
+	frames_dirty.assign(objects.size(), 0);
+	dirty_objects.reserve(objects.size());
+
+	// size every snapshot slot up front so publishing never allocates, then publish the starting state
+	frame_snapshots.for_each_slot([](frame_snapshot& snapshot)
+	{
+		snapshot.changed.reserve(objects.size());
+		snapshot.visible.reserve(objects.size());
+		snapshot.tick = 0;
+	});
+	change_log.reserve(objects.size());
+	publish_snapshot();
 
 
 	return true;
@@ -408,58 +567,636 @@ bool initialise_work_submission()
 		Running = false;
 		return false;
 	}
+
+	// the upload ring retires against this, so it has to exist before the first asset is uploaded
+	hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&queue_fence));
+	if (FAILED(hr))
+	{
+		Running = false;
+		return false;
+	}
+
+	// -- Create the copy queue asset uploads go through -- //
+
+	D3D12_COMMAND_QUEUE_DESC copy_desc = {};
+	copy_desc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	copy_desc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	hr = device->CreateCommandQueue(&copy_desc, IID_PPV_ARGS(&copy_queue));
+	if (FAILED(hr))
+	{
+		Running = false;
+		return false;
+	}
+	copy_queue->SetName(L"Asset Copy Queue");
+	hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&copy_fence));
+	if (FAILED(hr))
+	{
+		Running = false;
+		return false;
+	}
+	return true;
 }
 
-void Update()
+bool copy_queue_lists::open(int slot, ID3D12GraphicsCommandList*& recording)
 {
-	//Update Game logic
+	HRESULT hr;
+	if (slot == (int)allocators.size())
+	{
+		ID3D12CommandAllocator* allocator;
+		hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&allocator));
+		if (FAILED(hr))
+		{
+			return false;
+		}
+		allocators.push_back(allocator);
+	}
+	else
+	{
+		// the scheduler only hands out slots whose last submission has finished
+		hr = allocators[slot]->Reset();
+		if (FAILED(hr))
+		{
+			return false;
+		}
+	}
 
+	if (commands == nullptr)
+	{
+		hr = device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, allocators[slot], nullptr, IID_PPV_ARGS(&commands));
+		if (FAILED(hr))
+		{
+			return false;
+		}
+		commands->SetName(L"Asset Copy List");
+	}
+	else
+	{
+		hr = commands->Reset(allocators[slot], nullptr);
+		if (FAILED(hr))
+		{
+			return false;
+		}
+	}
+	recording = commands;
+	return true;
+}
 
+bool copy_queue_lists::execute(ID3D12GraphicsCommandList* recording, uint64_t fence_value)
+{
+	HRESULT hr = recording->Close();
+	if (FAILED(hr))
+	{
+		return false;
+	}
+	ID3D12CommandList* lists[] = { recording };
+	copy_queue->ExecuteCommandLists(_countof(lists), lists);
+	hr = copy_queue->Signal(copy_fence, fence_value);
+	if (FAILED(hr))
+	{
+		return false;
+	}
+	// the staging memory those copies read is free once the copy fence passes the same value
+	asset_uploads.submit(fence_value);
+	return true;
+}
 
-	auto object_cb = frame_resources.at(frame_index)->constant_buffer_object;
+uint64_t copy_queue_lists::completed_value()
+{
+	return copy_fence->GetCompletedValue();
+}
 
-	for (int i = 0; i < objects.size(); i++)
+void copy_queue_lists::wait(uint64_t fence_value)
+{
+	command_queue->Wait(copy_fence, fence_value);
+}
+
+void copy_queue_lists::release()
+{
+	SAFE_RELEASE(commands);
+	for (ID3D12CommandAllocator*& allocator : allocators)
 	{
+		SAFE_RELEASE(allocator);
+	}
+	allocators.clear();
+}
 
-		// create rotation matrices
-		XMMATRIX rotation_x = XMMatrixRotationX(0.0001f);
-		XMMATRIX rotation_y = XMMatrixRotationY(0.0002f);
-		XMMATRIX rotation_z = XMMatrixRotationZ(0.0003f);
+void simulate(float delta_time)
+{
+	// movement speed in units per second, scaled by the fixed step so it no longer depends on key repeat
+	const float movement = 3.0f * delta_time;
 
-		ObjectConstantBuffer data;
+	if (keys_down['W'])
+	{
+		g_pCamera->MoveForward(movement);
+	}
+	if (keys_down['A'])
+	{
+		g_pCamera->StrafeLeft(movement);
+	}
+	if (keys_down['S'])
+	{
+		g_pCamera->MoveBackward(movement);
+	}
+	if (keys_down['D'])
+	{
+		g_pCamera->StrafeRight(movement);
+	}
+
+	// create rotation matrices (radians per second)
+	XMMATRIX rotation_x = XMMatrixRotationX(0.1f * delta_time);
+	XMMATRIX rotation_y = XMMatrixRotationY(0.2f * delta_time);
+	XMMATRIX rotation_z = XMMatrixRotationZ(0.3f * delta_time);
+	XMMATRIX rotation_step = rotation_x * rotation_y * rotation_z;
+
+	// set_local only flags the subtree dirty, world matrices are rebuilt once per snapshot in publish_snapshot
+	for (int i = 0; i < objects.size(); i++)
+	{
 		//Concatenate rotation matrix for cube
-		XMMATRIX rotation_matrix = XMLoadFloat4x4(&objects.at(i)->rotation) * rotation_x * rotation_y * rotation_z;
+		XMMATRIX rotation_matrix = XMLoadFloat4x4(&objects.at(i)->rotation) * rotation_step;
 		XMStoreFloat4x4(&objects.at(i)->rotation, rotation_matrix);
 
-		// create translation matrix for cube 1 from cube 1's position vector
 		//Translation matrix, loaded from positional vector
-		XMMATRIX translation_matrix = XMMatrixTranslationFromVector(XMLoadFloat4(&objects.at(0)->position));
-		// create cube1's world matrix by first rotating the cube, then positioning the rotated cube
-		XMMATRIX worldMat = rotation_matrix * translation_matrix;
-		// store cube1's world matrix
-		XMStoreFloat4x4(&objects.at(i)->world, worldMat);
+		XMMATRIX translation_matrix = XMMatrixTranslationFromVector(XMLoadFloat4(&objects.at(i)->position));
+		// the local transform rotates the object, then positions the rotated object relative to its parent
+		XMFLOAT4X4 local;
+		XMStoreFloat4x4(&local, rotation_matrix * translation_matrix);
+		scene.set_local(scene.node_of(i), local);
+	}
+}
+
+void publish_snapshot()
+{
+	static UINT64 tick = 0;
+	static std::vector<int> changed_objects;
+	tick++;
+
+	// one pass over the dirty part of the hierarchy, static objects cost nothing here
+	changed_objects.clear();
+	scene.update(changed_objects);
+	for (int object : changed_objects)
+	{
+		objects.at(object)->world = scene.get_world(scene.node_of(object));
+		object_bounds[object] = transform_bounds(objects.at(object)->bounds, objects.at(object)->world);
+		change_log.push_back({ tick, object });
+	}
+	if (!changed_objects.empty())
+	{
+		scene_bvh.update(jobs, object_bounds);
+	}
+
+	// forget changes the render thread has already picked up
+	UINT64 consumed = consumed_tick.load(std::memory_order_acquire);
+	int seen = 0;
+	while (seen < change_log.size() && change_log[seen].tick <= consumed)
+	{
+		seen++;
+	}
+	change_log.erase(change_log.begin(), change_log.begin() + seen);
+
+	// the render thread may skip snapshots, so send everything it has not consumed yet rather than only this step
+	frame_snapshot& snapshot = frame_snapshots.write();
+	XMMATRIX view = g_pCamera->GetViewMatrix();
+	XMStoreFloat4x4(&snapshot.view, view);
+
+	// frustum cull against the bvh so the render thread only sees what can be on screen
+	frustum view_frustum = frustum_from_matrix(view * XMLoadFloat4x4(&cameraProjMat));
+	snapshot.visible.clear();
+	scene_bvh.tree.query_frustum(view_frustum, [&](int object)
+	{
+		snapshot.visible.push_back(object);
+	});
+
+	snapshot.changed.clear();
+	for (const logged_change& change : change_log)
+	{
+		if (snapshot_stamp[change.object] == tick)
+		{
+			continue;
+		}
+		snapshot_stamp[change.object] = tick;
+		snapshot.changed.push_back({ change.object, objects.at(change.object)->world });
+	}
+	snapshot.tick = tick;
+
+	frame_snapshots.publish();
+}
+
+void apply_snapshot(const frame_snapshot& snapshot)
+{
+	consumed_tick.store(snapshot.tick, std::memory_order_release);
+
+	for (const object_world& change : snapshot.changed)
+	{
+		render_world[change.object] = change.world;
+
+		// bounding sphere of the world space bounds, and the largest scale to take object space errors to world space
+		const aabb& bounds = objects.at(change.object)->bounds;
+		XMMATRIX world = XMLoadFloat4x4(&change.world);
+		float scale = XMVectorGetX(XMVectorMax(XMVector3Length(world.r[0]), XMVectorMax(XMVector3Length(world.r[1]), XMVector3Length(world.r[2]))));
+		XMVECTOR box_min = XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(bounds.min));
+		XMVECTOR box_max = XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(bounds.max));
+		XMFLOAT3 centre;
+		XMStoreFloat3(&centre, XMVector3TransformCoord((box_min + box_max) * 0.5f, world));
+		lod_objects.set(change.object, &centre.x, 0.5f * XMVectorGetX(XMVector3Length(box_max - box_min)) * scale, scale);
+
+		if (frames_dirty[change.object] == 0)
+		{
+			dirty_objects.push_back(change.object);
+		}
+		// every frame resource holds its own copy of the constant buffer, so each one needs the new matrix
+		frames_dirty[change.object] = frame_buffer_count;
+	}
+}
+
+void Update()
+{
+	//Game logic runs on the simulation thread, here we only turn its latest snapshot into constant buffer data
+	const frame_snapshot& snapshot = frame_snapshots.read();
+	apply_snapshot(snapshot);
+
+	FrameResource* frame_resource = frame_resources.at(frame_index);
+	begin_frame_scratch(frame_resource, (int)snapshot.visible.size());
+
+	// the camera moves independently of the objects, so view projection lives in the per pass buffer
+	DefaultConstantBuffer pass;
+	XMMATRIX view = XMLoadFloat4x4(&snapshot.view); // load view matrix
+	XMMATRIX projection = XMLoadFloat4x4(&cameraProjMat); // load projection matrix
+	XMStoreFloat4x4(&pass.view_projection, XMMatrixTranspose(view * projection)); // must transpose for the gpu
+	XMStoreFloat3(&pass.camera_position, XMMatrixInverse(nullptr, view).r[3]);
+	pass.terrain_origin = XMFLOAT2(terrain.settings.origin[0], terrain.settings.origin[1]);
+	pass.terrain_size = terrain.settings.size;
+	pass.terrain_height_scale = terrain.settings.height_scale;
+	pass.terrain_base_height = terrain.settings.base_height;
+	pass.terrain_chunk_quads = (float)terrain_chunk_quads;
+	pass.terrain_heightmap_size = (float)terrain_heightmap_resolution;
+	upload_space pass_space;
+	if (!frame_resource->constants.allocate(sizeof(pass), pass_space))
+	{
+		Running = false;
+		return;
+	}
+	memcpy(pass_space.cpu, &pass, sizeof(pass));
+	frame_resource->pass_constants = pass_space.gpu;
 
-		// update constant buffer for cube1 (for each object, we need a constant buffer view)
-		// create the wvp matrix and store in constant buffer
+	// only objects whose world matrix changed in the last frame_buffer_count frames are written
+	auto object_data = frame_resource->object_data;
+	jobs->parallel_for((int)dirty_objects.size(), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			int object = dirty_objects[i];
+			ObjectData data;
+			XMStoreFloat4x4(&data.world, XMMatrixTranspose(XMLoadFloat4x4(&render_world[object])));
+			// copy the world matrix to the object's slot in the mapped structured buffer
+			object_data->copy_data(object, data);
+		}
+	}, 256);
 
-		//Update Constant Buffer for cub
-		XMMATRIX view = g_pCamera->GetViewMatrix(); // load view matrix
-		XMMATRIX projection = XMLoadFloat4x4(&cameraProjMat); // load projection matrix
-		XMMATRIX world_view_projection = XMLoadFloat4x4(&objects.at(i)->world) * view * projection; // create wvp matrix
-		XMMATRIX transposed = XMMatrixTranspose(world_view_projection); // must transpose wvp matrix for the gpu
+	// the instance and terrain lists are written straight into upload ring memory, freed once this frame has executed
+	upload_space instance_space;
+	upload_space chunk_space;
+	if (!uploads.allocate(std::max<UINT64>(snapshot.visible.size(), 1) * sizeof(UINT), 256, instance_space) ||
+		!uploads.allocate(max_terrain_chunks * sizeof(terrain_chunk), 256, chunk_space))
+	{
+		Running = false;
+		return;
+	}
+	frame_resource->instance_objects = instance_space.gpu;
+	frame_resource->terrain_chunks = chunk_space.gpu;
 
-		XMStoreFloat4x4(&data.wvpMat, transposed); // store transposed wvp matrix in constant buffer
-		// copy our ConstantBuffer instance to the mapped constant buffer resource
-		object_cb->copy_data(0, data);
+	select_lods(snapshot);
+	build_batches(snapshot, reinterpret_cast<UINT*>(instance_space.cpu));
+	cull_clusters(snapshot);
+	terrain_chunk_count = select_terrain(snapshot, reinterpret_cast<terrain_chunk*>(chunk_space.cpu));
+
+	for (int i = 0; i < dirty_objects.size();)
+	{
+		int object = dirty_objects[i];
+		if (--frames_dirty[object] == 0)
+		{
+			dirty_objects[i] = dirty_objects.back();
+			dirty_objects.pop_back();
+			continue;
+		}
+		i++;
 	}
 }
 
+void begin_frame_scratch(FrameResource* frame_resource, int visible_count)
+{
+	// the lists still point into the last frame's arena, replacing them frees nothing
+	frame_arena& arena = frame_resource->arena();
+	lod_pixels = frame_vector<float>(&arena);
+	draw_keys = frame_vector<draw_key>(&arena);
+	draw_keys_scratch = frame_vector<draw_key>(&arena);
+	draw_batches = frame_vector<draw_batch>(&arena);
+	cluster_draws = frame_vector<cluster_draw>(&arena);
+	cluster_ranges = frame_vector<index_range>(&arena);
+
+	// sized for the worst case up front, a list that grows leaves its old copy behind in the arena
+	lod_pixels.reserve(visible_count + packet_width);
+	draw_keys.reserve(visible_count);
+	draw_keys_scratch.reserve(visible_count);
+	draw_batches.reserve(visible_count);
+	cluster_draws.reserve(visible_count);
+}
+
+void build_batches(const frame_snapshot& snapshot, UINT* instance_list)
+{
+	const std::vector<int>& visible = snapshot.visible;
+	const XMFLOAT4X4& view = snapshot.view;
+
+	auto sort_start = std::chrono::high_resolution_clock::now();
+
+	draw_keys.resize(visible.size());
+	jobs->parallel_for((int)visible.size(), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			int object = visible[i];
+			Geometry* geometry = objects.at(object);
+			const XMFLOAT4X4& world = render_world[object];
+
+			// view space depth of the object's origin, opaque draws go front to back
+			float depth = world.m[3][0] * view.m[0][2] + world.m[3][1] * view.m[1][2] + world.m[3][2] * view.m[2][2] + view.m[3][2];
+			depth = depth < 0.0f ? 0.0f : (depth > draw_key_depth_range ? draw_key_depth_range : depth);
+			uint64_t quantized_depth = (uint64_t)(depth / draw_key_depth_range * ((1 << draw_key_depth_bits) - 1));
+
+			uint64_t key = 0; // opaque pass
+			key |= (uint64_t)materials.at(geometry->material)->pso_index << draw_key_pipeline_shift;
+			key |= (uint64_t)geometry->material << draw_key_material_shift;
+			key |= (uint64_t)geometry->mesh << draw_key_mesh_shift;
+			key |= (uint64_t)object_lods[object] << draw_key_lod_shift;
+			key |= quantized_depth;
+			draw_keys[i] = { key, object };
+		}
+	}, 1024);
+	radix_sort(jobs, draw_keys, draw_keys_scratch);
+
+	draw_stats.sort_milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sort_start).count();
+
+	// everything above the depth bits is draw state, a run of equal state is one instanced draw
+	draw_batches.clear();
+	for (int i = 0; i < draw_keys.size(); i++)
+	{
+		instance_list[i] = draw_keys[i].object;
+		if (i == 0 || (draw_keys[i].key >> draw_key_depth_bits) != (draw_keys[i - 1].key >> draw_key_depth_bits))
+		{
+			draw_batches.push_back({ objects.at(draw_keys[i].object), i, 0, -1, object_lods[draw_keys[i].object] });
+		}
+		draw_batches.back().instance_count++;
+	}
+}
+
+void select_lods(const frame_snapshot& snapshot)
+{
+	const std::vector<int>& visible = snapshot.visible;
+	lod_visible.resize((int)visible.size());
+	lod_pixels.resize(lod_visible.x.size());
+
+	XMFLOAT3 camera;
+	XMStoreFloat3(&camera, XMMatrixInverse(nullptr, XMLoadFloat4x4(&snapshot.view)).r[3]);
+	lod_view view = { { camera.x, camera.y, camera.z }, cameraProjMat.m[1][1] * Height * 0.5f, -cameraProjMat.m[3][2] / cameraProjMat.m[2][2] };
+
+	// each job gathers its own packets of spheres, projects them and picks a level for every object in them
+	jobs->parallel_for((int)lod_visible.x.size() / packet_width, [&](int begin, int end)
+	{
+		int first = begin * packet_width;
+		int last = std::min(end * packet_width, (int)visible.size());
+		for (int i = first; i < last; i++)
+		{
+			lod_visible.copy(i, lod_objects, visible[i]);
+		}
+		project_lod_scales(lod_visible, begin, end, view, lod_pixels.data());
+		for (int i = first; i < last; i++)
+		{
+			int object = visible[i];
+			object_lods[object] = (uint8_t)select_lod(objects.at(object)->lods, lod_pixels[i], lod_max_pixels, lod_hysteresis, object_lods[object]);
+		}
+	}, 64);
+}
+
+void cull_clusters(const frame_snapshot& snapshot)
+{
+	auto cull_start = std::chrono::high_resolution_clock::now();
+
+	// a mesh that is a single meshlet is better off drawn instanced with its batch
+	cluster_draws.clear();
+	int range_count = 0;
+	for (draw_batch& batch : draw_batches)
+	{
+		// meshlets index into the full detail list, coarser levels are drawn whole
+		if (batch.geometry->meshlets == nullptr || batch.lod != 0)
+		{
+			continue;
+		}
+		int meshlet_count = (int)batch.geometry->meshlets->meshlets.size();
+		if (meshlet_count <= 1)
+		{
+			continue;
+		}
+		batch.first_cluster_draw = (int)cluster_draws.size();
+		for (int i = 0; i < batch.instance_count; i++)
+		{
+			cluster_draws.push_back({ batch.first_instance + i, range_count, 0, 0 });
+			range_count += meshlet_count;
+		}
+	}
+	if (cluster_draws.empty())
+	{
+		return;
+	}
+	cluster_ranges.resize(range_count);
+
+	XMMATRIX view = XMLoadFloat4x4(&snapshot.view);
+	XMMATRIX projection = XMLoadFloat4x4(&cameraProjMat);
+	XMVECTOR camera_position = XMMatrixInverse(nullptr, view).r[3];
+	jobs->parallel_for((int)cluster_draws.size(), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			cluster_draw& draw = cluster_draws[i];
+			int object = draw_keys[draw.instance].object;
+			Geometry* geometry = objects.at(object);
+			XMMATRIX world = XMLoadFloat4x4(&render_world[object]);
+			XMMATRIX object_to_view = world * view;
+
+			// everything is moved into object space so the meshlet bounds are used as stored
+			cluster_cull_view cull_view;
+			cull_view.planes = frustum_from_matrix(object_to_view * projection);
+			XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(cull_view.camera), XMVector3TransformCoord(camera_position, XMMatrixInverse(nullptr, world)));
+			XMFLOAT4X4 to_view;
+			XMStoreFloat4x4(&to_view, object_to_view);
+			for (int row = 0; row < 4; row++)
+			{
+				for (int column = 0; column < 3; column++)
+				{
+					cull_view.object_to_view[row][column] = to_view.m[row][column];
+				}
+			}
+			cull_view.radius_scale = XMVectorGetX(XMVectorMax(XMVector3Length(world.r[0]), XMVectorMax(XMVector3Length(world.r[1]), XMVector3Length(world.r[2]))));
+			cull_view.projection_x = cameraProjMat.m[0][0] * Width * 0.5f;
+			cull_view.projection_y = cameraProjMat.m[1][1] * Height * 0.5f;
+			cull_view.viewport_centre[0] = Width * 0.5f;
+			cull_view.viewport_centre[1] = Height * 0.5f;
+			cull_view.near_plane = -cameraProjMat.m[3][2] / cameraProjMat.m[2][2];
+
+			draw.range_count = cull_meshlets(*geometry->meshlets, cull_view, &cluster_ranges[draw.range_offset], draw.visible_meshlets);
+		}
+	}, 16);
+
+	for (const cluster_draw& draw : cluster_draws)
+	{
+		draw_stats.meshlets_tested += (int)objects.at(draw_keys[draw.instance].object)->meshlets->meshlets.size();
+		draw_stats.meshlets_drawn += draw.visible_meshlets;
+	}
+	draw_stats.cull_milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cull_start).count();
+}
+
+int select_terrain(const frame_snapshot& snapshot, terrain_chunk* chunks)
+{
+	// chunks are written straight into this frame's upload memory, the terrain draw instances over them
+	XMMATRIX view = XMLoadFloat4x4(&snapshot.view);
+	frustum view_frustum = frustum_from_matrix(view * XMLoadFloat4x4(&cameraProjMat));
+	XMFLOAT3 camera;
+	XMStoreFloat3(&camera, XMMatrixInverse(nullptr, view).r[3]);
+	int count = terrain.select(view_frustum, &camera.x, chunks, max_terrain_chunks);
+	draw_stats.terrain_chunks += count;
+	return count;
+}
+
+void report_draw_statistics()
+{
+	draw_stats.frames++;
+	if (draw_stats.frames < 256)
+	{
+		return;
+	}
+
+	char message[384];
+	sprintf_s(message, "per frame: %.1f draws, %.1f pipeline changes, %.1f table changes, sort %.3f ms, %.1f of %.1f meshlets drawn, cull %.3f ms, %.1f terrain chunks, %.0f triangles, %.1f KB reclaimed, %.1f KB scratch, %d scratch heap allocations in %d frames\n",
+		draw_stats.draws / (float)draw_stats.frames,
+		draw_stats.pipeline_changes / (float)draw_stats.frames,
+		draw_stats.table_changes / (float)draw_stats.frames,
+		draw_stats.sort_milliseconds / draw_stats.frames,
+		draw_stats.meshlets_drawn / (float)draw_stats.frames,
+		draw_stats.meshlets_tested / (float)draw_stats.frames,
+		draw_stats.cull_milliseconds / draw_stats.frames,
+		draw_stats.terrain_chunks / (float)draw_stats.frames,
+		draw_stats.triangles / (float)draw_stats.frames,
+		draw_stats.bytes_reclaimed / 1024.0 / draw_stats.frames,
+		draw_stats.scratch_bytes / 1024.0 / draw_stats.frames,
+		draw_stats.scratch_heap_allocations,
+		draw_stats.frames);
+	OutputDebugStringA(message);
+#ifdef _DEBUG
+	long long heap_allocations = heap_allocation_count.load(std::memory_order_relaxed);
+	sprintf_s(message, "general heap: %.1f allocations per frame on all threads\n", (heap_allocations - heap_allocations_reported) / (float)draw_stats.frames);
+	OutputDebugStringA(message);
+	heap_allocations_reported = heap_allocations;
+#endif
+	draw_stats = {};
+}
+
+aabb transform_bounds(const aabb& bounds, const XMFLOAT4X4& world)
+{
+	// Arvo's method, each axis of the result only needs the min/max of every matrix term
+	aabb result;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		result.min[axis] = result.max[axis] = world.m[3][axis];
+		for (int row = 0; row < 3; row++)
+		{
+			float a = world.m[row][axis] * bounds.min[row];
+			float b = world.m[row][axis] * bounds.max[row];
+			result.min[axis] += a < b ? a : b;
+			result.max[axis] += a < b ? b : a;
+		}
+	}
+	return result;
+}
+
+frustum frustum_from_matrix(FXMMATRIX view_projection)
+{
+	// Gribb/Hartmann, the planes are sums and differences of the matrix columns (d3d clip z is 0..1)
+	XMFLOAT4X4 m;
+	XMStoreFloat4x4(&m, view_projection);
+
+	float coefficients[6][4];
+	for (int i = 0; i < 4; i++)
+	{
+		coefficients[0][i] = m.m[i][3] + m.m[i][0]; // left
+		coefficients[1][i] = m.m[i][3] - m.m[i][0]; // right
+		coefficients[2][i] = m.m[i][3] + m.m[i][1]; // bottom
+		coefficients[3][i] = m.m[i][3] - m.m[i][1]; // top
+		coefficients[4][i] = m.m[i][2]; // near
+		coefficients[5][i] = m.m[i][3] - m.m[i][2]; // far
+	}
+
+	frustum result;
+	for (int p = 0; p < 6; p++)
+	{
+		float length = sqrtf(coefficients[p][0] * coefficients[p][0] + coefficients[p][1] * coefficients[p][1] + coefficients[p][2] * coefficients[p][2]);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			result.planes[p].normal[axis] = coefficients[p][axis] / length;
+		}
+		result.planes[p].distance = coefficients[p][3] / length;
+	}
+	return result;
+}
+
+int pick(int x, int y, float& distance)
+{
+	// unproject the cursor onto the near and far planes to get a world space ray
+	float ndc_x = 2.0f * x / Width - 1.0f;
+	float ndc_y = 1.0f - 2.0f * y / Height;
+	XMMATRIX inverse_view_projection = XMMatrixInverse(nullptr, g_pCamera->GetViewMatrix() * XMLoadFloat4x4(&cameraProjMat));
+	XMVECTOR near_point = XMVector3TransformCoord(XMVectorSet(ndc_x, ndc_y, 0.0f, 1.0f), inverse_view_projection);
+	XMVECTOR far_point = XMVector3TransformCoord(XMVectorSet(ndc_x, ndc_y, 1.0f, 1.0f), inverse_view_projection);
+
+	XMFLOAT3 origin;
+	XMFLOAT3 direction;
+	XMStoreFloat3(&origin, near_point);
+	XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSubtract(far_point, near_point)));
+
+	float inverse[3];
+	ray_inverse(&direction.x, inverse);
+
+	// objects whose bounds the ray enters are tested against their own triangles, nearest bvh nodes first
+	return scene_bvh.tree.query_ray(&origin.x, &direction.x, FLT_MAX, [&](int object, float max_t)
+	{
+		if (intersect_ray_box(object_bounds[object].min, object_bounds[object].max, &origin.x, inverse, max_t) < 0.0f)
+		{
+			return -1.0f;
+		}
+
+		// the ray is moved into object space without renormalising, so the hit parameter stays a world distance
+		Geometry* geometry = objects.at(object);
+		XMMATRIX world_inverse = XMMatrixInverse(nullptr, XMLoadFloat4x4(&geometry->world));
+		XMFLOAT3 object_origin;
+		XMFLOAT3 object_direction;
+		XMStoreFloat3(&object_origin, XMVector3TransformCoord(XMLoadFloat3(&origin), world_inverse));
+		XMStoreFloat3(&object_direction, XMVector3TransformNormal(XMLoadFloat3(&direction), world_inverse));
+
+		float hit_t;
+		if (geometry->triangles == nullptr)
+		{
+			// no triangles kept, the box entry the test above found is as close as it gets
+			return intersect_ray_box(object_bounds[object].min, object_bounds[object].max, &origin.x, inverse, max_t);
+		}
+		if (geometry->triangles->intersect(&object_origin.x, &object_direction.x, max_t, hit_t) < 0)
+		{
+			return -1.0f;
+		}
+		return hit_t;
+	}, distance);
+}
+
 void UpdatePipeline()
 {
 	HRESULT hr;
 
-	WaitForPreviousFrame();
-
 	hr = command_allocator[frame_index]->Reset();
 
 	if (FAILED(hr))
@@ -497,25 +1234,114 @@ void UpdatePipeline()
 	command_list->SetGraphicsRootSignature(rootSignature); // set the root signature
 
 	// set the descriptor heap
-	ID3D12DescriptorHeap* descriptorHeaps[] = { srv_heap };
+	ID3D12DescriptorHeap* descriptorHeaps[] = { srv_ring.memory };
 	command_list->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
-	// set the descriptor table to the descriptor heap (parameter 1, as constant buffer root descriptor is parameter index 0)
-	command_list->SetGraphicsRootDescriptorTable(1, srv_heap->GetGPUDescriptorHandleForHeapStart());
-
 	command_list->RSSetViewports(1, &viewport); // set the viewports
 	command_list->RSSetScissorRects(1, &scissorRect); // set the scissor rects
 	command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST); // set the primitive topology
-	command_list->IASetVertexBuffers(0, 1, &objects.at(0)->vertex_buffer_view()); // set the vertex buffer (using the vertex buffer view)
-	command_list->IASetIndexBuffer(&objects.at(0)->index_buffer_view());
 
-	// first cube
+	// set the per pass constant buffer (view projection)
+	command_list->SetGraphicsRootConstantBufferView(2, frame_resources.at(frame_index)->pass_constants);
+
+	// every object's world matrix, and the visible objects grouped per batch, the shader finds an instance's
+	// object through instance_objects[first_instance + SV_InstanceID]
+	FrameResource* frame_resource = frame_resources.at(frame_index);
+	command_list->SetGraphicsRootShaderResourceView(3, frame_resource->object_data->upload_buffer->GetGPUVirtualAddress());
+	command_list->SetGraphicsRootShaderResourceView(4, frame_resource->instance_objects);
+
+	// bindless materials: every texture goes in one table, in the order of textures, and the pixel shader finds a
+	// draw's maps through materials[material], so the table is bound once for the whole frame. It is staged again
+	// each frame, which keeps it in step with textures as they are added.
+	frame_vector<int> texture_slots(&frame_resource->arena());
+	texture_slots.reserve(textures.size());
+	copies_used = std::max(meshes.ready, material_buffer_ready);
+	for (Texture* texture : textures)
+	{
+		texture_slots.push_back(texture->srv);
+		copies_used = std::max(copies_used, texture->ready);
+	}
+	command_list->SetGraphicsRootDescriptorTable(1, stage_table(texture_slots.data(), (int)texture_slots.size()));
+	command_list->SetGraphicsRootShaderResourceView(7, material_buffer->GetGPUVirtualAddress());
+	draw_stats.table_changes++;
+
+	// one instanced draw per mesh and material that survived frustum culling on the simulation thread.
+	// Batches arrive in sort key order, so state is only set when it differs from the previous batch.
+	int bound_pipeline = 0; // the command list was reset with pipeline_states[0]
+
+	// every mesh lives in the pool, so the input assembler is bound once and draws select their mesh by offset
+	command_list->IASetVertexBuffers(0, 1, &meshes.vertex_buffer_view()); // set the vertex buffer (using the vertex buffer view)
+	int bound_index_width = -1; // 16 and 32 bit indices live in separate buffers
+	for (const draw_batch& batch : draw_batches)
+	{
+		Geometry* geometry = batch.geometry;
+		Material* material = materials.at(geometry->material);
+		if (material->pso_index != bound_pipeline)
+		{
+			command_list->SetPipelineState(pipeline_states.at(material->pso_index));
+			bound_pipeline = material->pso_index;
+			draw_stats.pipeline_changes++;
+		}
+
+		if ((int)geometry->wide_indices != bound_index_width)
+		{
+			command_list->IASetIndexBuffer(&meshes.index_buffer_view(geometry->wide_indices));
+			bound_index_width = (int)geometry->wide_indices;
+		}
+
+		BatchConstants constants;
+		constants.first_instance = batch.first_instance;
+		constants.quantization = geometry->quantization;
+		constants.material = geometry->material;
+		if (batch.first_cluster_draw < 0)
+		{
+			const mesh_lod& lod = geometry->lods.levels[batch.lod];
+			command_list->SetGraphicsRoot32BitConstants(0, sizeof(BatchConstants) / 4, &constants, 0);
+			command_list->DrawIndexedInstanced(lod.index_count, batch.instance_count, geometry->first_index + lod.first_index, geometry->base_vertex, 0);
+			draw_stats.draws++;
+			draw_stats.triangles += lod.index_count / 3 * batch.instance_count;
+			continue;
+		}
 
-	// set cube1's constant buffer
-	command_list->SetGraphicsRootConstantBufferView(0, frame_resources.at(frame_index)->constant_buffer_object->upload_buffer->GetGPUVirtualAddress());
+		// clustered meshes draw each instance on its own, one draw per run of visible meshlets
+		for (int i = 0; i < batch.instance_count; i++)
+		{
+			const cluster_draw& draw = cluster_draws[batch.first_cluster_draw + i];
+			if (draw.range_count == 0)
+			{
+				continue;
+			}
+			constants.first_instance = draw.instance;
+			command_list->SetGraphicsRoot32BitConstants(0, sizeof(BatchConstants) / 4, &constants, 0);
+			for (int r = 0; r < draw.range_count; r++)
+			{
+				const index_range& range = cluster_ranges[draw.range_offset + r];
+				command_list->DrawIndexedInstanced(range.index_count, 1, geometry->first_index + range.first_index, geometry->base_vertex, 0);
+				draw_stats.draws++;
+				draw_stats.triangles += range.index_count / 3;
+			}
+		}
+	}
 
-	// draw first cube
-	command_list->DrawIndexedInstanced(objects.at(0)->index_count, 1, 0, 0, 0);
+	// the terrain is one instanced draw of the chunk grid, one instance per selected chunk
+	if (terrain_chunk_count > 0)
+	{
+		command_list->SetPipelineState(terrain_pso);
+		draw_stats.pipeline_changes++;
+		// the material constant outlives the batches' constants, the terrain uses the first material's textures
+		command_list->SetGraphicsRoot32BitConstant(0, 0, offsetof(BatchConstants, material) / 4);
+		command_list->SetGraphicsRootDescriptorTable(6, stage_table(&terrain_heightmap_srv, 1));
+		copies_used = std::max(copies_used, terrain_heightmap_ready);
+		command_list->SetGraphicsRootShaderResourceView(5, frame_resource->terrain_chunks);
+		if ((int)terrain_grid.wide_indices != bound_index_width)
+		{
+			command_list->IASetIndexBuffer(&meshes.index_buffer_view(terrain_grid.wide_indices));
+		}
+		command_list->DrawIndexedInstanced(terrain_grid.index_count, terrain_chunk_count, terrain_grid.first_index, terrain_grid.base_vertex, 0);
+		draw_stats.draws++;
+		draw_stats.triangles += terrain_grid.index_count / 3 * terrain_chunk_count;
+	}
+	report_draw_statistics();
 
 	
 
@@ -535,11 +1361,19 @@ void Render()
 
 	UpdatePipeline(); // update the pipeline by sending commands to the command_queue
 
+	// uploads recorded since the last frame start copying now, and the direct queue waits for the ones this frame
+	// reads only if it has not already
+	if (!copies.submit() || !copies.acquire(copies_used))
+	{
+		Running = false;
+	}
+
 	// create an array of command lists (only one command list here)
 	ID3D12CommandList* ppCommandLists[] = { command_list };
 
 	// execute the array of command lists
 	command_queue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+	signal_queue_timeline();
 
 	// this command goes in at the end of our command queue. we will know when our command queue 
 	// has finished because the fence value will be set to "fenceValue" from the GPU since the command
@@ -560,27 +1394,34 @@ void Render()
 
 void Cleanup()
 {
-	// wait for the gpu to finish all frames
-	for (int i = 0; i < frame_buffer_count; ++i)
+	// wait for the gpu to finish everything. Every submission to the direct queue is followed by a signal on the
+	// timeline, so one more signal covers all of them, frames, uploads and the resources waiting to be retired.
+	// Nothing below is released before this. Initialisation can fail before any of it exists, so everything is
+	// checked before it is used.
+	if (command_queue && queue_fence && signal_queue_timeline() && queue_fence->GetCompletedValue() < queue_fence_value)
 	{
-		frame_index = i;
-		WaitForPreviousFrame();
+		queue_fence->SetEventOnCompletion(queue_fence_value, fence_event);
+		WaitForSingleObject(fence_event, INFINITE);
 	}
 
 	// get swapchain out of full screen before exiting
 	BOOL fs = false;
-	if (swap_chain->GetFullscreenState(&fs, NULL))
+	if (swap_chain && swap_chain->GetFullscreenState(&fs, NULL))
 		swap_chain->SetFullscreenState(false, NULL);
 
-	SAFE_RELEASE(device);
 	SAFE_RELEASE(swap_chain);
-	SAFE_RELEASE(command_queue);
-	SAFE_RELEASE(main_rtv->rtv_heap);
+	if (main_rtv)
+	{
+		SAFE_RELEASE(main_rtv->rtv_heap);
+	}
 	SAFE_RELEASE(command_list);
 
 	for (int i = 0; i < frame_buffer_count; ++i)
 	{
-		SAFE_RELEASE(main_rtv->render_targets[i]);
+		if (main_rtv)
+		{
+			SAFE_RELEASE(main_rtv->render_targets[i]);
+		}
 		SAFE_RELEASE(command_allocator[i]);
 		SAFE_RELEASE(fence[i]);
 	};
@@ -590,8 +1431,54 @@ void Cleanup()
 	//SAFE_RELEASE(vertexBuffer);
 	//SAFE_RELEASE(indexBuffer);
 
-	SAFE_RELEASE(main_depth->depth_stencil_data);
-	SAFE_RELEASE(main_depth->depth_heap);
+	// the copy queue may still be working on uploads nothing has drawn yet
+	if (copy_fence && copy_fence->GetCompletedValue() < copies.submitted)
+	{
+		copy_fence->SetEventOnCompletion(copies.submitted, fence_event);
+		WaitForSingleObject(fence_event, INFINITE);
+	}
+	copies.backend.release();
+	SAFE_RELEASE(copy_queue);
+	SAFE_RELEASE(copy_fence);
+
+	srv_staging.release();
+	srv_ring.release();
+	meshes.release();
+	uploads.release();
+	asset_uploads.release();
+	for (FrameResource* resource : frame_resources)
+	{
+		resource->constants.release();
+	}
+	SAFE_RELEASE(terrain_pso);
+	release_after_gpu(terrain_heightmap, terrain_heightmap_memory);
+	release_after_gpu(material_buffer, material_buffer_memory);
+
+	if (main_depth)
+	{
+		release_after_gpu(main_depth->depth_stencil_data, main_depth->depth_memory);
+		SAFE_RELEASE(main_depth->depth_heap);
+	}
+
+	for (Texture* texture : textures)
+	{
+		ID3D12Resource* resource = texture->texture_default_buffer.Detach();
+		release_after_gpu(resource, texture->memory);
+	}
+	// the timeline was drained above, so everything queued can go without looking at the fence, and then the
+	// heaps the placed resources lived in
+	retired.flush();
+	gpu_heaps.release();
+
+	// last, everything above was made from them or waited on them
+	SAFE_RELEASE(queue_fence);
+	SAFE_RELEASE(command_queue);
+	SAFE_RELEASE(device);
+
+	// stop the worker threads, once nothing still queued on them reads scene data
+	scene_bvh.finish(jobs);
+	delete jobs;
+	jobs = nullptr;
 
 	for (int i = 0; i < frame_buffer_count; ++i)
 	{
@@ -624,24 +1511,119 @@ void WaitForPreviousFrame()
 
 	// increment fenceValue for next frame
 	fence_value[frame_index]++;
+
+	// the GPU is done with this frame resource's last frame, so its constants and scratch can all be written over
+	if (frame_index < (int)frame_resources.size())
+	{
+		FrameResource* finished = frame_resources[frame_index];
+		finished->constants.reset();
+		for (frame_arena& arena : finished->arenas)
+		{
+			draw_stats.scratch_bytes += arena.used;
+			draw_stats.scratch_heap_allocations += arena.heap_allocations;
+			arena.reset();
+		}
+	}
+
+	// whatever the GPU has finished with is reused by this frame's uploads
+	uploads.retire();
+	asset_uploads.retire();
+	srv_ring.retire();
+	draw_stats.bytes_reclaimed += retired.retire();
+}
+
+void release_after_gpu(ID3D12Resource*& resource, gpu_allocation& memory)
+{
+	if (resource == nullptr)
+	{
+		return;
+	}
+	// commands recorded but not yet submitted go out with the next signal, so wait for that one
+	UINT64 bytes = memory.heap >= 0 ? memory.size : 0;
+	retired.defer({ resource, memory }, bytes, queue_fence_value + 1);
+	resource = nullptr;
+	memory = gpu_allocation();
+}
+
+bool signal_queue_timeline()
+{
+	// everything allocated from the upload ring so far is read by what was just submitted
+	queue_fence_value++;
+	HRESULT hr = command_queue->Signal(queue_fence, queue_fence_value);
+	if (FAILED(hr))
+	{
+		Running = false;
+		return false;
+	}
+	uploads.submit(queue_fence_value);
+	srv_ring.submit(queue_fence_value);
+	return true;
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE stage_table(const int* slots, int count)
+{
+	D3D12_GPU_DESCRIPTOR_HANDLE table = {};
+	int first = srv_ring.allocate(count);
+	if (first < 0)
+	{
+		OutputDebugStringA("descriptor ring is full\n");
+		Running = false;
+		return table;
+	}
+
+	// one call per run of up to 64, the staged descriptors need not be next to each other
+	D3D12_CPU_DESCRIPTOR_HANDLE sources[64];
+	UINT source_sizes[64];
+	for (int copied = 0; copied < count;)
+	{
+		int run = std::min(count - copied, (int)_countof(sources));
+		for (int i = 0; i < run; i++)
+		{
+			sources[i].ptr = (SIZE_T)srv_staging.cpu(slots[copied + i]);
+			source_sizes[i] = 1;
+		}
+		D3D12_CPU_DESCRIPTOR_HANDLE destination = { (SIZE_T)srv_ring.cpu(first + copied) };
+		UINT destination_size = run;
+		device->CopyDescriptors(1, &destination, &destination_size, run, sources, source_sizes, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+		copied += run;
+	}
+	table.ptr = srv_ring.gpu(first);
+	return table;
 }
 
 bool build_shaders_and_input_layout()
 {
-	shader_vertex = new Shader(L"VertexShader.hlsl" , "main" , "vs_5_0");
+	shader_vertex = new Shader(L"VertexShader.hlsl" , "main" , "vs_5_1"); // 5.1 for the unbounded texture_map[] in common.hlsl
+
+	// the compiler's messages were already written out by Shader
+	if (shader_vertex->failed)
+	{
+		Running = false;
+		return false;
+	}
+
+	shader_pixel = new Shader(L"PixelShader.hlsl", "main", "ps_5_1");
+
+	if (shader_pixel->failed)
+	{
+		Running = false;
+		return false;
+	}
 
-	if (shader_vertex->failed == false)
+	// samples the heightmap and morphs the shared chunk grid, see terrain.h
+	shader_terrain_vertex = new Shader(L"TerrainVertexShader.hlsl", "main", "vs_5_1");
+
+	if (shader_terrain_vertex->failed)
 	{
-		OutputDebugStringA((char*)shader_vertex->error->GetBufferPointer());
 		Running = false;
 		return false;
 	}
 
-	shader_pixel = new Shader(L"PixelShader.hlsl", "main", "ps_5_0");
+	// the same shading, with texture coordinates that tile across the terrain
+	shader_terrain_pixel = new Shader(L"PixelShader.hlsl", "terrain_main", "ps_5_1");
 
-	if (shader_pixel->failed == false)
+	if (shader_terrain_pixel->failed)
 	{
-		OutputDebugStringA((char*)shader_vertex->error->GetBufferPointer());
 		Running = false;
 		return false;
 	}
@@ -653,11 +1635,16 @@ bool build_shaders_and_input_layout()
 	// The input layout is used by the Input Assembler so that it knows
 	// how to read the vertex data bound to it.
 
+	// matches packed_vertex, the vertex shader decodes position and tangent frame
+	static_assert(sizeof(packed_vertex) == 20, "the vertex buffer stride is 20 bytes");
+	static_assert(offsetof(packed_vertex, position) == 0, "POSITION is the first 8 bytes");
+	static_assert(offsetof(packed_vertex, qtangent) == 8, "TANGENT follows POSITION");
+	static_assert(offsetof(packed_vertex, texcoord) == 16, "TEXCOORD is the last 4 bytes");
 	input_layout =
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, offsetof(packed_vertex, position), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, offsetof(packed_vertex, qtangent), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, offsetof(packed_vertex, texcoord), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
 	};
 
 	return true;
@@ -692,46 +1679,51 @@ bool build_pso()
 		Running = false;
 		return false;
 	}
-}
-
-bool build_geometry()
-{
-	HRESULT hr;
+	pipeline_states.push_back(pso);
 
-	build_cube();
+	// the terrain reads the same packed vertices, it swaps the vertex shader and the pixel shader's sampler
+	pso_desc.VS = shader_terrain_vertex->shader_byte_code();
+	pso_desc.PS = shader_terrain_pixel->shader_byte_code();
+	hr = device->CreateGraphicsPipelineState(&pso_desc, IID_PPV_ARGS(&terrain_pso));
+	if (FAILED(hr))
+	{
+		Running = false;
+		return false;
+	}
 	return true;
 }
 
-
-bool build_constant_views()
+bool build_geometry()
 {
 	HRESULT hr;
-	int object_cb_byte_size = frame_resources.at(0)->constant_buffer_per_object_byte_size;
-	int object_count = objects.size();
-	for (int frame = 0; frame < frame_buffer_count; ++frame)
+
+	if (!meshes.create(mesh_pool_vertex_capacity, mesh_pool_index_capacity))
+	{
+		return false;
+	}
+	// the cube grid below copies objects[0], so nothing else can be built without it
+	if (!build_cube() || !build_terrain() || !build_primitives())
+	{
+		return false;
+	}
+	// a model that does not load is not worth failing over, the built in scene is still there to look at
+	if (!model_path.empty() && !load_model(model_path))
 	{
-		auto object_cb = frame_resources.at(frame)->constant_buffer_object->upload_buffer;
+		OutputDebugStringA(("model import: " + model_path + " was not loaded, showing the built in scene\n").c_str());
+	}
 
-		for (int j = 0; j < object_count; j++)
+	// copies share the cube's buffers, mesh and material, only their transform differs
+	Geometry* cube = objects.at(0);
+	for (int y = 0; y < cube_grid_size; y++)
+	{
+		for (int x = 0; x < cube_grid_size; x++)
 		{
-			D3D12_GPU_VIRTUAL_ADDRESS address = object_cb->GetGPUVirtualAddress();
-
-			// Offset to the ith object constant buffer in the buffer.
-			address += j * object_cb_byte_size;
-
-			// Offset to the object cbv in the descriptor heap.
-			int heapIndex = frame * object_count + j;
-			auto handle = CD3DX12_CPU_DESCRIPTOR_HANDLE(cbv_heap->GetCPUDescriptorHandleForHeapStart());
-			handle.Offset(heapIndex, cbv_srv_uav_descriptor_size);
-
-			D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc;
-			cbvDesc.BufferLocation = address;
-
-			cbvDesc.SizeInBytes = object_cb_byte_size;
-
-			device->CreateConstantBufferView(&cbvDesc, handle);
+			Geometry* copy = new Geometry(*cube);
+			copy->position = XMFLOAT4((x - cube_grid_size / 2) * 2.0f, (y - cube_grid_size / 2) * 2.0f, 20.0f, 0.0f);
+			objects.push_back(copy);
 		}
 	}
+
 	return true;
 }
 
@@ -769,14 +1761,13 @@ bool build_descriptor_heaps()
 		return false;
 	}
 
-	D3D12_DESCRIPTOR_HEAP_DESC srv_heap_desc = {};
-	srv_heap_desc.NumDescriptors = 2;
-	srv_heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-	srv_heap_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	hr = device->CreateDescriptorHeap(&srv_heap_desc, IID_PPV_ARGS(&srv_heap));
-
-	//Used to offset to next pointer in srv heap to store next texture- handles are essentially pointers btw
-	CD3DX12_CPU_DESCRIPTOR_HANDLE srv_handle(srv_heap->GetCPUDescriptorHandleForHeapStart());
+	// views are made once into the staging heaps, the shader visible ring only ever receives copies of them
+	srv_staging.initialise(cbv_srv_uav_descriptor_size);
+	if (!srv_ring.create(descriptor_ring_size, cbv_srv_uav_descriptor_size))
+	{
+		Running = false;
+		return false;
+	}
 
 	// now we create a shader resource view (descriptor that points to the texture and describes it)
 	D3D12_SHADER_RESOURCE_VIEW_DESC srv_view = {};
@@ -787,50 +1778,38 @@ bool build_descriptor_heaps()
 	
 	for (auto texture : textures)
 	{
+		texture->srv = srv_staging.allocate();
+		if (texture->srv < 0)
+		{
+			Running = false;
+			return false;
+		}
 		srv_view.Format = texture->texture_default_buffer->GetDesc().Format;
 		srv_view.Texture2D.MipLevels = texture->texture_default_buffer->GetDesc().MipLevels;
-		device->CreateShaderResourceView(texture->texture_default_buffer.Get(), &srv_view, srv_heap->GetCPUDescriptorHandleForHeapStart());
-
-		// next descriptor
-		srv_handle.Offset(1, cbv_srv_uav_descriptor_size);
+		device->CreateShaderResourceView(texture->texture_default_buffer.Get(), &srv_view, { (SIZE_T)srv_staging.cpu(texture->srv) });
 	}
 
-	if (FAILED(hr))
+	terrain_heightmap_srv = srv_staging.allocate();
+	if (terrain_heightmap_srv < 0)
 	{
 		Running = false;
+		return false;
 	}
+	srv_view.Format = DXGI_FORMAT_R16_UNORM;
+	srv_view.Texture2D.MipLevels = 1;
+	device->CreateShaderResourceView(terrain_heightmap, &srv_view, { (SIZE_T)srv_staging.cpu(terrain_heightmap_srv) });
 
-
-
-	// Need a CBV descriptor for each object for each frame resource,
-	// +1 for the perPass CBV for each frame resource.
-	UINT num_descriptors = (objects.size() * frame_buffer_count);
-
-	// Save an offset to the start of the pass CBVs.  These are the last 3 descriptors.
-	cbv_offset = objects.size()* frame_buffer_count;
-
-	D3D12_DESCRIPTOR_HEAP_DESC cbv_desc;
-	cbv_desc.NumDescriptors = num_descriptors;
-	cbv_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	cbv_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-	cbv_desc.NodeMask = 0;
-	
-	device->CreateDescriptorHeap(&cbv_desc, IID_PPV_ARGS(&cbv_heap));
-	
-	srv_heap->SetName(L"SRV Resource Heap");;
 	main_depth->depth_heap->SetName(L"Depth/Stencil Resource Heap");
 	main_rtv->rtv_heap->SetName(L"RTV Resource Heap");
-	cbv_heap->SetName(L"RTV Resource Heap");
 
 
 	//Build RTV & DSV buffers 
-	hr = device->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-		D3D12_HEAP_FLAG_NONE,
-		&CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, Width, Height, 1, 0, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL),
+	hr = gpu_heaps.create(
+		CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, Width, Height, 1, 0, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL),
 		D3D12_RESOURCE_STATE_DEPTH_WRITE,
 		&main_depth->clear_value(),
-		IID_PPV_ARGS(&main_depth->depth_stencil_data)
+		&main_depth->depth_stencil_data,
+		main_depth->depth_memory
 	);
 	if (FAILED(hr))
 	{
@@ -874,7 +1853,6 @@ bool build_frame_resources()
 {
 	HRESULT hr;
 	//BUild GPU - CPU synchronization objects
-	frame = new FrameResource(objects.size());
 
 	// -- Create a Fence & Fence Event -- //
 
@@ -900,7 +1878,7 @@ bool build_frame_resources()
 
 	for (int i = 0; i < frame_buffer_count; i++)
 	{
-			FrameResource* resource = new FrameResource(objects.size());
+			FrameResource* resource = new FrameResource(objects.size(), frame_pass_count);
 	frame_resources.push_back(resource);
 	}
 
@@ -950,59 +1928,10 @@ bool build_cube()
 		{ -0.5f, -0.5f,  0.5f, 1.0f, 0.0f },
 	};
 
-	cube->vertex_buffer_size = vertices.size() * sizeof(Vertex);
-
-	// create default heap
-	// default heap is memory on the GPU. Only the GPU has access to this memory
-	// To get data into this heap, we will have to upload the data using
-	// an upload heap
-	hr = device->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), // a default heap
-		D3D12_HEAP_FLAG_NONE, // no flags
-		&CD3DX12_RESOURCE_DESC::Buffer(cube->vertex_buffer_size), // resource description for a buffer
-		D3D12_RESOURCE_STATE_COPY_DEST, // we will start this heap in the copy destination state since we will copy data
-		// from the upload heap to this heap
-		nullptr, // optimized clear value must be null for this type of resource. used for render targets and depth/stencil buffers
-		IID_PPV_ARGS(&cube->vertex_default));
-	if (FAILED(hr))
-	{
-		Running = false;
-		return false;
-	}
-
-	// we can give resource heaps a name so when we debug with the graphics debugger we know what resource we are looking at
-	cube->vertex_default->SetName(L"Vertex Buffer Resource Heap");
-
-	// create upload heap
-	// upload heaps are used to upload data to the GPU. CPU can write to it, GPU can read from it
-	// We will upload the vertex buffer using this heap to the default heap
-
-	hr = device->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), // upload heap
-		D3D12_HEAP_FLAG_NONE, // no flags
-		&CD3DX12_RESOURCE_DESC::Buffer(cube->vertex_buffer_size), // resource description for a buffer
-		D3D12_RESOURCE_STATE_GENERIC_READ, // GPU will read from this buffer and copy its contents to the default heap
-		nullptr,
-		IID_PPV_ARGS(&cube->vertex_upload));
-	if (FAILED(hr))
+	for (const Vertex& vertex : vertices)
 	{
-		Running = false;
-		return false;
+		cube->bounds.grow(&vertex.pos.x);
 	}
-	cube->vertex_upload->SetName(L"Vertex Buffer Upload Resource Heap");
-
-	// store vertex buffer in upload heap
-	D3D12_SUBRESOURCE_DATA vertex_data = {};
-	vertex_data.pData = vertices.data(); // pointer to our vertex array
-	vertex_data.RowPitch = cube->vertex_buffer_size; // size of all our triangle vertex data
-	vertex_data.SlicePitch = cube->vertex_buffer_size; // also the size of our triangle vertex data
-
-	// we are now creating a command with the command list to copy the data from
-	// the upload heap to the default heap
-	UpdateSubresources(command_list, cube->vertex_default, cube->vertex_upload, 0, 0, 1, &vertex_data);
-
-	// transition the vertex buffer data from copy destination state to vertex buffer state
-	command_list->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(cube->vertex_default, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
 
 	// Create index buffer
 
@@ -1033,214 +1962,338 @@ bool build_cube()
 		20, 23, 21, // second triangle
 	};
 
-	cube->index_buffer_size = indices.size() * sizeof(int);
+	// reorder for the vertex cache and fetch locality before anything depends on the index order
+	std::vector<mesh_optimize_task<Vertex>> optimize_tasks = { { &vertices, &indices } };
+	optimize_geometry(optimize_tasks);
 
 	cube->index_count = indices.size() ;
 
-	// create default heap to hold index buffer
-	hr = device->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), // a default heap
-		D3D12_HEAP_FLAG_NONE, // no flags
-		&CD3DX12_RESOURCE_DESC::Buffer(cube->index_buffer_size), // resource description for a buffer
-		D3D12_RESOURCE_STATE_COPY_DEST, // start in the copy destination state
-		nullptr, // optimized clear value must be null for this type of resource
-		IID_PPV_ARGS(&cube->index_default));
- 	if (FAILED(hr))
+	compute_vertex_normals(&vertices[0].pos.x, &vertices[0].normal.x, sizeof(Vertex), (int)vertices.size(), indices.data(), cube->index_count);
+	split_mirrored_vertices(vertices, indices);
+	compute_tangents(jobs, &vertices[0].pos.x, &vertices[0].normal.x, &vertices[0].texCoord.x, &vertices[0].tangent.x, sizeof(Vertex), (int)vertices.size(), indices.data(), cube->index_count);
+
+	cube->triangles = new triangle_bvh();
+	cube->triangles->build(&vertices[0].pos.x, sizeof(Vertex), indices.data(), cube->index_count);
+	cube->meshlets = new meshlet_set();
+	build_meshlets(&vertices[0].pos.x, sizeof(Vertex), indices.data(), cube->index_count, (int)vertices.size(), *cube->meshlets);
+	cube->mesh = mesh_count++;
+	cube->material = 0;
+
+	// the cube's data is copied into the shared mesh buffers, it only keeps its offsets
+	if (!meshes.add(vertices.data(), (int)vertices.size(), indices.data(), cube->index_count, cube))
 	{
-		Running = false;
 		return false;
 	}
 
-	// we can give resource heaps a name so when we debug with the graphics debugger we know what resource we are looking at
-	cube->index_default->SetName(L"Index Buffer Resource Heap");
+	objects.push_back(cube);
+	return true;
+}
 
-	hr = device->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), // upload heap
-		D3D12_HEAP_FLAG_NONE, // no flags
-		&CD3DX12_RESOURCE_DESC::Buffer(cube->index_buffer_size), // resource description for a buffer
-		D3D12_RESOURCE_STATE_GENERIC_READ, // GPU will read from this buffer and copy its contents to the default heap
-		nullptr,
-		IID_PPV_ARGS(&cube->index_upload));
-	if (FAILED(hr))
+void optimize_geometry(std::vector<mesh_optimize_task<Vertex>>& tasks)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	optimize_meshes(jobs, tasks);
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	size_t triangles = 0;
+	char message[256];
+	for (const mesh_optimize_task<Vertex>& task : tasks)
 	{
-		Running = false;
+		triangles += task.indices->size() / 3;
+		sprintf_s(message, "mesh optimize: acmr %.3f -> %.3f, atvr %.3f -> %.3f\n", task.before.acmr, task.after.acmr, task.before.atvr, task.after.atvr);
+		OutputDebugStringA(message);
+	}
+	sprintf_s(message, "mesh optimize: %zu triangles in %.2f ms (%.2f million triangles/s)\n", triangles, milliseconds, milliseconds > 0.0 ? triangles / milliseconds / 1000.0 : 0.0);
+	OutputDebugStringA(message);
+}
+
+void simplify_geometry(std::vector<mesh_simplify_task<Vertex>>& tasks)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	simplify_meshes(jobs, tasks);
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	size_t triangles = 0;
+	char message[256];
+	for (const mesh_simplify_task<Vertex>& task : tasks)
+	{
+		triangles += task.lods.levels[0].index_count / 3;
+		const mesh_lod& coarsest = task.lods.levels[task.lods.count - 1];
+		sprintf_s(message, "mesh simplify: %d levels, %d -> %d triangles, error %.4f\n", task.lods.count, task.lods.levels[0].index_count / 3, coarsest.index_count / 3, coarsest.error);
+		OutputDebugStringA(message);
+	}
+	sprintf_s(message, "mesh simplify: %zu triangles in %.2f ms (%.2f million triangles/s)\n", triangles, milliseconds, milliseconds > 0.0 ? triangles / milliseconds / 1000.0 : 0.0);
+	OutputDebugStringA(message);
+}
+
+bool load_model(const std::string& path)
+{
+	mapped_file file;
+	if (!file.open(path))
+	{
+		OutputDebugStringA(("model import: could not open " + path + "\n").c_str());
+		return false;
+	}
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	std::string extension = path.substr(std::min(path.size(), path.find_last_of('.')));
+	for (char& c : extension)
+	{
+		c = (char)tolower(c);
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	imported_scene scene;
+	bool imported = false;
+	std::vector<std::unique_ptr<mapped_file>> buffers; // external glTF buffers, mapped until the import is done
+	if (extension == ".obj")
+	{
+		imported = import_obj(jobs, reinterpret_cast<const char*>(file.data), file.size, scene);
+		for (const std::string& library : scene.material_libraries)
+		{
+			// a missing material library only loses colours
+			mapped_file material_file;
+			if (imported && material_file.open(directory + library))
+			{
+				imported = import_mtl(reinterpret_cast<const char*>(material_file.data), material_file.size, scene);
+			}
+		}
+	}
+	else if (extension == ".gltf" || extension == ".glb")
+	{
+		imported = import_gltf(jobs, file.data, file.size, [&](const std::string& uri, byte_view& bytes)
+		{
+			buffers.emplace_back(new mapped_file());
+			if (!buffers.back()->open(directory + uri))
+			{
+				return false;
+			}
+			bytes = { buffers.back()->data, buffers.back()->size };
+			return true;
+		}, scene);
+	}
+	else
+	{
+		scene.error = "unknown model format " + extension;
+	}
+	if (!imported)
+	{
+		OutputDebugStringA(("model import: " + scene.error + "\n").c_str());
 		return false;
 	}
-	cube->index_upload->SetName(L"Index Buffer Upload Resource Heap");
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	char message[256];
+	sprintf_s(message, "model import: %zu meshes, %zu materials in %.2f ms (%.1f MB/s)\n", scene.meshes.size(), scene.materials.size(), milliseconds, milliseconds > 0.0 ? file.size / milliseconds / 1000.0 : 0.0);
+	OutputDebugStringA(message);
+
+	// imported materials go after the built in ones, they use the default textures until texture loading covers them
+	int material_base = (int)materials.size();
+	for (const imported_material& source : scene.materials)
+	{
+		auto material = new Material();
+		material->name = source.name;
+		material->material_cb_index = (int)materials.size();
+		material->pso_index = 0;
+		material->diffuse_srv_heap_index = 0;
+		material->normal_srv_heap_index = 1;
+		material->diffuse_albedo = XMFLOAT4(source.base_colour[0], source.base_colour[1], source.base_colour[2], source.base_colour[3]);
+		material->fresnel = XMFLOAT3(0.1f, 0.1f, 0.1f);
+		material->roughness = 0.5f;
+		XMStoreFloat4x4(&material->material_transformation, XMMatrixIdentity());
+		materials.push_back(material);
+	}
 
-	// store vertex buffer in upload heap
-	D3D12_SUBRESOURCE_DATA index_data = {};
-	index_data.pData = indices.data(); // pointer to our index array
-	index_data.RowPitch = cube->index_buffer_size; // size of all our index buffer
-	index_data.SlicePitch = cube->index_buffer_size; // also the size of our index buffer
+	int mesh_total = (int)scene.meshes.size();
+	std::vector<std::vector<Vertex>> vertices(mesh_total);
+	std::vector<mesh_optimize_task<Vertex>> optimize_tasks(mesh_total);
+	for (int m = 0; m < mesh_total; m++)
+	{
+		const imported_mesh& source = scene.meshes[m];
+		vertices[m].reserve(source.vertices.size());
+		for (const imported_vertex& vertex : source.vertices)
+		{
+			vertices[m].emplace_back(vertex.position[0], vertex.position[1], vertex.position[2], vertex.texcoord[0], vertex.texcoord[1]);
+			vertices[m].back().normal = XMFLOAT3(vertex.normal[0], vertex.normal[1], vertex.normal[2]);
+		}
+		optimize_tasks[m] = { &vertices[m], &scene.meshes[m].indices };
+	}
+	optimize_geometry(optimize_tasks);
 
-	// we are now creating a command with the command list to copy the data from
-	// the upload heap to the default heap
-	UpdateSubresources(command_list, cube->index_default, cube->index_upload, 0, 0, 1, &index_data);
+	// picking and culling structures are independent per mesh, only the copies into the pool are recorded in order
+	std::vector<Geometry*> geometry(mesh_total);
+	jobs->parallel_for(mesh_total, [&](int begin, int end)
+	{
+		for (int m = begin; m < end; m++)
+		{
+			imported_mesh& source = scene.meshes[m];
+			std::vector<Vertex>& mesh_vertices = vertices[m];
+			Geometry* model = new Geometry();
+			model->name = std::wstring(source.name.begin(), source.name.end());
+			model->index_count = (int)source.indices.size();
+			model->material = source.material >= 0 ? material_base + source.material : 0;
+			if (mesh_vertices.empty() || model->index_count == 0)
+			{
+				geometry[m] = model;
+				continue;
+			}
+			for (const Vertex& vertex : mesh_vertices)
+			{
+				model->bounds.grow(&vertex.pos.x);
+			}
+			if (!source.has_normals)
+			{
+				compute_vertex_normals(&mesh_vertices[0].pos.x, &mesh_vertices[0].normal.x, sizeof(Vertex), (int)mesh_vertices.size(), source.indices.data(), model->index_count);
+			}
+			// after the normals, so both sides of a mirror seam keep the same one
+			split_mirrored_vertices(mesh_vertices, source.indices);
+			compute_tangents(jobs, &mesh_vertices[0].pos.x, &mesh_vertices[0].normal.x, &mesh_vertices[0].texCoord.x, &mesh_vertices[0].tangent.x, sizeof(Vertex), (int)mesh_vertices.size(),
+				source.indices.data(), model->index_count);
+			model->triangles = new triangle_bvh();
+			model->triangles->build(&mesh_vertices[0].pos.x, sizeof(Vertex), source.indices.data(), model->index_count);
+			model->meshlets = new meshlet_set();
+			build_meshlets(&mesh_vertices[0].pos.x, sizeof(Vertex), source.indices.data(), model->index_count, (int)mesh_vertices.size(), *model->meshlets);
+			geometry[m] = model;
+		}
+	}, 1);
 
-	// transition the vertex buffer data from copy destination state to vertex buffer state
-	command_list->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(cube->index_default, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
+	// coarser levels go after the full detail indices, which picking and the meshlets above already use
+	std::vector<mesh_simplify_task<Vertex>> simplify_tasks(mesh_total);
+	for (int m = 0; m < mesh_total; m++)
+	{
+		simplify_tasks[m] = { &vertices[m], &scene.meshes[m].indices, geometry[m]->index_count > 0 ? model_lod_count : 1 };
+	}
+	simplify_geometry(simplify_tasks);
 
-	objects.push_back(cube);
+	for (int m = 0; m < mesh_total; m++)
+	{
+		Geometry* model = geometry[m];
+		if (model->index_count == 0)
+		{
+			delete model; // nothing to draw, e.g. a primitive made only of points
+			continue;
+		}
+		model->mesh = mesh_count++;
+		if (!meshes.add(vertices[m].data(), (int)vertices[m].size(), scene.meshes[m].indices.data(), (int)scene.meshes[m].indices.size(), model))
+		{
+			OutputDebugStringA("model import: the mesh pool is full\n");
+			// the meshes already added stay, the ones that did not fit are dropped
+			for (int rest = m; rest < mesh_total; rest++)
+			{
+				delete geometry[rest];
+			}
+			return false;
+		}
+		model->lods = simplify_tasks[m].lods;
+		objects.push_back(model);
+	}
+	return true;
 }
 
-bool build_grid()
+//Pool space for a generated mesh, the caller generates into destination. Generated meshes have no triangle bvh
+//or meshlets, they are picked against their bounds and drawn whole.
+Geometry* add_procedural(const wchar_t* name, const aabb& bounds, mesh_counts counts, mesh_destination& destination)
 {
-	HRESULT hr;
-	//Geometry* grid = new Geometry();
-	//int vertex_count = 40.0f * 60.0f;
-	//int face_count = (40.0f - 1) * (60.0f - 1) * 2;
-
-	//float half_width = 0.5f * 20.0f;
-	//float half_depth = 0.5f * 30.0f;
-
-	//float dx = 30.0f / (40.0f - 1);
-	//float dz = 30.0f / (60.0f - 1);
-	//float du = 1.0f / (40.0f - 1);
-	//float dv = 1.0f / (60l0f - 1);
-	//std::vector<Vertex> vertices;
-	//vertices.resize(vertex_count);
-
-	//for (int i = 0; i < 60.0f; ++i)
-	//{
-	//	float z = half_depth - i * dz;
-	//	for (int j = 0; j < 40.0f; ++j)
-	//	{
-	//		float x = -half_width + j * dx;
-
-	//		vertices[i * 40.0f + j].pos = XMFLOAT3(x, 0.0f, z);
-
-	//		// Stretch texture over grid.
-	//		vertices[i * 40.0f + j].texCoord.x = j * du;
-	//		vertices[i * 40.0f + j].texCoord.y = i * dv;
-	//	}
-	//}
-	//cube->vertex_buffer_size = sizeof(vertices);
-
-	//// create default heap
-	//// default heap is memory on the GPU. Only the GPU has access to this memory
-	//// To get data into this heap, we will have to upload the data using
-	//// an upload heap
-	//hr = device->CreateCommittedResource(
-	//	&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), // a default heap
-	//	D3D12_HEAP_FLAG_NONE, // no flags
-	//	&CD3DX12_RESOURCE_DESC::Buffer(cube->vertex_buffer_size), // resource description for a buffer
-	//	D3D12_RESOURCE_STATE_COPY_DEST, // we will start this heap in the copy destination state since we will copy data
-	//	// from the upload heap to this heap
-	//	nullptr, // optimized clear value must be null for this type of resource. used for render targets and depth/stencil buffers
-	//	IID_PPV_ARGS(&cube->vertex_default));
-	//if (FAILED(hr))
-	//{
-	//	Running = false;
-	//	return false;
-	//}
-
-	//// we can give resource heaps a name so when we debug with the graphics debugger we know what resource we are looking at
-	//cube->vertex_default->SetName(L"Vertex Buffer Resource Heap");
-
-	//// create upload heap
-	//// upload heaps are used to upload data to the GPU. CPU can write to it, GPU can read from it
-	//// We will upload the vertex buffer using this heap to the default heap
-
-	//hr = device->CreateCommittedResource(
-	//	&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), // upload heap
-	//	D3D12_HEAP_FLAG_NONE, // no flags
-	//	&CD3DX12_RESOURCE_DESC::Buffer(cube->vertex_buffer_size), // resource description for a buffer
-	//	D3D12_RESOURCE_STATE_GENERIC_READ, // GPU will read from this buffer and copy its contents to the default heap
-	//	nullptr,
-	//	IID_PPV_ARGS(&cube->vertex_upload));
-	//if (FAILED(hr))
-	//{
-	//	Running = false;
-	//	return false;
-	//}
-	//cube->vertex_upload->SetName(L"Vertex Buffer Upload Resource Heap");
-
-	//// store vertex buffer in upload heap
-	//D3D12_SUBRESOURCE_DATA vertex_data = {};
-	//vertex_data.pData = reinterpret_cast<BYTE*>(vertices); // pointer to our vertex array
-	//vertex_data.RowPitch = cube->vertex_buffer_size; // size of all our triangle vertex data
-	//vertex_data.SlicePitch = cube->vertex_buffer_size; // also the size of our triangle vertex data
-
-	//// we are now creating a command with the command list to copy the data from
-	//// the upload heap to the default heap
-	//UpdateSubresources(commandList, cube->vertex_default, cube->vertex_upload, 0, 0, 1, &vertex_data);
-
-	//// transition the vertex buffer data from copy destination state to vertex buffer state
-	//commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(cube->vertex_default, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
-
-	//std::vector<int> indicies;
-	//indicies.resize(face_count * 3);
-	//// Iterate over each quad and compute indices.
-	//int k = 0;
-	//for (int i = 0; i < 60.0f - 1; ++i)
-	//{
-	//	for (int j = 0; j < 40.0f - 1; ++j)
-	//	{
-	//		indicies[k] = i * 40.0f + j;
-	//		indicies[k + 1] = i * 40.0f + j + 1;
-	//		indicies[k + 2] = (i + 1) * 40.0f + j;
-
-	//		indicies[k + 3] = (i + 1) * 40.0f + j;
-	//		indicies[k + 4] = i * 40.0f + j + 1;
-	//		indicies[k + 5] = (i + 1) * 40.0f + j + 1;
-
-	//		k += 6; // next quad
-	//	}
-	//}
-	//grid->index_buffer_size = sizeof(indices);
-
-	//grid->index_count = sizeof(indices) / sizeof(int);
-
-	//// create default heap to hold index buffer
-	//hr = device->CreateCommittedResource(
-	//	&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), // a default heap
-	//	D3D12_HEAP_FLAG_NONE, // no flags
-	//	&CD3DX12_RESOURCE_DESC::Buffer(grid->index_buffer_size), // resource description for a buffer
-	//	D3D12_RESOURCE_STATE_COPY_DEST, // start in the copy destination state
-	//	nullptr, // optimized clear value must be null for this type of resource
-	//	IID_PPV_ARGS(&grid->index_default));
-	//if (FAILED(hr))
-	//{
-	//	Running = false;
-	//	return false;
-	//}
-
-	//// we can give resource heaps a name so when we debug with the graphics debugger we know what resource we are looking at
-	//cube->index_default->SetName(L"Index Buffer Resource Heap");
-
-	//hr = device->CreateCommittedResource(
-	//	&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), // upload heap
-	//	D3D12_HEAP_FLAG_NONE, // no flags
-	//	&CD3DX12_RESOURCE_DESC::Buffer(grid->index_buffer_size), // resource description for a buffer
-	//	D3D12_RESOURCE_STATE_GENERIC_READ, // GPU will read from this buffer and copy its contents to the default heap
-	//	nullptr,
-	//	IID_PPV_ARGS(&cube->index_upload));
-	//if (FAILED(hr))
-	//{
-	//	Running = false;
-	//	return false;
-	//}
-	//cube->index_upload->SetName(L"Index Buffer Upload Resource Heap");
-
-	//// store vertex buffer in upload heap
-	//D3D12_SUBRESOURCE_DATA index_data = {};
-	//index_data.pData = reinterpret_cast<BYTE*>(indices); // pointer to our index array
-	//index_data.RowPitch = grid->index_buffer_size; // size of all our index buffer
-	//index_data.SlicePitch = grid->index_buffer_size; // also the size of our index buffer
-
-	//// we are now creating a command with the command list to copy the data from
-	//// the upload heap to the default heap
-	//UpdateSubresources(commandList, grid->index_default, grid->index_upload, 0, 0, 1, &index_data);
-
-	//// transition the vertex buffer data from copy destination state to vertex buffer state
-	//commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(grid->index_default, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
-
-	//objects.push_back(grid);
+	Geometry* geometry = new Geometry();
+	geometry->name = name;
+	geometry->bounds = bounds;
+	geometry->material = 0;
+	geometry->mesh = mesh_count++;
+	if (!meshes.allocate(counts.vertex_count, counts.index_count, bounds, geometry, destination))
+	{
+		delete geometry;
+		return nullptr;
+	}
+	objects.push_back(geometry);
+	return geometry;
+}
+
+bool build_terrain()
+{
+	terrain_settings settings;
+	settings.origin[0] = -1024.0f;
+	settings.origin[1] = -1024.0f;
+	settings.size = 2048.0f;
+	settings.base_height = -60.0f;
+	settings.height_scale = 50.0f;
+	settings.lod_count = 6; // 64 unit leaves, drawn as 32 unit chunks
+	settings.detail_distance = 64.0f;
+	settings.morph_ratio = 0.66f;
+
+	std::vector<uint16_t> heights;
+	generate_heightmap(jobs, terrain_heightmap_resolution, 1, heights);
+	terrain.build(settings, heights.data(), terrain_heightmap_resolution);
+
+	// every chunk is an instance of this one grid, its texture coordinates are the grid position
+	grid_shape chunk = { 1.0f, 1.0f, terrain_chunk_quads, terrain_chunk_quads };
+	mesh_counts counts = procedural_counts(chunk);
+	mesh_destination destination;
+	terrain_grid.name = L"terrain chunk grid";
+	terrain_grid.bounds = procedural_bounds(chunk);
+	if (!meshes.allocate(counts.vertex_count, counts.index_count, terrain_grid.bounds, &terrain_grid, destination))
+	{
+		return false;
+	}
+	generate(chunk, destination);
+
+	HRESULT hr = gpu_heaps.create(
+		CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R16_UNORM, terrain_heightmap_resolution, terrain_heightmap_resolution, 1, 1),
+		D3D12_RESOURCE_STATE_COMMON, // promoted to copy dest on the copy queue and to a shader resource when the terrain reads it
+		nullptr,
+		&terrain_heightmap,
+		terrain_heightmap_memory);
+	if (FAILED(hr))
+	{
+		Running = false;
+		return false;
+	}
+	terrain_heightmap->SetName(L"Terrain Heightmap");
+
+	ID3D12GraphicsCommandList* copy_list;
+	upload_space staging;
+	if (!copies.record(copy_list) || !asset_uploads.allocate(GetRequiredIntermediateSize(terrain_heightmap, 0, 1), D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, staging))
+	{
+		Running = false;
+		return false;
+	}
 
+	D3D12_SUBRESOURCE_DATA height_data = {};
+	height_data.pData = heights.data();
+	height_data.RowPitch = terrain_heightmap_resolution * sizeof(uint16_t);
+	height_data.SlicePitch = height_data.RowPitch * terrain_heightmap_resolution;
+	UpdateSubresources(copy_list, terrain_heightmap, staging.memory, staging.offset, 0, 1, &height_data);
+	terrain_heightmap_ready = copies.ticket();
 	return true;
 }
 
+bool build_primitives()
+{
+	// one of each generated shape in a row in front of the cubes
+	mesh_destination destination;
+	float x = -12.0f;
+	auto add_shape = [&](const wchar_t* name, const auto& shape)
+	{
+		Geometry* geometry = add_procedural(name, procedural_bounds(shape), procedural_counts(shape), destination);
+		if (!geometry)
+		{
+			return false;
+		}
+		generate(shape, destination);
+		procedural_lods(shape, geometry->lods);
+		geometry->position = XMFLOAT4(x, 0.0f, 10.0f, 0.0f);
+		x += 4.0f;
+		return true;
+	};
+
+	// each with coarser levels for when they are far away
+	sphere_shape sphere = { 1.0f, 48, 24, 4 };
+	capsule_shape capsule = { 0.75f, 1.5f, 48, 12, 4 };
+	cylinder_shape cylinder = { 1.0f, 2.0f, 48, 4, 4 };
+	torus_shape torus = { 1.0f, 0.4f, 64, 24, 4 };
+	box_shape box = { { 2.0f, 2.0f, 2.0f }, { 8, 8, 8 }, 4 };
+	grid_shape tile = { 2.0f, 2.0f, 16, 16, 4 };
+	return add_shape(L"sphere", sphere) && add_shape(L"capsule", capsule) && add_shape(L"cylinder", cylinder) &&
+		add_shape(L"torus", torus) && add_shape(L"box", box) && add_shape(L"tile", tile);
+}
+
 bool build_root_signature()
 {
 	HRESULT hr;
@@ -1254,7 +2307,7 @@ bool build_root_signature()
 	// this is a range of descriptors inside a descriptor heap
 	D3D12_DESCRIPTOR_RANGE  descriptorTableRanges[1]; // only one range right now
 	descriptorTableRanges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV; // this is a range of shader resource views (descriptors)
-	descriptorTableRanges[0].NumDescriptors = 1; // we only have one texture right now, so the range is only 1
+	descriptorTableRanges[0].NumDescriptors = UINT_MAX; // unbounded, every texture from t0 on, indexed through the material buffer
 	descriptorTableRanges[0].BaseShaderRegister = 0; // start index of the shader registers in the range
 	descriptorTableRanges[0].RegisterSpace = 0; // space 0. can usually be zero
 	descriptorTableRanges[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND; // this appends the range to the end of the root signature descriptor tables
@@ -1263,27 +2316,79 @@ bool build_root_signature()
 	D3D12_ROOT_DESCRIPTOR_TABLE descriptorTable;
 	descriptorTable.NumDescriptorRanges = _countof(descriptorTableRanges); // we only have one range
 	descriptorTable.pDescriptorRanges = &descriptorTableRanges[0]; // the pointer to the beginning of our ranges array
-	// create a root descriptor, which explains where to find the data for this root parameter
-	D3D12_ROOT_DESCRIPTOR rootCBVDescriptor;
-	rootCBVDescriptor.RegisterSpace = 0;
-	rootCBVDescriptor.ShaderRegister = 0;
+	// per batch constants (b0), the batch's offset into the instance list, its mesh's position decode and its material
+	D3D12_ROOT_CONSTANTS batchConstants;
+	batchConstants.RegisterSpace = 0;
+	batchConstants.ShaderRegister = 0;
+	batchConstants.Num32BitValues = sizeof(BatchConstants) / 4;
 
+	// per pass constant buffer (b1)
 	D3D12_ROOT_DESCRIPTOR rootCBVDescriptor2;
-	rootCBVDescriptor2.RegisterSpace = 1;
-	rootCBVDescriptor2.ShaderRegister = 0;
+	rootCBVDescriptor2.RegisterSpace = 0;
+	rootCBVDescriptor2.ShaderRegister = 1;
+
+	// object data (t0, space1) and instance list (t1, space1) structured buffers
+	D3D12_ROOT_DESCRIPTOR objectDataDescriptor;
+	objectDataDescriptor.RegisterSpace = 1;
+	objectDataDescriptor.ShaderRegister = 0;
+
+	D3D12_ROOT_DESCRIPTOR instanceObjectsDescriptor;
+	instanceObjectsDescriptor.RegisterSpace = 1;
+	instanceObjectsDescriptor.ShaderRegister = 1;
+
+	// terrain chunks (t2, space1) and the heightmap (t0, space2), read by the terrain vertex shader
+	D3D12_ROOT_DESCRIPTOR terrainChunksDescriptor;
+	terrainChunksDescriptor.RegisterSpace = 1;
+	terrainChunksDescriptor.ShaderRegister = 2;
+
+	// material buffer (t3, space1), read by the pixel shader
+	D3D12_ROOT_DESCRIPTOR materialsDescriptor;
+	materialsDescriptor.RegisterSpace = 1;
+	materialsDescriptor.ShaderRegister = 3;
+
+	D3D12_DESCRIPTOR_RANGE heightmapRange;
+	heightmapRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+	heightmapRange.NumDescriptors = 1;
+	heightmapRange.BaseShaderRegister = 0;
+	heightmapRange.RegisterSpace = 2;
+	heightmapRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+	D3D12_ROOT_DESCRIPTOR_TABLE heightmapTable;
+	heightmapTable.NumDescriptorRanges = 1;
+	heightmapTable.pDescriptorRanges = &heightmapRange;
 
 	// create a root parameter for the root descriptor and fill it out
-	D3D12_ROOT_PARAMETER  rootParameters[3]; // only one parameter right now
-	rootParameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV; // this is a constant buffer view root descriptor
-	rootParameters[0].Descriptor = rootCBVDescriptor; // this is the root descriptor for this root parameter
-	rootParameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX; // our pixel shader will be the only shader accessing this parameter for now
+	D3D12_ROOT_PARAMETER  rootParameters[8];
+	rootParameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS; // changes once per batch
+	rootParameters[0].Constants = batchConstants;
+	rootParameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL; // the pixel shader reads the material
 	
 	rootParameters[2].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV; // this is a constant buffer view root descriptor
 	rootParameters[2].Descriptor = rootCBVDescriptor2; // this is the root descriptor for this root parameter
 	rootParameters[2].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX; // our pixel shader will be the only shader accessing this parameter for now
 
+	rootParameters[3].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+	rootParameters[3].Descriptor = objectDataDescriptor;
+	rootParameters[3].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX;
+
+	rootParameters[4].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+	rootParameters[4].Descriptor = instanceObjectsDescriptor;
+	rootParameters[4].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX;
+
+	rootParameters[5].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+	rootParameters[5].Descriptor = terrainChunksDescriptor;
+	rootParameters[5].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX;
+
+	rootParameters[6].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+	rootParameters[6].DescriptorTable = heightmapTable;
+	rootParameters[6].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX;
+
+	rootParameters[7].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+	rootParameters[7].Descriptor = materialsDescriptor;
+	rootParameters[7].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
 	// fill out the parameter for our descriptor table. Remember it's a good idea to sort parameters by frequency of change. Our constant
-	// buffer will be changed multiple times per frame, while our descriptor table will not be changed at all (in this tutorial)
+	// buffer will be changed multiple times per frame, while the texture table is set once per frame
 	rootParameters[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE; // this is a descriptor table
 	rootParameters[1].DescriptorTable = descriptorTable; // this is our descriptor table for this root parameter
 	rootParameters[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL; // our pixel shader will be the only shader accessing this parameter for now
@@ -1304,11 +2409,26 @@ bool build_root_signature()
 	sampler.RegisterSpace = 0;
 	sampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 
+	// heights are filtered between samples and never wrap around the terrain's edges (s1)
+	D3D12_STATIC_SAMPLER_DESC samplers[3] = { sampler, sampler, sampler };
+	samplers[1].Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+	samplers[1].AddressU = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+	samplers[1].AddressV = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+	samplers[1].AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+	samplers[1].ShaderRegister = 1;
+	samplers[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_VERTEX;
+	// the terrain's texture coordinates are world position / 8 and repeat its maps all over it (s2)
+	samplers[2].Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+	samplers[2].AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+	samplers[2].AddressV = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+	samplers[2].AddressW = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+	samplers[2].ShaderRegister = 2;
+
 	CD3DX12_ROOT_SIGNATURE_DESC rootSignatureDesc;
 	rootSignatureDesc.Init(_countof(rootParameters), // we have 2 root parameters
 		rootParameters, // a pointer to the beginning of our root parameters array
-		1, // we have one static sampler
-		&sampler, // a pointer to our static sampler (array)
+		_countof(samplers),
+		samplers, // a pointer to our static samplers
 		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT | // we can deny shader stages here for better performance
 		D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
 		D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
@@ -1352,28 +2472,103 @@ bool build_materials()
 	auto cube = new Material();
 	cube->name = "cube";
 	cube->material_cb_index = 0;
+	cube->pso_index = 0;
 	cube->diffuse_srv_heap_index = 0;
 	cube->normal_srv_heap_index = 1;
 	cube->diffuse_albedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	cube->fresnel = XMFLOAT3(0.1f, 0.1f, 0.1f);
 	cube->roughness = 0.3f;
+	XMStoreFloat4x4(&cube->material_transformation, XMMatrixIdentity());
 
 	materials.push_back(cube);
 	return true;
 }
 
+bool build_material_buffer()
+{
+	UINT64 size = materials.size() * sizeof(MaterialData);
+	HRESULT hr = gpu_heaps.create(
+		CD3DX12_RESOURCE_DESC::Buffer(size),
+		D3D12_RESOURCE_STATE_COMMON, // promoted like the mesh pool's buffers, no barriers on either queue
+		nullptr,
+		&material_buffer,
+		material_buffer_memory);
+	if (FAILED(hr))
+	{
+		Running = false;
+		return false;
+	}
+	material_buffer->SetName(L"Material Buffer");
+
+	ID3D12GraphicsCommandList* copy_list;
+	upload_space staging;
+	if (!copies.record(copy_list) || !asset_uploads.allocate(size, 16, staging))
+	{
+		Running = false;
+		return false;
+	}
+
+	MaterialData* data = reinterpret_cast<MaterialData*>(staging.cpu);
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		const Material* material = materials[i];
+		MaterialData& entry = data[i];
+		entry.diffuse_albedo = material->diffuse_albedo;
+		entry.fresnel = material->fresnel;
+		entry.roughness = material->roughness;
+		XMStoreFloat4x4(&entry.material_transformation, XMMatrixTranspose(XMLoadFloat4x4(&material->material_transformation))); // must transpose for the gpu
+		entry.diffuse_map_index = material->diffuse_srv_heap_index;
+		entry.normal_map_index = material->normal_srv_heap_index;
+		entry.padding[0] = entry.padding[1] = 0;
+	}
+	copy_list->CopyBufferRegion(material_buffer, 0, staging.memory, staging.offset, size);
+	material_buffer_ready = copies.ticket();
+	return true;
+}
+
 void load_texture()
 {
 	HRESULT hr;
+	// texels go through the asset upload ring like every other upload, and are copied on the copy queue
+	ID3D12GraphicsCommandList* copy_list;
+	if (!copies.record(copy_list))
+	{
+		Running = false;
+		return;
+	}
+	DirectX::UploadAllocator12 upload;
+	upload.user = &asset_uploads;
+	upload.allocate = [](void* user, UINT64 size, UINT64 alignment, ID3D12Resource** buffer, UINT64* offset)
+	{
+		upload_space space;
+		if (!static_cast<upload_ring<asset_upload_pages>*>(user)->allocate(size, alignment, space))
+		{
+			return false;
+		}
+		*buffer = space.memory;
+		*offset = space.offset;
+		return true;
+	};
+	// and are placed in the texture heaps, user is the texture's gpu_allocation
+	DirectX::TextureAllocator12 placed;
+	placed.create = [](void* user, const D3D12_RESOURCE_DESC* desc, D3D12_RESOURCE_STATES state, ID3D12Resource** texture)
+	{
+		return gpu_heaps.create(*desc, state, nullptr, texture, *static_cast<gpu_allocation*>(user));
+	};
+
 	auto cube_texture = new Texture();
 	cube_texture->texture_name = "Cube Albedo Texture";
 	cube_texture->file_name = L"Textures/bricks.dds";
-	hr = DirectX::CreateDDSTextureFromFile12(device, command_list, cube_texture->file_name.c_str(), cube_texture->texture_default_buffer, cube_texture->texture_upload_buffer);
+	placed.user = &cube_texture->memory;
+	hr = DirectX::CreateDDSTextureFromFile12(device, copy_list, cube_texture->file_name.c_str(), cube_texture->texture_default_buffer, upload, placed);
+	cube_texture->ready = copies.ticket();
 
 	auto cube_normal = new Texture();
 	cube_normal->texture_name = "Cube Normal Texture";
 	cube_normal->file_name = L"Textures/normal.dds";
-	hr = DirectX::CreateDDSTextureFromFile12(device, command_list, cube_normal->file_name.c_str(), cube_normal->texture_default_buffer, cube_normal->texture_upload_buffer);
+	placed.user = &cube_normal->memory;
+	hr = DirectX::CreateDDSTextureFromFile12(device, copy_list, cube_normal->file_name.c_str(), cube_normal->texture_default_buffer, upload, placed);
+	cube_normal->ready = copies.ticket();
 
 	textures.push_back(cube_texture);
 	textures.push_back(cube_normal);
@@ -0,0 +1,1517 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "job_system.h"
+
+//OBJ (with MTL) and glTF 2.0 (.gltf and .glb) import from memory, the caller maps the files.
+//OBJ files are split into chunks at line boundaries and parsed in parallel, then faces are grouped per material and
+//their position/texcoord/normal triples welded into vertices with a hash table. glTF primitives convert in parallel.
+//Both formats are right handed with counter clockwise front faces, meshes come out in the renderer's convention:
+//z negated, clockwise front faces and texture v pointing down.
+
+struct imported_vertex
+{
+	float position[3];
+	float normal[3];
+	float texcoord[2];
+};
+
+struct imported_material
+{
+	std::string name;
+	float base_colour[4];
+	std::string diffuse_texture; // as written in the file, relative to it
+};
+
+struct imported_mesh
+{
+	std::string name;
+	int material; // into imported_scene::materials, -1 for none
+	bool has_normals; // false when any vertex had no normal, they are left zero
+	std::vector<imported_vertex> vertices;
+	std::vector<int> indices;
+};
+
+struct imported_scene
+{
+	std::vector<imported_mesh> meshes;
+	std::vector<imported_material> materials;
+	std::vector<std::string> material_libraries; // mtllib files an OBJ asked for, load them with import_mtl
+	std::string error;
+};
+
+//Text scanning
+
+//Next '\n' at or after p, or end. 16 bytes at a time, the tail byte by byte so nothing past end is read.
+inline const char* find_line_end(const char* p, const char* end)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	while (end - p >= 16)
+	{
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), newline));
+		if (mask != 0)
+		{
+#ifdef _MSC_VER
+			unsigned long first;
+			_BitScanForward(&first, (unsigned long)mask);
+			return p + first;
+#else
+			return p + __builtin_ctz((unsigned)mask);
+#endif
+		}
+		p += 16;
+	}
+	while (p < end && *p != '\n')
+	{
+		p++;
+	}
+	return p;
+}
+
+inline bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skip_blanks(const char* p, const char* end)
+{
+	while (p < end && is_blank(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+//Eight ascii digits in one little endian word, checked and converted without a per byte loop (Lemire)
+inline bool is_eight_digits(uint64_t word)
+{
+	return (((word + 0x4646464646464646ull) | (word - 0x3030303030303030ull)) & 0x8080808080808080ull) == 0;
+}
+
+inline uint32_t parse_eight_digits(uint64_t word)
+{
+	word = (word & 0x0f0f0f0f0f0f0f0full) * 2561 >> 8;
+	word = (word & 0x00ff00ff00ff00ffull) * 6553601 >> 16;
+	return (uint32_t)((word & 0x0000ffff0000ffffull) * 42949672960001ull >> 32);
+}
+
+//Accumulates a run of digits into mantissa, keeping at most 19 significant ones. Returns how many digits were read
+//and how many of them did not fit.
+inline int scan_digits(const char*& p, const char* end, uint64_t& mantissa, int& kept, int& dropped)
+{
+	int read = 0;
+	while (kept <= 11 && end - p >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		if (!is_eight_digits(word))
+		{
+			break;
+		}
+		mantissa = mantissa * 100000000 + parse_eight_digits(word);
+		// leading zeros do not count against the 19 digit limit
+		kept = mantissa != 0 ? kept + 8 : 0;
+		p += 8;
+		read += 8;
+	}
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		if (kept < 19)
+		{
+			mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+			kept = mantissa != 0 ? kept + 1 : 0;
+		}
+		else
+		{
+			dropped++;
+		}
+		p++;
+		read++;
+	}
+	return read;
+}
+
+//Decimal with optional sign, fraction and exponent. Advances p past it and returns false if there was no number.
+inline bool parse_number(const char*& p, const char* end, double& value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int kept = 0;
+	int dropped = 0;
+	int digits = scan_digits(p, end, mantissa, kept, dropped);
+	int exponent = dropped;
+	if (p < end && *p == '.')
+	{
+		p++;
+		int fraction_dropped = 0;
+		int fraction_digits = scan_digits(p, end, mantissa, kept, fraction_dropped);
+		digits += fraction_digits;
+		// digits kept after the point scale the mantissa down, leading zeros of a small number included
+		exponent -= fraction_digits - fraction_dropped;
+	}
+	if (digits == 0)
+	{
+		p = start;
+		return false;
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* exponent_start = p;
+		p++;
+		bool exponent_negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			exponent_negative = *p == '-';
+			p++;
+		}
+		int written = 0;
+		int exponent_digits = 0;
+		while (p < end && (unsigned)(*p - '0') < 10)
+		{
+			written = std::min(written * 10 + (*p - '0'), 100000);
+			p++;
+			exponent_digits++;
+		}
+		if (exponent_digits == 0)
+		{
+			p = exponent_start; // an 'e' without digits is not part of the number
+		}
+		else
+		{
+			exponent += exponent_negative ? -written : written;
+		}
+	}
+
+	double result = (double)mantissa;
+	if (mantissa != 0)
+	{
+		if (exponent >= 0 && exponent <= 22)
+		{
+			result *= powers[exponent];
+		}
+		else if (exponent < 0 && exponent >= -22)
+		{
+			result /= powers[-exponent];
+		}
+		else
+		{
+			result *= std::pow(10.0, (double)exponent);
+		}
+	}
+	value = negative ? -result : result;
+	return true;
+}
+
+inline bool parse_float(const char*& p, const char* end, float& value)
+{
+	double number;
+	if (!parse_number(p, end, number))
+	{
+		return false;
+	}
+	value = (float)number;
+	return true;
+}
+
+inline bool parse_int(const char*& p, const char* end, int& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	if (p >= end || (unsigned)(*p - '0') >= 10)
+	{
+		return false;
+	}
+	int64_t result = 0;
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		result = std::min<int64_t>(result * 10 + (*p - '0'), INT32_MAX);
+		p++;
+	}
+	value = (int)(negative ? -result : result);
+	return true;
+}
+
+//Rest of the line without surrounding blanks
+inline std::string line_remainder(const char* p, const char* end)
+{
+	p = skip_blanks(p, end);
+	while (end > p && is_blank(end[-1]))
+	{
+		end--;
+	}
+	return std::string(p, end);
+}
+
+inline bool starts_with_word(const char* p, const char* end, const char* word)
+{
+	size_t length = strlen(word);
+	return (size_t)(end - p) > length && memcmp(p, word, length) == 0 && is_blank(p[length]);
+}
+
+//Welding
+
+inline uint32_t hash_mix(uint32_t h)
+{
+	// murmur3 finaliser, every input bit affects every output bit
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+struct weld_slot
+{
+	uint32_t hash;
+	int vertex; // -1 for an empty slot
+};
+
+//Gives every distinct key a vertex. indices[i] becomes the vertex of keys[i] and first_use[v] the first key that
+//produced vertex v. Big inputs are split into shards by hash, each shard has its own open addressing table on its
+//own thread and vertices are numbered shard by shard, so the result does not depend on scheduling.
+template <typename Key, typename Hash, typename Equal>
+void weld(job_system* jobs, const Key* keys, int count, std::vector<int>& indices, std::vector<int>& first_use, const Hash& hash, const Equal& equal)
+{
+	const int min_sharded = 1 << 16;
+	int shard_count = 1;
+	while (count >= min_sharded && shard_count * 2 <= jobs->worker_count() + 1 && shard_count < 64)
+	{
+		shard_count *= 2;
+	}
+
+	std::vector<uint32_t> hashes(count);
+	jobs->parallel_for(count, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			hashes[i] = hash_mix(hash(keys[i]));
+		}
+	}, 4096);
+
+	indices.resize(count);
+	std::vector<std::vector<int>> shard_first_use(shard_count);
+	jobs->parallel_for(shard_count, [&](int begin, int end)
+	{
+		for (int shard = begin; shard < end; shard++)
+		{
+			std::vector<int>& unique = shard_first_use[shard];
+			// meshes usually have several corners per vertex, so sizing for half the shard's corners rarely grows
+			size_t table_size = 1024;
+			while (table_size < (size_t)count / shard_count)
+			{
+				table_size *= 2;
+			}
+			std::vector<weld_slot> table(table_size, weld_slot{ 0, -1 });
+			for (int i = 0; i < count; i++)
+			{
+				uint32_t h = hashes[i];
+				if ((int)(h & (shard_count - 1)) != shard)
+				{
+					continue;
+				}
+				if (unique.size() * 2 >= table.size())
+				{
+					// keep the load at most one half, rehash into twice the slots
+					std::vector<weld_slot> grown(table.size() * 2, weld_slot{ 0, -1 });
+					size_t grown_mask = grown.size() - 1;
+					for (const weld_slot& entry : table)
+					{
+						if (entry.vertex < 0)
+						{
+							continue;
+						}
+						size_t slot = (entry.hash >> 6) & grown_mask;
+						while (grown[slot].vertex >= 0)
+						{
+							slot = (slot + 1) & grown_mask;
+						}
+						grown[slot] = entry;
+					}
+					table.swap(grown);
+				}
+				size_t mask = table.size() - 1;
+				size_t slot = (h >> 6) & mask;
+				while (true)
+				{
+					const weld_slot& entry = table[slot];
+					if (entry.vertex < 0)
+					{
+						table[slot] = { h, (int)unique.size() };
+						indices[i] = (int)unique.size();
+						unique.push_back(i);
+						break;
+					}
+					// the stored hash rejects almost every other key without touching it
+					if (entry.hash == h && equal(keys[unique[entry.vertex]], keys[i]))
+					{
+						indices[i] = entry.vertex;
+						break;
+					}
+					slot = (slot + 1) & mask;
+				}
+			}
+		}
+	}, 1);
+
+	std::vector<int> shard_base(shard_count, 0);
+	first_use.clear();
+	for (int shard = 0; shard < shard_count; shard++)
+	{
+		shard_base[shard] = (int)first_use.size();
+		first_use.insert(first_use.end(), shard_first_use[shard].begin(), shard_first_use[shard].end());
+	}
+	if (shard_count > 1)
+	{
+		jobs->parallel_for(count, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				indices[i] += shard_base[hashes[i] & (shard_count - 1)];
+			}
+		}, 4096);
+	}
+}
+
+//OBJ
+
+struct obj_corner
+{
+	int position;
+	int texcoord; // -1 when the face has none
+	int normal;
+};
+
+//One run of triangles that share a material inside a chunk
+struct obj_material_run
+{
+	int first_triangle;
+	int material;
+	int mesh_offset; // where the run's triangles go in its mesh, filled in once every chunk is parsed
+};
+
+struct obj_chunk
+{
+	const char* begin;
+	const char* end;
+	std::vector<float> positions;
+	std::vector<float> texcoords;
+	std::vector<float> normals;
+	std::vector<obj_corner> corners; // three per triangle
+	std::vector<int> relative; // corner * 3 + component for negative indices, they count from the chunk's start
+	std::vector<std::pair<int, std::string>> material_switches; // triangle, material name
+	std::vector<std::string> libraries;
+	std::vector<obj_material_run> runs;
+	int position_base;
+	int texcoord_base;
+	int normal_base;
+	std::string error;
+};
+
+inline bool parse_obj_floats(const char*& p, const char* end, float* values, int required, int maximum)
+{
+	int count = 0;
+	while (count < maximum)
+	{
+		p = skip_blanks(p, end);
+		if (!parse_float(p, end, values[count]))
+		{
+			break;
+		}
+		count++;
+	}
+	return count >= required;
+}
+
+inline void parse_obj_face(const char* p, const char* end, obj_chunk& chunk)
+{
+	obj_corner first = {};
+	obj_corner previous = {};
+	int first_relative = 0;
+	int previous_relative = 0;
+	int local_counts[3] = { (int)chunk.positions.size() / 3, (int)chunk.texcoords.size() / 2, (int)chunk.normals.size() / 3 };
+	int corner_count = 0;
+
+	auto push = [&](const obj_corner& corner, int relative_mask)
+	{
+		for (int component = 0; component < 3; component++)
+		{
+			if (relative_mask & (1 << component))
+			{
+				chunk.relative.push_back((int)chunk.corners.size() * 3 + component);
+			}
+		}
+		chunk.corners.push_back(corner);
+	};
+
+	while (true)
+	{
+		p = skip_blanks(p, end);
+		if (p >= end)
+		{
+			break;
+		}
+		int raw[3] = { 0, 0, 0 };
+		if (!parse_int(p, end, raw[0]))
+		{
+			chunk.error = "malformed face";
+			return;
+		}
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (p < end && *p != '/' && !parse_int(p, end, raw[1]))
+			{
+				chunk.error = "malformed face";
+				return;
+			}
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (!parse_int(p, end, raw[2]))
+				{
+					chunk.error = "malformed face";
+					return;
+				}
+			}
+		}
+		if (raw[0] == 0)
+		{
+			chunk.error = "face index of zero";
+			return;
+		}
+
+		// positive indices are absolute and one based, negative ones count back from the latest element
+		obj_corner corner;
+		int* resolved = &corner.position;
+		int relative_mask = 0;
+		for (int component = 0; component < 3; component++)
+		{
+			if (raw[component] > 0)
+			{
+				resolved[component] = raw[component] - 1;
+			}
+			else if (raw[component] < 0)
+			{
+				resolved[component] = local_counts[component] + raw[component];
+				relative_mask |= 1 << component;
+			}
+			else
+			{
+				resolved[component] = -1;
+			}
+		}
+
+		// fan, with the winding reversed for clockwise front faces
+		if (corner_count == 0)
+		{
+			first = corner;
+			first_relative = relative_mask;
+		}
+		else if (corner_count >= 2)
+		{
+			push(first, first_relative);
+			push(corner, relative_mask);
+			push(previous, previous_relative);
+		}
+		previous = corner;
+		previous_relative = relative_mask;
+		corner_count++;
+	}
+	if (corner_count < 3)
+	{
+		chunk.error = "face with fewer than three corners";
+	}
+}
+
+inline void parse_obj_chunk(obj_chunk& chunk)
+{
+	const char* p = chunk.begin;
+	while (p < chunk.end && chunk.error.empty())
+	{
+		const char* line_end = find_line_end(p, chunk.end);
+		p = skip_blanks(p, line_end);
+		if (line_end - p >= 2)
+		{
+			float values[3];
+			if (p[0] == 'v' && is_blank(p[1]))
+			{
+				p += 2;
+				if (!parse_obj_floats(p, line_end, values, 3, 3))
+				{
+					chunk.error = "malformed position";
+					break;
+				}
+				chunk.positions.push_back(values[0]);
+				chunk.positions.push_back(values[1]);
+				chunk.positions.push_back(-values[2]);
+			}
+			else if (p[0] == 'v' && p[1] == 't')
+			{
+				p += 2;
+				values[1] = 0.0f;
+				if (!parse_obj_floats(p, line_end, values, 1, 2))
+				{
+					chunk.error = "malformed texture coordinate";
+					break;
+				}
+				chunk.texcoords.push_back(values[0]);
+				chunk.texcoords.push_back(1.0f - values[1]);
+			}
+			else if (p[0] == 'v' && p[1] == 'n')
+			{
+				p += 2;
+				if (!parse_obj_floats(p, line_end, values, 3, 3))
+				{
+					chunk.error = "malformed normal";
+					break;
+				}
+				chunk.normals.push_back(values[0]);
+				chunk.normals.push_back(values[1]);
+				chunk.normals.push_back(-values[2]);
+			}
+			else if (p[0] == 'f' && is_blank(p[1]))
+			{
+				parse_obj_face(p + 2, line_end, chunk);
+			}
+			else if (starts_with_word(p, line_end, "usemtl"))
+			{
+				chunk.material_switches.push_back({ (int)chunk.corners.size() / 3, line_remainder(p + 6, line_end) });
+			}
+			else if (starts_with_word(p, line_end, "mtllib"))
+			{
+				chunk.libraries.push_back(line_remainder(p + 6, line_end));
+			}
+			// comments, groups, objects, smoothing groups, lines and points are skipped
+		}
+		p = line_end + 1;
+	}
+}
+
+inline bool import_obj(job_system* jobs, const char* text, size_t size, imported_scene& scene)
+{
+	const size_t min_chunk = 1 << 20;
+	const char* end = text + size;
+
+	//Chunks end just after a newline, so no line is split between two of them
+	size_t chunk_count = std::max<size_t>(1, std::min<size_t>((size_t)(jobs->worker_count() + 1) * 4, size / min_chunk));
+	std::vector<obj_chunk> chunks;
+	chunks.reserve(chunk_count);
+	const char* chunk_begin = text;
+	for (size_t c = 0; c < chunk_count && chunk_begin < end; c++)
+	{
+		const char* chunk_end = c + 1 == chunk_count ? end : std::max(chunk_begin, text + size / chunk_count * (c + 1));
+		if (chunk_end < end)
+		{
+			chunk_end = find_line_end(chunk_end, end);
+			chunk_end = chunk_end < end ? chunk_end + 1 : end;
+		}
+		chunks.emplace_back();
+		chunks.back().begin = chunk_begin;
+		chunks.back().end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	jobs->parallel_for((int)chunks.size(), [&](int begin, int end)
+	{
+		for (int c = begin; c < end; c++)
+		{
+			parse_obj_chunk(chunks[c]);
+		}
+	}, 1);
+
+	//Element numbering and material runs carry over from one chunk to the next
+	int position_count = 0;
+	int texcoord_count = 0;
+	int normal_count = 0;
+	int material = -1;
+	std::unordered_map<std::string, int> material_ids;
+	for (int existing = 0; existing < (int)scene.materials.size(); existing++)
+	{
+		material_ids[scene.materials[existing].name] = existing;
+	}
+	for (obj_chunk& chunk : chunks)
+	{
+		if (!chunk.error.empty())
+		{
+			scene.error = "obj: " + chunk.error + " near byte " + std::to_string(chunk.begin - text);
+			return false;
+		}
+		chunk.position_base = position_count;
+		chunk.texcoord_base = texcoord_count;
+		chunk.normal_base = normal_count;
+		position_count += (int)chunk.positions.size() / 3;
+		texcoord_count += (int)chunk.texcoords.size() / 2;
+		normal_count += (int)chunk.normals.size() / 3;
+		scene.material_libraries.insert(scene.material_libraries.end(), chunk.libraries.begin(), chunk.libraries.end());
+
+		chunk.runs.push_back({ 0, material, 0 });
+		for (const std::pair<int, std::string>& change : chunk.material_switches)
+		{
+			auto found = material_ids.find(change.second);
+			if (found == material_ids.end())
+			{
+				found = material_ids.insert({ change.second, (int)scene.materials.size() }).first;
+				scene.materials.push_back({ change.second, { 1.0f, 1.0f, 1.0f, 1.0f }, "" });
+			}
+			material = found->second;
+			if (chunk.runs.back().first_triangle == change.first)
+			{
+				chunk.runs.back().material = material;
+			}
+			else
+			{
+				chunk.runs.push_back({ change.first, material, 0 });
+			}
+		}
+	}
+
+	//One mesh per material, triangles keep their file order
+	std::vector<int> mesh_of_material(scene.materials.size() + 1, -1); // shifted by one for "no material"
+	std::vector<int> mesh_triangles;
+	std::vector<imported_mesh> meshes;
+	for (obj_chunk& chunk : chunks)
+	{
+		int chunk_triangles = (int)chunk.corners.size() / 3;
+		for (size_t r = 0; r < chunk.runs.size(); r++)
+		{
+			obj_material_run& run = chunk.runs[r];
+			int run_end = r + 1 < chunk.runs.size() ? chunk.runs[r + 1].first_triangle : chunk_triangles;
+			if (run_end == run.first_triangle)
+			{
+				continue;
+			}
+			int& mesh = mesh_of_material[run.material + 1];
+			if (mesh < 0)
+			{
+				mesh = (int)meshes.size();
+				meshes.emplace_back();
+				meshes.back().name = run.material >= 0 ? scene.materials[run.material].name : "default";
+				meshes.back().material = run.material;
+				mesh_triangles.push_back(0);
+			}
+			run.mesh_offset = mesh_triangles[mesh];
+			mesh_triangles[mesh] += run_end - run.first_triangle;
+		}
+	}
+	std::vector<std::vector<obj_corner>> mesh_corners(meshes.size());
+	for (size_t mesh = 0; mesh < meshes.size(); mesh++)
+	{
+		mesh_corners[mesh].resize((size_t)mesh_triangles[mesh] * 3);
+	}
+
+	//Make indices global, check them and copy every chunk's elements and triangles to their final place
+	std::vector<float> positions((size_t)position_count * 3);
+	std::vector<float> texcoords((size_t)texcoord_count * 2);
+	std::vector<float> normals((size_t)normal_count * 3);
+	jobs->parallel_for((int)chunks.size(), [&](int begin, int end)
+	{
+		for (int c = begin; c < end; c++)
+		{
+			obj_chunk& chunk = chunks[c];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + (size_t)chunk.position_base * 3);
+			std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + (size_t)chunk.texcoord_base * 2);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + (size_t)chunk.normal_base * 3);
+
+			int bases[3] = { chunk.position_base, chunk.texcoord_base, chunk.normal_base };
+			for (int slot : chunk.relative)
+			{
+				(&chunk.corners[slot / 3].position)[slot % 3] += bases[slot % 3];
+			}
+			int counts[3] = { position_count, texcoord_count, normal_count };
+			for (const obj_corner& corner : chunk.corners)
+			{
+				const int* components = &corner.position;
+				for (int component = 0; component < 3; component++)
+				{
+					bool optional = component > 0 && components[component] == -1;
+					if (!optional && (components[component] < 0 || components[component] >= counts[component]))
+					{
+						chunk.error = "face index out of range";
+					}
+				}
+			}
+
+			int chunk_triangles = (int)chunk.corners.size() / 3;
+			for (size_t r = 0; r < chunk.runs.size(); r++)
+			{
+				const obj_material_run& run = chunk.runs[r];
+				int run_end = r + 1 < chunk.runs.size() ? chunk.runs[r + 1].first_triangle : chunk_triangles;
+				if (run_end == run.first_triangle)
+				{
+					continue;
+				}
+				std::vector<obj_corner>& destination = mesh_corners[mesh_of_material[run.material + 1]];
+				std::copy(chunk.corners.begin() + (size_t)run.first_triangle * 3, chunk.corners.begin() + (size_t)run_end * 3, destination.begin() + (size_t)run.mesh_offset * 3);
+			}
+		}
+	}, 1);
+	for (const obj_chunk& chunk : chunks)
+	{
+		if (!chunk.error.empty())
+		{
+			scene.error = "obj: " + chunk.error + " in the chunk starting at byte " + std::to_string(chunk.begin - text);
+			return false;
+		}
+	}
+	chunks.clear();
+
+	//Weld each mesh's corners into vertices
+	for (size_t mesh = 0; mesh < meshes.size(); mesh++)
+	{
+		imported_mesh& result = meshes[mesh];
+		const std::vector<obj_corner>& corners = mesh_corners[mesh];
+		std::vector<int> first_use;
+		weld(jobs, corners.data(), (int)corners.size(), result.indices, first_use,
+			[](const obj_corner& corner) { return (uint32_t)corner.position * 0x9e3779b1u ^ (uint32_t)corner.texcoord * 0x85ebca77u ^ (uint32_t)corner.normal * 0xc2b2ae3du; },
+			[](const obj_corner& a, const obj_corner& b) { return a.position == b.position && a.texcoord == b.texcoord && a.normal == b.normal; });
+
+		result.vertices.resize(first_use.size());
+		result.has_normals = true;
+		jobs->parallel_for((int)first_use.size(), [&](int begin, int end)
+		{
+			for (int v = begin; v < end; v++)
+			{
+				const obj_corner& corner = corners[first_use[v]];
+				imported_vertex& vertex = result.vertices[v];
+				memcpy(vertex.position, &positions[(size_t)corner.position * 3], sizeof(vertex.position));
+				if (corner.texcoord >= 0)
+				{
+					memcpy(vertex.texcoord, &texcoords[(size_t)corner.texcoord * 2], sizeof(vertex.texcoord));
+				}
+				else
+				{
+					vertex.texcoord[0] = vertex.texcoord[1] = 0.0f;
+				}
+				if (corner.normal >= 0)
+				{
+					memcpy(vertex.normal, &normals[(size_t)corner.normal * 3], sizeof(vertex.normal));
+				}
+				else
+				{
+					vertex.normal[0] = vertex.normal[1] = vertex.normal[2] = 0.0f;
+				}
+			}
+		}, 4096);
+		for (const obj_corner& corner : corners)
+		{
+			if (corner.normal < 0)
+			{
+				result.has_normals = false;
+				break;
+			}
+		}
+	}
+
+	for (imported_mesh& mesh : meshes)
+	{
+		scene.meshes.push_back(std::move(mesh));
+	}
+	return true;
+}
+
+//Fills in the materials import_obj created from usemtl names, materials the OBJ never used are ignored
+inline bool import_mtl(const char* text, size_t size, imported_scene& scene)
+{
+	const char* p = text;
+	const char* end = text + size;
+	imported_material* current = nullptr;
+	while (p < end)
+	{
+		const char* line_end = find_line_end(p, end);
+		p = skip_blanks(p, line_end);
+		if (starts_with_word(p, line_end, "newmtl"))
+		{
+			std::string name = line_remainder(p + 6, line_end);
+			current = nullptr;
+			for (imported_material& material : scene.materials)
+			{
+				if (material.name == name)
+				{
+					current = &material;
+				}
+			}
+		}
+		else if (current && starts_with_word(p, line_end, "Kd"))
+		{
+			p += 2;
+			if (!parse_obj_floats(p, line_end, current->base_colour, 3, 3))
+			{
+				scene.error = "mtl: malformed Kd";
+				return false;
+			}
+		}
+		else if (current && starts_with_word(p, line_end, "d"))
+		{
+			p += 1;
+			if (!parse_obj_floats(p, line_end, &current->base_colour[3], 1, 1))
+			{
+				scene.error = "mtl: malformed d";
+				return false;
+			}
+		}
+		else if (current && starts_with_word(p, line_end, "map_Kd"))
+		{
+			// options come first, the file name is the last word
+			std::string arguments = line_remainder(p + 6, line_end);
+			size_t last_space = arguments.find_last_of(" \t");
+			current->diffuse_texture = last_space == std::string::npos ? arguments : arguments.substr(last_space + 1);
+		}
+		p = line_end + 1;
+	}
+	return true;
+}
+
+//glTF
+
+//Just enough JSON for glTF, numbers are doubles and objects keep their member order
+struct json_value
+{
+	enum kind_type { null_kind, boolean_kind, number_kind, string_kind, array_kind, object_kind };
+	kind_type kind = null_kind;
+	double number = 0.0;
+	std::string string;
+	std::vector<json_value> items;
+	std::vector<std::pair<std::string, json_value>> members;
+
+	const json_value* find(const char* key) const
+	{
+		for (const std::pair<std::string, json_value>& member : members)
+		{
+			if (member.first == key)
+			{
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+	double number_or(const char* key, double fallback) const
+	{
+		const json_value* value = find(key);
+		return value && value->kind == number_kind ? value->number : fallback;
+	}
+	int int_or(const char* key, int fallback) const
+	{
+		return (int)number_or(key, fallback);
+	}
+	std::string string_or(const char* key, const char* fallback) const
+	{
+		const json_value* value = find(key);
+		return value && value->kind == string_kind ? value->string : fallback;
+	}
+	const std::vector<json_value>& array(const char* key) const
+	{
+		static const std::vector<json_value> empty;
+		const json_value* value = find(key);
+		return value && value->kind == array_kind ? value->items : empty;
+	}
+};
+
+struct json_parser
+{
+	const char* p;
+	const char* end;
+	int depth = 0;
+
+	void skip_space()
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		{
+			p++;
+		}
+	}
+
+	bool literal(const char* word)
+	{
+		size_t length = strlen(word);
+		if ((size_t)(end - p) < length || memcmp(p, word, length) != 0)
+		{
+			return false;
+		}
+		p += length;
+		return true;
+	}
+
+	bool parse_string(std::string& out)
+	{
+		if (p >= end || *p != '"')
+		{
+			return false;
+		}
+		p++;
+		while (p < end && *p != '"')
+		{
+			char c = *p++;
+			if (c != '\\')
+			{
+				out.push_back(c);
+				continue;
+			}
+			if (p >= end)
+			{
+				return false;
+			}
+			char escape = *p++;
+			switch (escape)
+			{
+			case 'b': out.push_back('\b'); break;
+			case 'f': out.push_back('\f'); break;
+			case 'n': out.push_back('\n'); break;
+			case 'r': out.push_back('\r'); break;
+			case 't': out.push_back('\t'); break;
+			case 'u':
+			{
+				if (end - p < 4)
+				{
+					return false;
+				}
+				unsigned code = 0;
+				for (int i = 0; i < 4; i++)
+				{
+					char h = *p++;
+					code <<= 4;
+					if (h >= '0' && h <= '9') code |= h - '0';
+					else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+					else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+					else return false;
+				}
+				// utf-8, surrogate pairs are not combined (glTF names and uris are rarely outside the BMP)
+				if (code < 0x80)
+				{
+					out.push_back((char)code);
+				}
+				else if (code < 0x800)
+				{
+					out.push_back((char)(0xc0 | (code >> 6)));
+					out.push_back((char)(0x80 | (code & 0x3f)));
+				}
+				else
+				{
+					out.push_back((char)(0xe0 | (code >> 12)));
+					out.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+					out.push_back((char)(0x80 | (code & 0x3f)));
+				}
+				break;
+			}
+			default: out.push_back(escape); break; // quote, backslash and slash
+			}
+		}
+		if (p >= end)
+		{
+			return false;
+		}
+		p++;
+		return true;
+	}
+
+	bool parse(json_value& value)
+	{
+		skip_space();
+		if (p >= end || ++depth > 64)
+		{
+			return false;
+		}
+		bool ok = true;
+		if (*p == '{')
+		{
+			value.kind = json_value::object_kind;
+			p++;
+			skip_space();
+			if (p < end && *p == '}')
+			{
+				p++;
+			}
+			else
+			{
+				ok = false;
+				while (true)
+				{
+					skip_space();
+					value.members.emplace_back();
+					if (!parse_string(value.members.back().first))
+					{
+						break;
+					}
+					skip_space();
+					if (p >= end || *p != ':')
+					{
+						break;
+					}
+					p++;
+					if (!parse(value.members.back().second))
+					{
+						break;
+					}
+					skip_space();
+					if (p < end && *p == ',')
+					{
+						p++;
+						continue;
+					}
+					if (p < end && *p == '}')
+					{
+						p++;
+						ok = true;
+					}
+					break;
+				}
+			}
+		}
+		else if (*p == '[')
+		{
+			value.kind = json_value::array_kind;
+			p++;
+			skip_space();
+			if (p < end && *p == ']')
+			{
+				p++;
+			}
+			else
+			{
+				ok = false;
+				while (true)
+				{
+					value.items.emplace_back();
+					if (!parse(value.items.back()))
+					{
+						break;
+					}
+					skip_space();
+					if (p < end && *p == ',')
+					{
+						p++;
+						continue;
+					}
+					if (p < end && *p == ']')
+					{
+						p++;
+						ok = true;
+					}
+					break;
+				}
+			}
+		}
+		else if (*p == '"')
+		{
+			value.kind = json_value::string_kind;
+			ok = parse_string(value.string);
+		}
+		else if (literal("true"))
+		{
+			value.kind = json_value::boolean_kind;
+			value.number = 1.0;
+		}
+		else if (literal("false"))
+		{
+			value.kind = json_value::boolean_kind;
+		}
+		else if (literal("null"))
+		{
+			value.kind = json_value::null_kind;
+		}
+		else
+		{
+			value.kind = json_value::number_kind;
+			ok = parse_number(p, end, value.number);
+		}
+		depth--;
+		return ok;
+	}
+};
+
+//Read only bytes handed to the importer
+struct byte_view
+{
+	const uint8_t* data;
+	size_t size;
+};
+
+inline bool decode_base64(const char* text, size_t length, std::vector<uint8_t>& out)
+{
+	out.clear();
+	out.reserve(length / 4 * 3);
+	uint32_t bits = 0;
+	int bit_count = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		char c = text[i];
+		int value;
+		if (c >= 'A' && c <= 'Z') value = c - 'A';
+		else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') value = c - '0' + 52;
+		else if (c == '+' || c == '-') value = 62;
+		else if (c == '/' || c == '_') value = 63;
+		else if (c == '=') break;
+		else return false;
+		bits = (bits << 6) | (uint32_t)value;
+		bit_count += 6;
+		if (bit_count >= 8)
+		{
+			bit_count -= 8;
+			out.push_back((uint8_t)(bits >> bit_count));
+		}
+	}
+	return true;
+}
+
+//Typed view of an accessor's elements, checked against its buffer
+struct gltf_accessor
+{
+	const uint8_t* data;
+	int count;
+	int components;
+	int component_type;
+	int stride;
+	bool normalized;
+
+	float read_float(int element, int component) const
+	{
+		const uint8_t* source = data + (size_t)element * stride;
+		switch (component_type)
+		{
+		case 5126: { float value; memcpy(&value, source + component * 4, 4); return value; }
+		case 5121: return normalized ? source[component] / 255.0f : source[component];
+		case 5120: return normalized ? std::max(-1.0f, (int8_t)source[component] / 127.0f) : (int8_t)source[component];
+		case 5123: { uint16_t value; memcpy(&value, source + component * 2, 2); return normalized ? value / 65535.0f : value; }
+		case 5122: { int16_t value; memcpy(&value, source + component * 2, 2); return normalized ? std::max(-1.0f, value / 32767.0f) : value; }
+		case 5125: { uint32_t value; memcpy(&value, source + component * 4, 4); return (float)value; }
+		}
+		return 0.0f;
+	}
+
+	uint32_t read_index(int element) const
+	{
+		const uint8_t* source = data + (size_t)element * stride;
+		switch (component_type)
+		{
+		case 5121: return source[0];
+		case 5123: { uint16_t value; memcpy(&value, source, 2); return value; }
+		case 5125: { uint32_t value; memcpy(&value, source, 4); return value; }
+		}
+		return 0;
+	}
+};
+
+inline int gltf_component_size(int component_type)
+{
+	switch (component_type)
+	{
+	case 5120: case 5121: return 1;
+	case 5122: case 5123: return 2;
+	case 5125: case 5126: return 4;
+	}
+	return 0;
+}
+
+inline int gltf_type_components(const std::string& type)
+{
+	if (type == "SCALAR") return 1;
+	if (type == "VEC2") return 2;
+	if (type == "VEC3") return 3;
+	if (type == "VEC4") return 4;
+	return 0;
+}
+
+//data is a whole .gltf or .glb file. load_uri maps an external buffer relative to the file, the view must stay
+//valid until import_gltf returns.
+inline bool import_gltf(job_system* jobs, const uint8_t* data, size_t size, const std::function<bool(const std::string& uri, byte_view& bytes)>& load_uri, imported_scene& scene)
+{
+	//A .glb is a 12 byte header and then chunks, JSON first and the binary buffer second
+	const char* json_text = reinterpret_cast<const char*>(data);
+	size_t json_size = size;
+	byte_view binary_chunk = { nullptr, 0 };
+	if (size >= 12 && memcmp(data, "glTF", 4) == 0)
+	{
+		uint32_t header[3];
+		memcpy(header, data, sizeof(header));
+		size_t total = std::min<size_t>(header[2], size);
+		size_t offset = 12;
+		while (offset + 8 <= total)
+		{
+			uint32_t chunk_header[2];
+			memcpy(chunk_header, data + offset, sizeof(chunk_header));
+			size_t chunk_size = chunk_header[0];
+			if (offset + 8 + chunk_size > total)
+			{
+				scene.error = "glb: chunk past the end of the file";
+				return false;
+			}
+			if (chunk_header[1] == 0x4e4f534a) // JSON
+			{
+				json_text = reinterpret_cast<const char*>(data + offset + 8);
+				json_size = chunk_size;
+			}
+			else if (chunk_header[1] == 0x004e4942 && !binary_chunk.data) // BIN
+			{
+				binary_chunk = { data + offset + 8, chunk_size };
+			}
+			offset += 8 + ((chunk_size + 3) & ~(size_t)3);
+		}
+	}
+
+	json_value document;
+	json_parser parser = { json_text, json_text + json_size };
+	if (!parser.parse(document) || document.kind != json_value::object_kind)
+	{
+		scene.error = "gltf: invalid json";
+		return false;
+	}
+
+	//Buffers come from the glb, a data uri or an external file
+	std::vector<byte_view> buffers;
+	std::vector<std::vector<uint8_t>> decoded;
+	decoded.reserve(document.array("buffers").size());
+	for (const json_value& buffer : document.array("buffers"))
+	{
+		std::string uri = buffer.string_or("uri", "");
+		size_t length = (size_t)buffer.number_or("byteLength", 0.0);
+		byte_view bytes = { nullptr, 0 };
+		if (uri.empty())
+		{
+			bytes = binary_chunk;
+		}
+		else if (uri.compare(0, 5, "data:") == 0)
+		{
+			size_t comma = uri.find(',');
+			if (comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos)
+			{
+				scene.error = "gltf: unsupported data uri";
+				return false;
+			}
+			decoded.emplace_back();
+			if (!decode_base64(uri.data() + comma + 1, uri.size() - comma - 1, decoded.back()))
+			{
+				scene.error = "gltf: invalid base64";
+				return false;
+			}
+			bytes = { decoded.back().data(), decoded.back().size() };
+		}
+		else if (!load_uri(uri, bytes))
+		{
+			scene.error = "gltf: could not load " + uri;
+			return false;
+		}
+		if (bytes.size < length)
+		{
+			scene.error = "gltf: buffer shorter than its byteLength";
+			return false;
+		}
+		buffers.push_back(bytes);
+	}
+
+	const std::vector<json_value>& buffer_views = document.array("bufferViews");
+	const std::vector<json_value>& accessors = document.array("accessors");
+	auto make_accessor = [&](int index, gltf_accessor& result) -> bool
+	{
+		if (index < 0 || index >= (int)accessors.size())
+		{
+			return false;
+		}
+		const json_value& accessor = accessors[index];
+		int view_index = accessor.int_or("bufferView", -1);
+		if (view_index < 0 || view_index >= (int)buffer_views.size() || accessor.find("sparse"))
+		{
+			return false; // all zero and sparse accessors are not supported
+		}
+		const json_value& view = buffer_views[view_index];
+		int buffer_index = view.int_or("buffer", -1);
+		if (buffer_index < 0 || buffer_index >= (int)buffers.size())
+		{
+			return false;
+		}
+		result.count = accessor.int_or("count", 0);
+		result.components = gltf_type_components(accessor.string_or("type", ""));
+		result.component_type = accessor.int_or("componentType", 0);
+		result.normalized = accessor.find("normalized") && accessor.find("normalized")->number != 0.0;
+		int element_size = result.components * gltf_component_size(result.component_type);
+		result.stride = view.int_or("byteStride", element_size);
+		size_t view_offset = (size_t)view.number_or("byteOffset", 0.0);
+		size_t view_length = (size_t)view.number_or("byteLength", 0.0);
+		size_t offset = (size_t)accessor.number_or("byteOffset", 0.0);
+		if (element_size == 0 || result.count < 0 || result.stride < element_size || view_offset + view_length > buffers[buffer_index].size)
+		{
+			return false;
+		}
+		if (result.count > 0 && offset + (size_t)(result.count - 1) * result.stride + element_size > view_length)
+		{
+			return false;
+		}
+		result.data = buffers[buffer_index].data + view_offset + offset;
+		return true;
+	};
+
+	//Materials keep their glTF index
+	const std::vector<json_value>& textures = document.array("textures");
+	const std::vector<json_value>& images = document.array("images");
+	size_t material_base = scene.materials.size();
+	for (const json_value& source : document.array("materials"))
+	{
+		imported_material material = { source.string_or("name", ""), { 1.0f, 1.0f, 1.0f, 1.0f }, "" };
+		const json_value* pbr = source.find("pbrMetallicRoughness");
+		if (pbr)
+		{
+			const std::vector<json_value>& factor = pbr->array("baseColorFactor");
+			for (size_t i = 0; i < factor.size() && i < 4; i++)
+			{
+				material.base_colour[i] = (float)factor[i].number;
+			}
+			const json_value* texture = pbr->find("baseColorTexture");
+			int texture_index = texture ? texture->int_or("index", -1) : -1;
+			int image_index = texture_index >= 0 && texture_index < (int)textures.size() ? textures[texture_index].int_or("source", -1) : -1;
+			if (image_index >= 0 && image_index < (int)images.size())
+			{
+				material.diffuse_texture = images[image_index].string_or("uri", "");
+			}
+		}
+		scene.materials.push_back(material);
+	}
+
+	//Every triangle list primitive becomes a mesh, converted in parallel
+	struct primitive_source
+	{
+		const json_value* primitive;
+		std::string name;
+	};
+	std::vector<primitive_source> primitives;
+	for (const json_value& mesh : document.array("meshes"))
+	{
+		const std::vector<json_value>& mesh_primitives = mesh.array("primitives");
+		for (size_t i = 0; i < mesh_primitives.size(); i++)
+		{
+			if (mesh_primitives[i].int_or("mode", 4) == 4)
+			{
+				primitives.push_back({ &mesh_primitives[i], mesh.string_or("name", "mesh") + (mesh_primitives.size() > 1 ? "." + std::to_string(i) : "") });
+			}
+		}
+	}
+
+	std::vector<imported_mesh> meshes(primitives.size());
+	std::vector<std::string> errors(primitives.size());
+	jobs->parallel_for((int)primitives.size(), [&](int begin, int end)
+	{
+		for (int p = begin; p < end; p++)
+		{
+			const json_value& primitive = *primitives[p].primitive;
+			imported_mesh& mesh = meshes[p];
+			mesh.name = primitives[p].name;
+			int material = primitive.int_or("material", -1);
+			mesh.material = material >= 0 && material_base + material < scene.materials.size() ? (int)material_base + material : -1;
+
+			const json_value* attributes = primitive.find("attributes");
+			gltf_accessor positions;
+			gltf_accessor normals;
+			gltf_accessor texcoords;
+			if (!attributes || !make_accessor(attributes->int_or("POSITION", -1), positions) || positions.components != 3)
+			{
+				errors[p] = "gltf: primitive without usable positions";
+				continue;
+			}
+			mesh.has_normals = make_accessor(attributes->int_or("NORMAL", -1), normals) && normals.components == 3 && normals.count == positions.count;
+			bool has_texcoords = make_accessor(attributes->int_or("TEXCOORD_0", -1), texcoords) && texcoords.components == 2 && texcoords.count == positions.count;
+
+			mesh.vertices.resize(positions.count);
+			for (int v = 0; v < positions.count; v++)
+			{
+				imported_vertex& vertex = mesh.vertices[v];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					vertex.position[axis] = positions.read_float(v, axis);
+					vertex.normal[axis] = mesh.has_normals ? normals.read_float(v, axis) : 0.0f;
+				}
+				vertex.position[2] = -vertex.position[2];
+				vertex.normal[2] = -vertex.normal[2];
+				vertex.texcoord[0] = has_texcoords ? texcoords.read_float(v, 0) : 0.0f;
+				vertex.texcoord[1] = has_texcoords ? texcoords.read_float(v, 1) : 0.0f;
+			}
+
+			gltf_accessor indices;
+			if (primitive.find("indices"))
+			{
+				if (!make_accessor(primitive.int_or("indices", -1), indices) || indices.components != 1 || indices.component_type == 5126)
+				{
+					errors[p] = "gltf: unusable index accessor";
+					continue;
+				}
+				mesh.indices.resize(indices.count / 3 * 3);
+				for (int i = 0; i < (int)mesh.indices.size(); i++)
+				{
+					uint32_t index = indices.read_index(i);
+					if (index >= (uint32_t)positions.count)
+					{
+						errors[p] = "gltf: index out of range";
+						break;
+					}
+					mesh.indices[i] = (int)index;
+				}
+			}
+			else
+			{
+				// unindexed, every three vertices are a triangle until identical ones are welded
+				std::vector<imported_vertex> unwelded;
+				unwelded.swap(mesh.vertices);
+				unwelded.resize(unwelded.size() / 3 * 3);
+				std::vector<int> first_use;
+				weld(jobs, unwelded.data(), (int)unwelded.size(), mesh.indices, first_use,
+					[](const imported_vertex& vertex)
+					{
+						uint32_t words[8];
+						memcpy(words, &vertex, sizeof(words));
+						uint32_t h = 0;
+						for (uint32_t word : words)
+						{
+							h = (h ^ word) * 0x9e3779b1u;
+						}
+						return h;
+					},
+					[](const imported_vertex& a, const imported_vertex& b) { return memcmp(&a, &b, sizeof(imported_vertex)) == 0; });
+				mesh.vertices.resize(first_use.size());
+				for (size_t v = 0; v < first_use.size(); v++)
+				{
+					mesh.vertices[v] = unwelded[first_use[v]];
+				}
+			}
+
+			// negating z mirrors the mesh, so the winding flips back to clockwise
+			for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+			{
+				std::swap(mesh.indices[i + 1], mesh.indices[i + 2]);
+			}
+		}
+	}, 1);
+
+	for (size_t p = 0; p < primitives.size(); p++)
+	{
+		if (!errors[p].empty())
+		{
+			scene.error = errors[p] + " in " + primitives[p].name;
+			return false;
+		}
+		scene.meshes.push_back(std::move(meshes[p]));
+	}
+	return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "simd.h"
+
+//Discrete levels of detail as index ranges of one mesh, all over the same vertices. Each level records how far
+//(in object space) its surface can be from the real one, and the level drawn is the coarsest whose error projects
+//to under a pixel budget, so triangle counts follow screen coverage instead of scene content.
+
+const int max_mesh_lods = 8;
+
+struct mesh_lod
+{
+	int first_index; // relative to the mesh's first index in the pool
+	int index_count;
+	float error; // largest object space distance from the surface
+};
+
+//Level 0 is full detail, the errors grow with the level
+struct lod_chain
+{
+	int count;
+	mesh_lod levels[max_mesh_lods];
+};
+
+//Camera terms for projecting errors to pixels
+struct lod_view
+{
+	float camera[3];
+	float projection_scale; // pixels covered by one unit at distance one, projection[1][1] * height / 2
+	float near_plane;
+};
+
+//World space bounding spheres and scales as structure of arrays, padded to a whole packet
+struct lod_spheres
+{
+	void resize(int count)
+	{
+		// padding lanes have zero scale, so they project to nothing and are never looked at
+		int padded = (count + packet_width - 1) / packet_width * packet_width;
+		for (std::vector<float>* values : { &x, &y, &z, &radius, &scale })
+		{
+			values->assign(padded, 0.0f);
+		}
+	}
+
+	void set(int i, const float centre[3], float sphere_radius, float world_scale)
+	{
+		x[i] = centre[0];
+		y[i] = centre[1];
+		z[i] = centre[2];
+		radius[i] = sphere_radius;
+		scale[i] = world_scale;
+	}
+
+	void copy(int i, const lod_spheres& from, int j)
+	{
+		x[i] = from.x[j];
+		y[i] = from.y[j];
+		z[i] = from.z[j];
+		radius[i] = from.radius[j];
+		scale[i] = from.scale[j];
+	}
+
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> radius;
+	std::vector<float> scale; // largest axis scale of the world matrix, turns object space errors into world space
+};
+
+//Pixels one object space unit of error covers at each sphere's nearest point to the camera, for the packets
+//first_packet up to end_packet. pixels_per_unit is padded like the spheres.
+inline void project_lod_scales(const lod_spheres& spheres, int first_packet, int end_packet, const lod_view& view, float* pixels_per_unit)
+{
+	simd_float camera_x = simd_set(view.camera[0]);
+	simd_float camera_y = simd_set(view.camera[1]);
+	simd_float camera_z = simd_set(view.camera[2]);
+	simd_float projection_scale = simd_set(view.projection_scale);
+	simd_float near_plane = simd_set(view.near_plane);
+	for (int packet = first_packet; packet < end_packet; packet++)
+	{
+		int i = packet * packet_width;
+		simd_float dx = simd_sub(simd_load(&spheres.x[i]), camera_x);
+		simd_float dy = simd_sub(simd_load(&spheres.y[i]), camera_y);
+		simd_float dz = simd_sub(simd_load(&spheres.z[i]), camera_z);
+		simd_float distance = simd_sqrt(simd_add(simd_add(simd_mul(dx, dx), simd_mul(dy, dy)), simd_mul(dz, dz)));
+		// inside the sphere (or nearly) counts as the near plane, which always asks for full detail
+		distance = simd_max(simd_sub(distance, simd_load(&spheres.radius[i])), near_plane);
+		alignas(32) float result[packet_width];
+		simd_store(result, simd_div(simd_mul(simd_load(&spheres.scale[i]), projection_scale), distance));
+		memcpy(pixels_per_unit + i, result, sizeof(result));
+	}
+}
+
+//The coarsest level whose projected error fits max_pixels, starting from the level drawn last frame. Going coarser
+//needs the error to fit max_pixels * (1 - hysteresis), so an object sitting at a threshold does not flip between
+//two levels every frame.
+inline int select_lod(const lod_chain& chain, float pixels_per_unit, float max_pixels, float hysteresis, int current)
+{
+	int lod = std::max(0, std::min(current, chain.count - 1));
+	while (lod > 0 && chain.levels[lod].error * pixels_per_unit > max_pixels)
+	{
+		lod--;
+	}
+	float coarser_pixels = max_pixels * (1.0f - hysteresis);
+	while (lod + 1 < chain.count && chain.levels[lod + 1].error * pixels_per_unit <= coarser_pixels)
+	{
+		lod++;
+	}
+	return lod;
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "job_system.h"
+
+//Index buffer reordering for the post transform vertex cache (Tipsify, Sander et al. 2007), cluster ordering
+//against overdraw from the same paper, and vertex buffer reordering into first use order for fetch locality.
+//Every step is deterministic, meshes are optimized in parallel with one job per mesh.
+
+struct vertex_cache_statistics
+{
+	float acmr; // transformed vertices per triangle, 0.5 is ideal for large regular meshes
+	float atvr; // transformed vertices per vertex, 1.0 is ideal
+};
+
+//Simulates a FIFO cache of cache_size entries over the index buffer
+inline vertex_cache_statistics analyze_vertex_cache(const int* indices, int index_count, int vertex_count, int cache_size = 16)
+{
+	vertex_cache_statistics result = { 0.0f, 0.0f };
+	if (index_count < 3 || vertex_count == 0)
+	{
+		return result;
+	}
+
+	//A vertex is in the cache if it was added fewer than cache_size misses ago
+	std::vector<int> added(vertex_count, -cache_size - 1);
+	int misses = 0;
+	for (int i = 0; i < index_count; i++)
+	{
+		int vertex = indices[i];
+		if (misses - added[vertex] > cache_size)
+		{
+			added[vertex] = misses;
+			misses++;
+		}
+	}
+	result.acmr = misses / (float)(index_count / 3);
+	result.atvr = misses / (float)vertex_count;
+	return result;
+}
+
+//Tipsify, reorders triangles in place. Fans around a vertex and moves on to the neighbour most likely still in
+//the cache. Each time it has to jump to a vertex outside the cache a new cluster starts, the start of each
+//cluster (in triangles) is appended to cluster_starts for the overdraw pass.
+inline void optimize_vertex_cache(int* indices, int index_count, int vertex_count, std::vector<int>& cluster_starts, int cache_size = 16)
+{
+	int triangle_count = index_count / 3;
+	cluster_starts.clear();
+	if (triangle_count <= 0)
+	{
+		return;
+	}
+
+	//Triangles around each vertex, compressed row storage
+	std::vector<int> live(vertex_count, 0);
+	for (int i = 0; i < triangle_count * 3; i++)
+	{
+		live[indices[i]]++;
+	}
+	std::vector<int> offsets(vertex_count + 1, 0);
+	for (int v = 0; v < vertex_count; v++)
+	{
+		offsets[v + 1] = offsets[v] + live[v];
+	}
+	std::vector<int> adjacency(offsets[vertex_count]);
+	std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+	for (int t = 0; t < triangle_count; t++)
+	{
+		for (int corner = 0; corner < 3; corner++)
+		{
+			adjacency[cursor[indices[t * 3 + corner]]++] = t;
+		}
+	}
+
+	std::vector<int> cache_time(vertex_count, 0);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	std::vector<int> dead_end;
+	std::vector<int> candidates;
+	std::vector<int> output;
+	output.reserve(triangle_count * 3);
+
+	int time = cache_size + 1;
+	int scan = 0;
+	int fan = 0;
+	cluster_starts.push_back(0);
+	while (fan >= 0)
+	{
+		candidates.clear();
+		for (int a = offsets[fan]; a < offsets[fan + 1]; a++)
+		{
+			int t = adjacency[a];
+			if (emitted[t])
+			{
+				continue;
+			}
+			emitted[t] = 1;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				int vertex = indices[t * 3 + corner];
+				output.push_back(vertex);
+				dead_end.push_back(vertex);
+				candidates.push_back(vertex);
+				live[vertex]--;
+				if (time - cache_time[vertex] > cache_size)
+				{
+					cache_time[vertex] = time;
+					time++;
+				}
+			}
+		}
+
+		//Best candidate is the one that stays in the cache longest once its remaining triangles are emitted
+		int next = -1;
+		int best_priority = -1;
+		for (int vertex : candidates)
+		{
+			if (live[vertex] == 0)
+			{
+				continue;
+			}
+			int priority = 0;
+			if (time - cache_time[vertex] + 2 * live[vertex] <= cache_size)
+			{
+				priority = time - cache_time[vertex];
+			}
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				next = vertex;
+			}
+		}
+
+		if (next < 0)
+		{
+			//Dead end, back up through recently used vertices, then fall back to scanning in input order
+			while (!dead_end.empty() && next < 0)
+			{
+				int vertex = dead_end.back();
+				dead_end.pop_back();
+				if (live[vertex] > 0)
+				{
+					next = vertex;
+				}
+			}
+			while (next < 0 && scan < vertex_count)
+			{
+				if (live[scan] > 0)
+				{
+					next = scan;
+				}
+				scan++;
+			}
+			if (next >= 0 && time - cache_time[next] > cache_size)
+			{
+				//The new fan starts outside the cache, which is a hard boundary between clusters
+				cluster_starts.push_back((int)output.size() / 3);
+			}
+		}
+		fan = next;
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+//Sorts the clusters found by optimize_vertex_cache so that those facing away from the mesh centre are drawn first,
+//they are the most likely to occlude the rest. Triangle order inside each cluster is kept, so the cache benefit is too.
+//positions points at the first vertex's x and steps by stride bytes.
+inline void optimize_overdraw(int* indices, int index_count, const float* positions, int stride, const std::vector<int>& cluster_starts)
+{
+	int triangle_count = index_count / 3;
+	int cluster_count = (int)cluster_starts.size();
+	if (cluster_count <= 1)
+	{
+		return;
+	}
+	auto position_of = [&](int vertex) { return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + (size_t)vertex * stride); };
+
+	//Area weighted centroid of the whole mesh
+	double mesh_centre[3] = { 0.0, 0.0, 0.0 };
+	double mesh_area = 0.0;
+	std::vector<float> cluster_data(cluster_count * 7, 0.0f); // centroid xyz, normal xyz, area
+	for (int c = 0; c < cluster_count; c++)
+	{
+		int end = c + 1 < cluster_count ? cluster_starts[c + 1] : triangle_count;
+		float* data = &cluster_data[c * 7];
+		for (int t = cluster_starts[c]; t < end; t++)
+		{
+			const float* a = position_of(indices[t * 3]);
+			const float* b = position_of(indices[t * 3 + 1]);
+			const float* d = position_of(indices[t * 3 + 2]);
+			float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float ad[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+			float normal[3] = { ab[1] * ad[2] - ab[2] * ad[1], ab[2] * ad[0] - ab[0] * ad[2], ab[0] * ad[1] - ab[1] * ad[0] };
+			float area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]) * 0.5f;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float centre = (a[axis] + b[axis] + d[axis]) / 3.0f;
+				data[axis] += centre * area;
+				data[3 + axis] += normal[axis];
+				mesh_centre[axis] += centre * area;
+			}
+			data[6] += area;
+			mesh_area += area;
+		}
+	}
+	if (mesh_area <= 0.0)
+	{
+		return;
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		mesh_centre[axis] /= mesh_area;
+	}
+
+	std::vector<float> score(cluster_count, 0.0f);
+	for (int c = 0; c < cluster_count; c++)
+	{
+		const float* data = &cluster_data[c * 7];
+		if (data[6] <= 0.0f)
+		{
+			continue;
+		}
+		float length = std::sqrt(data[3] * data[3] + data[4] * data[4] + data[5] * data[5]);
+		if (length <= 0.0f)
+		{
+			continue;
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			score[c] += (float)(data[axis] / data[6] - mesh_centre[axis]) * data[3 + axis] / length;
+		}
+	}
+
+	std::vector<int> order(cluster_count);
+	for (int c = 0; c < cluster_count; c++)
+	{
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return score[a] > score[b]; });
+
+	std::vector<int> sorted;
+	sorted.reserve(triangle_count * 3);
+	for (int c : order)
+	{
+		int end = c + 1 < cluster_count ? cluster_starts[c + 1] : triangle_count;
+		sorted.insert(sorted.end(), indices + cluster_starts[c] * 3, indices + end * 3);
+	}
+	std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+//Renumbers vertices in the order the index buffer first uses them and reorders the vertex array to match,
+//unreferenced vertices are dropped
+template <typename VertexType>
+void optimize_vertex_fetch(std::vector<VertexType>& vertices, std::vector<int>& indices)
+{
+	std::vector<int> remap(vertices.size(), -1);
+	std::vector<int> first_use;
+	first_use.reserve(vertices.size());
+	for (int& index : indices)
+	{
+		if (remap[index] < 0)
+		{
+			remap[index] = (int)first_use.size();
+			first_use.push_back(index);
+		}
+		index = remap[index];
+	}
+
+	std::vector<VertexType> reordered;
+	reordered.reserve(first_use.size());
+	for (int vertex : first_use)
+	{
+		reordered.push_back(vertices[vertex]);
+	}
+	vertices.swap(reordered);
+}
+
+//One mesh to optimize, VertexType needs a pos member with x, y and z
+template <typename VertexType>
+struct mesh_optimize_task
+{
+	std::vector<VertexType>* vertices;
+	std::vector<int>* indices;
+	vertex_cache_statistics before;
+	vertex_cache_statistics after;
+};
+
+template <typename VertexType>
+void optimize_mesh(mesh_optimize_task<VertexType>& task)
+{
+	std::vector<VertexType>& vertices = *task.vertices;
+	std::vector<int>& indices = *task.indices;
+	int vertex_count = (int)vertices.size();
+	int index_count = (int)indices.size();
+
+	task.before = analyze_vertex_cache(indices.data(), index_count, vertex_count);
+	if (index_count >= 3 && vertex_count > 0)
+	{
+		std::vector<int> cluster_starts;
+		optimize_vertex_cache(indices.data(), index_count, vertex_count, cluster_starts);
+		optimize_overdraw(indices.data(), index_count, &vertices[0].pos.x, sizeof(VertexType), cluster_starts);
+		optimize_vertex_fetch(vertices, indices);
+	}
+	task.after = analyze_vertex_cache(indices.data(), (int)indices.size(), (int)vertices.size());
+}
+
+//Meshes are independent, so each one is its own job and the result does not depend on scheduling
+template <typename VertexType>
+void optimize_meshes(job_system* jobs, std::vector<mesh_optimize_task<VertexType>>& tasks)
+{
+	jobs->parallel_for((int)tasks.size(), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			optimize_mesh(tasks[i]);
+		}
+	}, 1);
+}
@@ -0,0 +1,663 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "job_system.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+
+//Levels of detail for loaded meshes by edge collapse with quadric error metrics (Garland and Heckbert 1997).
+//Every collapse moves a vertex onto one of its neighbours rather than to a new position, so each level is just an
+//index list over the full detail vertices and the whole chain shares one vertex buffer.
+//Vertices are classified once up front. Open boundaries only collapse along themselves, attribute seams (texture
+//or normal splits, where vertices share a position) collapse both sides together along the seam, and anything
+//more tangled stays where it is. Collapses are picked in passes, cheapest first and with no position used twice
+//in a pass, so there is no priority queue to maintain, only a few linear sweeps and a bucket sort per pass.
+
+const float simplify_boundary_weight = 10.0f; // boundary edge planes against surface planes
+const float simplify_normal_weight = 1.0f; // squared normal change, integrated over the area that takes it on
+const float simplify_texcoord_weight = 0.1f; // squared texture coordinate change, likewise
+
+//Sum of squared distances to a set of planes, weighted by area
+struct quadric
+{
+	void add_plane(const float normal[3], float distance, float plane_weight)
+	{
+		a00 += plane_weight * normal[0] * normal[0];
+		a11 += plane_weight * normal[1] * normal[1];
+		a22 += plane_weight * normal[2] * normal[2];
+		a10 += plane_weight * normal[1] * normal[0];
+		a20 += plane_weight * normal[2] * normal[0];
+		a21 += plane_weight * normal[2] * normal[1];
+		b0 += plane_weight * normal[0] * distance;
+		b1 += plane_weight * normal[1] * distance;
+		b2 += plane_weight * normal[2] * distance;
+		c += plane_weight * distance * distance;
+		weight += plane_weight;
+	}
+
+	void add(const quadric& other)
+	{
+		a00 += other.a00;
+		a11 += other.a11;
+		a22 += other.a22;
+		a10 += other.a10;
+		a20 += other.a20;
+		a21 += other.a21;
+		b0 += other.b0;
+		b1 += other.b1;
+		b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+
+	//Squared distance from p to the planes, averaged over their weight
+	float evaluate(const float p[3]) const
+	{
+		float rx = a00 * p[0] + a10 * p[1] + a20 * p[2] + b0;
+		float ry = a10 * p[0] + a11 * p[1] + a21 * p[2] + b1;
+		float rz = a20 * p[0] + a21 * p[1] + a22 * p[2] + b2;
+		float r = rx * p[0] + ry * p[1] + rz * p[2] + b0 * p[0] + b1 * p[1] + b2 * p[2] + c;
+		return weight > 0.0f ? std::abs(r) / weight : 0.0f;
+	}
+
+	float a00, a11, a22, a10, a20, a21;
+	float b0, b1, b2;
+	float c;
+	float weight;
+};
+
+struct mesh_simplifier
+{
+	//positions, normals and texcoords point at the first vertex's values and step by stride bytes
+	void build(const float* positions, const float* normals, const float* texcoords, int stride, int count, const int* indices, int index_count)
+	{
+		vertex_count = count;
+		max_error = 0.0f;
+
+		// everything works in the unit cube, so errors and weights mean the same for every mesh
+		float low[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float high[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int v = 0; v < vertex_count; v++)
+		{
+			const float* p = vertex_at(positions, stride, v);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				low[axis] = std::min(low[axis], p[axis]);
+				high[axis] = std::max(high[axis], p[axis]);
+			}
+		}
+		extent = std::max(std::max(high[0] - low[0], high[1] - low[1]), high[2] - low[2]);
+		extent = extent > 0.0f ? extent : 1.0f;
+		position.resize((size_t)vertex_count * 3);
+		attributes.resize((size_t)vertex_count * attribute_count);
+		for (int v = 0; v < vertex_count; v++)
+		{
+			const float* p = vertex_at(positions, stride, v);
+			const float* n = vertex_at(normals, stride, v);
+			const float* t = vertex_at(texcoords, stride, v);
+			float* a = &attributes[(size_t)v * attribute_count];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				position[v * 3 + axis] = (p[axis] - low[axis]) / extent;
+				a[axis] = n[axis] * std::sqrt(simplify_normal_weight);
+			}
+			a[3] = t[0] * std::sqrt(simplify_texcoord_weight);
+			a[4] = t[1] * std::sqrt(simplify_texcoord_weight);
+		}
+
+		weld_positions();
+		build_edges(indices, index_count);
+		classify();
+
+		quadrics.assign(vertex_count, quadric());
+		area.assign(vertex_count, 0.0f);
+		for (int i = 0; i + 2 < index_count; i += 3)
+		{
+			int corners[3] = { indices[i], indices[i + 1], indices[i + 2] };
+			float normal[3];
+			float length = triangle_normal(&position[corners[0] * 3], &position[corners[1] * 3], &position[corners[2] * 3], normal);
+			if (length == 0.0f)
+			{
+				continue;
+			}
+			for (float& n : normal)
+			{
+				n /= length;
+			}
+			float distance = -(normal[0] * position[corners[0] * 3] + normal[1] * position[corners[0] * 3 + 1] + normal[2] * position[corners[0] * 3 + 2]);
+			for (int corner = 0; corner < 3; corner++)
+			{
+				quadrics[wedge[corners[corner]]].add_plane(normal, distance, 0.5f * length);
+				area[corners[corner]] += length / 6.0f;
+			}
+
+			// open edges (borders and both sides of seams) also keep to a plane standing on the edge
+			for (int edge = 0; edge < 3; edge++)
+			{
+				int a = corners[edge];
+				int b = corners[(edge + 1) % 3];
+				if (open_out[a] != b)
+				{
+					continue;
+				}
+				const float* pa = &position[a * 3];
+				const float* pb = &position[b * 3];
+				float along[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+				float edge_length_squared = along[0] * along[0] + along[1] * along[1] + along[2] * along[2];
+				float side[3] = {
+					along[1] * normal[2] - along[2] * normal[1],
+					along[2] * normal[0] - along[0] * normal[2],
+					along[0] * normal[1] - along[1] * normal[0],
+				};
+				float side_length = std::sqrt(side[0] * side[0] + side[1] * side[1] + side[2] * side[2]);
+				if (side_length == 0.0f)
+				{
+					continue;
+				}
+				for (float& s : side)
+				{
+					s /= side_length;
+				}
+				float side_distance = -(side[0] * pa[0] + side[1] * pa[1] + side[2] * pa[2]);
+				quadrics[wedge[a]].add_plane(side, side_distance, edge_length_squared * simplify_boundary_weight);
+				quadrics[wedge[b]].add_plane(side, side_distance, edge_length_squared * simplify_boundary_weight);
+			}
+		}
+	}
+
+	//Collapses edges of indices (this mesh, or a level an earlier call made) until at most target_index_count are
+	//left or nothing more can go. Returns the object space distance of the worst collapse made so far.
+	float simplify(std::vector<int>& indices, int target_index_count)
+	{
+		while ((int)indices.size() > target_index_count)
+		{
+			int triangle_count = (int)indices.size() / 3;
+			build_vertex_triangles(indices);
+
+			// the cheaper direction of every edge, edges inside the mesh show up twice which the pass sorts out
+			candidates.clear();
+			for (int t = 0; t < triangle_count; t++)
+			{
+				for (int edge = 0; edge < 3; edge++)
+				{
+					int a = indices[t * 3 + edge];
+					int b = indices[t * 3 + (edge + 1) % 3];
+					if (wedge[a] > wedge[b] && open_out[a] != b)
+					{
+						continue;
+					}
+					collapse forward;
+					collapse backward;
+					bool can_forward = plan_collapse(a, b, forward);
+					bool can_backward = plan_collapse(b, a, backward);
+					if (can_forward || can_backward)
+					{
+						candidates.push_back(can_forward && (!can_backward || forward.cost <= backward.cost) ? forward : backward);
+					}
+				}
+			}
+			if (candidates.empty())
+			{
+				break;
+			}
+			sort_candidates();
+
+			// most collapses take two triangles with them. Collapses much dearer than the goal's are left for a
+			// later pass, by which time the cheap ones around them may have made them cheaper. Candidates that
+			// would flip a triangle are no use to anyone, so each one moves the limit further down the list.
+			int goal = std::max(1, (triangle_count - target_index_count / 3) / 2);
+			int last = (int)sorted.size() - 1;
+			int limit_rank = std::min(goal - 1, last);
+			touched.assign(vertex_count, 0);
+			remap.resize(vertex_count);
+			std::iota(remap.begin(), remap.end(), 0);
+			int applied = 0;
+			for (const collapse& candidate : sorted)
+			{
+				if (applied >= goal || candidate.cost > sorted[limit_rank].cost * 1.5f)
+				{
+					break;
+				}
+				if (touched[wedge[candidate.from]] || touched[wedge[candidate.to]])
+				{
+					continue;
+				}
+				if (flips(indices, candidate.from, candidate.to) || (candidate.twin_from >= 0 && flips(indices, candidate.twin_from, candidate.twin_to)))
+				{
+					limit_rank = std::min(limit_rank + 1, last);
+					continue;
+				}
+				remap[candidate.from] = candidate.to;
+				area[candidate.to] += area[candidate.from];
+				if (candidate.twin_from >= 0)
+				{
+					remap[candidate.twin_from] = candidate.twin_to;
+					area[candidate.twin_to] += area[candidate.twin_from];
+				}
+				quadrics[wedge[candidate.to]].add(quadrics[wedge[candidate.from]]);
+				touched[wedge[candidate.from]] = 1;
+				touched[wedge[candidate.to]] = 1;
+				max_error = std::max(max_error, candidate.error);
+				applied++;
+			}
+			if (applied == 0)
+			{
+				break;
+			}
+
+			// triangles that had the edge now have two corners in one place and go
+			int kept = 0;
+			for (int t = 0; t < triangle_count; t++)
+			{
+				int a = remap[indices[t * 3]];
+				int b = remap[indices[t * 3 + 1]];
+				int c = remap[indices[t * 3 + 2]];
+				if (wedge[a] == wedge[b] || wedge[b] == wedge[c] || wedge[c] == wedge[a])
+				{
+					continue;
+				}
+				indices[kept++] = a;
+				indices[kept++] = b;
+				indices[kept++] = c;
+			}
+			indices.resize(kept);
+		}
+		return std::sqrt(max_error) * extent;
+	}
+
+private:
+	enum vertex_kind : uint8_t
+	{
+		kind_manifold, // collapses onto any neighbour
+		kind_border, // on an open boundary, collapses along it
+		kind_seam, // one of two vertices at a position, collapses along the seam together with the other
+		kind_locked,
+	};
+
+	//from moves onto to, and on a seam twin_from onto twin_to at the same time
+	struct collapse
+	{
+		int from;
+		int to;
+		int twin_from;
+		int twin_to;
+		float cost; // geometric error plus attribute change, what collapses are ordered by
+		float error; // geometric only, squared and in the unit cube
+	};
+
+	static const int attribute_count = 5; // normal, texture coordinates
+
+	static const float* vertex_at(const float* first, int stride, int v)
+	{
+		return reinterpret_cast<const float*>(reinterpret_cast<const char*>(first) + (size_t)v * stride);
+	}
+
+	//Unnormalized, returns the length (twice the area)
+	static float triangle_normal(const float* a, const float* b, const float* c, float normal[3])
+	{
+		float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+		normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+		normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+		return std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	}
+
+	//wedge is the lowest numbered vertex at each position, next_wedge cycles through all vertices at it
+	void weld_positions()
+	{
+		std::vector<int> order(vertex_count);
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](int a, int b)
+		{
+			int compare = memcmp(&position[a * 3], &position[b * 3], sizeof(float) * 3);
+			return compare != 0 ? compare < 0 : a < b;
+		});
+		wedge.resize(vertex_count);
+		next_wedge.resize(vertex_count);
+		for (int first = 0; first < vertex_count;)
+		{
+			int last = first + 1;
+			while (last < vertex_count && memcmp(&position[order[first] * 3], &position[order[last] * 3], sizeof(float) * 3) == 0)
+			{
+				last++;
+			}
+			for (int i = first; i < last; i++)
+			{
+				wedge[order[i]] = order[first];
+				next_wedge[order[i]] = order[i + 1 < last ? i + 1 : first];
+			}
+			first = last;
+		}
+	}
+
+	//Directed edges out of every vertex, and the single edge in or out of it without a twin running the other way
+	//(-1 for none, -2 for more than one)
+	void build_edges(const int* indices, int index_count)
+	{
+		edge_offsets.assign(vertex_count + 1, 0);
+		for (int i = 0; i < index_count; i++)
+		{
+			edge_offsets[indices[i] + 1]++;
+		}
+		for (int v = 0; v < vertex_count; v++)
+		{
+			edge_offsets[v + 1] += edge_offsets[v];
+		}
+		edge_targets.resize(edge_offsets[vertex_count]);
+		std::vector<int> cursor(edge_offsets.begin(), edge_offsets.end() - 1);
+		for (int i = 0; i + 2 < index_count; i += 3)
+		{
+			for (int edge = 0; edge < 3; edge++)
+			{
+				edge_targets[cursor[indices[i + edge]]++] = indices[i + (edge + 1) % 3];
+			}
+		}
+
+		open_out.assign(vertex_count, -1);
+		open_in.assign(vertex_count, -1);
+		for (int a = 0; a < vertex_count; a++)
+		{
+			for (int e = edge_offsets[a]; e < edge_offsets[a + 1]; e++)
+			{
+				int b = edge_targets[e];
+				if (!has_edge(b, a))
+				{
+					open_out[a] = open_out[a] == -1 ? b : -2;
+					open_in[b] = open_in[b] == -1 ? a : -2;
+				}
+			}
+		}
+	}
+
+	bool has_edge(int a, int b) const
+	{
+		for (int e = edge_offsets[a]; e < edge_offsets[a + 1]; e++)
+		{
+			if (edge_targets[e] == b)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//An edge from a's position to b's, through any of the vertices at either
+	bool has_position_edge(int a, int b) const
+	{
+		int v = a;
+		do
+		{
+			for (int e = edge_offsets[v]; e < edge_offsets[v + 1]; e++)
+			{
+				if (wedge[edge_targets[e]] == wedge[b])
+				{
+					return true;
+				}
+			}
+			v = next_wedge[v];
+		} while (v != a);
+		return false;
+	}
+
+	void classify()
+	{
+		kind.assign(vertex_count, kind_locked);
+		for (int v = 0; v < vertex_count; v++)
+		{
+			if (wedge[v] != v)
+			{
+				continue;
+			}
+			int twin = next_wedge[v];
+			if (twin == v)
+			{
+				// a single vertex is manifold when closed, a border when its open edges are open by position as well
+				// (otherwise it is where a seam ends)
+				if (open_out[v] == -1 && open_in[v] == -1)
+				{
+					kind[v] = kind_manifold;
+				}
+				else if (open_out[v] >= 0 && open_in[v] >= 0 && !has_position_edge(open_out[v], v) && !has_position_edge(v, open_in[v]))
+				{
+					kind[v] = kind_border;
+				}
+				continue;
+			}
+			// two vertices whose open edges close each other by position
+			if (next_wedge[twin] == v && open_out[v] >= 0 && open_in[v] >= 0 && open_out[twin] >= 0 && open_in[twin] >= 0 &&
+				wedge[open_out[v]] == wedge[open_in[twin]] && wedge[open_in[v]] == wedge[open_out[twin]])
+			{
+				kind[v] = kind_seam;
+				kind[twin] = kind_seam;
+			}
+		}
+	}
+
+	bool plan_collapse(int from, int to, collapse& result) const
+	{
+		result.from = from;
+		result.to = to;
+		result.twin_from = -1;
+		result.twin_to = -1;
+		switch (kind[from])
+		{
+		case kind_manifold:
+			break;
+		case kind_border:
+			if (open_out[from] != to && open_in[from] != to)
+			{
+				return false;
+			}
+			break;
+		case kind_seam:
+			if (open_out[from] != to && open_in[from] != to)
+			{
+				return false;
+			}
+			// the other side runs the opposite way
+			result.twin_from = next_wedge[from];
+			result.twin_to = open_out[from] == to ? open_in[result.twin_from] : open_out[result.twin_from];
+			break;
+		default:
+			return false;
+		}
+
+		result.error = quadrics[wedge[from]].evaluate(&position[to * 3]);
+		result.cost = result.error + attribute_cost(from, to);
+		if (result.twin_from >= 0)
+		{
+			result.cost += attribute_cost(result.twin_from, result.twin_to);
+		}
+		return true;
+	}
+
+	//Attribute change over the area that takes on the target's attributes
+	float attribute_cost(int from, int to) const
+	{
+		const float* a = &attributes[(size_t)from * attribute_count];
+		const float* b = &attributes[(size_t)to * attribute_count];
+		float difference = 0.0f;
+		for (int i = 0; i < attribute_count; i++)
+		{
+			difference += (a[i] - b[i]) * (a[i] - b[i]);
+		}
+		return difference * area[from];
+	}
+
+	//Triangles around each vertex in indices, compressed row storage
+	void build_vertex_triangles(const std::vector<int>& indices)
+	{
+		triangle_offsets.assign(vertex_count + 1, 0);
+		for (int index : indices)
+		{
+			triangle_offsets[index + 1]++;
+		}
+		for (int v = 0; v < vertex_count; v++)
+		{
+			triangle_offsets[v + 1] += triangle_offsets[v];
+		}
+		vertex_triangles.resize(indices.size());
+		std::vector<int>& cursor = remap; // free until the collapses are applied
+		cursor.assign(triangle_offsets.begin(), triangle_offsets.end() - 1);
+		for (int i = 0; i < (int)indices.size(); i++)
+		{
+			vertex_triangles[cursor[indices[i]]++] = i / 3;
+		}
+	}
+
+	//Moving from onto to turns one of from's remaining triangles over. Neighbours may already have moved in this
+	//pass, so the triangles are taken through remap.
+	bool flips(const std::vector<int>& indices, int from, int to) const
+	{
+		const float* target = &position[to * 3];
+		for (int i = triangle_offsets[from]; i < triangle_offsets[from + 1]; i++)
+		{
+			const int* source = &indices[vertex_triangles[i] * 3];
+			int corners[3] = { remap[source[0]], remap[source[1]], remap[source[2]] };
+			if (wedge[corners[0]] == wedge[to] || wedge[corners[1]] == wedge[to] || wedge[corners[2]] == wedge[to] ||
+				wedge[corners[0]] == wedge[corners[1]] || wedge[corners[1]] == wedge[corners[2]] || wedge[corners[2]] == wedge[corners[0]])
+			{
+				continue; // collapses away
+			}
+			const float* before[3];
+			const float* after[3];
+			for (int corner = 0; corner < 3; corner++)
+			{
+				before[corner] = &position[corners[corner] * 3];
+				after[corner] = corners[corner] == from ? target : before[corner];
+			}
+			float old_normal[3];
+			float new_normal[3];
+			float old_length = triangle_normal(before[0], before[1], before[2], old_normal);
+			float new_length = triangle_normal(after[0], after[1], after[2], new_normal);
+			if (old_normal[0] * new_normal[0] + old_normal[1] * new_normal[1] + old_normal[2] * new_normal[2] <= 0.25f * old_length * new_length)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//Costs are never negative, so their bits sort like the floats. The top 16 bits are close enough for picking
+	//collapses and make a single counting pass.
+	void sort_candidates()
+	{
+		histogram.assign(1 << 16, 0);
+		for (const collapse& candidate : candidates)
+		{
+			uint32_t bits;
+			memcpy(&bits, &candidate.cost, sizeof(bits));
+			histogram[bits >> 16]++;
+		}
+		int sum = 0;
+		for (int& count : histogram)
+		{
+			int bucket = count;
+			count = sum;
+			sum += bucket;
+		}
+		sorted.resize(candidates.size());
+		for (const collapse& candidate : candidates)
+		{
+			uint32_t bits;
+			memcpy(&bits, &candidate.cost, sizeof(bits));
+			sorted[histogram[bits >> 16]++] = candidate;
+		}
+	}
+
+	int vertex_count;
+	float extent; // object space size of the unit cube
+	float max_error; // squared, in the unit cube
+	std::vector<float> position; // 3 per vertex, in the unit cube
+	std::vector<float> attributes; // attribute_count per vertex, scaled by the square roots of their weights
+	std::vector<int> wedge;
+	std::vector<int> next_wedge;
+	std::vector<int> edge_offsets;
+	std::vector<int> edge_targets;
+	std::vector<int> open_out;
+	std::vector<int> open_in;
+	std::vector<uint8_t> kind; // vertex_kind
+	std::vector<quadric> quadrics; // per wedge
+	std::vector<float> area; // per vertex, surface that carries its attributes
+
+	// rebuilt every pass
+	std::vector<int> triangle_offsets;
+	std::vector<int> vertex_triangles;
+	std::vector<collapse> candidates;
+	std::vector<collapse> sorted;
+	std::vector<int> histogram;
+	std::vector<uint8_t> touched; // per wedge
+	std::vector<int> remap;
+};
+
+//Appends up to lod_count - 1 coarser levels to indices, each aiming at half the triangles of the one before, and
+//describes them in chain. A level that hardly shrinks ends the chain. Coarser levels are reordered for the vertex
+//cache and overdraw like the full detail one, the vertices are left alone.
+inline void simplify_lods(const float* positions, const float* normals, const float* texcoords, int stride, int vertex_count, std::vector<int>& indices, int lod_count, lod_chain& chain)
+{
+	int full_count = (int)indices.size();
+	chain.count = 1;
+	chain.levels[0] = { 0, full_count, 0.0f };
+	lod_count = std::min(lod_count, max_mesh_lods);
+	if (lod_count < 2 || full_count < 6 || vertex_count == 0)
+	{
+		return;
+	}
+
+	mesh_simplifier simplifier;
+	simplifier.build(positions, normals, texcoords, stride, vertex_count, indices.data(), full_count);
+	std::vector<int> level(indices.begin(), indices.end());
+	std::vector<int> cluster_starts;
+	for (int lod = 1; lod < lod_count; lod++)
+	{
+		int previous_count = (int)level.size();
+		float error = simplifier.simplify(level, (full_count / 3 >> lod) * 3);
+		if (level.empty() || level.size() > previous_count * 0.85f)
+		{
+			break;
+		}
+		optimize_vertex_cache(level.data(), (int)level.size(), vertex_count, cluster_starts);
+		optimize_overdraw(level.data(), (int)level.size(), positions, stride, cluster_starts);
+		chain.levels[lod] = { (int)indices.size(), (int)level.size(), error };
+		indices.insert(indices.end(), level.begin(), level.end());
+		chain.count++;
+	}
+}
+
+//One mesh to make levels of detail for, VertexType needs pos, normal and texCoord members
+template <typename VertexType>
+struct mesh_simplify_task
+{
+	const std::vector<VertexType>* vertices;
+	std::vector<int>* indices; // full detail in, every level back to back out
+	int lod_count;
+	lod_chain lods;
+};
+
+//Meshes are independent, so each one is its own job and the result does not depend on scheduling
+template <typename VertexType>
+void simplify_meshes(job_system* jobs, std::vector<mesh_simplify_task<VertexType>>& tasks)
+{
+	jobs->parallel_for((int)tasks.size(), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			mesh_simplify_task<VertexType>& task = tasks[i];
+			const std::vector<VertexType>& vertices = *task.vertices;
+			if (vertices.empty())
+			{
+				task.lods = { 1, { { 0, (int)task.indices->size(), 0.0f } } };
+				continue;
+			}
+			simplify_lods(&vertices[0].pos.x, &vertices[0].normal.x, &vertices[0].texCoord.x, sizeof(VertexType), (int)vertices.size(), *task.indices, task.lod_count, task.lods);
+		}
+	}, 1);
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "simd.h"
+
+//Clusters of at most 64 vertices and 124 triangles cut from a mesh's index buffer, each with a bounding sphere and
+//a normal cone so whole clusters can be culled on the CPU. A meshlet is a contiguous run of the (already cache
+//optimized) index buffer, so the survivors are drawn straight from the mesh's own indices as index ranges.
+const int meshlet_max_vertices = 64;
+const int meshlet_max_triangles = 124;
+
+struct meshlet
+{
+	int first_index; // relative to the mesh's first index
+	int index_count;
+	int vertex_count;
+};
+
+//Meshlets and their bounds as structure of arrays, padded with zeros to whole packets
+struct meshlet_set
+{
+	std::vector<meshlet> meshlets;
+	std::vector<float> centre[3];
+	std::vector<float> radius;
+	std::vector<float> cone_axis[3];
+	std::vector<float> cone_cutoff; // sine of the cone's half angle, above 1 when the cone is too wide to ever cull
+};
+
+//Drawable part of a mesh, in indices relative to the mesh's first index
+struct index_range
+{
+	int first_index;
+	int index_count;
+};
+
+//Splits indices into meshlets in their existing order, starting a new one when the next triangle would exceed
+//either limit. positions points at the first vertex's x and steps by stride bytes.
+inline void build_meshlets(const float* positions, int stride, const int* indices, int index_count, int vertex_count, meshlet_set& set)
+{
+	auto position_of = [&](int vertex) { return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + (size_t)vertex * stride); };
+
+	set.meshlets.clear();
+	std::vector<int> owner(vertex_count, -1); // last meshlet that used each vertex
+	for (int i = 0; i + 2 < index_count; i += 3)
+	{
+		int current = (int)set.meshlets.size() - 1;
+		int added = 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			int vertex = indices[i + corner];
+			bool repeated = (corner > 0 && indices[i] == vertex) || (corner > 1 && indices[i + 1] == vertex);
+			if (current < 0 || (owner[vertex] != current && !repeated))
+			{
+				added++;
+			}
+		}
+		if (current < 0 || set.meshlets[current].vertex_count + added > meshlet_max_vertices || set.meshlets[current].index_count == meshlet_max_triangles * 3)
+		{
+			set.meshlets.push_back({ i, 0, 0 });
+			current++;
+		}
+		meshlet& cluster = set.meshlets[current];
+		for (int corner = 0; corner < 3; corner++)
+		{
+			int vertex = indices[i + corner];
+			if (owner[vertex] != current)
+			{
+				owner[vertex] = current;
+				cluster.vertex_count++;
+			}
+		}
+		cluster.index_count += 3;
+	}
+
+	int count = (int)set.meshlets.size();
+	int padded = (count + packet_width - 1) / packet_width * packet_width;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		set.centre[axis].assign(padded, 0.0f);
+		set.cone_axis[axis].assign(padded, 0.0f);
+	}
+	set.radius.assign(padded, 0.0f);
+	set.cone_cutoff.assign(padded, 2.0f);
+
+	std::vector<float> normals;
+	for (int m = 0; m < count; m++)
+	{
+		const meshlet& cluster = set.meshlets[m];
+		const int* cluster_indices = indices + cluster.first_index;
+
+		//Sphere around the centre of the cluster's box
+		aabb bounds;
+		for (int i = 0; i < cluster.index_count; i++)
+		{
+			bounds.grow(position_of(cluster_indices[i]));
+		}
+		float centre[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			centre[axis] = (bounds.min[axis] + bounds.max[axis]) * 0.5f;
+		}
+		float radius_squared = 0.0f;
+		for (int i = 0; i < cluster.index_count; i++)
+		{
+			const float* position = position_of(cluster_indices[i]);
+			float dx = position[0] - centre[0];
+			float dy = position[1] - centre[1];
+			float dz = position[2] - centre[2];
+			radius_squared = std::max(radius_squared, dx * dx + dy * dy + dz * dz);
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			set.centre[axis][m] = centre[axis];
+		}
+		set.radius[m] = std::sqrt(radius_squared);
+
+		//Cone around the average face normal, wide enough for every face in the cluster
+		normals.clear();
+		float axis_sum[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < cluster.index_count; i += 3)
+		{
+			const float* a = position_of(cluster_indices[i]);
+			const float* b = position_of(cluster_indices[i + 1]);
+			const float* c = position_of(cluster_indices[i + 2]);
+			float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float normal[3] = { ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0] };
+			float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			if (length <= 0.0f)
+			{
+				continue; // degenerate, it never rasterizes so it cannot keep the cluster alive
+			}
+			for (int axis = 0; axis < 3; axis++)
+			{
+				normals.push_back(normal[axis] / length);
+				axis_sum[axis] += normal[axis] / length;
+			}
+		}
+		float axis_length = std::sqrt(axis_sum[0] * axis_sum[0] + axis_sum[1] * axis_sum[1] + axis_sum[2] * axis_sum[2]);
+		if (axis_length <= 0.0f)
+		{
+			continue;
+		}
+		float min_dot = 1.0f;
+		for (size_t n = 0; n < normals.size(); n += 3)
+		{
+			float dot = (normals[n] * axis_sum[0] + normals[n + 1] * axis_sum[1] + normals[n + 2] * axis_sum[2]) / axis_length;
+			min_dot = std::min(min_dot, dot);
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			set.cone_axis[axis][m] = axis_sum[axis] / axis_length;
+		}
+		// a half angle of 90 degrees or more faces every direction somewhere
+		set.cone_cutoff[m] = min_dot > 0.0f ? std::sqrt(std::max(0.0f, 1.0f - min_dot * min_dot)) : 2.0f;
+	}
+}
+
+//Everything the culling pass needs about one object and the camera, in the object's own space
+struct cluster_cull_view
+{
+	frustum planes; // normalised, from the object to clip matrix
+	float camera[3];
+	float object_to_view[4][3]; // row vector convention, translation in the last row
+	float radius_scale; // largest axis scale of the object's world matrix
+	float projection_x; // projection m00 and m11 times half the viewport size
+	float projection_y;
+	float viewport_centre[2];
+	float near_plane;
+};
+
+//Tests a packet of meshlets at a time and appends the visible ones to ranges, merging neighbours in the index buffer
+//into one range. A meshlet is culled when its sphere is outside a frustum plane, when its normal cone faces away
+//from the camera from every point of the sphere, or when the sphere is so small on screen that it covers no
+//pixel centre. ranges needs room for one entry per meshlet, returns the number of ranges written.
+inline int cull_meshlets(const meshlet_set& set, const cluster_cull_view& view, index_range* ranges, int& visible_meshlets)
+{
+	int count = (int)set.meshlets.size();
+	int range_count = 0;
+	visible_meshlets = 0;
+
+	simd_float zero = simd_set(0.0f);
+	simd_float one = simd_set(1.0f);
+	simd_float half = simd_set(0.5f);
+	simd_float radius_scale = simd_set(view.radius_scale);
+	simd_float screen_limit = simd_set(1e6f); // keeps floor inside the integer range
+	for (int base = 0; base < count; base += packet_width)
+	{
+		simd_float centre_x = simd_load(&set.centre[0][base]);
+		simd_float centre_y = simd_load(&set.centre[1][base]);
+		simd_float centre_z = simd_load(&set.centre[2][base]);
+		simd_float radius = simd_load(&set.radius[base]);
+		simd_float scaled_radius = simd_mul(radius, radius_scale);
+
+		simd_float culled = zero;
+		for (const plane& p : view.planes.planes)
+		{
+			simd_float distance = simd_add(simd_add(simd_mul(centre_x, simd_set(p.normal[0])), simd_mul(centre_y, simd_set(p.normal[1]))),
+				simd_add(simd_mul(centre_z, simd_set(p.normal[2])), simd_set(p.distance)));
+			culled = simd_or(culled, simd_less(simd_add(distance, radius), zero));
+		}
+
+		//Backfacing from every point of the sphere: dot(centre - camera, axis) >= |centre - camera| * cutoff + radius * (1 + cutoff)
+		simd_float to_centre_x = simd_sub(centre_x, simd_set(view.camera[0]));
+		simd_float to_centre_y = simd_sub(centre_y, simd_set(view.camera[1]));
+		simd_float to_centre_z = simd_sub(centre_z, simd_set(view.camera[2]));
+		simd_float distance = simd_sqrt(simd_add(simd_add(simd_mul(to_centre_x, to_centre_x), simd_mul(to_centre_y, to_centre_y)), simd_mul(to_centre_z, to_centre_z)));
+		simd_float cone_dot = simd_add(simd_add(simd_mul(to_centre_x, simd_load(&set.cone_axis[0][base])), simd_mul(to_centre_y, simd_load(&set.cone_axis[1][base]))),
+			simd_mul(to_centre_z, simd_load(&set.cone_axis[2][base])));
+		simd_float cutoff = simd_load(&set.cone_cutoff[base]);
+		simd_float cone_limit = simd_add(simd_mul(distance, cutoff), simd_mul(radius, simd_add(one, cutoff)));
+		culled = simd_or(culled, simd_greater_equal(cone_dot, cone_limit));
+
+		//Small primitives, only for spheres entirely in front of the near plane. The projected extent is bounded by
+		//radius * sqrt(x^2 + z^2) / (z * (z - radius)) around x / z, and the same for y.
+		simd_float view_x = simd_add(simd_add(simd_mul(centre_x, simd_set(view.object_to_view[0][0])), simd_mul(centre_y, simd_set(view.object_to_view[1][0]))),
+			simd_add(simd_mul(centre_z, simd_set(view.object_to_view[2][0])), simd_set(view.object_to_view[3][0])));
+		simd_float view_y = simd_add(simd_add(simd_mul(centre_x, simd_set(view.object_to_view[0][1])), simd_mul(centre_y, simd_set(view.object_to_view[1][1]))),
+			simd_add(simd_mul(centre_z, simd_set(view.object_to_view[2][1])), simd_set(view.object_to_view[3][1])));
+		simd_float view_z = simd_add(simd_add(simd_mul(centre_x, simd_set(view.object_to_view[0][2])), simd_mul(centre_y, simd_set(view.object_to_view[1][2]))),
+			simd_add(simd_mul(centre_z, simd_set(view.object_to_view[2][2])), simd_set(view.object_to_view[3][2])));
+		simd_float nearest = simd_sub(view_z, scaled_radius);
+		simd_float in_front = simd_greater_equal(nearest, simd_set(view.near_plane));
+		simd_float inverse_z = simd_div(one, view_z);
+		simd_float extent = simd_div(scaled_radius, simd_mul(view_z, nearest));
+		simd_float screen_x = simd_add(simd_set(view.viewport_centre[0]), simd_mul(simd_mul(view_x, inverse_z), simd_set(view.projection_x)));
+		simd_float screen_y = simd_sub(simd_set(view.viewport_centre[1]), simd_mul(simd_mul(view_y, inverse_z), simd_set(view.projection_y)));
+		simd_float extent_x = simd_mul(simd_mul(extent, simd_sqrt(simd_add(simd_mul(view_x, view_x), simd_mul(view_z, view_z)))), simd_set(view.projection_x));
+		simd_float extent_y = simd_mul(simd_mul(extent, simd_sqrt(simd_add(simd_mul(view_y, view_y), simd_mul(view_z, view_z)))), simd_set(view.projection_y));
+		//[low, high] holds a pixel centre k + 0.5 when floor(high - 0.5) >= ceil(low - 0.5) = -floor(0.5 - low)
+		auto misses_centres = [&](simd_float screen, simd_float size)
+		{
+			simd_float low = simd_max(simd_min(simd_sub(screen, size), screen_limit), simd_sub(zero, screen_limit));
+			simd_float high = simd_max(simd_min(simd_add(screen, size), screen_limit), simd_sub(zero, screen_limit));
+			return simd_less(simd_add(simd_floor(simd_sub(high, half)), simd_floor(simd_sub(half, low))), zero);
+		};
+		simd_float tiny = simd_or(misses_centres(screen_x, extent_x), misses_centres(screen_y, extent_y));
+		culled = simd_or(culled, simd_and(in_front, tiny));
+
+		int lanes = std::min(packet_width, count - base);
+		int visible = ~simd_mask(culled) & ((1 << lanes) - 1);
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			if (!(visible & (1 << lane)))
+			{
+				continue;
+			}
+			const meshlet& cluster = set.meshlets[base + lane];
+			visible_meshlets++;
+			if (range_count > 0 && ranges[range_count - 1].first_index + ranges[range_count - 1].index_count == cluster.first_index)
+			{
+				ranges[range_count - 1].index_count += cluster.index_count;
+			}
+			else
+			{
+				ranges[range_count++] = { cluster.first_index, cluster.index_count };
+			}
+		}
+	}
+	return range_count;
+}
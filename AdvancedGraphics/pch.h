@@ -3,6 +3,9 @@
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN    // Exclude rarely-used stuff from Windows headers.
 #endif
+#ifndef NOMINMAX
+#define NOMINMAX // the min/max macros break std::min and std::max in the headers below
+#endif
 
 #include <windows.h>
 #include <d3d12.h>
@@ -11,6 +14,30 @@
 #include <DirectXMath.h>
 #include "d3dx12.h"
 #include "DDSTextureLoader.h"
+#include "job_system.h"
+#include "input_queue.h"
+#include "frame_snapshot.h"
+#include "scene_graph.h"
+#include "bvh.h"
+#include "picking.h"
+#include "radix_sort.h"
+#include "vertex_format.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+#include "mesh_import.h"
+#include "mesh_lod.h"
+#include "mesh_simplify.h"
+#include "tangent_space.h"
+#include "procedural_mesh.h"
+#include "terrain.h"
+#include "upload_ring.h"
+#include "constant_allocator.h"
+#include "tlsf.h"
+#include "release_queue.h"
+#include "copy_queue.h"
+#include "frame_arena.h"
+#include "descriptor_heap.h"
+#include <atomic>
 #include <string>
 
 #include <wincodec.h>
@@ -22,21 +49,31 @@
 using namespace DirectX; // we will be using the directxmath library
 
 const int frame_buffer_count = 3;
-// we will exit the program when this becomes false
-bool Running = true;
+// we will exit the program when this becomes false (read by the message, simulation and render threads)
+std::atomic<bool> Running{ true };
 // width and height of the window
 int Width = 800;
 int Height = 600;
 // create a window
 ID3D12Device* device; // direct3d device
-//Constant Buffer Data Per Object
-struct ObjectConstantBuffer
+job_system* jobs; // worker threads for culling, updates, recording and asset work
+//Per object data, read by the vertex shader from a structured buffer and only rewritten when the world matrix changes
+struct ObjectData
 {
-	XMFLOAT4X4 wvpMat;
+	XMFLOAT4X4 world;
 };
+//Constant Buffer Data Per Pass, rewritten every frame
 struct DefaultConstantBuffer
 {
-
+	XMFLOAT4X4 view_projection;
+	XMFLOAT3 camera_position;
+	// terrain_settings the terrain vertex shader needs, see terrain.h
+	float terrain_size;
+	XMFLOAT2 terrain_origin;
+	float terrain_height_scale;
+	float terrain_base_height;
+	float terrain_chunk_quads;
+	float terrain_heightmap_size;
 };
 
 struct Material
@@ -45,7 +82,9 @@ struct Material
 
 	//Index to constant buffer to the materials
 	int material_cb_index;
-	//Index to srv heap for diffuse/colour texture
+	//Index into pipeline_states
+	int pso_index;
+	//Index into textures for diffuse/colour texture, which is also its place in the bindless texture table
 	int diffuse_srv_heap_index;
 
 	//Same thing as above
@@ -58,75 +97,542 @@ struct Material
 	float roughness;
 	DirectX::XMFLOAT4X4 material_transformation;
 };
+//One material as the pixel shader reads it from the material buffer, laid out as material_data in common.hlsl.
+//The map indices are into textures, which is also the order of the bindless texture table.
+struct MaterialData
+{
+	DirectX::XMFLOAT4 diffuse_albedo;
+	DirectX::XMFLOAT3 fresnel;
+	float roughness;
+	DirectX::XMFLOAT4X4 material_transformation;
+	UINT diffuse_map_index;
+	UINT normal_map_index;
+	UINT padding[2];
+};
+struct object_world
+{
+	int object;
+	XMFLOAT4X4 world;
+};
+//Everything the render thread needs from one simulation step
+struct frame_snapshot
+{
+	XMFLOAT4X4 view;
+	//Objects whose world matrix changed since the last snapshot the render thread consumed
+	std::vector<object_world> changed;
+	//Objects inside the view frustum, culled against the scene bvh by the simulation thread
+	std::vector<int> visible;
+	UINT64 tick;
+};
+//Full precision source vertex, packed into a packed_vertex when the mesh is added to the mesh pool
 struct Vertex {
-	Vertex(float x, float y, float z, float u, float v) : pos(x, y, z), texCoord(u, v) {}
+	Vertex(float x, float y, float z, float u, float v) : pos(x, y, z), texCoord(u, v), normal(0.0f, 0.0f, 0.0f), tangent(0.0f, 0.0f, 0.0f, 1.0f) {}
 	XMFLOAT3 pos;
 	XMFLOAT2 texCoord;
+	XMFLOAT3 normal;
+	XMFLOAT4 tangent; // w is the bitangent's handedness
+};
+//Signalled on command_queue after every submission. Unlike the per frame fences it is a single timeline, so
+//anything the GPU reads can be tagged with the value of the submission that reads it.
+ID3D12Fence* queue_fence;
+UINT64 queue_fence_value = 0;
+//upload_ring backend, each page is an upload heap buffer that stays mapped for as long as it lives
+struct upload_heap_pages
+{
+	typedef ID3D12Resource* resource;
+
+	bool create_page(uint64_t size, ID3D12Resource*& memory, uint8_t*& cpu, uint64_t& gpu)
+	{
+		HRESULT hr = device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(size),
+			D3D12_RESOURCE_STATE_GENERIC_READ,
+			nullptr,
+			IID_PPV_ARGS(&memory));
+		if (FAILED(hr))
+		{
+			OutputDebugStringA("upload page allocation failed\n");
+			return false;
+		}
+		memory->SetName(L"Upload Ring Page");
+		hr = memory->Map(0, nullptr, reinterpret_cast<void**>(&cpu));
+		if (FAILED(hr))
+		{
+			memory->Release();
+			return false;
+		}
+		gpu = memory->GetGPUVirtualAddress();
+		return true;
+	}
+
+	void release_page(ID3D12Resource* memory)
+	{
+		memory->Release();
+	}
+
+	uint64_t completed_value()
+	{
+		return queue_fence->GetCompletedValue();
+	}
+};
+typedef upload_allocation<ID3D12Resource*> upload_space;
+upload_ring<upload_heap_pages> uploads; // each frame's instance and terrain lists
+//Asset uploads are read by the copy queue, so their pages retire against its fence
+ID3D12CommandQueue* copy_queue;
+ID3D12Fence* copy_fence;
+struct asset_upload_pages : upload_heap_pages
+{
+	uint64_t completed_value()
+	{
+		return copy_fence->GetCompletedValue();
+	}
+};
+upload_ring<asset_upload_pages> asset_uploads; // staging for meshes, textures and the heightmap
+//copy_scheduler backend, a command allocator per slot and one list that is reset onto whichever slot is free
+struct copy_queue_lists
+{
+	typedef ID3D12GraphicsCommandList* list;
+
+	bool open(int slot, ID3D12GraphicsCommandList*& recording);
+	bool execute(ID3D12GraphicsCommandList* recording, uint64_t fence_value);
+	uint64_t completed_value();
+	void wait(uint64_t fence_value);
+	void release();
+
+	std::vector<ID3D12CommandAllocator*> allocators;
+	ID3D12GraphicsCommandList* commands = nullptr;
+};
+copy_scheduler<copy_queue_lists> copies;
+UINT64 copies_used = 0; // newest copy ticket the frame being recorded reads
+//Default heap memory for everything the GPU keeps, placed into a few large heaps instead of one committed
+//allocation (and one kernel call) per resource. Heap tier 1 hardware can not mix buffers, textures and render
+//targets in a heap, so each kind gets its own heaps, carved up by tlsf_allocator. Placement is in 64KB granules,
+//MSAA targets ask GetResourceAllocationInfo for 4MB and get it from the same target heaps.
+enum gpu_memory_kind { gpu_buffers, gpu_textures, gpu_targets, gpu_memory_kinds };
+const UINT64 gpu_heap_size = 64 << 20; // bigger resources get a heap of their own size
+struct gpu_allocation
+{
+	int kind = 0;
+	int heap = -1; // -1 when nothing is allocated
+	int block = -1; // in the heap's tlsf_allocator
+	UINT64 offset = 0;
+	UINT64 size = 0;
+};
+struct gpu_heap
+{
+	ID3D12Heap* heap;
+	tlsf_allocator blocks;
+};
+struct gpu_memory
+{
+	//CreatePlacedResource in the first heap of the right kind with room, adding a heap when none has
+	HRESULT create(const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES state, const D3D12_CLEAR_VALUE* clear, ID3D12Resource** resource, gpu_allocation& allocation)
+	{
+		D3D12_RESOURCE_ALLOCATION_INFO info = device->GetResourceAllocationInfo(0, 1, &desc);
+		int kind = gpu_textures;
+		if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+		{
+			kind = gpu_buffers;
+		}
+		else if (desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL))
+		{
+			kind = gpu_targets;
+		}
+
+		std::vector<gpu_heap>& candidates = heaps[kind];
+		int heap = -1;
+		int block = -1;
+		UINT64 offset = 0;
+		for (int h = 0; h < (int)candidates.size() && block < 0; h++)
+		{
+			block = candidates[h].blocks.allocate(info.SizeInBytes, info.Alignment, offset);
+			heap = h;
+		}
+		if (block < 0)
+		{
+			heap = add_heap(kind, info.SizeInBytes);
+			if (heap < 0)
+			{
+				return E_OUTOFMEMORY;
+			}
+			block = candidates[heap].blocks.allocate(info.SizeInBytes, info.Alignment, offset);
+		}
+
+		HRESULT hr = device->CreatePlacedResource(candidates[heap].heap, offset, &desc, state, clear, IID_PPV_ARGS(resource));
+		if (FAILED(hr))
+		{
+			candidates[heap].blocks.free(block);
+			return hr;
+		}
+		allocation.kind = kind;
+		allocation.heap = heap;
+		allocation.block = block;
+		allocation.offset = offset;
+		allocation.size = info.SizeInBytes;
+		return S_OK;
+	}
+
+	//The resource placed in the allocation has to be released, and the GPU done with it
+	void free(gpu_allocation& allocation)
+	{
+		if (allocation.heap < 0)
+		{
+			return;
+		}
+		heaps[allocation.kind][allocation.heap].blocks.free(allocation.block);
+		allocation = gpu_allocation();
+	}
+
+	//Use and fragmentation of every heap to the debugger output
+	void report()
+	{
+		const char* names[gpu_memory_kinds] = { "buffers", "textures", "targets" };
+		for (int kind = 0; kind < gpu_memory_kinds; kind++)
+		{
+			for (int h = 0; h < (int)heaps[kind].size(); h++)
+			{
+				const tlsf_allocator& blocks = heaps[kind][h].blocks;
+				char line[256];
+				sprintf_s(line, "gpu heap %s %d: %d allocations, %llu of %llu KB used, largest free %llu KB, fragmentation %.2f\n",
+					names[kind], h, blocks.allocations, blocks.used_bytes() >> 10, blocks.size_bytes() >> 10, blocks.largest_free_bytes() >> 10, blocks.fragmentation());
+				OutputDebugStringA(line);
+			}
+		}
+	}
+
+	//Placed resources keep their heap alive, so they can be released before or after this
+	void release()
+	{
+		for (std::vector<gpu_heap>& kind : heaps)
+		{
+			for (gpu_heap& h : kind)
+			{
+				SAFE_RELEASE(h.heap);
+			}
+			kind.clear();
+		}
+	}
+
+	std::vector<gpu_heap> heaps[gpu_memory_kinds];
+
+private:
+	int add_heap(int kind, UINT64 size)
+	{
+		// target heaps are 4MB aligned so MSAA targets can go in them
+		UINT64 alignment = kind == gpu_targets ? D3D12_DEFAULT_MSAA_RESOURCE_PLACEMENT_ALIGNMENT : D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+		const D3D12_HEAP_FLAGS flags[gpu_memory_kinds] = {
+			D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS,
+			D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES,
+			D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES,
+		};
+		D3D12_HEAP_DESC desc = {};
+		desc.SizeInBytes = std::max(gpu_heap_size, (size + alignment - 1) & ~(alignment - 1));
+		desc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+		desc.Alignment = alignment;
+		desc.Flags = flags[kind];
+		gpu_heap fresh = {};
+		if (FAILED(device->CreateHeap(&desc, IID_PPV_ARGS(&fresh.heap))))
+		{
+			OutputDebugStringA("gpu heap allocation failed\n");
+			return -1;
+		}
+		fresh.blocks.initialise(desc.SizeInBytes, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+		heaps[kind].push_back(std::move(fresh));
+		return (int)heaps[kind].size() - 1;
+	}
+};
+gpu_memory gpu_heaps; // the mesh pool, textures, the terrain heightmap and the depth buffer
+//release_queue backend, a resource and the heap space it was placed in (heap -1 for committed resources)
+struct retired_resource
+{
+	ID3D12Resource* resource;
+	gpu_allocation memory;
+};
+struct retired_resources
+{
+	typedef retired_resource item;
+
+	void release(const retired_resource& what)
+	{
+		what.resource->Release();
+		gpu_allocation memory = what.memory;
+		gpu_heaps.free(memory);
+	}
+
+	uint64_t completed_value()
+	{
+		return queue_fence->GetCompletedValue();
+	}
+};
+release_queue<retired_resources> retired; // drained by WaitForPreviousFrame
+void release_after_gpu(ID3D12Resource*& resource, gpu_allocation& memory); // once everything submitted so far, and the next submission, has executed
+//descriptor_staging and descriptor_ring backend, CBV/SRV/UAV heaps whose ring retires against the queue timeline
+struct shader_resource_heaps
+{
+	typedef ID3D12DescriptorHeap* heap;
+
+	bool create_heap(int capacity, bool shader_visible, ID3D12DescriptorHeap*& created, uint64_t& cpu, uint64_t& gpu)
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC desc = {};
+		desc.NumDescriptors = capacity;
+		desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+		desc.Flags = shader_visible ? D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE : D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+		HRESULT hr = device->CreateDescriptorHeap(&desc, IID_PPV_ARGS(&created));
+		if (FAILED(hr))
+		{
+			OutputDebugStringA("descriptor heap creation failed\n");
+			return false;
+		}
+		created->SetName(shader_visible ? L"Shader Visible Descriptor Ring" : L"Descriptor Staging Heap");
+		cpu = created->GetCPUDescriptorHandleForHeapStart().ptr;
+		gpu = shader_visible ? created->GetGPUDescriptorHandleForHeapStart().ptr : 0;
+		return true;
+	}
+
+	void release_heap(ID3D12DescriptorHeap* released)
+	{
+		released->Release();
+	}
+
+	uint64_t completed_value()
+	{
+		return queue_fence->GetCompletedValue();
+	}
 };
+descriptor_staging<shader_resource_heaps> srv_staging; // every shader resource view, created once
+descriptor_ring<shader_resource_heaps> srv_ring; // the tables shaders read, copied out of srv_staging each frame
+D3D12_GPU_DESCRIPTOR_HANDLE stage_table(const int* slots, int count); // a table in srv_ring holding the staged descriptors in order
 struct default_buffer
 {
-	ID3D12Resource* create_default_buffer()
+	//Fills default_buffer, false when the heaps could not place it
+	bool create_default_buffer()
 	{
 		//If we are creating constant buffer upload buffer, elements need to be multiples of
 		//256 bytes. This is due to hardware can only view constant data at elements at this size with offset.
 
-		ID3D12Resource* buffer = nullptr;;
+		default_buffer = nullptr;
 
 		// Create the actual default buffer resource.
-		device->CreateCommittedResource(
-			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-			D3D12_HEAP_FLAG_NONE,
-			&CD3DX12_RESOURCE_DESC::Buffer(byte_size),
-			D3D12_RESOURCE_STATE_COMMON,
-			nullptr,
-			IID_PPV_ARGS(&buffer));
-
-		return buffer;
+		HRESULT hr = gpu_heaps.create(CD3DX12_RESOURCE_DESC::Buffer(byte_size), D3D12_RESOURCE_STATE_COMMON, nullptr, &default_buffer, memory);
+		if (FAILED(hr))
+		{
+			Running = false;
+			return false;
+		}
+		return true;
 	}
 	int byte_size;
 	ID3D12Resource* default_buffer;
+	gpu_allocation memory;
 };
 struct Geometry
 {
 	std::wstring name;
+
+	XMFLOAT4X4 world;
+	XMFLOAT4X4 rotation;
+	XMFLOAT4 position;
+	aabb bounds; // object space bounds of the vertices
+	triangle_bvh* triangles; // object space triangles for picking, shared by every copy of the mesh, null picks against bounds
+	meshlet_set* meshlets; // clusters for culling on the CPU, shared like triangles, null draws the mesh whole
+	int mesh; // objects with the same mesh share vertex and index buffers
+	int material;
+	int index_count; // every level of detail together
+	lod_chain lods; // index ranges of each level of detail, relative to first_index
+	// where the mesh lives in the mesh pool
+	int first_index;
+	int base_vertex;
+	bool wide_indices; // 32 bit indices, only for meshes with 65536 or more vertices
+	position_quantization quantization; // decodes the mesh's snorm16 positions
+};
+//Root constants for one draw batch, laid out as BatchConstants in common.hlsl
+struct BatchConstants
+{
+	UINT first_instance;
+	position_quantization quantization;
+	UINT material; // into the material buffer, the pixel shader takes its textures from there
+};
+//All static meshes sub-allocated from one vertex buffer and two index buffers (16 and 32 bit), so the input
+//assembler is bound once per frame and draws pick their mesh with StartIndexLocation/BaseVertexLocation.
+//Vertices are packed into packed_vertex as they are copied in. Meshes are copied on the copy queue, the buffers
+//stay in the common state and are promoted to whatever each queue uses them as, so no barriers are needed.
+struct mesh_pool
+{
+	bool create(int vertex_capacity, int index_capacity)
+	{
+		max_vertices = vertex_capacity;
+		max_indices = index_capacity;
+
+		HRESULT hr;
+		hr = gpu_heaps.create(
+			CD3DX12_RESOURCE_DESC::Buffer((UINT64)max_vertices * sizeof(packed_vertex)),
+			D3D12_RESOURCE_STATE_COMMON,
+			nullptr,
+			&vertex_buffer,
+			vertex_memory);
+		if (FAILED(hr))
+		{
+			Running = false;
+			return false;
+		}
+		vertex_buffer->SetName(L"Mesh Pool Vertex Buffer");
+
+		for (int width = 0; width < 2; width++)
+		{
+			hr = gpu_heaps.create(
+				CD3DX12_RESOURCE_DESC::Buffer((UINT64)max_indices * index_size(width == 1)),
+				D3D12_RESOURCE_STATE_COMMON,
+				nullptr,
+				&index_buffers[width],
+				index_memory[width]);
+			if (FAILED(hr))
+			{
+				Running = false;
+				return false;
+			}
+		}
+		index_buffers[0]->SetName(L"Mesh Pool 16 Bit Index Buffer");
+		index_buffers[1]->SetName(L"Mesh Pool 32 Bit Index Buffer");
+		return true;
+	}
+
+	//Reserves room for a mesh, records its copy into the pool on the copy queue and stores its offsets and
+	//quantization (from bounds) in geometry. destination points at mapped upload memory for the caller to fill in
+	//before the copies are submitted, packed vertices first and then indices of the width it says.
+	bool allocate(int vertex_count, int index_count, const aabb& bounds, Geometry* geometry, mesh_destination& destination)
+	{
+		// indices are relative to the mesh's base vertex, so 16 bits cover any mesh below 65536 vertices
+		bool wide = vertex_count >= 65536;
+		int width = wide ? 1 : 0;
+		if (vertex_used + vertex_count > max_vertices || index_used[width] + index_count > max_indices)
+		{
+			OutputDebugStringA("mesh pool is full\n");
+			return false;
+		}
+
+		ID3D12GraphicsCommandList* list;
+		if (!copies.record(list))
+		{
+			Running = false;
+			return false;
+		}
+
+		//Both halves come from the upload ring, which keeps them until the copy has executed
+		UINT64 vertex_bytes = (UINT64)vertex_count * sizeof(packed_vertex);
+		UINT64 index_bytes = (UINT64)index_count * index_size(wide);
+		upload_space staging;
+		if (!asset_uploads.allocate(vertex_bytes + index_bytes, 16, staging))
+		{
+			Running = false;
+			return false;
+		}
+		BYTE* mapped = staging.cpu;
+
+		// positions are quantized against the mesh bounds, the shader undoes it with the same numbers
+		position_quantization quantization = quantization_from_bounds(bounds.min, bounds.max);
+		destination.vertices = reinterpret_cast<packed_vertex*>(mapped);
+		destination.indices = mapped + vertex_bytes;
+		destination.wide_indices = wide;
+		destination.quantization = quantization;
+
+		list->CopyBufferRegion(vertex_buffer, (UINT64)vertex_used * sizeof(packed_vertex), staging.memory, staging.offset, vertex_bytes);
+		list->CopyBufferRegion(index_buffers[width], (UINT64)index_used[width] * index_size(wide), staging.memory, staging.offset + vertex_bytes, index_bytes);
+
+		geometry->base_vertex = vertex_used;
+		geometry->first_index = index_used[width];
+		geometry->index_count = index_count;
+		geometry->lods = { 1, { { 0, index_count, 0.0f } } };
+		geometry->wide_indices = wide;
+		geometry->quantization = quantization;
+		vertex_used += vertex_count;
+		index_used[width] += index_count;
+		ready = copies.ticket();
+		return true;
+	}
+
+	//Packs full precision vertices into the pool, see allocate()
+	bool add(const Vertex* vertices, int vertex_count, const int* indices, int index_count, Geometry* geometry)
+	{
+		aabb bounds;
+		for (int v = 0; v < vertex_count; v++)
+		{
+			bounds.grow(&vertices[v].pos.x);
+		}
+		mesh_destination destination;
+		if (!allocate(vertex_count, index_count, bounds, geometry, destination))
+		{
+			return false;
+		}
+
+		// pack straight into the mapped upload memory
+		for (int v = 0; v < vertex_count; v++)
+		{
+			pack_vertex(&vertices[v].pos.x, &vertices[v].normal.x, &vertices[v].tangent.x, &vertices[v].texCoord.x, destination.quantization, destination.vertices[v]);
+		}
+		if (destination.wide_indices)
+		{
+			memcpy(destination.indices, indices, (size_t)index_count * sizeof(UINT));
+		}
+		else
+		{
+			uint16_t* narrow = static_cast<uint16_t*>(destination.indices);
+			for (int i = 0; i < index_count; i++)
+			{
+				narrow[i] = (uint16_t)indices[i];
+			}
+		}
+		return true;
+	}
+
 	D3D12_VERTEX_BUFFER_VIEW vertex_buffer_view()
 	{
 		D3D12_VERTEX_BUFFER_VIEW view;
 
-		view.BufferLocation = vertex_default->GetGPUVirtualAddress();
-		view.StrideInBytes = sizeof(Vertex);
-		view.SizeInBytes = vertex_buffer_size;
+		view.BufferLocation = vertex_buffer->GetGPUVirtualAddress();
+		view.StrideInBytes = sizeof(packed_vertex);
+		view.SizeInBytes = vertex_used * sizeof(packed_vertex);
 		return view;
 	}
 
-	D3D12_INDEX_BUFFER_VIEW index_buffer_view()
+	D3D12_INDEX_BUFFER_VIEW index_buffer_view(bool wide)
 	{
 		D3D12_INDEX_BUFFER_VIEW view;
 
-		view.BufferLocation = index_default->GetGPUVirtualAddress();
-		view.Format = DXGI_FORMAT_R32_UINT; // 32-bit unsigned integer (this is what a dword is, double word, a word is 2 bytes)
-		view.SizeInBytes = index_buffer_size;
+		int width = wide ? 1 : 0;
+		view.BufferLocation = index_buffers[width]->GetGPUVirtualAddress();
+		view.Format = wide ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+		view.SizeInBytes = index_used[width] * index_size(wide);
 		return view;
 	}
-	ID3D12Resource* vertex_default; // a default buffer in GPU memory that we will load vertex data for our triangle into
-	ID3D12Resource* index_default; // a default buffer in GPU memory that we will load index data for our triangle into
 
-	ID3D12Resource* vertex_upload;
-	ID3D12Resource* index_upload;
+	static int index_size(bool wide) { return wide ? sizeof(UINT) : sizeof(uint16_t); }
 
-	XMFLOAT4X4 world;
-	XMFLOAT4X4 rotation;
-	XMFLOAT4 position;
-	int index_buffer_size;
-	int index_count;
-	int vertex_buffer_size;
+	void release()
+	{
+		release_after_gpu(vertex_buffer, vertex_memory);
+		release_after_gpu(index_buffers[0], index_memory[0]);
+		release_after_gpu(index_buffers[1], index_memory[1]);
+	}
+
+	ID3D12Resource* vertex_buffer = nullptr;
+	ID3D12Resource* index_buffers[2] = {}; // 16 bit, 32 bit
+	gpu_allocation vertex_memory;
+	gpu_allocation index_memory[2];
+	int max_vertices = 0;
+	int max_indices = 0;
+	int vertex_used = 0;
+	int index_used[2] = {};
+	UINT64 ready = 0; // copy ticket of the newest mesh
 };
 struct Texture
 {
 	std::string texture_name;
 	std::wstring file_name;
 	Microsoft::WRL::ComPtr<ID3D12Resource> texture_default_buffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D12Resource> texture_upload_buffer = nullptr;
+	gpu_allocation memory; // where texture_default_buffer is placed
+	UINT64 ready = 0; // copy ticket of its texels
+	int srv = -1; // slot in srv_staging
 };
 struct Shader
 {
@@ -143,7 +649,9 @@ struct Shader
 			0,
 			&shader_data,
 			&error);
-		if (FAILED(hr))
+		// a missing file fails without a message
+		failed = FAILED(hr);
+		if (failed && error)
 		{
 			OutputDebugStringA((char*)error->GetBufferPointer());
 		}
@@ -165,16 +673,81 @@ struct Shader
 	};
 
 };
+//Read only mapping of a whole file, model files are parsed straight out of it
+struct mapped_file
+{
+	mapped_file() = default;
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	~mapped_file()
+	{
+		close();
+	}
+
+	bool open(const std::string& path)
+	{
+		close();
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size))
+		{
+			return false;
+		}
+		size = (size_t)file_size.QuadPart;
+		if (size == 0)
+		{
+			return true; // an empty file cannot be mapped, but it is not an error either
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+		{
+			return false;
+		}
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		return data != nullptr;
+	}
+
+	void close()
+	{
+		if (data)
+		{
+			UnmapViewOfFile(data);
+		}
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+		data = nullptr;
+		size = 0;
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+	}
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+};
 struct upload_buffer
 {
 	void create_upload_buffer(int byte_size , int element_count)
 	{
 		element_byte_size = byte_size;
 		HRESULT hr;
+		// size of the resource heap. Must be a multiple of 64KB for single-textures and constant buffers
+		UINT64 buffer_size = ((UINT64)byte_size * element_count + 0xffff) & ~(UINT64)0xffff;
 		hr = device->CreateCommittedResource(
 			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), // this heap will be used to upload the constant buffer data
 			D3D12_HEAP_FLAG_NONE, // no flags
-			&CD3DX12_RESOURCE_DESC::Buffer(1024 * 64), // size of the resource heap. Must be a multiple of 64KB for single-textures and constant buffers
+			&CD3DX12_RESOURCE_DESC::Buffer(buffer_size),
 			D3D12_RESOURCE_STATE_GENERIC_READ, // will be data that is read from so we keep it in the generic read state
 			nullptr, // we do not have use an optimized clear value for constant buffers
 			IID_PPV_ARGS(&upload_buffer));
@@ -190,9 +763,10 @@ struct upload_buffer
 	
 
 	}
-	void copy_data(int element , ObjectConstantBuffer data)
+	template <typename T>
+	void copy_data(int element , const T& data)
 	{
-		memcpy(&mapped_data[element * element_byte_size], &data, sizeof(ObjectConstantBuffer));
+		memcpy(&mapped_data[element * element_byte_size], &data, sizeof(T));
 
 	}
 	BYTE* mapped_data = nullptr;
@@ -201,29 +775,43 @@ struct upload_buffer
 	int element_byte_size;
 
 };
+//Terrain chunks one frame can draw, selection stops adding chunks once it is reached
+const int max_terrain_chunks = 4096;
+const int frame_pass_count = 1; // passes with their own DefaultConstantBuffer each frame
 struct FrameResource
 {
 
 
-	FrameResource(int object_count)
+	FrameResource(int object_count, int pass_count)
 	{
-		constant_buffer_object = new upload_buffer();
-		constant_buffer_default = new upload_buffer();
+		object_data = new upload_buffer();
 
-		constant_buffer_per_object_byte_size = (sizeof(ObjectConstantBuffer) + 255) & ~255;
-		//constant_buffer_default_byte_size = (sizeof(DefaultConstantBuffer) + 255) & ~255;
+		// structured buffers are read per element, so unlike constant buffers they need no 256 byte padding
+		object_data->create_upload_buffer(sizeof(ObjectData), object_count);
 
-		constant_buffer_object->create_upload_buffer(constant_buffer_per_object_byte_size, object_count);
-		//constant_buffer_default->create_upload_buffer(constant_buffer_default_byte_size, 1);
+		// room for every pass, the per draw constants are root constants and take none of it
+		UINT64 pass_bytes = constant_allocator<upload_heap_pages>::round_up(sizeof(DefaultConstantBuffer), constant_alignment);
+		if (!constants.reserve(pass_bytes * pass_count))
+		{
+			Running = false;
+		}
 	}
 
-	int constant_buffer_per_object_byte_size;
-	int constant_buffer_default_byte_size;
-	ObjectConstantBuffer cbPerObject; 
-	upload_buffer* constant_buffer_object;
-	upload_buffer* constant_buffer_default;
-	UINT8* cb_gpu_object_address;
+	upload_buffer* object_data; // world matrix of every object
+	// rewritten whole every frame, so they live in the upload ring rather than in buffers of their own
+	D3D12_GPU_VIRTUAL_ADDRESS instance_objects; // this frame's visible objects, grouped into one run per draw batch
+	D3D12_GPU_VIRTUAL_ADDRESS terrain_chunks; // this frame's terrain selection, one instance of the terrain grid each
+	//Constant buffers for this frame, reset when WaitForPreviousFrame has seen the frame's fence complete
+	constant_allocator<upload_heap_pages> constants;
+	D3D12_GPU_VIRTUAL_ADDRESS pass_constants; // DefaultConstantBuffer
 
+	//CPU scratch for building this frame, the calling thread's arena, reset along with constants
+	frame_arena& arena()
+	{
+		int thread = jobs->register_thread();
+		return arenas[thread < 0 ? 0 : thread];
+	}
+	frame_arena arenas[job_system::max_threads]; // by job system thread index, blocks are only made when used
 
 };
 struct depth
@@ -253,6 +841,7 @@ struct depth
 
 	ID3D12DescriptorHeap* depth_heap;
 	ID3D12Resource* depth_stencil_data;
+	gpu_allocation depth_memory;
 };
 struct rtv
 {
@@ -290,8 +879,26 @@ bool full_screen = false;
 
 bool initialise_window(HINSTANCE hInstance,int ShowWnd,bool fullscreen);
 
-// main application loop
+// main application loop, pumps window messages while the simulation and render threads run
 void mainloop();
+void simulation_loop();
+void render_loop();
+void process_input();
+void simulate(float delta_time);
+void publish_snapshot();
+void apply_snapshot(const frame_snapshot& snapshot);
+void build_batches(const frame_snapshot& snapshot, UINT* instance_list);
+void select_lods(const frame_snapshot& snapshot);
+void cull_clusters(const frame_snapshot& snapshot);
+void begin_frame_scratch(FrameResource* frame_resource, int visible_count); // points the per frame lists at the frame resource's arena
+int select_terrain(const frame_snapshot& snapshot, terrain_chunk* chunks);
+void report_draw_statistics();
+void optimize_geometry(std::vector<mesh_optimize_task<Vertex>>& tasks);
+void simplify_geometry(std::vector<mesh_simplify_task<Vertex>>& tasks);
+bool load_model(const std::string& path);
+aabb transform_bounds(const aabb& bounds, const XMFLOAT4X4& world);
+frustum frustum_from_matrix(FXMMATRIX view_projection);
+int pick(int x, int y, float& distance);
 
 // callback function for windows messages
 LRESULT CALLBACK WndProc(HWND hWnd,
@@ -318,7 +925,7 @@ bool init_d3d(); // initializes direct3d 12
 bool init_dxgi();
 bool initialise_swap_chain();
 bool initialise_work_submission();
-void Update(); // update the game logic
+void Update(); // copy the latest simulation snapshot into the constant buffers
 
 void UpdatePipeline(); // update the direct3d pipeline (update command lists)
 
@@ -327,18 +934,21 @@ void Render(); // execute the command list
 void Cleanup(); // release com ojects and clean up memory
 
 void WaitForPreviousFrame(); 
+bool signal_queue_timeline(); // after every ExecuteCommandLists, see queue_fence
 bool build_shaders_and_input_layout();
 bool build_pso();
 bool build_geometry();
-bool build_constant_views();
 bool build_materials();
+bool build_material_buffer(); // after every material has been added
 bool build_descriptor_heaps();
 bool build_frame_resources();
 
 
 //Optional Geometry Objects we can draw
 bool build_cube();
-bool build_grid();
+bool build_terrain();
+bool build_primitives();
+Geometry* add_procedural(const wchar_t* name, const aabb& bounds, mesh_counts counts, mesh_destination& destination);
 
 bool build_root_signature();
 void build_viewport_scissor_rect();
@@ -349,6 +959,7 @@ bool adapter_found = false; // set this to true when a good one was found
 
 std::vector< D3D12_INPUT_ELEMENT_DESC> input_layout;
 ID3D12PipelineState* pso; // pso containing a pipeline state
+std::vector<ID3D12PipelineState*> pipeline_states; // every pso, indexed by Material::pso_index
 
 ID3D12RootSignature* rootSignature; // root signature defines data shaders will access
 
@@ -356,21 +967,134 @@ D3D12_VIEWPORT viewport; // area that output from rasterizer will be stretched t
 
 D3D12_RECT scissorRect; // the area to draw in. pixels outside that area will not be drawn onto
 
+//Simulation runs at a fixed rate on its own thread, independent of how often WndProc sees key repeats
+const float simulation_step = 1.0f / 60.0f;
+input_queue input_events; // message thread -> simulation thread
+snapshot_buffer<frame_snapshot> frame_snapshots; // simulation thread -> render thread
+bool keys_down[256]; // owned by the simulation thread
+
+//Transform hierarchy, owned by the simulation thread
+scene_graph scene;
+//Changes the render thread may not have seen yet, trimmed once consumed_tick passes them
+struct logged_change
+{
+	UINT64 tick;
+	int object;
+};
+std::vector<logged_change> change_log;
+std::vector<UINT64> snapshot_stamp; // last snapshot each object was written into, used to skip duplicates
+std::atomic<UINT64> consumed_tick{ 0 }; // newest snapshot the render thread has picked up
+//World space bounds of every object and the hierarchy over them, owned by the simulation thread
+std::vector<aabb> object_bounds;
+dynamic_bvh scene_bvh;
+int selected_object = -1; // last object clicked on, owned by the simulation thread
+
+//Render thread copy of every world matrix. Each frame resource has its own constant buffer, so a change has
+//to be written frame_buffer_count times before every copy is current again.
+std::vector<XMFLOAT4X4> render_world;
+std::vector<int> frames_dirty;
+std::vector<int> dirty_objects;
+//Level of detail per object, chosen on the render thread from how many pixels a level's error covers. lod_objects
+//are bounding spheres kept current with render_world, lod_visible gathers the visible ones into whole packets.
+lod_spheres lod_objects;
+lod_spheres lod_visible;
+frame_vector<float> lod_pixels; // per visible object, pixels one unit of object space error covers
+std::vector<uint8_t> object_lods; // level each object was last drawn at, selection starts from it
+const float lod_max_pixels = 1.0f; // largest projected error a level may have
+const float lod_hysteresis = 0.25f; // going coarser needs the error to fit this much under lod_max_pixels
+
+//Visible objects that share a mesh and material, drawn with a single instanced draw
+struct draw_batch
+{
+	Geometry* geometry;
+	int first_instance; // offset into the frame's instance_objects
+	int instance_count;
+	int first_cluster_draw; // -1 when the whole mesh is drawn instanced, otherwise one cluster_draw per instance
+	int lod; // into geometry->lods
+};
+//Sort key per visible object, most significant first: pass | pipeline | material | mesh | lod | depth.
+//Sorting groups draws by the state that is most expensive to change, and front to back within a mesh.
+struct draw_key
+{
+	uint64_t key;
+	int object;
+};
+const int draw_key_depth_bits = 21;
+const int draw_key_lod_shift = 21; // 3 bits, max_mesh_lods
+const int draw_key_mesh_shift = 24; // 16 bits
+const int draw_key_material_shift = 40; // 12 bits
+const int draw_key_pipeline_shift = 52; // 8 bits
+const int draw_key_pass_shift = 60; // 4 bits
+const float draw_key_depth_range = 1000.0f; // matches the far plane
+//Rebuilt by the render thread every frame in the frame resource's arena, see begin_frame_scratch()
+frame_vector<draw_batch> draw_batches;
+frame_vector<draw_key> draw_keys;
+frame_vector<draw_key> draw_keys_scratch;
+//Meshes split into more than one meshlet are drawn an object at a time, with only the clusters that survive
+//culling. Each cluster_draw is one such object, its index ranges start at range_offset in cluster_ranges.
+struct cluster_draw
+{
+	int instance; // into the frame's instance_objects
+	int range_offset;
+	int range_count;
+	int visible_meshlets;
+};
+frame_vector<cluster_draw> cluster_draws;
+frame_vector<index_range> cluster_ranges;
+
+//Per frame counts of the state changes recording actually issued, reported as averages every few hundred frames
+struct draw_statistics
+{
+	int frames;
+	int draws;
+	int pipeline_changes;
+	int table_changes;
+	int meshlets_tested;
+	int meshlets_drawn;
+	int terrain_chunks;
+	int triangles;
+	double sort_milliseconds;
+	double cull_milliseconds;
+	UINT64 bytes_reclaimed; // by the release queue
+	UINT64 scratch_bytes; // taken from the frame arenas
+	int scratch_heap_allocations; // blocks the frame arenas took, zero once they fit a frame. See heap_allocation_count for the rest
+};
+draw_statistics draw_stats = {};
+
 std::vector<Material*> materials;
 std::vector<Texture*> textures;
+//Every material's MaterialData, drawn from by index so draws never switch descriptor tables for their textures
+ID3D12Resource* material_buffer = nullptr;
+gpu_allocation material_buffer_memory;
+UINT64 material_buffer_ready = 0; // copy ticket
 std::vector<Geometry*> objects;
+int mesh_count = 0;
+mesh_pool meshes;
+const int mesh_pool_vertex_capacity = 1 << 20;
+const int mesh_pool_index_capacity = 1 << 22;
+//Copies of the cube laid out in a grid, they all share its buffers and are drawn as one batch
+const int cube_grid_size = 32;
+std::string model_path; // OBJ or glTF file named on the command line, loaded next to the cubes
+const int model_lod_count = 5; // levels of detail simplified for every imported mesh, including full detail
+//Ground under the scene, see terrain.h. The heightmap is a texture the terrain vertex shader samples, the
+//quadtree keeps the height bounds of every node on the CPU for selection.
+terrain_quadtree terrain;
+const int terrain_heightmap_resolution = 1024;
+ID3D12Resource* terrain_heightmap = nullptr;
+gpu_allocation terrain_heightmap_memory;
+UINT64 terrain_heightmap_ready = 0; // copy ticket
+int terrain_heightmap_srv = -1; // slot in srv_staging
+Geometry terrain_grid = {}; // the shared chunk grid in the mesh pool, not an object
+int terrain_chunk_count = 0; // selected this frame
+ID3D12PipelineState* terrain_pso;
 //Descriptor Heaps - Stores data outside of PSO (SRVs, RTVs, DSVs ect..)
 
 depth* main_depth;
 rtv* main_rtv;
-ID3D12DescriptorHeap* srv_heap;
-ID3D12DescriptorHeap* cbv_heap;
-FrameResource* frame;
 
 
 
 
-int cbv_offset = 0;
 XMFLOAT4X4 cameraProjMat;
 XMFLOAT4X4 cameraViewMat;
 
@@ -384,3 +1108,5 @@ void load_texture();
 
 Shader* shader_vertex;
 Shader* shader_pixel;
+Shader* shader_terrain_vertex;
+Shader* shader_terrain_pixel;
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bvh.h"
+#include "simd.h"
+
+//Triangles are tested a packet at a time, see simd.h for the width.
+//Up to packet_width triangles stored as structure of arrays, one packet per bvh leaf.
+//Unused lanes have zero edges, so their determinant is zero and they never hit.
+struct triangle_packet
+{
+	float v0[3][packet_width];
+	float edge1[3][packet_width];
+	float edge2[3][packet_width];
+	int triangle[packet_width];
+};
+
+//Object space triangle bvh for one mesh, built once at load and used for picking and other ray queries
+struct triangle_bvh
+{
+	//positions points at the x of the first vertex, stride is the byte distance between vertices
+	void build(const float* positions, int stride, const int* indices, int index_count)
+	{
+		int triangle_count = index_count / 3;
+		std::vector<aabb> triangle_bounds(triangle_count);
+		std::vector<float> corners(triangle_count * 9);
+		for (int t = 0; t < triangle_count; t++)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				const float* position = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + indices[t * 3 + corner] * stride);
+				triangle_bounds[t].grow(position);
+				for (int axis = 0; axis < 3; axis++)
+				{
+					corners[t * 9 + corner * 3 + axis] = position[axis];
+				}
+			}
+		}
+
+		tree.max_leaf_items = packet_width;
+		tree.items_per_test = packet_width;
+		tree.build(triangle_bounds);
+
+		//Leaves never hold more than packet_width triangles, so every leaf becomes exactly one packet
+		packets.clear();
+		leaf_packet.assign(tree.nodes.size(), -1);
+		for (int n = 0; n < (int)tree.nodes.size(); n++)
+		{
+			const bvh_node& node = tree.nodes[n];
+			if (!node.is_leaf())
+			{
+				continue;
+			}
+			leaf_packet[n] = (int)packets.size();
+			packets.emplace_back();
+			triangle_packet& packet = packets.back();
+			memset(&packet, 0, sizeof(packet));
+			for (int lane = 0; lane < node.count; lane++)
+			{
+				int t = tree.item_indices[node.first + lane];
+				const float* corner = &corners[t * 9];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					packet.v0[axis][lane] = corner[axis];
+					packet.edge1[axis][lane] = corner[3 + axis] - corner[axis];
+					packet.edge2[axis][lane] = corner[6 + axis] - corner[axis];
+				}
+				packet.triangle[lane] = t;
+			}
+		}
+	}
+
+	//Closest hit in object space, returns the triangle (or -1) and the ray parameter of the hit
+	int intersect(const float origin[3], const float direction[3], float max_t, float& hit_t) const
+	{
+		int hit_triangle = -1;
+		simd_float origin_x = simd_set(origin[0]);
+		simd_float origin_y = simd_set(origin[1]);
+		simd_float origin_z = simd_set(origin[2]);
+		simd_float direction_x = simd_set(direction[0]);
+		simd_float direction_y = simd_set(direction[1]);
+		simd_float direction_z = simd_set(direction[2]);
+
+		tree.query_ray_leaves(origin, direction, max_t, [&](int leaf, float& closest)
+		{
+			const triangle_packet& packet = packets[leaf_packet[leaf]];
+
+			//Möller–Trumbore across every lane at once
+			simd_float edge1_x = simd_load(packet.edge1[0]);
+			simd_float edge1_y = simd_load(packet.edge1[1]);
+			simd_float edge1_z = simd_load(packet.edge1[2]);
+			simd_float edge2_x = simd_load(packet.edge2[0]);
+			simd_float edge2_y = simd_load(packet.edge2[1]);
+			simd_float edge2_z = simd_load(packet.edge2[2]);
+
+			//p = direction x edge2
+			simd_float p_x = simd_sub(simd_mul(direction_y, edge2_z), simd_mul(direction_z, edge2_y));
+			simd_float p_y = simd_sub(simd_mul(direction_z, edge2_x), simd_mul(direction_x, edge2_z));
+			simd_float p_z = simd_sub(simd_mul(direction_x, edge2_y), simd_mul(direction_y, edge2_x));
+			simd_float determinant = simd_add(simd_add(simd_mul(edge1_x, p_x), simd_mul(edge1_y, p_y)), simd_mul(edge1_z, p_z));
+			simd_float valid = simd_greater_equal(simd_abs(determinant), simd_set(1e-12f));
+			simd_float inverse = simd_div(simd_set(1.0f), determinant);
+
+			simd_float s_x = simd_sub(origin_x, simd_load(packet.v0[0]));
+			simd_float s_y = simd_sub(origin_y, simd_load(packet.v0[1]));
+			simd_float s_z = simd_sub(origin_z, simd_load(packet.v0[2]));
+			simd_float u = simd_mul(simd_add(simd_add(simd_mul(s_x, p_x), simd_mul(s_y, p_y)), simd_mul(s_z, p_z)), inverse);
+
+			//q = s x edge1
+			simd_float q_x = simd_sub(simd_mul(s_y, edge1_z), simd_mul(s_z, edge1_y));
+			simd_float q_y = simd_sub(simd_mul(s_z, edge1_x), simd_mul(s_x, edge1_z));
+			simd_float q_z = simd_sub(simd_mul(s_x, edge1_y), simd_mul(s_y, edge1_x));
+			simd_float v = simd_mul(simd_add(simd_add(simd_mul(direction_x, q_x), simd_mul(direction_y, q_y)), simd_mul(direction_z, q_z)), inverse);
+			simd_float t = simd_mul(simd_add(simd_add(simd_mul(edge2_x, q_x), simd_mul(edge2_y, q_y)), simd_mul(edge2_z, q_z)), inverse);
+
+			simd_float zero = simd_set(0.0f);
+			valid = simd_and(valid, simd_greater_equal(u, zero));
+			valid = simd_and(valid, simd_greater_equal(v, zero));
+			valid = simd_and(valid, simd_greater_equal(simd_set(1.0f), simd_add(u, v)));
+			valid = simd_and(valid, simd_greater_equal(t, zero));
+			valid = simd_and(valid, simd_less(t, simd_set(closest)));
+
+			int mask = simd_mask(valid);
+			if (mask == 0)
+			{
+				return;
+			}
+
+			alignas(32) float distances[packet_width];
+			simd_store(distances, simd_select(valid, t, simd_set(FLT_MAX)));
+			for (int lane = 0; lane < packet_width; lane++)
+			{
+				if ((mask & (1 << lane)) && distances[lane] < closest)
+				{
+					closest = distances[lane];
+					hit_triangle = packet.triangle[lane];
+				}
+			}
+		}, hit_t);
+		return hit_triangle;
+	}
+
+	bvh tree;
+	std::vector<triangle_packet> packets;
+	std::vector<int> leaf_packet; // packet index for each leaf node, -1 for interior nodes
+};
@@ -0,0 +1,825 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <emmintrin.h>
+
+#include "bvh.h"
+#include "mesh_lod.h"
+#include "vertex_format.h"
+
+//Grid, sphere, capsule, cylinder, torus and subdivided box generators. Each shape reports its vertex and index
+//counts and bounds up front, so the caller can map exactly enough memory (and pick the quantization), then the
+//generator writes packed vertices and indices straight into it. Nothing is staged, and the destination is only
+//ever written front to back, which suits write combined upload memory.
+//Every shape is rows of vertices swept along its surface, so a row is generated four vertices at a time from
+//values that stay fixed along the row (height, ring radius) and values that stay fixed down a column (angle, u).
+//Shapes can ask for coarser levels of detail too. They follow the full detail index list and reuse its vertices,
+//skipping every other row and column per level, so the counts have to halve evenly for a level to be made.
+
+//Mapped memory a generator writes one mesh into
+struct mesh_destination
+{
+	packed_vertex* vertices;
+	void* indices; // uint16_t, or uint32_t when wide_indices
+	bool wide_indices;
+	position_quantization quantization;
+};
+
+struct mesh_counts
+{
+	int vertex_count;
+	int index_count;
+};
+
+//Surfaces of revolution share one table of column angles on the stack
+const int max_procedural_slices = 4096;
+
+struct grid_shape
+{
+	float width; // along x
+	float depth; // along z
+	int columns;
+	int rows;
+	int lod_count = 1; // levels of detail wanted, up to max_mesh_lods
+};
+
+struct sphere_shape
+{
+	float radius;
+	int slices;
+	int stacks;
+	int lod_count = 1;
+};
+
+struct capsule_shape
+{
+	float radius;
+	float height; // of the cylinder between the two hemispheres
+	int slices;
+	int stacks; // per hemisphere
+	int lod_count = 1;
+};
+
+struct cylinder_shape
+{
+	float radius;
+	float height;
+	int slices;
+	int stacks;
+	int lod_count = 1;
+};
+
+struct torus_shape
+{
+	float major_radius; // centre to the middle of the tube
+	float minor_radius; // of the tube
+	int slices; // around the centre
+	int sides; // around the tube
+	int lod_count = 1;
+};
+
+struct box_shape
+{
+	float size[3];
+	int divisions[3];
+	int lod_count = 1;
+};
+
+//Four vertices at a time
+
+inline __m128i quantize_snorm16(__m128 value, float offset, float inverse_scale)
+{
+	value = _mm_mul_ps(_mm_sub_ps(value, _mm_set1_ps(offset)), _mm_set1_ps(inverse_scale));
+	value = _mm_max_ps(_mm_set1_ps(-1.0f), _mm_min_ps(_mm_set1_ps(1.0f), value));
+	return _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(32767.0f)));
+}
+
+//Half precision bits for values in [0, 65504], smaller than the smallest normal half (6.1e-5) become zero
+inline __m128i encode_half4(__m128 value)
+{
+	__m128i bits = _mm_castps_si128(value);
+	// round to nearest even on the 13 bits that are dropped
+	__m128i rounding = _mm_add_epi32(_mm_set1_epi32(0xfff), _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1)));
+	__m128i half = _mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(bits, rounding), 13), _mm_set1_epi32(112 << 10));
+	return _mm_and_si128(half, _mm_castps_si128(_mm_cmpge_ps(value, _mm_set1_ps(6.103515625e-05f))));
+}
+
+//Same as encode_qtangent for four unit quaternions, all with the same handedness
+inline void encode_qtangent4(__m128 x, __m128 y, __m128 z, __m128 w, float handedness, __m128i encoded[4])
+{
+	// flip the quaternions with a negative w, then the whole lot for a mirrored bitangent
+	__m128 sign = _mm_and_ps(w, _mm_set1_ps(-0.0f));
+	__m128 flip = _mm_set1_ps(handedness < 0.0f ? -0.0f : 0.0f);
+	__m128 scale = _mm_set1_ps(32767.0f);
+	encoded[0] = _mm_cvtps_epi32(_mm_mul_ps(_mm_xor_ps(_mm_xor_ps(x, sign), flip), scale));
+	encoded[1] = _mm_cvtps_epi32(_mm_mul_ps(_mm_xor_ps(_mm_xor_ps(y, sign), flip), scale));
+	encoded[2] = _mm_cvtps_epi32(_mm_mul_ps(_mm_xor_ps(_mm_xor_ps(z, sign), flip), scale));
+	w = _mm_max_ps(_mm_xor_ps(w, sign), _mm_set1_ps(qtangent_bias));
+	encoded[3] = _mm_cvtps_epi32(_mm_mul_ps(_mm_xor_ps(w, flip), scale));
+}
+
+//Transposes four vertices' fields (32 bit lanes, each already in 16 bit range) into four packed_vertex and writes
+//count of them, each as one 16 byte store of the position and QTangent and one 4 byte store of the uv.
+inline void store_packed4(packed_vertex* out, int count, __m128i x, __m128i y, __m128i z, const __m128i qtangent[4], __m128i u, __m128i v)
+{
+	__m128i position_xy = _mm_packs_epi32(x, y); // x0 x1 x2 x3 y0 y1 y2 y3
+	__m128i position_zw = _mm_packs_epi32(z, _mm_setzero_si128());
+	__m128i qtangent_xy = _mm_packs_epi32(qtangent[0], qtangent[1]);
+	__m128i qtangent_zw = _mm_packs_epi32(qtangent[2], qtangent[3]);
+	__m128i texcoord = _mm_packs_epi32(u, v); // halves of values up to 1.99 fit below 0x8000, so nothing saturates
+
+	position_xy = _mm_unpacklo_epi16(position_xy, _mm_srli_si128(position_xy, 8)); // x0 y0 x1 y1 ...
+	position_zw = _mm_unpacklo_epi16(position_zw, _mm_srli_si128(position_zw, 8));
+	qtangent_xy = _mm_unpacklo_epi16(qtangent_xy, _mm_srli_si128(qtangent_xy, 8));
+	qtangent_zw = _mm_unpacklo_epi16(qtangent_zw, _mm_srli_si128(qtangent_zw, 8));
+	texcoord = _mm_unpacklo_epi16(texcoord, _mm_srli_si128(texcoord, 8)); // u0 v0 u1 v1 ...
+
+	__m128i position_low = _mm_unpacklo_epi32(position_xy, position_zw);
+	__m128i position_high = _mm_unpackhi_epi32(position_xy, position_zw);
+	__m128i qtangent_low = _mm_unpacklo_epi32(qtangent_xy, qtangent_zw);
+	__m128i qtangent_high = _mm_unpackhi_epi32(qtangent_xy, qtangent_zw);
+	__m128i vertices[4] = {
+		_mm_unpacklo_epi64(position_low, qtangent_low),
+		_mm_unpackhi_epi64(position_low, qtangent_low),
+		_mm_unpacklo_epi64(position_high, qtangent_high),
+		_mm_unpackhi_epi64(position_high, qtangent_high),
+	};
+	alignas(16) uint32_t texcoords[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(texcoords), texcoord);
+	static_assert(sizeof(packed_vertex) == sizeof(__m128i) + sizeof(uint32_t), "a packed vertex is a 128 bit store and a 32 bit one");
+	for (int i = 0; i < count; i++)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), vertices[i]);
+		memcpy(out[i].texcoord, &texcoords[i], sizeof(uint32_t));
+	}
+}
+
+//Indices
+
+inline __m128i add_index_lanes(__m128i a, __m128i b, uint16_t) { return _mm_add_epi16(a, b); }
+inline __m128i add_index_lanes(__m128i a, __m128i b, uint32_t) { return _mm_add_epi32(a, b); }
+inline __m128i set_index_lanes(int value, uint16_t) { return _mm_set1_epi16((short)value); }
+inline __m128i set_index_lanes(int value, uint32_t) { return _mm_set1_epi32(value); }
+
+//columns x rows quads over vertex rows stride vertices long, each quad spanning step vertices along a row and
+//row_step rows. Full detail is a step of one, coarser levels of detail skip vertices.
+struct strip_quads
+{
+	int first_vertex;
+	int columns;
+	int rows;
+	int stride;
+	int step;
+	int row_step;
+};
+
+//Two clockwise triangles for every quad. Four quads (24 indices) are written per step from a pattern that only
+//needs the first quad's corner added.
+template <typename IndexType>
+IndexType* write_strip_indices(IndexType* out, const strip_quads& quads)
+{
+	int down = quads.stride * quads.row_step;
+	const int lanes = 16 / sizeof(IndexType);
+	IndexType pattern[24];
+	for (int quad = 0; quad < 4; quad++)
+	{
+		int corner = quad * quads.step;
+		IndexType* corners = pattern + quad * 6;
+		corners[0] = (IndexType)corner;
+		corners[1] = (IndexType)(corner + down);
+		corners[2] = (IndexType)(corner + quads.step);
+		corners[3] = (IndexType)(corner + quads.step);
+		corners[4] = (IndexType)(corner + down);
+		corners[5] = (IndexType)(corner + down + quads.step);
+	}
+	__m128i pattern_lanes[24 / lanes];
+	for (int v = 0; v < 24 / lanes; v++)
+	{
+		pattern_lanes[v] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + v * lanes));
+	}
+
+	for (int row = 0; row < quads.rows; row++)
+	{
+		int row_start = quads.first_vertex + row * down;
+		int column = 0;
+		for (; column + 4 <= quads.columns; column += 4)
+		{
+			__m128i base = set_index_lanes(row_start + column * quads.step, IndexType());
+			for (int v = 0; v < 24 / lanes; v++)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + v * lanes), add_index_lanes(pattern_lanes[v], base, IndexType()));
+			}
+			out += 24;
+		}
+		for (; column < quads.columns; column++)
+		{
+			for (int i = 0; i < 6; i++)
+			{
+				*out++ = (IndexType)(row_start + column * quads.step + pattern[i]);
+			}
+		}
+	}
+	return out;
+}
+
+//Into whichever index width the destination has, returns the next index slot
+inline int write_strip_indices(const mesh_destination& destination, int first_index, const strip_quads& quads)
+{
+	if (destination.wide_indices)
+	{
+		uint32_t* start = static_cast<uint32_t*>(destination.indices) + first_index;
+		return first_index + (int)(write_strip_indices(start, quads) - start);
+	}
+	uint16_t* start = static_cast<uint16_t*>(destination.indices) + first_index;
+	return first_index + (int)(write_strip_indices(start, quads) - start);
+}
+
+//Flat patches
+
+//(columns + 1) x (rows + 1) vertices at origin + column * step_u + row * step_v. The front face is on the side of
+//step_v x step_u, texture coordinates run 0 to 1 along both steps.
+inline void write_patch(const mesh_destination& destination, int first_vertex, const float origin[3], const float step_u[3], const float step_v[3], int columns, int rows)
+{
+	const position_quantization& q = destination.quantization;
+	float inverse_scale[3] = { 1.0f / q.scale[0], 1.0f / q.scale[1], 1.0f / q.scale[2] };
+
+	// one frame for the whole patch, the tangent runs along step_u and the bitangent along step_v
+	float normal[3] = {
+		step_v[1] * step_u[2] - step_v[2] * step_u[1],
+		step_v[2] * step_u[0] - step_v[0] * step_u[2],
+		step_v[0] * step_u[1] - step_v[1] * step_u[0],
+	};
+	float tangent[4] = { step_u[0], step_u[1], step_u[2], 0.0f };
+	float bitangent[3] = {
+		normal[1] * tangent[2] - normal[2] * tangent[1],
+		normal[2] * tangent[0] - normal[0] * tangent[2],
+		normal[0] * tangent[1] - normal[1] * tangent[0],
+	};
+	tangent[3] = bitangent[0] * step_v[0] + bitangent[1] * step_v[1] + bitangent[2] * step_v[2] < 0.0f ? -1.0f : 1.0f;
+	int16_t frame[4];
+	encode_qtangent(normal, tangent, frame);
+	__m128i qtangent[4] = { _mm_set1_epi32(frame[0]), _mm_set1_epi32(frame[1]), _mm_set1_epi32(frame[2]), _mm_set1_epi32(frame[3]) };
+
+	packed_vertex* out = destination.vertices + first_vertex;
+	__m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	for (int row = 0; row <= rows; row++)
+	{
+		__m128 row_x = _mm_set1_ps(origin[0] + row * step_v[0]);
+		__m128 row_y = _mm_set1_ps(origin[1] + row * step_v[1]);
+		__m128 row_z = _mm_set1_ps(origin[2] + row * step_v[2]);
+		__m128i v = encode_half4(_mm_set1_ps(row / (float)rows));
+		for (int column = 0; column <= columns; column += 4)
+		{
+			__m128 index = _mm_add_ps(_mm_set1_ps((float)column), lane);
+			__m128 x = _mm_add_ps(row_x, _mm_mul_ps(index, _mm_set1_ps(step_u[0])));
+			__m128 y = _mm_add_ps(row_y, _mm_mul_ps(index, _mm_set1_ps(step_u[1])));
+			__m128 z = _mm_add_ps(row_z, _mm_mul_ps(index, _mm_set1_ps(step_u[2])));
+			__m128i u = encode_half4(_mm_mul_ps(index, _mm_set1_ps(1.0f / columns)));
+			store_packed4(out, std::min(4, columns + 1 - column),
+				quantize_snorm16(x, q.offset[0], inverse_scale[0]),
+				quantize_snorm16(y, q.offset[1], inverse_scale[1]),
+				quantize_snorm16(z, q.offset[2], inverse_scale[2]),
+				qtangent, u, v);
+			out += std::min(4, columns + 1 - column);
+		}
+	}
+}
+
+//Levels a patch can have, each one halves both counts. Flat patches lose nothing, so every level has zero error.
+inline int patch_lod_count(int columns, int rows, int wanted)
+{
+	int levels = 1;
+	while (levels < std::min(wanted, max_mesh_lods) && columns % (2 << (levels - 1)) == 0 && rows % (2 << (levels - 1)) == 0)
+	{
+		levels++;
+	}
+	return levels;
+}
+
+inline int grid_lod_count(const grid_shape& shape)
+{
+	return patch_lod_count(shape.columns, shape.rows, shape.lod_count);
+}
+
+inline mesh_counts procedural_counts(const grid_shape& shape)
+{
+	mesh_counts counts = { (shape.columns + 1) * (shape.rows + 1), 0 };
+	for (int lod = 0; lod < grid_lod_count(shape); lod++)
+	{
+		counts.index_count += (shape.columns >> lod) * (shape.rows >> lod) * 6;
+	}
+	return counts;
+}
+
+inline void procedural_lods(const grid_shape& shape, lod_chain& chain)
+{
+	chain.count = grid_lod_count(shape);
+	int first_index = 0;
+	for (int lod = 0; lod < chain.count; lod++)
+	{
+		int index_count = (shape.columns >> lod) * (shape.rows >> lod) * 6;
+		chain.levels[lod] = { first_index, index_count, 0.0f };
+		first_index += index_count;
+	}
+}
+
+inline aabb procedural_bounds(const grid_shape& shape)
+{
+	aabb bounds;
+	float corner[3] = { -0.5f * shape.width, 0.0f, -0.5f * shape.depth };
+	bounds.grow(corner);
+	corner[0] = -corner[0];
+	corner[2] = -corner[2];
+	bounds.grow(corner);
+	return bounds;
+}
+
+//Flat in xz around the origin, facing up
+inline void generate(const grid_shape& shape, const mesh_destination& destination)
+{
+	float origin[3] = { -0.5f * shape.width, 0.0f, -0.5f * shape.depth };
+	float step_u[3] = { shape.width / shape.columns, 0.0f, 0.0f };
+	float step_v[3] = { 0.0f, 0.0f, shape.depth / shape.rows };
+	write_patch(destination, 0, origin, step_u, step_v, shape.columns, shape.rows);
+	int index = 0;
+	for (int lod = 0; lod < grid_lod_count(shape); lod++)
+	{
+		index = write_strip_indices(destination, index, { 0, shape.columns >> lod, shape.rows >> lod, shape.columns + 1, 1 << lod, 1 << lod });
+	}
+}
+
+//Faces of a box, two across each axis and spanned by the other two
+inline int box_lod_count(const box_shape& shape)
+{
+	int levels = max_mesh_lods;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		levels = std::min(levels, patch_lod_count(shape.divisions[(axis + 1) % 3], shape.divisions[(axis + 2) % 3], shape.lod_count));
+	}
+	return levels;
+}
+
+inline int box_lod_index_count(const box_shape& shape, int lod)
+{
+	int index_count = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		index_count += 2 * (shape.divisions[(axis + 1) % 3] >> lod) * (shape.divisions[(axis + 2) % 3] >> lod) * 6;
+	}
+	return index_count;
+}
+
+inline mesh_counts procedural_counts(const box_shape& shape)
+{
+	mesh_counts counts = { 0, 0 };
+	for (int axis = 0; axis < 3; axis++)
+	{
+		counts.vertex_count += 2 * (shape.divisions[(axis + 1) % 3] + 1) * (shape.divisions[(axis + 2) % 3] + 1);
+	}
+	for (int lod = 0; lod < box_lod_count(shape); lod++)
+	{
+		counts.index_count += box_lod_index_count(shape, lod);
+	}
+	return counts;
+}
+
+inline void procedural_lods(const box_shape& shape, lod_chain& chain)
+{
+	chain.count = box_lod_count(shape);
+	int first_index = 0;
+	for (int lod = 0; lod < chain.count; lod++)
+	{
+		chain.levels[lod] = { first_index, box_lod_index_count(shape, lod), 0.0f };
+		first_index += chain.levels[lod].index_count;
+	}
+}
+
+inline aabb procedural_bounds(const box_shape& shape)
+{
+	aabb bounds;
+	float corner[3] = { -0.5f * shape.size[0], -0.5f * shape.size[1], -0.5f * shape.size[2] };
+	bounds.grow(corner);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		corner[axis] = -corner[axis];
+	}
+	bounds.grow(corner);
+	return bounds;
+}
+
+//Centred on the origin, every face is its own patch so the edges stay hard
+inline void generate(const box_shape& shape, const mesh_destination& destination)
+{
+	int vertex = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int u_axis = (axis + 1) % 3;
+		int v_axis = (axis + 2) % 3;
+		for (int side = 0; side < 2; side++)
+		{
+			// the patch faces step_v x step_u, so one of the steps flips with the side
+			float direction = side == 0 ? 1.0f : -1.0f;
+			float origin[3];
+			origin[axis] = 0.5f * shape.size[axis] * direction;
+			origin[u_axis] = -0.5f * shape.size[u_axis] * direction;
+			origin[v_axis] = -0.5f * shape.size[v_axis];
+			float step_u[3] = { 0.0f, 0.0f, 0.0f };
+			float step_v[3] = { 0.0f, 0.0f, 0.0f };
+			step_u[u_axis] = shape.size[u_axis] / shape.divisions[u_axis] * direction;
+			step_v[v_axis] = shape.size[v_axis] / shape.divisions[v_axis];
+			write_patch(destination, vertex, origin, step_u, step_v, shape.divisions[u_axis], shape.divisions[v_axis]);
+			vertex += (shape.divisions[u_axis] + 1) * (shape.divisions[v_axis] + 1);
+		}
+	}
+
+	// all six faces of one level, then the next level
+	int index = 0;
+	for (int lod = 0; lod < box_lod_count(shape); lod++)
+	{
+		int first_vertex = 0;
+		for (int face = 0; face < 6; face++)
+		{
+			int columns = shape.divisions[(face / 2 + 1) % 3];
+			int rows = shape.divisions[(face / 2 + 2) % 3];
+			index = write_strip_indices(destination, index, { first_vertex, columns >> lod, rows >> lod, columns + 1, 1 << lod, 1 << lod });
+			first_vertex += (columns + 1) * (rows + 1);
+		}
+	}
+}
+
+//Surfaces of revolution
+
+//One ring of vertices around the y axis
+struct revolution_ring
+{
+	float radius;
+	float y;
+	float normal_radial; // normal = (normal_radial * cos, normal_y, normal_radial * sin)
+	float normal_y;
+	float v;
+};
+
+//Rings joined by strips. Separate segments do not share rings, so hard edges (cylinder caps) get their own
+//vertices. The profile's curvature bounds how far a coarser level's strips cut inside the real surface.
+struct revolution_segment
+{
+	int first_ring;
+	int spans; // strips, to ring first_ring + spans
+	float curvature_radius; // zero where the profile is straight
+	float span_angle; // the profile turns through this much per strip
+};
+
+struct revolution_layout
+{
+	int ring_count;
+	int slices;
+	float max_radius; // of any ring
+	int segment_count;
+	revolution_segment segments[3];
+};
+
+inline int revolution_slices(int slices)
+{
+	return std::max(3, std::min(slices, max_procedural_slices));
+}
+
+//Each level halves the slices, and the rings of segments whose span count halves evenly
+inline int revolution_lod_count(const revolution_layout& layout, int wanted)
+{
+	int levels = 1;
+	while (levels < std::min(wanted, max_mesh_lods) && layout.slices % (2 << (levels - 1)) == 0 && (layout.slices >> levels) >= 3)
+	{
+		levels++;
+	}
+	return levels;
+}
+
+inline int revolution_row_step(int spans, int lod)
+{
+	int step = 1 << lod;
+	while (spans % step != 0)
+	{
+		step >>= 1;
+	}
+	return step;
+}
+
+inline int revolution_lod_index_count(const revolution_layout& layout, int lod)
+{
+	int index_count = 0;
+	for (int s = 0; s < layout.segment_count; s++)
+	{
+		const revolution_segment& segment = layout.segments[s];
+		index_count += segment.spans / revolution_row_step(segment.spans, lod) * (layout.slices >> lod) * 6;
+	}
+	return index_count;
+}
+
+inline mesh_counts revolution_counts(const revolution_layout& layout, int lod_count)
+{
+	mesh_counts counts = { layout.ring_count * (layout.slices + 1), 0 };
+	for (int lod = 0; lod < lod_count; lod++)
+	{
+		counts.index_count += revolution_lod_index_count(layout, lod);
+	}
+	return counts;
+}
+
+//Errors are the sagitta of the longest chord around the axis plus that of the longest chord along the profile
+inline void revolution_lods(const revolution_layout& layout, int lod_count, lod_chain& chain)
+{
+	const float pi = 3.14159265f;
+	chain.count = lod_count;
+	int first_index = 0;
+	for (int lod = 0; lod < lod_count; lod++)
+	{
+		float error = layout.max_radius * (1.0f - std::cos(pi * (1 << lod) / layout.slices));
+		float profile_error = 0.0f;
+		for (int s = 0; s < layout.segment_count; s++)
+		{
+			const revolution_segment& segment = layout.segments[s];
+			float angle = segment.span_angle * revolution_row_step(segment.spans, lod);
+			profile_error = std::max(profile_error, segment.curvature_radius * (1.0f - std::cos(0.5f * angle)));
+		}
+		chain.levels[lod] = { first_index, revolution_lod_index_count(layout, lod), error + profile_error };
+		first_index += chain.levels[lod].index_count;
+	}
+}
+
+//Rings from ring(0) to ring(ring_count - 1), each slices + 1 vertices with the seam repeated for texturing, then
+//the strips of every level. Rings have to run from the top of the profile to the bottom. Rings of radius zero
+//(poles, cap centres) leave one zero area triangle per quad, which the rasterizer drops.
+template <typename Profile>
+void write_revolution(const mesh_destination& destination, const Profile& ring, const revolution_layout& layout, int lod_count)
+{
+	const position_quantization& q = destination.quantization;
+	float inverse_scale[3] = { 1.0f / q.scale[0], 1.0f / q.scale[1], 1.0f / q.scale[2] };
+	int slices = layout.slices;
+
+	// the angle only depends on the column, the tables are padded to a whole packet
+	alignas(16) float cosines[max_procedural_slices + 4];
+	alignas(16) float sines[max_procedural_slices + 4];
+	alignas(16) float texcoord_u[max_procedural_slices + 4];
+	// the rotation about y by the angle as a quaternion, cos and sin of the half angle
+	alignas(16) float half_cosines[max_procedural_slices + 4];
+	alignas(16) float half_sines[max_procedural_slices + 4];
+	for (int column = 0; column <= slices + 3; column++)
+	{
+		// the seam column repeats column 0 exactly so the mesh stays watertight. Going from +x towards -z keeps
+		// the strips clockwise seen from outside.
+		double angle = 2.0 * 3.14159265358979323846 * (column % slices) / slices;
+		cosines[column] = (float)std::cos(angle);
+		sines[column] = (float)-std::sin(angle);
+		half_cosines[column] = (float)std::cos(angle * 0.5);
+		half_sines[column] = (float)std::sin(angle * 0.5);
+		texcoord_u[column] = column / (float)slices;
+	}
+
+	packed_vertex* out = destination.vertices;
+	for (int r = 0; r < layout.ring_count; r++)
+	{
+		revolution_ring current = ring(r);
+		__m128 radius = _mm_set1_ps(current.radius);
+		// the frame at angle zero, u runs towards -z there and v down the profile, which is mirrored. Every other
+		// column's frame is this one turned about y.
+		float normal[3] = { current.normal_radial, current.normal_y, 0.0f };
+		float tangent[3] = { 0.0f, 0.0f, -1.0f };
+		float bitangent[3] = { -current.normal_y, current.normal_radial, 0.0f }; // normal x tangent
+		float frame[4];
+		quaternion_from_frame(tangent, bitangent, normal, frame);
+		__m128 frame_x = _mm_set1_ps(frame[0]);
+		__m128 frame_y = _mm_set1_ps(frame[1]);
+		__m128 frame_z = _mm_set1_ps(frame[2]);
+		__m128 frame_w = _mm_set1_ps(frame[3]);
+		__m128i y = quantize_snorm16(_mm_set1_ps(current.y), q.offset[1], inverse_scale[1]);
+		__m128i v = encode_half4(_mm_set1_ps(current.v));
+		for (int column = 0; column <= slices; column += 4)
+		{
+			__m128 cosine = _mm_load_ps(cosines + column);
+			__m128 sine = _mm_load_ps(sines + column);
+			// (0, s, 0, c) * frame
+			__m128 c = _mm_load_ps(half_cosines + column);
+			__m128 s = _mm_load_ps(half_sines + column);
+			__m128i qtangent[4];
+			encode_qtangent4(
+				_mm_add_ps(_mm_mul_ps(c, frame_x), _mm_mul_ps(s, frame_z)),
+				_mm_add_ps(_mm_mul_ps(c, frame_y), _mm_mul_ps(s, frame_w)),
+				_mm_sub_ps(_mm_mul_ps(c, frame_z), _mm_mul_ps(s, frame_x)),
+				_mm_sub_ps(_mm_mul_ps(c, frame_w), _mm_mul_ps(s, frame_y)),
+				-1.0f, qtangent);
+			store_packed4(out, std::min(4, slices + 1 - column),
+				quantize_snorm16(_mm_mul_ps(radius, cosine), q.offset[0], inverse_scale[0]),
+				y,
+				quantize_snorm16(_mm_mul_ps(radius, sine), q.offset[2], inverse_scale[2]),
+				qtangent, encode_half4(_mm_load_ps(texcoord_u + column)), v);
+			out += std::min(4, slices + 1 - column);
+		}
+	}
+
+	int index = 0;
+	for (int lod = 0; lod < lod_count; lod++)
+	{
+		for (int s = 0; s < layout.segment_count; s++)
+		{
+			const revolution_segment& segment = layout.segments[s];
+			int row_step = revolution_row_step(segment.spans, lod);
+			index = write_strip_indices(destination, index, { segment.first_ring * (slices + 1), slices >> lod, segment.spans / row_step, slices + 1, 1 << lod, row_step });
+		}
+	}
+}
+
+inline revolution_layout layout_of(const sphere_shape& shape)
+{
+	return { shape.stacks + 1, revolution_slices(shape.slices), shape.radius, 1, { { 0, shape.stacks, shape.radius, 3.14159265f / shape.stacks } } };
+}
+
+inline mesh_counts procedural_counts(const sphere_shape& shape)
+{
+	revolution_layout layout = layout_of(shape);
+	return revolution_counts(layout, revolution_lod_count(layout, shape.lod_count));
+}
+
+inline void procedural_lods(const sphere_shape& shape, lod_chain& chain)
+{
+	revolution_layout layout = layout_of(shape);
+	revolution_lods(layout, revolution_lod_count(layout, shape.lod_count), chain);
+}
+
+inline aabb procedural_bounds(const sphere_shape& shape)
+{
+	aabb bounds;
+	float corner[3] = { -shape.radius, -shape.radius, -shape.radius };
+	bounds.grow(corner);
+	corner[0] = corner[1] = corner[2] = shape.radius;
+	bounds.grow(corner);
+	return bounds;
+}
+
+inline void generate(const sphere_shape& shape, const mesh_destination& destination)
+{
+	revolution_layout layout = layout_of(shape);
+	write_revolution(destination, [&](int stack)
+	{
+		float angle = 3.14159265f * stack / shape.stacks; // from the top pole
+		float radial = std::sin(angle);
+		float up = std::cos(angle);
+		return revolution_ring{ shape.radius * radial, shape.radius * up, radial, up, stack / (float)shape.stacks };
+	}, layout, revolution_lod_count(layout, shape.lod_count));
+}
+
+//The two hemispheres, joined by the cylinder's single strip
+inline revolution_layout layout_of(const capsule_shape& shape)
+{
+	float span_angle = 3.14159265f * 0.5f / shape.stacks;
+	return { 2 * (shape.stacks + 1), revolution_slices(shape.slices), shape.radius, 3, {
+		{ 0, shape.stacks, shape.radius, span_angle },
+		{ shape.stacks, 1, 0.0f, 0.0f },
+		{ shape.stacks + 1, shape.stacks, shape.radius, span_angle } } };
+}
+
+inline mesh_counts procedural_counts(const capsule_shape& shape)
+{
+	revolution_layout layout = layout_of(shape);
+	return revolution_counts(layout, revolution_lod_count(layout, shape.lod_count));
+}
+
+inline void procedural_lods(const capsule_shape& shape, lod_chain& chain)
+{
+	revolution_layout layout = layout_of(shape);
+	revolution_lods(layout, revolution_lod_count(layout, shape.lod_count), chain);
+}
+
+inline aabb procedural_bounds(const capsule_shape& shape)
+{
+	aabb bounds;
+	float half_height = 0.5f * shape.height + shape.radius;
+	float corner[3] = { -shape.radius, -half_height, -shape.radius };
+	bounds.grow(corner);
+	corner[0] = corner[2] = shape.radius;
+	corner[1] = half_height;
+	bounds.grow(corner);
+	return bounds;
+}
+
+//Along y
+inline void generate(const capsule_shape& shape, const mesh_destination& destination)
+{
+	revolution_layout layout = layout_of(shape);
+	int rings = layout.ring_count;
+	write_revolution(destination, [&](int ring)
+	{
+		bool lower = ring > shape.stacks;
+		int stack = lower ? ring - 1 : ring;
+		float angle = 3.14159265f * 0.5f * stack / shape.stacks;
+		float radial = std::sin(angle);
+		float up = std::cos(angle);
+		float centre = (lower ? -0.5f : 0.5f) * shape.height;
+		return revolution_ring{ shape.radius * radial, centre + shape.radius * up, radial, up, ring / (float)(rings - 1) };
+	}, layout, revolution_lod_count(layout, shape.lod_count));
+}
+
+//A centre and rim ring for each cap, with the side's rings between them
+inline revolution_layout layout_of(const cylinder_shape& shape)
+{
+	int side_rings = shape.stacks + 1;
+	return { 4 + side_rings, revolution_slices(shape.slices), shape.radius, 3, {
+		{ 0, 1, 0.0f, 0.0f },
+		{ 2, shape.stacks, 0.0f, 0.0f },
+		{ 2 + side_rings, 1, 0.0f, 0.0f } } };
+}
+
+inline mesh_counts procedural_counts(const cylinder_shape& shape)
+{
+	revolution_layout layout = layout_of(shape);
+	return revolution_counts(layout, revolution_lod_count(layout, shape.lod_count));
+}
+
+inline void procedural_lods(const cylinder_shape& shape, lod_chain& chain)
+{
+	revolution_layout layout = layout_of(shape);
+	revolution_lods(layout, revolution_lod_count(layout, shape.lod_count), chain);
+}
+
+inline aabb procedural_bounds(const cylinder_shape& shape)
+{
+	aabb bounds;
+	float corner[3] = { -shape.radius, -0.5f * shape.height, -shape.radius };
+	bounds.grow(corner);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		corner[axis] = -corner[axis];
+	}
+	bounds.grow(corner);
+	return bounds;
+}
+
+//Along y, with flat caps
+inline void generate(const cylinder_shape& shape, const mesh_destination& destination)
+{
+	revolution_layout layout = layout_of(shape);
+	float half_height = 0.5f * shape.height;
+	int side_rings = shape.stacks + 1;
+	write_revolution(destination, [&](int ring)
+	{
+		if (ring < 2)
+		{
+			return revolution_ring{ ring * shape.radius, half_height, 0.0f, 1.0f, (float)ring };
+		}
+		if (ring < 2 + side_rings)
+		{
+			float t = (ring - 2) / (float)shape.stacks;
+			return revolution_ring{ shape.radius, half_height - t * shape.height, 1.0f, 0.0f, t };
+		}
+		return revolution_ring{ (3 + side_rings - ring) * shape.radius, -half_height, 0.0f, -1.0f, (float)(ring - 2 - side_rings) };
+	}, layout, revolution_lod_count(layout, shape.lod_count));
+}
+
+inline revolution_layout layout_of(const torus_shape& shape)
+{
+	return { shape.sides + 1, revolution_slices(shape.slices), shape.major_radius + shape.minor_radius, 1,
+		{ { 0, shape.sides, shape.minor_radius, 2.0f * 3.14159265f / shape.sides } } };
+}
+
+inline mesh_counts procedural_counts(const torus_shape& shape)
+{
+	revolution_layout layout = layout_of(shape);
+	return revolution_counts(layout, revolution_lod_count(layout, shape.lod_count));
+}
+
+inline void procedural_lods(const torus_shape& shape, lod_chain& chain)
+{
+	revolution_layout layout = layout_of(shape);
+	revolution_lods(layout, revolution_lod_count(layout, shape.lod_count), chain);
+}
+
+inline aabb procedural_bounds(const torus_shape& shape)
+{
+	aabb bounds;
+	float outer = shape.major_radius + shape.minor_radius;
+	float corner[3] = { -outer, -shape.minor_radius, -outer };
+	bounds.grow(corner);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		corner[axis] = -corner[axis];
+	}
+	bounds.grow(corner);
+	return bounds;
+}
+
+//Lying in xz around the origin
+inline void generate(const torus_shape& shape, const mesh_destination& destination)
+{
+	revolution_layout layout = layout_of(shape);
+	write_revolution(destination, [&](int side)
+	{
+		// starts on the top of the tube and goes over the outside first, like the sphere's profile
+		float angle = 2.0f * 3.14159265f * (side % shape.sides) / shape.sides;
+		float radial = std::sin(angle);
+		float up = std::cos(angle);
+		return revolution_ring{ shape.major_radius + shape.minor_radius * radial, shape.minor_radius * up, radial, up, side / (float)shape.sides };
+	}, layout, revolution_lod_count(layout, shape.lod_count));
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "job_system.h"
+
+//LSD radix sort on a 64 bit key, 8 bits per pass. T needs a uint64_t member called key.
+//Stable, so items with equal keys keep their input order. The input is split into chunks that build their
+//histograms and scatter in parallel, and passes where every key has the same digit are skipped entirely
+//(draw keys leave most of their high bits constant). The histograms come from items' allocator, so sorting
+//frame_vectors stays inside the frame arena.
+template <typename T, typename Allocator>
+void radix_sort(job_system* jobs, std::vector<T, Allocator>& items, std::vector<T, Allocator>& scratch)
+{
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<uint64_t> key_allocator;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<uint32_t> count_allocator;
+
+	const int digit_count = 8;
+	const int bucket_count = 256;
+	//Below this a chunk costs more to schedule than to sort
+	const int min_chunk = 4096;
+
+	int count = (int)items.size();
+	if (count <= 1)
+	{
+		return;
+	}
+	scratch.resize(count);
+
+	int chunk_count = std::max(1, std::min(jobs->worker_count() + 1, count / min_chunk));
+	int chunk_size = (count + chunk_count - 1) / chunk_count;
+
+	//A bit that is set in some keys but not all of them needs sorting, digits without one are skipped
+	std::vector<uint64_t, key_allocator> chunk_and(chunk_count, ~0ull, key_allocator(items.get_allocator()));
+	std::vector<uint64_t, key_allocator> chunk_or(chunk_count, 0, key_allocator(items.get_allocator()));
+	jobs->parallel_for(chunk_count, [&](int begin, int end)
+	{
+		for (int chunk = begin; chunk < end; chunk++)
+		{
+			int last = std::min(count, (chunk + 1) * chunk_size);
+			for (int i = chunk * chunk_size; i < last; i++)
+			{
+				chunk_and[chunk] &= items[i].key;
+				chunk_or[chunk] |= items[i].key;
+			}
+		}
+	}, 1);
+	uint64_t varying = 0;
+	uint64_t all_and = ~0ull;
+	for (int chunk = 0; chunk < chunk_count; chunk++)
+	{
+		varying |= chunk_or[chunk];
+		all_and &= chunk_and[chunk];
+	}
+	varying ^= all_and;
+
+	std::vector<uint32_t, count_allocator> histograms(chunk_count * bucket_count, 0, count_allocator(items.get_allocator()));
+	T* source = items.data();
+	T* destination = scratch.data();
+	for (int digit = 0; digit < digit_count; digit++)
+	{
+		int shift = digit * 8;
+		if (((varying >> shift) & 0xff) == 0)
+		{
+			continue;
+		}
+
+		jobs->parallel_for(chunk_count, [&](int begin, int end)
+		{
+			for (int chunk = begin; chunk < end; chunk++)
+			{
+				uint32_t* histogram = &histograms[chunk * bucket_count];
+				std::fill(histogram, histogram + bucket_count, 0);
+				int last = std::min(count, (chunk + 1) * chunk_size);
+				for (int i = chunk * chunk_size; i < last; i++)
+				{
+					histogram[(source[i].key >> shift) & 0xff]++;
+				}
+			}
+		}, 1);
+
+		//Exclusive prefix over (bucket, chunk) turns the counts into each chunk's write cursor per bucket
+		uint32_t total = 0;
+		for (int bucket = 0; bucket < bucket_count; bucket++)
+		{
+			for (int chunk = 0; chunk < chunk_count; chunk++)
+			{
+				uint32_t bucket_items = histograms[chunk * bucket_count + bucket];
+				histograms[chunk * bucket_count + bucket] = total;
+				total += bucket_items;
+			}
+		}
+
+		jobs->parallel_for(chunk_count, [&](int begin, int end)
+		{
+			for (int chunk = begin; chunk < end; chunk++)
+			{
+				uint32_t* cursor = &histograms[chunk * bucket_count];
+				int last = std::min(count, (chunk + 1) * chunk_size);
+				for (int i = chunk * chunk_size; i < last; i++)
+				{
+					destination[cursor[(source[i].key >> shift) & 0xff]++] = source[i];
+				}
+			}
+		}, 1);
+		std::swap(source, destination);
+	}
+
+	if (source != items.data())
+	{
+		items.swap(scratch);
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ring_queue.h"
+
+//Deferred destruction for things the GPU may still be reading. Each is queued with the fence value of the last
+//submission that can use it and released once the fence passes that value. Values only grow, so the queue stays
+//in fence order and retire() stops at the first entry still in flight, touching only what it frees.
+//The backend does the releasing and reads the fence, so the queue runs against a mock on any platform:
+//	typedef ... item;
+//	void release(item what);
+//	uint64_t completed_value();
+
+template <typename Backend>
+struct release_queue
+{
+	typedef typename Backend::item item;
+
+	struct entry
+	{
+		item what;
+		uint64_t bytes;
+		uint64_t fence_value;
+	};
+
+	//what is released once the fence reaches fence_value, bytes is only counted
+	void defer(item what, uint64_t bytes, uint64_t fence_value)
+	{
+		// a smaller value than the last would break the ordering, holding on a little longer is always safe
+		if (!pending.empty() && fence_value < pending.back().fence_value)
+		{
+			fence_value = pending.back().fence_value;
+		}
+		pending.push_back({ what, bytes, fence_value });
+		pending_bytes += bytes;
+	}
+
+	//Releases what the GPU is done with and returns its bytes
+	uint64_t retire()
+	{
+		if (pending.empty())
+		{
+			return 0;
+		}
+		uint64_t completed = backend.completed_value();
+		uint64_t freed = 0;
+		while (!pending.empty() && pending.front().fence_value <= completed)
+		{
+			backend.release(pending.front().what);
+			freed += pending.front().bytes;
+			pending.pop_front();
+		}
+		pending_bytes -= freed;
+		reclaimed_bytes += freed;
+		return freed;
+	}
+
+	//Releases everything without looking at the fence, the caller has to know the GPU is idle
+	void flush()
+	{
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			backend.release(pending[i].what);
+			reclaimed_bytes += pending[i].bytes;
+		}
+		pending.clear();
+		pending_bytes = 0;
+	}
+
+	Backend backend;
+	ring_queue<entry> pending;
+	uint64_t pending_bytes = 0;
+	uint64_t reclaimed_bytes = 0; // over the queue's life
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+//First in first out queue over one circular array, for the fence ordered lists that are pushed and popped every
+//frame. The array doubles when it is full and is never shrunk, so once it has grown to the most a frame keeps in
+//flight pushing and popping never allocate; std::deque allocates a block per element for anything over 16 bytes
+//with MSVC.
+template <typename T>
+struct ring_queue
+{
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+
+	T& front() { return items[head]; }
+	T& back() { return items[(head + count - 1) & (items.size() - 1)]; }
+	//index from the front
+	T& operator[](size_t index) { return items[(head + index) & (items.size() - 1)]; }
+
+	void push_back(const T& item)
+	{
+		if (count == items.size())
+		{
+			grow();
+		}
+		items[(head + count) & (items.size() - 1)] = item;
+		count++;
+	}
+
+	void pop_front()
+	{
+		head = (head + 1) & (items.size() - 1);
+		count--;
+	}
+
+	//Keeps the array
+	void clear()
+	{
+		head = 0;
+		count = 0;
+	}
+
+	size_t capacity() const { return items.size(); }
+
+private:
+	void grow()
+	{
+		// unwrapped into the front of the new array
+		std::vector<T> larger(items.empty() ? 16 : items.size() * 2);
+		for (size_t i = 0; i < count; i++)
+		{
+			larger[i] = (*this)[i];
+		}
+		items.swap(larger);
+		head = 0;
+	}
+
+	std::vector<T> items; // power of two size
+	size_t head = 0;
+	size_t count = 0;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+using namespace DirectX;
+
+//Transform hierarchy stored depth first, so a parent is always before its children and a subtree is the
+//contiguous range [node, subtree_end[node]). Changing a local transform flags that range dirty, update() then
+//walks only the span that contains dirty nodes and rebuilds just those world matrices.
+struct scene_graph
+{
+	int node_count() const { return (int)parent.size(); }
+
+	//Inserts a node at the end of its parent's subtree (or as a new root), object is the index into objects or -1
+	int add_node(int parent_node, const XMFLOAT4X4& local_transform, int object_index = -1)
+	{
+		int position = parent_node >= 0 ? subtree_end[parent_node] : node_count();
+
+		//Everything at or after the insertion point moves up one slot. Appending (every new root, and children of
+		//the last subtree) moves nothing, so building a scene in order stays linear.
+		bool appending = position == node_count();
+		for (int i = 0; i < node_count() && !appending; i++)
+		{
+			if (parent[i] >= position)
+			{
+				parent[i]++;
+			}
+			if (subtree_end[i] > position)
+			{
+				subtree_end[i]++;
+			}
+		}
+		//Ancestors whose subtree ended exactly here now contain the new node
+		for (int ancestor = parent_node; ancestor >= 0; ancestor = parent[ancestor])
+		{
+			if (subtree_end[ancestor] == position)
+			{
+				subtree_end[ancestor]++;
+			}
+		}
+		for (int i = 0; i < (int)object_node.size() && !appending; i++)
+		{
+			if (object_node[i] >= position)
+			{
+				object_node[i]++;
+			}
+		}
+
+		parent.insert(parent.begin() + position, parent_node);
+		subtree_end.insert(subtree_end.begin() + position, position + 1);
+		object.insert(object.begin() + position, object_index);
+		local.insert(local.begin() + position, local_transform);
+		world.insert(world.begin() + position, local_transform);
+		dirty.insert(dirty.begin() + position, 0);
+
+		if (object_index >= 0)
+		{
+			if (object_index >= (int)object_node.size())
+			{
+				object_node.resize(object_index + 1, -1);
+			}
+			object_node[object_index] = position;
+		}
+
+		//Dirty span indices may have shifted, simplest is to widen it to cover the new node
+		if (dirty_begin <= dirty_end)
+		{
+			dirty_end++;
+		}
+		mark_dirty(position);
+		return position;
+	}
+
+	int node_of(int object_index) const { return object_node[object_index]; }
+
+	void set_local(int node, const XMFLOAT4X4& local_transform)
+	{
+		local[node] = local_transform;
+		mark_dirty(node);
+	}
+
+	const XMFLOAT4X4& get_world(int node) const { return world[node]; }
+
+	//Recomputes every dirty world matrix and appends the object index of each node that changed
+	void update(std::vector<int>& changed_objects)
+	{
+		for (int i = dirty_begin; i < dirty_end; i++)
+		{
+			if (!dirty[i])
+			{
+				continue;
+			}
+			dirty[i] = 0;
+
+			XMMATRIX local_matrix = XMLoadFloat4x4(&local[i]);
+			if (parent[i] >= 0)
+			{
+				//Parent is earlier in the array, so it is already up to date
+				local_matrix = local_matrix * XMLoadFloat4x4(&world[parent[i]]);
+			}
+			XMStoreFloat4x4(&world[i], local_matrix);
+
+			if (object[i] >= 0)
+			{
+				changed_objects.push_back(object[i]);
+			}
+		}
+		dirty_begin = INT_MAX;
+		dirty_end = 0;
+	}
+
+	std::vector<int> parent;
+	std::vector<int> subtree_end;
+	std::vector<int> object;
+	std::vector<int> object_node;
+	std::vector<XMFLOAT4X4> local;
+	std::vector<XMFLOAT4X4> world;
+	std::vector<uint8_t> dirty;
+
+private:
+	void mark_dirty(int node)
+	{
+		//Subtrees are always flagged whole, so a dirty node means its children are already flagged
+		if (dirty[node])
+		{
+			return;
+		}
+		for (int i = node; i < subtree_end[node]; i++)
+		{
+			dirty[i] = 1;
+		}
+		if (node < dirty_begin)
+		{
+			dirty_begin = node;
+		}
+		if (subtree_end[node] > dirty_end)
+		{
+			dirty_end = subtree_end[node];
+		}
+	}
+
+	int dirty_begin = INT_MAX;
+	int dirty_end = 0;
+};
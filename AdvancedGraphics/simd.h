@@ -0,0 +1,54 @@
+#pragma once
+
+#include <immintrin.h>
+
+//Thin wrappers so packet code is written once, 8 wide when the project is built with AVX and 4 wide (SSE2) otherwise.
+//Loads are unaligned, stores need packet_width * 4 byte alignment.
+#if defined(__AVX__)
+typedef __m256 simd_float;
+static const int packet_width = 8;
+inline simd_float simd_set(float value) { return _mm256_set1_ps(value); }
+inline simd_float simd_load(const float* values) { return _mm256_loadu_ps(values); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm256_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm256_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm256_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm256_div_ps(a, b); }
+inline simd_float simd_and(simd_float a, simd_float b) { return _mm256_and_ps(a, b); }
+inline simd_float simd_abs(simd_float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+inline simd_float simd_greater_equal(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline simd_float simd_less(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm256_blendv_ps(b, a, mask); }
+inline int simd_mask(simd_float mask) { return _mm256_movemask_ps(mask); }
+inline void simd_store(float* values, simd_float a) { _mm256_store_ps(values, a); }
+inline simd_float simd_or(simd_float a, simd_float b) { return _mm256_or_ps(a, b); }
+inline simd_float simd_min(simd_float a, simd_float b) { return _mm256_min_ps(a, b); }
+inline simd_float simd_max(simd_float a, simd_float b) { return _mm256_max_ps(a, b); }
+inline simd_float simd_sqrt(simd_float a) { return _mm256_sqrt_ps(a); }
+inline simd_float simd_floor(simd_float a) { return _mm256_floor_ps(a); }
+#else
+typedef __m128 simd_float;
+static const int packet_width = 4;
+inline simd_float simd_set(float value) { return _mm_set1_ps(value); }
+inline simd_float simd_load(const float* values) { return _mm_loadu_ps(values); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm_div_ps(a, b); }
+inline simd_float simd_and(simd_float a, simd_float b) { return _mm_and_ps(a, b); }
+inline simd_float simd_abs(simd_float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline simd_float simd_greater_equal(simd_float a, simd_float b) { return _mm_cmpge_ps(a, b); }
+inline simd_float simd_less(simd_float a, simd_float b) { return _mm_cmplt_ps(a, b); }
+inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline int simd_mask(simd_float mask) { return _mm_movemask_ps(mask); }
+inline void simd_store(float* values, simd_float a) { _mm_store_ps(values, a); }
+inline simd_float simd_or(simd_float a, simd_float b) { return _mm_or_ps(a, b); }
+inline simd_float simd_min(simd_float a, simd_float b) { return _mm_min_ps(a, b); }
+inline simd_float simd_max(simd_float a, simd_float b) { return _mm_max_ps(a, b); }
+inline simd_float simd_sqrt(simd_float a) { return _mm_sqrt_ps(a); }
+//SSE2 has no floor, truncate and step down where that rounded up (valid within the int range)
+inline simd_float simd_floor(simd_float a)
+{
+	simd_float truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+	return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, a), _mm_set1_ps(1.0f)));
+}
+#endif
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "job_system.h"
+#include "vertex_format.h"
+
+//Per vertex tangents for normal mapping, following MikkTSpace (Mikkelsen 2008) so normal maps baked against it
+//come out the same. Every triangle's direction of increasing u is found, then each vertex sums those of the
+//triangles around it, projected into its tangent plane and weighted by the angle the triangle makes at the
+//vertex. Both passes are parallel (over triangles, then over vertices) and each vertex only reads its own
+//triangles in a fixed order, so the result does not depend on the thread count.
+//Like MikkTSpace, a vertex shared by mirrored and unmirrored triangles (the seam of a mirrored texture) is split
+//first so each side gets its own tangent and handedness, see split_mirrored_vertices.
+
+//Twice the signed area of a triangle in texture space, negative where the mapping is mirrored
+inline float texcoord_signed_area(const float* uv0, const float* uv1, const float* uv2)
+{
+	return (uv1[0] - uv0[0]) * (uv2[1] - uv0[1]) - (uv2[0] - uv0[0]) * (uv1[1] - uv0[1]);
+}
+
+//Gives the mirrored triangles at every vertex that also has unmirrored ones a vertex of their own, numbered from
+//vertex_count up in the order of the vertices they were split from. Their indices are rewritten and split_sources
+//lists the vertex each new one copies. Triangles without texture area take no side. Returns the new vertex count.
+inline int split_mirrored_vertices(const float* texcoords, int stride, int vertex_count, int* indices, int index_count, std::vector<int>& split_sources)
+{
+	auto uv = [&](int vertex) { return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(texcoords) + (size_t)vertex * stride); };
+	const uint8_t unmirrored_side = 1;
+	const uint8_t mirrored_side = 2;
+	int triangle_count = index_count / 3;
+	split_sources.clear();
+
+	std::vector<uint8_t> sides(vertex_count, 0);
+	std::vector<uint8_t> face_side(triangle_count, 0);
+	for (int t = 0; t < triangle_count; t++)
+	{
+		float signed_area = texcoord_signed_area(uv(indices[t * 3]), uv(indices[t * 3 + 1]), uv(indices[t * 3 + 2]));
+		face_side[t] = std::fabs(signed_area) > 1e-20f ? (signed_area < 0.0f ? mirrored_side : unmirrored_side) : 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			sides[indices[t * 3 + corner]] |= face_side[t];
+		}
+	}
+
+	std::vector<int> split(vertex_count, -1);
+	for (int v = 0; v < vertex_count; v++)
+	{
+		if (sides[v] == (unmirrored_side | mirrored_side))
+		{
+			split[v] = vertex_count + (int)split_sources.size();
+			split_sources.push_back(v);
+		}
+	}
+	if (split_sources.empty())
+	{
+		return vertex_count;
+	}
+	for (int t = 0; t < triangle_count; t++)
+	{
+		for (int corner = 0; corner < 3 && face_side[t] == mirrored_side; corner++)
+		{
+			int& index = indices[t * 3 + corner];
+			index = split[index] >= 0 ? split[index] : index;
+		}
+	}
+	return vertex_count + (int)split_sources.size();
+}
+
+//split_mirrored_vertices on a vertex array, VertexType needs a texCoord member with x and y. The copies go on the
+//end, so call it after the vertex fetch optimisation has ordered the rest.
+template <typename VertexType>
+void split_mirrored_vertices(std::vector<VertexType>& vertices, std::vector<int>& indices)
+{
+	if (vertices.empty())
+	{
+		return;
+	}
+	std::vector<int> split_sources;
+	int count = split_mirrored_vertices(&vertices[0].texCoord.x, sizeof(VertexType), (int)vertices.size(), indices.data(), (int)indices.size(), split_sources);
+	vertices.reserve(count);
+	for (int source : split_sources)
+	{
+		vertices.push_back(vertices[source]);
+	}
+}
+
+//Unit tangent at each vertex with its handedness in w, bitangent = w * normal x tangent. positions, normals and
+//texcoords point at the first vertex's fields and step by stride bytes, as do the float4 tangents. Split the
+//vertices first, on a vertex that still has both kinds of triangle the side with more angle decides w.
+inline void compute_tangents(job_system* jobs, const float* positions, const float* normals, const float* texcoords, float* tangents, int stride,
+	int vertex_count, const int* indices, int index_count)
+{
+	auto field = [&](const float* first, int vertex) { return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(first) + (size_t)vertex * stride); };
+	int triangle_count = index_count / 3;
+
+	// direction of increasing u, flipped for mirrored mappings so it always points along +u, and zero for
+	// triangles whose texture coordinates have no area
+	std::vector<float> face_tangents((size_t)triangle_count * 3);
+	std::vector<uint8_t> face_mirrored(triangle_count);
+	jobs->parallel_for(triangle_count, [&](int begin, int end)
+	{
+		for (int t = begin; t < end; t++)
+		{
+			const float* p0 = field(positions, indices[t * 3]);
+			const float* p1 = field(positions, indices[t * 3 + 1]);
+			const float* p2 = field(positions, indices[t * 3 + 2]);
+			const float* uv0 = field(texcoords, indices[t * 3]);
+			const float* uv1 = field(texcoords, indices[t * 3 + 1]);
+			const float* uv2 = field(texcoords, indices[t * 3 + 2]);
+			float t1 = uv1[1] - uv0[1];
+			float t2 = uv2[1] - uv0[1];
+			float signed_area = texcoord_signed_area(uv0, uv1, uv2);
+			float* tangent = &face_tangents[(size_t)t * 3];
+			float length_squared = 0.0f;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				tangent[axis] = t2 * (p1[axis] - p0[axis]) - t1 * (p2[axis] - p0[axis]);
+				length_squared += tangent[axis] * tangent[axis];
+			}
+			face_mirrored[t] = signed_area < 0.0f;
+			float scale = 0.0f;
+			if (std::fabs(signed_area) > 1e-20f && length_squared > 0.0f)
+			{
+				scale = (signed_area < 0.0f ? -1.0f : 1.0f) / std::sqrt(length_squared);
+			}
+			tangent[0] *= scale;
+			tangent[1] *= scale;
+			tangent[2] *= scale;
+		}
+	}, 1024);
+
+	// the corners at each vertex, as a triangle * 3 + corner list
+	std::vector<int> first_corner(vertex_count + 1, 0);
+	for (int i = 0; i < triangle_count * 3; i++)
+	{
+		first_corner[indices[i] + 1]++;
+	}
+	for (int v = 0; v < vertex_count; v++)
+	{
+		first_corner[v + 1] += first_corner[v];
+	}
+	std::vector<int> corners(triangle_count * 3);
+	std::vector<int> fill(first_corner.begin(), first_corner.end() - 1);
+	for (int i = 0; i < triangle_count * 3; i++)
+	{
+		corners[fill[indices[i]]++] = i;
+	}
+
+	jobs->parallel_for(vertex_count, [&](int begin, int end)
+	{
+		for (int v = begin; v < end; v++)
+		{
+			const float* normal = field(normals, v);
+			const float* p = field(positions, v);
+			float n[3] = { normal[0], normal[1], normal[2] };
+			float normal_length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				n[axis] = normal_length > 0.0f ? n[axis] / normal_length : 0.0f;
+			}
+			float sum[3] = { 0.0f, 0.0f, 0.0f };
+			float mirrored_angle = 0.0f;
+			auto project = [&](float* value)
+			{
+				float along = n[0] * value[0] + n[1] * value[1] + n[2] * value[2];
+				value[0] -= n[0] * along;
+				value[1] -= n[1] * along;
+				value[2] -= n[2] * along;
+				float length = std::sqrt(value[0] * value[0] + value[1] * value[1] + value[2] * value[2]);
+				if (length <= 0.0f)
+				{
+					return false;
+				}
+				value[0] /= length;
+				value[1] /= length;
+				value[2] /= length;
+				return true;
+			};
+			for (int c = first_corner[v]; c < first_corner[v + 1]; c++)
+			{
+				int t = corners[c] / 3;
+				int corner = corners[c] % 3;
+				const float* face = &face_tangents[(size_t)t * 3];
+				float tangent[3] = { face[0], face[1], face[2] };
+				if (!project(tangent))
+				{
+					continue;
+				}
+				// the angle at the corner between the two edges leaving it, measured in the tangent plane
+				const float* next = field(positions, indices[t * 3 + (corner + 1) % 3]);
+				const float* previous = field(positions, indices[t * 3 + (corner + 2) % 3]);
+				float edge_next[3] = { next[0] - p[0], next[1] - p[1], next[2] - p[2] };
+				float edge_previous[3] = { previous[0] - p[0], previous[1] - p[1], previous[2] - p[2] };
+				if (!project(edge_next) || !project(edge_previous))
+				{
+					continue;
+				}
+				float cosine = edge_next[0] * edge_previous[0] + edge_next[1] * edge_previous[1] + edge_next[2] * edge_previous[2];
+				float angle = std::acos(std::max(-1.0f, std::min(1.0f, cosine)));
+				sum[0] += tangent[0] * angle;
+				sum[1] += tangent[1] * angle;
+				sum[2] += tangent[2] * angle;
+				mirrored_angle += face_mirrored[t] ? angle : -angle;
+			}
+
+			float* result = reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(tangents) + (size_t)v * stride);
+			if (!project(sum))
+			{
+				// no usable texture mapping around the vertex, any frame will do
+				any_perpendicular(n, sum);
+			}
+			result[0] = sum[0];
+			result[1] = sum[1];
+			result[2] = sum[2];
+			result[3] = mirrored_angle > 0.0f ? -1.0f : 1.0f;
+		}
+	}, 1024);
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "job_system.h"
+
+//Heightmap terrain drawn with CDLOD (Strugar 2009). A quadtree over the heightmap is walked every frame and each
+//node is drawn at the coarsest level whose distance range still contains the camera. Every drawn piece is a
+//quadrant of a node, and all of them are instances of one shared grid of terrain_chunk_quads x terrain_chunk_quads
+//quads, so the triangle count follows the view distance rather than the size of the terrain. Towards the end of
+//its range a chunk's odd vertices slide onto the next coarser grid (in the vertex shader), so neighbouring levels
+//meet without cracks or popping.
+
+const int terrain_chunk_quads = 16; // per side of the shared grid, even so every other vertex can morph away
+const int max_terrain_lods = 12;
+
+//One instance of the shared grid, read by the terrain vertex shader
+struct terrain_chunk
+{
+	float origin[2]; // world x and z of the chunk's minimum corner
+	float size;
+	float morph_start; // camera distance where the vertices start moving onto the coarser grid
+	float morph_end; // and have reached it
+};
+
+struct terrain_settings
+{
+	float origin[2]; // world x and z of the heightmap's first sample
+	float size; // world extent along x and z
+	float base_height;
+	float height_scale; // world height of a heightmap value of 1
+	int lod_count; // quadtree depth, level 0 are the smallest nodes
+	float detail_distance; // level 0 is drawn up to this distance from the camera, every coarser level doubles it
+	float morph_ratio; // fraction of a level's range band drawn before it starts to morph
+};
+
+//Smoothly interpolated lattice noise in [0, 1]
+inline float value_noise(float x, float y, uint32_t seed)
+{
+	auto lattice = [&](int ix, int iy)
+	{
+		uint32_t h = (uint32_t)ix * 0x8da6b343u ^ (uint32_t)iy * 0xd8163841u ^ seed * 0xcb1ab31fu;
+		h ^= h >> 15;
+		h *= 0x2c1b3c6du;
+		h ^= h >> 12;
+		return (h & 0xffffff) / 16777215.0f;
+	};
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	int ix = (int)fx;
+	int iy = (int)fy;
+	float tx = x - fx;
+	float ty = y - fy;
+	tx = tx * tx * (3.0f - 2.0f * tx);
+	ty = ty * ty * (3.0f - 2.0f * ty);
+	float top = lattice(ix, iy) + (lattice(ix + 1, iy) - lattice(ix, iy)) * tx;
+	float bottom = lattice(ix, iy + 1) + (lattice(ix + 1, iy + 1) - lattice(ix, iy + 1)) * tx;
+	return top + (bottom - top) * ty;
+}
+
+//Fractal noise heights as unorm16, resolution x resolution samples row major (z rows, x columns). Rows are
+//independent, so they are generated in parallel and the result does not depend on scheduling.
+inline void generate_heightmap(job_system* jobs, int resolution, uint32_t seed, std::vector<uint16_t>& heights)
+{
+	const int octaves = 8;
+	heights.resize((size_t)resolution * resolution);
+	jobs->parallel_for(resolution, [&](int begin, int end)
+	{
+		for (int row = begin; row < end; row++)
+		{
+			for (int column = 0; column < resolution; column++)
+			{
+				float height = 0.0f;
+				float amplitude = 0.5f;
+				float frequency = 4.0f / resolution;
+				for (int octave = 0; octave < octaves; octave++)
+				{
+					height += amplitude * value_noise(column * frequency, row * frequency, seed + octave);
+					amplitude *= 0.5f;
+					frequency *= 2.0f;
+				}
+				// the amplitudes sum to just under 1, squaring flattens the valleys
+				height = std::min(1.0f, height * height * 1.5f);
+				heights[(size_t)row * resolution + column] = (uint16_t)(height * 65535.0f + 0.5f);
+			}
+		}
+	}, 16);
+}
+
+struct terrain_node_bounds
+{
+	float min_height;
+	float max_height;
+};
+
+struct terrain_quadtree
+{
+	//Height bounds for every node of every level from the heightmap, and the distance range of every level
+	void build(const terrain_settings& terrain, const uint16_t* heights, int resolution)
+	{
+		settings = terrain;
+		settings.lod_count = std::max(1, std::min(settings.lod_count, max_terrain_lods));
+		levels.assign(settings.lod_count, std::vector<terrain_node_bounds>());
+
+		// each leaf covers a span of samples, widened by one so bilinear filtering between samples stays inside
+		int leaves = nodes_per_side(0);
+		std::vector<terrain_node_bounds>& leaf_level = levels[0];
+		leaf_level.resize((size_t)leaves * leaves);
+		float samples_per_leaf = (resolution - 1) / (float)leaves;
+		for (int z = 0; z < leaves; z++)
+		{
+			int first_row = std::max(0, (int)std::floor(z * samples_per_leaf) - 1);
+			int last_row = std::min(resolution - 1, (int)std::ceil((z + 1) * samples_per_leaf) + 1);
+			for (int x = 0; x < leaves; x++)
+			{
+				int first_column = std::max(0, (int)std::floor(x * samples_per_leaf) - 1);
+				int last_column = std::min(resolution - 1, (int)std::ceil((x + 1) * samples_per_leaf) + 1);
+				uint16_t low = 0xffff;
+				uint16_t high = 0;
+				for (int row = first_row; row <= last_row; row++)
+				{
+					const uint16_t* sample = heights + (size_t)row * resolution;
+					for (int column = first_column; column <= last_column; column++)
+					{
+						low = std::min(low, sample[column]);
+						high = std::max(high, sample[column]);
+					}
+				}
+				leaf_level[(size_t)z * leaves + x] = { to_height(low), to_height(high) };
+			}
+		}
+
+		// parents cover their four children
+		for (int level = 1; level < settings.lod_count; level++)
+		{
+			int count = nodes_per_side(level);
+			levels[level].resize((size_t)count * count);
+			for (int z = 0; z < count; z++)
+			{
+				for (int x = 0; x < count; x++)
+				{
+					terrain_node_bounds& node = levels[level][(size_t)z * count + x];
+					node = child_bounds(level, x, z, 0);
+					for (int child = 1; child < 4; child++)
+					{
+						terrain_node_bounds other = child_bounds(level, x, z, child);
+						node.min_height = std::min(node.min_height, other.min_height);
+						node.max_height = std::max(node.max_height, other.max_height);
+					}
+				}
+			}
+		}
+
+		float previous = 0.0f;
+		for (int level = 0; level < settings.lod_count; level++)
+		{
+			ranges[level] = settings.detail_distance * (float)(1 << level);
+			morph_starts[level] = previous + (ranges[level] - previous) * settings.morph_ratio;
+			previous = ranges[level];
+		}
+	}
+
+	//Writes the chunks to draw from camera into chunks (usually mapped upload memory) and returns how many there
+	//are, at most max_chunks
+	int select(const frustum& view, const float camera[3], terrain_chunk* chunks, int max_chunks) const
+	{
+		selection output = { chunks, 0, max_chunks };
+		int top = settings.lod_count - 1;
+		select_node(view, camera, top, 0, 0, output);
+		return output.count;
+	}
+
+	float node_size(int level) const
+	{
+		return settings.size / (float)nodes_per_side(level);
+	}
+
+	int nodes_per_side(int level) const
+	{
+		return 1 << (settings.lod_count - 1 - level);
+	}
+
+	terrain_settings settings;
+	std::vector<std::vector<terrain_node_bounds>> levels; // per level, nodes row major
+	float ranges[max_terrain_lods];
+	float morph_starts[max_terrain_lods];
+
+private:
+	enum select_result
+	{
+		select_culled, // outside the frustum, nothing to draw
+		select_out_of_range, // too far for this level, the parent draws the area
+		select_done,
+	};
+
+	struct selection
+	{
+		terrain_chunk* chunks;
+		int count;
+		int capacity;
+	};
+
+	float to_height(uint16_t sample) const
+	{
+		return settings.base_height + sample / 65535.0f * settings.height_scale;
+	}
+
+	terrain_node_bounds child_bounds(int level, int x, int z, int child) const
+	{
+		int count = nodes_per_side(level - 1);
+		return levels[level - 1][(size_t)(z * 2 + (child >> 1)) * count + x * 2 + (child & 1)];
+	}
+
+	aabb node_box(int level, int x, int z) const
+	{
+		float size = node_size(level);
+		const terrain_node_bounds& bounds = levels[level][(size_t)z * nodes_per_side(level) + x];
+		aabb box;
+		box.min[0] = settings.origin[0] + x * size;
+		box.min[1] = bounds.min_height;
+		box.min[2] = settings.origin[1] + z * size;
+		box.max[0] = box.min[0] + size;
+		box.max[1] = bounds.max_height;
+		box.max[2] = box.min[2] + size;
+		return box;
+	}
+
+	static bool outside(const frustum& view, const aabb& box)
+	{
+		for (const plane& test : view.planes)
+		{
+			float far_distance = test.distance;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				far_distance += std::max(test.normal[axis] * box.min[axis], test.normal[axis] * box.max[axis]);
+			}
+			if (far_distance < 0.0f)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static bool in_range(const float camera[3], const aabb& box, float range)
+	{
+		float distance_squared = 0.0f;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float d = std::max(std::max(box.min[axis] - camera[axis], camera[axis] - box.max[axis]), 0.0f);
+			distance_squared += d * d;
+		}
+		return distance_squared <= range * range;
+	}
+
+	//Quadrant (0 to 3, x then z) of a node drawn at the node's level
+	void add_quadrant(const frustum& view, int level, int x, int z, int quadrant, selection& output) const
+	{
+		if (output.count == output.capacity)
+		{
+			return;
+		}
+		int child_x = x * 2 + (quadrant & 1);
+		int child_z = z * 2 + (quadrant >> 1);
+		if (level > 0 && outside(view, node_box(level - 1, child_x, child_z)))
+		{
+			return;
+		}
+		float size = node_size(level) * 0.5f;
+		terrain_chunk& chunk = output.chunks[output.count++];
+		chunk.origin[0] = settings.origin[0] + child_x * size;
+		chunk.origin[1] = settings.origin[1] + child_z * size;
+		chunk.size = size;
+		chunk.morph_start = morph_starts[level];
+		chunk.morph_end = ranges[level];
+	}
+
+	select_result select_node(const frustum& view, const float camera[3], int level, int x, int z, selection& output) const
+	{
+		aabb box = node_box(level, x, z);
+		if (outside(view, box))
+		{
+			return select_culled;
+		}
+		if (!in_range(camera, box, ranges[level]))
+		{
+			return select_out_of_range;
+		}
+
+		// the whole node at this level when nothing in it is close enough for the next finer one
+		if (level == 0 || !in_range(camera, box, ranges[level - 1]))
+		{
+			for (int quadrant = 0; quadrant < 4; quadrant++)
+			{
+				add_quadrant(view, level, x, z, quadrant, output);
+			}
+			return select_done;
+		}
+
+		// otherwise the children draw themselves, and this level fills in the ones that are out of their range
+		for (int quadrant = 0; quadrant < 4; quadrant++)
+		{
+			int child_x = x * 2 + (quadrant & 1);
+			int child_z = z * 2 + (quadrant >> 1);
+			if (select_node(view, camera, level - 1, child_x, child_z, output) == select_out_of_range)
+			{
+				add_quadrant(view, level, x, z, quadrant, output);
+			}
+		}
+		return select_done;
+	}
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//Two level segregated fit allocator (Masmano et al. 2004) over a range of offsets. It never touches the memory it
+//hands out, so it can carve up a GPU heap the CPU can not see; the blocks are kept in a side array instead.
+//Free blocks sit in lists by size class, the first level a power of two and the second level splitting each power
+//into tlsf_second_levels, with a bitmap per level marking the non empty lists. Allocating finds a list whose every
+//block is big enough with two bit scans and takes its head, freeing merges with the physical neighbours, so both
+//are O(1) whatever the number of blocks. Sizes are whole multiples of the granularity.
+
+const int tlsf_second_level_bits = 5;
+const int tlsf_second_levels = 1 << tlsf_second_level_bits;
+const int tlsf_first_levels = 64 - tlsf_second_level_bits;
+
+inline int tlsf_lowest_bit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (int)index;
+#else
+	return __builtin_ctzll(value);
+#endif
+}
+
+inline int tlsf_highest_bit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+struct tlsf_allocator
+{
+	struct block
+	{
+		uint64_t offset; // in granules
+		uint64_t size;
+		int previous_physical; // -1 at either end of the range
+		int next_physical;
+		int previous_free; // list links while free, next_free also links unused records
+		int next_free;
+		bool free;
+	};
+
+	//size and granularity in bytes, size is rounded down to whole granules
+	void initialise(uint64_t size, uint64_t bytes_per_granule)
+	{
+		granularity = bytes_per_granule;
+		blocks.clear();
+		unused_blocks = -1;
+		first_level_map = 0;
+		std::fill(std::begin(second_level_maps), std::end(second_level_maps), 0u);
+		for (int* list : free_lists)
+		{
+			std::fill(list, list + tlsf_second_levels, -1);
+		}
+		total = size / granularity;
+		used = 0;
+		allocations = 0;
+		int whole = new_block();
+		blocks[whole] = { 0, total, -1, -1, -1, -1, false };
+		insert_free(whole);
+	}
+
+	//Returns the block (kept for free()) and its byte offset, or -1 when nothing big enough is free. alignment is a
+	//power of two number of bytes, at least the granularity.
+	int allocate(uint64_t bytes, uint64_t alignment, uint64_t& offset)
+	{
+		uint64_t size = std::max<uint64_t>((bytes + granularity - 1) / granularity, 1);
+		uint64_t align = std::max<uint64_t>(alignment / granularity, 1);
+		// any block of the rounded up class fits, with room to slide up to the alignment
+		uint64_t search = size + align - 1;
+		if (search >= (uint64_t)1 << 62)
+		{
+			return -1;
+		}
+		int first, second;
+		mapping(round_up_to_class(search), first, second);
+
+		uint32_t second_map = first < tlsf_first_levels ? second_level_maps[first] & (~0u << second) : 0;
+		if (second_map == 0)
+		{
+			uint64_t first_map = first + 1 < 64 ? first_level_map & (~(uint64_t)0 << (first + 1)) : 0;
+			if (first_map == 0)
+			{
+				return -1;
+			}
+			first = tlsf_lowest_bit(first_map);
+			second_map = second_level_maps[first];
+		}
+		second = tlsf_lowest_bit(second_map);
+		int found = free_lists[first][second];
+		remove_free(found);
+
+		// the front padding and the tail go back on the free lists
+		uint64_t aligned = (blocks[found].offset + align - 1) / align * align;
+		if (aligned > blocks[found].offset)
+		{
+			int front = split(found, aligned - blocks[found].offset);
+			insert_free(found);
+			found = front;
+		}
+		if (blocks[found].size > size)
+		{
+			insert_free(split(found, size));
+		}
+		blocks[found].free = false;
+		used += blocks[found].size;
+		allocations++;
+		offset = blocks[found].offset * granularity;
+		return found;
+	}
+
+	void free(int handle)
+	{
+		block& freed = blocks[handle];
+		used -= freed.size;
+		allocations--;
+		int merged = handle;
+		int next = freed.next_physical;
+		if (next >= 0 && blocks[next].free)
+		{
+			remove_free(next);
+			absorb(merged, next);
+		}
+		int previous = blocks[merged].previous_physical;
+		if (previous >= 0 && blocks[previous].free)
+		{
+			remove_free(previous);
+			absorb(previous, merged);
+			merged = previous;
+		}
+		insert_free(merged);
+	}
+
+	uint64_t size_bytes() const { return total * granularity; }
+	uint64_t used_bytes() const { return used * granularity; }
+	uint64_t free_bytes() const { return (total - used) * granularity; }
+
+	//Walks only the largest non empty list
+	uint64_t largest_free_bytes() const
+	{
+		if (first_level_map == 0)
+		{
+			return 0;
+		}
+		int first = tlsf_highest_bit(first_level_map);
+		int second = tlsf_highest_bit(second_level_maps[first]);
+		uint64_t largest = 0;
+		for (int b = free_lists[first][second]; b >= 0; b = blocks[b].next_free)
+		{
+			largest = std::max(largest, blocks[b].size);
+		}
+		return largest * granularity;
+	}
+
+	//0 when the free space is one block, towards 1 as it splinters
+	float fragmentation() const
+	{
+		uint64_t free_space = free_bytes();
+		return free_space == 0 ? 0.0f : 1.0f - (float)largest_free_bytes() / free_space;
+	}
+
+	std::vector<block> blocks;
+	int unused_blocks = -1; // records of merged away blocks, linked through next_free
+	uint64_t first_level_map = 0;
+	uint32_t second_level_maps[tlsf_first_levels] = {};
+	int free_lists[tlsf_first_levels][tlsf_second_levels];
+	uint64_t granularity = 1;
+	uint64_t total = 0; // granules
+	uint64_t used = 0;
+	int allocations = 0;
+
+private:
+	//Sizes below tlsf_second_levels get a list each, above that each power of two is split evenly
+	static void mapping(uint64_t size, int& first, int& second)
+	{
+		if (size < (uint64_t)tlsf_second_levels)
+		{
+			first = 0;
+			second = (int)size;
+			return;
+		}
+		int top = tlsf_highest_bit(size);
+		first = top - tlsf_second_level_bits + 1;
+		second = (int)((size >> (top - tlsf_second_level_bits)) - tlsf_second_levels);
+	}
+
+	//Up to the start of the next class, so every block in that class is at least size
+	static uint64_t round_up_to_class(uint64_t size)
+	{
+		if (size < (uint64_t)tlsf_second_levels)
+		{
+			return size;
+		}
+		uint64_t step = (uint64_t)1 << (tlsf_highest_bit(size) - tlsf_second_level_bits);
+		return size + step - 1;
+	}
+
+	int new_block()
+	{
+		if (unused_blocks >= 0)
+		{
+			int reused = unused_blocks;
+			unused_blocks = blocks[reused].next_free;
+			return reused;
+		}
+		blocks.push_back({});
+		return (int)blocks.size() - 1;
+	}
+
+	void insert_free(int handle)
+	{
+		block& b = blocks[handle];
+		int first, second;
+		mapping(b.size, first, second);
+		b.free = true;
+		b.previous_free = -1;
+		b.next_free = free_lists[first][second];
+		if (b.next_free >= 0)
+		{
+			blocks[b.next_free].previous_free = handle;
+		}
+		free_lists[first][second] = handle;
+		first_level_map |= (uint64_t)1 << first;
+		second_level_maps[first] |= 1u << second;
+	}
+
+	void remove_free(int handle)
+	{
+		block& b = blocks[handle];
+		if (b.previous_free >= 0)
+		{
+			blocks[b.previous_free].next_free = b.next_free;
+		}
+		else
+		{
+			int first, second;
+			mapping(b.size, first, second);
+			free_lists[first][second] = b.next_free;
+			if (b.next_free < 0)
+			{
+				second_level_maps[first] &= ~(1u << second);
+				if (second_level_maps[first] == 0)
+				{
+					first_level_map &= ~((uint64_t)1 << first);
+				}
+			}
+		}
+		if (b.next_free >= 0)
+		{
+			blocks[b.next_free].previous_free = b.previous_free;
+		}
+		b.free = false;
+	}
+
+	//Cuts the block after size granules and returns the back part, the front keeps the handle
+	int split(int handle, uint64_t size)
+	{
+		int back = new_block();
+		block& front = blocks[handle];
+		blocks[back] = { front.offset + size, front.size - size, handle, front.next_physical, -1, -1, false };
+		if (front.next_physical >= 0)
+		{
+			blocks[front.next_physical].previous_physical = back;
+		}
+		front.next_physical = back;
+		front.size = size;
+		return back;
+	}
+
+	//Grows front over back, which has to follow it, and recycles back's record
+	void absorb(int front, int back)
+	{
+		blocks[front].size += blocks[back].size;
+		blocks[front].next_physical = blocks[back].next_physical;
+		if (blocks[back].next_physical >= 0)
+		{
+			blocks[blocks[back].next_physical].previous_physical = front;
+		}
+		blocks[back].next_free = unused_blocks;
+		unused_blocks = back;
+	}
+};
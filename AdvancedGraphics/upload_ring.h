@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ring_queue.h"
+
+//Persistently mapped upload memory for everything the CPU hands to the GPU, asset data on its way into default
+//heaps as well as per frame lists the shaders read in place. Pages are used as rings: allocating bumps the head,
+//submit() tags everything allocated since the last submit with a fence value, and once the GPU passes that value
+//the tail catches up and the space is reused. When no page has room a new one is chained on, twice the size of the
+//last, and pages left idle for long enough are handed back.
+//The backend owns the real memory and the fence, so the ring itself runs against a mock on any platform:
+//	typedef ... resource;
+//	bool create_page(uint64_t size, resource& memory, uint8_t*& cpu, uint64_t& gpu);
+//	void release_page(resource memory);
+//	uint64_t completed_value(); // the fence's value, submit() values at or below it are finished with
+
+const uint64_t upload_page_size = 4 << 20; // the first page, later ones double
+const uint64_t upload_page_alignment = 1 << 16; // pages start on this, so no allocation can ask for more
+const int upload_page_idle_submits = 256; // an empty page unused for this many submits is released
+
+template <typename Resource>
+struct upload_allocation
+{
+	Resource memory;
+	uint64_t offset; // into memory
+	uint8_t* cpu;
+	uint64_t gpu;
+};
+
+template <typename Backend>
+struct upload_ring
+{
+	typedef typename Backend::resource resource;
+
+	struct page
+	{
+		resource memory;
+		uint8_t* cpu;
+		uint64_t gpu;
+		uint64_t size; // zero for a released page slot
+		uint64_t head; // next free byte
+		uint64_t tail; // oldest byte the GPU may still read
+		uint64_t used; // from tail to head, including padding and the wasted end when the head wraps
+		uint64_t open; // allocated since the last submit
+		uint64_t last_submit; // submit count when the page last held anything
+	};
+
+	//A pending run of bytes at a page's tail, free once the fence passes fence_value
+	struct span
+	{
+		int page;
+		uint64_t bytes;
+		uint64_t fence_value;
+	};
+
+	//size bytes at a multiple of alignment (a power of two up to upload_page_alignment)
+	bool allocate(uint64_t size, uint64_t alignment, upload_allocation<resource>& allocation)
+	{
+		// almost every allocation fits straight after the last one
+		if (current < (int)pages.size())
+		{
+			page& p = pages[current];
+			uint64_t offset = (p.head + alignment - 1) & ~(alignment - 1);
+			if (p.size != 0 && offset + size <= free_end(p))
+			{
+				take(current, offset, offset + size - p.head, allocation);
+				return true;
+			}
+		}
+		return allocate_slow(size, alignment, allocation);
+	}
+
+	//Everything allocated since the last submit is free once the backend's fence reaches fence_value. Values have to
+	//increase from one submit to the next.
+	void submit(uint64_t fence_value)
+	{
+		submits++;
+		for (int i = 0; i < (int)pages.size(); i++)
+		{
+			page& p = pages[i];
+			if (p.open > 0)
+			{
+				pending.push_back({ i, p.open, fence_value });
+				p.open = 0;
+			}
+		}
+	}
+
+	//Frees the spans the GPU is done with, touching only those
+	void retire()
+	{
+		uint64_t completed = backend.completed_value();
+		while (!pending.empty() && pending.front().fence_value <= completed)
+		{
+			const span& done = pending.front();
+			page& p = pages[done.page];
+			p.tail = (p.tail + done.bytes) % p.size;
+			p.used -= done.bytes;
+			if (p.used == 0)
+			{
+				// an empty page starts over, so the next allocation gets all of it in one piece
+				p.head = 0;
+				p.tail = 0;
+			}
+			pending.pop_front();
+		}
+
+		// big pages chained on for a burst of asset loading should not stay around forever
+		for (int i = 0; i < (int)pages.size(); i++)
+		{
+			page& p = pages[i];
+			if (p.size != 0 && p.used == 0 && i != current && submits - p.last_submit > (uint64_t)upload_page_idle_submits)
+			{
+				backend.release_page(p.memory);
+				p.size = 0;
+				next_page_size = std::max(upload_page_size, next_page_size / 2);
+			}
+		}
+	}
+
+	//Waits for nothing, the caller has to know the GPU is done with every page
+	void release()
+	{
+		for (page& p : pages)
+		{
+			if (p.size != 0)
+			{
+				backend.release_page(p.memory);
+			}
+		}
+		pages.clear();
+		pending.clear();
+		current = 0;
+	}
+
+	uint64_t capacity() const
+	{
+		uint64_t total = 0;
+		for (const page& p : pages)
+		{
+			total += p.size;
+		}
+		return total;
+	}
+
+	uint64_t in_flight() const
+	{
+		uint64_t total = 0;
+		for (const page& p : pages)
+		{
+			total += p.used;
+		}
+		return total;
+	}
+
+	Backend backend;
+	std::vector<page> pages;
+	ring_queue<span> pending;
+	int current = 0; // page the last allocation came from
+	uint64_t submits = 0;
+	uint64_t next_page_size = upload_page_size;
+
+private:
+	//End of the free run that starts at the head
+	static uint64_t free_end(const page& p)
+	{
+		bool wrapped = p.head < p.tail || (p.head == p.tail && p.used > 0);
+		return wrapped ? p.tail : p.size;
+	}
+
+	void take(int index, uint64_t offset, uint64_t cost, upload_allocation<resource>& allocation)
+	{
+		page& p = pages[index];
+		p.head = (p.head + cost) % p.size;
+		p.used += cost;
+		p.open += cost;
+		p.last_submit = submits;
+		allocation = { p.memory, offset, p.cpu + offset, p.gpu + offset };
+		current = index;
+	}
+
+	bool try_page(int index, uint64_t size, uint64_t alignment, upload_allocation<resource>& allocation)
+	{
+		page& p = pages[index];
+		if (p.size == 0)
+		{
+			return false;
+		}
+		uint64_t offset = (p.head + alignment - 1) & ~(alignment - 1);
+		if (offset + size <= free_end(p))
+		{
+			take(index, offset, offset + size - p.head, allocation);
+			return true;
+		}
+		// wrap to the start, the rest of the page goes with this allocation
+		if (free_end(p) == p.size && size <= p.tail)
+		{
+			take(index, 0, p.size - p.head + size, allocation);
+			return true;
+		}
+		return false;
+	}
+
+	bool allocate_slow(uint64_t size, uint64_t alignment, upload_allocation<resource>& allocation)
+	{
+		retire();
+		int count = (int)pages.size();
+		for (int k = 0; k < count; k++)
+		{
+			if (try_page((current + k) % count, size, alignment, allocation))
+			{
+				return true;
+			}
+		}
+
+		// chain on a new page, in a released slot if there is one
+		uint64_t page_size = std::max(next_page_size, (size + upload_page_alignment - 1) & ~(upload_page_alignment - 1));
+		page fresh = {};
+		if (!backend.create_page(page_size, fresh.memory, fresh.cpu, fresh.gpu))
+		{
+			return false;
+		}
+		fresh.size = page_size;
+		next_page_size = page_size * 2;
+		int index = count;
+		for (int i = 0; i < count; i++)
+		{
+			if (pages[i].size == 0)
+			{
+				index = i;
+				break;
+			}
+		}
+		if (index == count)
+		{
+			pages.push_back(fresh);
+		}
+		else
+		{
+			pages[index] = fresh;
+		}
+		take(index, 0, size, allocation);
+		return true;
+	}
+};
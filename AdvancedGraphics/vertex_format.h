@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+//GPU vertex, 20 bytes instead of 48 for float position, normal, tangent and uv.
+//Position is snorm16 relative to the mesh bounds (the shader gets the centre and half extent per draw), the
+//tangent frame is one quaternion in four snorm16 (a QTangent, its sign carries the bitangent's handedness) and
+//the uv is two halves.
+struct packed_vertex
+{
+	int16_t position[4]; // xyz, w unused
+	int16_t qtangent[4];
+	uint16_t texcoord[2];
+};
+
+inline int16_t encode_snorm16(float value)
+{
+	value = std::max(-1.0f, std::min(1.0f, value));
+	return (int16_t)std::lround(value * 32767.0f);
+}
+
+inline float decode_snorm16(int16_t value)
+{
+	return std::max(-1.0f, value / 32767.0f);
+}
+
+//Round to nearest even, overflow goes to infinity and tiny values to half denormals or zero
+inline uint16_t encode_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	if (magnitude >= 0x7f800000)
+	{
+		// infinity stays infinity, nan keeps a mantissa bit
+		return (uint16_t)(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+	}
+	if (magnitude >= 0x477ff000)
+	{
+		// rounds past the largest half
+		return (uint16_t)(sign | 0x7c00);
+	}
+	if (magnitude < 0x38800000)
+	{
+		// half denormal, shift the implicit bit in and round
+		if (magnitude < 0x33000000)
+		{
+			return (uint16_t)sign;
+		}
+		uint32_t exponent = magnitude >> 23;
+		uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+		uint32_t shift = 126 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1)))
+		{
+			half++;
+		}
+		return (uint16_t)(sign | half);
+	}
+
+	uint32_t half = (magnitude - 0x38000000) >> 13;
+	uint32_t remainder = magnitude & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+	{
+		half++;
+	}
+	return (uint16_t)(sign | half);
+}
+
+inline float decode_half(uint16_t value)
+{
+	uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+	uint32_t bits;
+	if (exponent == 0)
+	{
+		float result = mantissa * (1.0f / 16777216.0f); // 2^-24
+		return sign ? -result : result;
+	}
+	if (exponent == 31)
+	{
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else
+	{
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+//Rotation taking x, y and z to the tangent, bitangent and normal as a quaternion (x, y, z, w). The columns have
+//to be orthonormal and right handed, bitangent = normal x tangent.
+inline void quaternion_from_frame(const float tangent[3], const float bitangent[3], const float normal[3], float q[4])
+{
+	// m[row][column], the columns are the frame's axes
+	float m[3][3] = {
+		{ tangent[0], bitangent[0], normal[0] },
+		{ tangent[1], bitangent[1], normal[1] },
+		{ tangent[2], bitangent[2], normal[2] },
+	};
+	// divide by the largest of the four candidates so nothing cancels
+	float trace = m[0][0] + m[1][1] + m[2][2];
+	if (trace > 0.0f)
+	{
+		float s = std::sqrt(trace + 1.0f) * 2.0f;
+		q[0] = (m[2][1] - m[1][2]) / s;
+		q[1] = (m[0][2] - m[2][0]) / s;
+		q[2] = (m[1][0] - m[0][1]) / s;
+		q[3] = 0.25f * s;
+	}
+	else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+	{
+		float s = std::sqrt(1.0f + m[0][0] - m[1][1] - m[2][2]) * 2.0f;
+		q[0] = 0.25f * s;
+		q[1] = (m[0][1] + m[1][0]) / s;
+		q[2] = (m[0][2] + m[2][0]) / s;
+		q[3] = (m[2][1] - m[1][2]) / s;
+	}
+	else if (m[1][1] > m[2][2])
+	{
+		float s = std::sqrt(1.0f + m[1][1] - m[0][0] - m[2][2]) * 2.0f;
+		q[0] = (m[0][1] + m[1][0]) / s;
+		q[1] = 0.25f * s;
+		q[2] = (m[1][2] + m[2][1]) / s;
+		q[3] = (m[0][2] - m[2][0]) / s;
+	}
+	else
+	{
+		float s = std::sqrt(1.0f + m[2][2] - m[0][0] - m[1][1]) * 2.0f;
+		q[0] = (m[0][2] + m[2][0]) / s;
+		q[1] = (m[1][2] + m[2][1]) / s;
+		q[2] = 0.25f * s;
+		q[3] = (m[1][0] - m[0][1]) / s;
+	}
+	float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	for (int i = 0; i < 4; i++)
+	{
+		q[i] /= length;
+	}
+}
+
+//Some unit vector at right angles to a unit vector
+inline void any_perpendicular(const float v[3], float result[3])
+{
+	// crossing with the axis v is least aligned with can not come out short
+	float ax = std::fabs(v[0]), ay = std::fabs(v[1]), az = std::fabs(v[2]);
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+	axis[ax <= ay && ax <= az ? 0 : (ay <= az ? 1 : 2)] = 1.0f;
+	result[0] = v[1] * axis[2] - v[2] * axis[1];
+	result[1] = v[2] * axis[0] - v[0] * axis[2];
+	result[2] = v[0] * axis[1] - v[1] * axis[0];
+	float length = std::sqrt(result[0] * result[0] + result[1] * result[1] + result[2] * result[2]);
+	if (length <= 0.0f)
+	{
+		// v was zero
+		result[0] = 1.0f;
+		return;
+	}
+	result[0] /= length;
+	result[1] /= length;
+	result[2] /= length;
+}
+
+//Smallest w a snorm16 keeps the sign of, see encode_qtangent
+const float qtangent_bias = 1.0f / 32767.0f;
+
+//q and -q are the same rotation, so the sign of w is free to carry the bitangent's handedness. w is made positive
+//and kept at least qtangent_bias (so it does not quantize to a zero without a sign), then the whole quaternion is
+//negated for a mirrored bitangent.
+inline void encode_qtangent(const float q[4], float handedness, int16_t encoded[4])
+{
+	float sign = q[3] < 0.0f ? -1.0f : 1.0f;
+	float flip = handedness < 0.0f ? -1.0f : 1.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		encoded[i] = encode_snorm16(q[i] * sign * flip);
+	}
+	encoded[3] = encode_snorm16(std::max(q[3] * sign, qtangent_bias) * flip);
+}
+
+//Frame of a unit normal and a tangent (xyz, w the handedness: bitangent = w * normal x tangent). The tangent is
+//made perpendicular to the normal first, and replaced by any perpendicular when it is parallel or zero.
+inline void encode_qtangent(const float normal[3], const float tangent[4], int16_t encoded[4])
+{
+	float n[3] = { normal[0], normal[1], normal[2] };
+	float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	if (length > 0.0f)
+	{
+		n[0] /= length;
+		n[1] /= length;
+		n[2] /= length;
+	}
+	else
+	{
+		n[0] = n[1] = 0.0f;
+		n[2] = 1.0f;
+	}
+	float along = n[0] * tangent[0] + n[1] * tangent[1] + n[2] * tangent[2];
+	float t[3] = { tangent[0] - n[0] * along, tangent[1] - n[1] * along, tangent[2] - n[2] * along };
+	length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+	if (length > 1e-6f)
+	{
+		t[0] /= length;
+		t[1] /= length;
+		t[2] /= length;
+	}
+	else
+	{
+		any_perpendicular(n, t);
+	}
+	float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+	float q[4];
+	quaternion_from_frame(t, b, n, q);
+	encode_qtangent(q, tangent[3], encoded);
+}
+
+//Inverse of encode_qtangent, tangent[3] gets the handedness
+inline void decode_qtangent(const int16_t encoded[4], float normal[3], float tangent[4])
+{
+	float x = decode_snorm16(encoded[0]);
+	float y = decode_snorm16(encoded[1]);
+	float z = decode_snorm16(encoded[2]);
+	float w = decode_snorm16(encoded[3]);
+	float length = std::sqrt(x * x + y * y + z * z + w * w);
+	x /= length;
+	y /= length;
+	z /= length;
+	w /= length;
+	normal[0] = 2.0f * (x * z + w * y);
+	normal[1] = 2.0f * (y * z - w * x);
+	normal[2] = 1.0f - 2.0f * (x * x + y * y);
+	tangent[0] = 1.0f - 2.0f * (y * y + z * z);
+	tangent[1] = 2.0f * (x * y + w * z);
+	tangent[2] = 2.0f * (x * z - w * y);
+	tangent[3] = w < 0.0f ? -1.0f : 1.0f;
+}
+
+//Per mesh position decode, position = offset + quantized * scale
+struct position_quantization
+{
+	float offset[3];
+	float scale[3];
+};
+
+inline position_quantization quantization_from_bounds(const float min[3], const float max[3])
+{
+	position_quantization result;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		result.offset[axis] = (min[axis] + max[axis]) * 0.5f;
+		// flat meshes still need a non zero scale to divide by
+		result.scale[axis] = std::max((max[axis] - min[axis]) * 0.5f, 1e-6f);
+	}
+	return result;
+}
+
+//tangent is xyz and the handedness, see encode_qtangent
+inline void pack_vertex(const float position[3], const float normal[3], const float tangent[4], const float texcoord[2], const position_quantization& quantization, packed_vertex& packed)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		packed.position[axis] = encode_snorm16((position[axis] - quantization.offset[axis]) / quantization.scale[axis]);
+	}
+	packed.position[3] = 0;
+	encode_qtangent(normal, tangent, packed.qtangent);
+	packed.texcoord[0] = encode_half(texcoord[0]);
+	packed.texcoord[1] = encode_half(texcoord[1]);
+}
+
+//Area weighted vertex normals from the triangles that use each vertex. positions and normals point at the first
+//vertex's x and step by stride bytes.
+inline void compute_vertex_normals(const float* positions, float* normals, int stride, int vertex_count, const int* indices, int index_count)
+{
+	auto position_of = [&](int vertex) { return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + (size_t)vertex * stride); };
+	auto normal_of = [&](int vertex) { return reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(normals) + (size_t)vertex * stride); };
+
+	for (int v = 0; v < vertex_count; v++)
+	{
+		float* normal = normal_of(v);
+		normal[0] = normal[1] = normal[2] = 0.0f;
+	}
+	for (int i = 0; i + 2 < index_count; i += 3)
+	{
+		const float* a = position_of(indices[i]);
+		const float* b = position_of(indices[i + 1]);
+		const float* c = position_of(indices[i + 2]);
+		float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		// the cross product's length is twice the area, so larger triangles weigh more
+		float face[3] = { ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0] };
+		for (int corner = 0; corner < 3; corner++)
+		{
+			float* normal = normal_of(indices[i + corner]);
+			normal[0] += face[0];
+			normal[1] += face[1];
+			normal[2] += face[2];
+		}
+	}
+	for (int v = 0; v < vertex_count; v++)
+	{
+		float* normal = normal_of(v);
+		float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length > 0.0f)
+		{
+			normal[0] /= length;
+			normal[1] /= length;
+			normal[2] /= length;
+		}
+	}
+}
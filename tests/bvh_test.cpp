@@ -0,0 +1,280 @@
+#include "check.h"
+#include "bvh.h"
+
+#include <random>
+
+//Build, refit and query timings over a million objects, with every query checked against testing each object
+const int object_count = 1000000;
+const float world_size = 2000.0f;
+const int queries_checked = 100;
+
+static bool boxes_overlap(const aabb& a, const aabb& b)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (a.min[axis] > b.max[axis] || a.max[axis] < b.min[axis])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool box_outside_frustum(const aabb& box, const frustum& view)
+{
+	for (const plane& test : view.planes)
+	{
+		float far_distance = test.distance;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			far_distance += std::max(test.normal[axis] * box.min[axis], test.normal[axis] * box.max[axis]);
+		}
+		if (far_distance < 0.0f)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static float box_distance_squared(const aabb& box, const float centre[3])
+{
+	float distance_squared = 0.0f;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float delta = centre[axis] - std::max(box.min[axis], std::min(centre[axis], box.max[axis]));
+		distance_squared += delta * delta;
+	}
+	return distance_squared;
+}
+
+//A box shaped view volume turned about y, enough to exercise partially and fully inside subtrees
+static frustum make_frustum(const float centre[3], float half_size, float angle)
+{
+	float c = std::cos(angle);
+	float s = std::sin(angle);
+	float axes[3][3] = { { c, 0.0f, s }, { 0.0f, 1.0f, 0.0f }, { -s, 0.0f, c } };
+	frustum view;
+	for (int a = 0; a < 3; a++)
+	{
+		float along = axes[a][0] * centre[0] + axes[a][1] * centre[1] + axes[a][2] * centre[2];
+		for (int side = 0; side < 2; side++)
+		{
+			float sign = side == 0 ? 1.0f : -1.0f;
+			plane& p = view.planes[a * 2 + side];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				p.normal[axis] = axes[a][axis] * sign;
+			}
+			p.distance = half_size - sign * along;
+		}
+	}
+	return view;
+}
+
+//Every item the brute force finds has to be visited, the tree may visit a few more from straddling leaves
+static void check_superset(const std::vector<int>& expected, std::vector<int>& visited, long long& extra)
+{
+	std::sort(visited.begin(), visited.end());
+	CHECK(std::adjacent_find(visited.begin(), visited.end()) == visited.end());
+	CHECK(std::includes(visited.begin(), visited.end(), expected.begin(), expected.end()));
+	extra += (long long)visited.size() - (long long)expected.size();
+}
+
+int main()
+{
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-world_size * 0.5f, world_size * 0.5f);
+	std::uniform_real_distribution<float> extent(0.5f, 4.0f);
+	std::uniform_real_distribution<float> step(-1.0f, 1.0f);
+
+	std::vector<aabb> bounds(object_count);
+	for (aabb& box : bounds)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float centre = position(random);
+			float half = extent(random);
+			box.min[axis] = centre - half;
+			box.max[axis] = centre + half;
+		}
+	}
+
+	bvh tree;
+	auto start = std::chrono::high_resolution_clock::now();
+	tree.build(bounds);
+	printf("build: %d objects in %.1f ms, %zu nodes, SAH cost %.2f\n", object_count, milliseconds_since(start), tree.nodes.size(), tree.built_cost);
+
+	// every object is in exactly one leaf
+	std::vector<int> seen(tree.item_indices);
+	std::sort(seen.begin(), seen.end());
+	bool permutation = true;
+	for (int i = 0; i < object_count; i++)
+	{
+		permutation = permutation && seen[i] == i;
+	}
+	CHECK(permutation);
+
+	// everything drifts a little each frame, refit keeps the topology and only grows the cost
+	const int refit_frames = 10;
+	double refit_milliseconds = 0.0;
+	for (int frame = 0; frame < refit_frames; frame++)
+	{
+		for (aabb& box : bounds)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float delta = step(random);
+				box.min[axis] += delta;
+				box.max[axis] += delta;
+			}
+		}
+		start = std::chrono::high_resolution_clock::now();
+		tree.refit(bounds);
+		refit_milliseconds += milliseconds_since(start);
+	}
+	printf("refit: %.2f ms per frame, SAH cost %.2f (%.2fx built), rebuild %s\n", refit_milliseconds / refit_frames,
+		tree.current_cost, tree.current_cost / tree.built_cost, tree.needs_rebuild() ? "due" : "not due");
+	aabb root = tree.node_bounds(0);
+	aabb everything;
+	for (const aabb& box : bounds)
+	{
+		everything.grow(box);
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		CHECK(root.min[axis] == everything.min[axis] && root.max[axis] == everything.max[axis]);
+	}
+
+	std::vector<int> expected;
+	std::vector<int> visited;
+	double tree_milliseconds[4] = {};
+	double brute_milliseconds[4] = {};
+	long long extra[3] = {};
+	for (int q = 0; q < queries_checked; q++)
+	{
+		float centre[3] = { position(random), position(random), position(random) };
+
+		// overlap
+		aabb box;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			box.min[axis] = centre[axis] - 40.0f;
+			box.max[axis] = centre[axis] + 40.0f;
+		}
+		expected.clear();
+		visited.clear();
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < object_count; i++)
+		{
+			if (boxes_overlap(bounds[i], box))
+			{
+				expected.push_back(i);
+			}
+		}
+		brute_milliseconds[0] += milliseconds_since(start);
+		start = std::chrono::high_resolution_clock::now();
+		tree.query_overlap(box, [&](int item) { visited.push_back(item); });
+		tree_milliseconds[0] += milliseconds_since(start);
+		check_superset(expected, visited, extra[0]);
+
+		// sphere
+		float radius = 50.0f;
+		expected.clear();
+		visited.clear();
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < object_count; i++)
+		{
+			if (box_distance_squared(bounds[i], centre) <= radius * radius)
+			{
+				expected.push_back(i);
+			}
+		}
+		brute_milliseconds[1] += milliseconds_since(start);
+		start = std::chrono::high_resolution_clock::now();
+		tree.query_sphere(centre, radius, [&](int item) { visited.push_back(item); });
+		tree_milliseconds[1] += milliseconds_since(start);
+		check_superset(expected, visited, extra[1]);
+
+		// frustum
+		frustum view = make_frustum(centre, 150.0f, q * 0.37f);
+		expected.clear();
+		visited.clear();
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < object_count; i++)
+		{
+			if (!box_outside_frustum(bounds[i], view))
+			{
+				expected.push_back(i);
+			}
+		}
+		brute_milliseconds[2] += milliseconds_since(start);
+		start = std::chrono::high_resolution_clock::now();
+		tree.query_frustum(view, [&](int item) { visited.push_back(item); });
+		tree_milliseconds[2] += milliseconds_since(start);
+		check_superset(expected, visited, extra[2]);
+
+		// closest hit ray, the distance has to match exactly
+		float direction[3] = { step(random), step(random), step(random) };
+		float length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+		for (float& d : direction)
+		{
+			d /= length;
+		}
+		float inverse[3];
+		ray_inverse(direction, inverse);
+		float max_t = world_size * 2.0f;
+		float brute_t = max_t;
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < object_count; i++)
+		{
+			float t = intersect_ray_box(bounds[i].min, bounds[i].max, centre, inverse, brute_t);
+			if (t >= 0.0f && t < brute_t)
+			{
+				brute_t = t;
+			}
+		}
+		brute_milliseconds[3] += milliseconds_since(start);
+		float hit_t;
+		start = std::chrono::high_resolution_clock::now();
+		int hit = tree.query_ray(centre, direction, max_t, [&](int item, float closest)
+		{
+			return intersect_ray_box(bounds[item].min, bounds[item].max, centre, inverse, closest);
+		}, hit_t);
+		tree_milliseconds[3] += milliseconds_since(start);
+		CHECK((hit < 0) == (brute_t == max_t));
+		CHECK(hit_t == brute_t);
+	}
+
+	const char* names[4] = { "overlap", "sphere", "frustum", "ray" };
+	for (int k = 0; k < 4; k++)
+	{
+		printf("%-7s query: %8.4f ms, brute force %8.3f ms", names[k], tree_milliseconds[k] / queries_checked, brute_milliseconds[k] / queries_checked);
+		if (k < 3)
+		{
+			printf(", %.1f extra items visited", extra[k] / (double)queries_checked);
+		}
+		printf("\n");
+	}
+
+	start = std::chrono::high_resolution_clock::now();
+	tree.build(bounds);
+	printf("rebuild: %.1f ms, SAH cost %.2f\n", milliseconds_since(start), tree.built_cost);
+
+	// a background rebuild queued on a job system with no workers only runs when someone waits for it, finish()
+	// has to, and the tree swapped in on the next update covers the moved bounds
+	{
+		job_system jobs(0);
+		std::vector<aabb> moving(bounds.begin(), bounds.begin() + 10000);
+		dynamic_bvh scene;
+		scene.build(moving);
+		std::shuffle(moving.begin(), moving.end(), random);
+		scene.update(&jobs, moving);
+		CHECK(scene.tree.needs_rebuild());
+		scene.finish(&jobs);
+		scene.update(&jobs, moving);
+		CHECK(!scene.tree.needs_rebuild());
+		scene.finish(&jobs);
+	}
+	return check_failures;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+//Failed checks are printed and counted, main returns the count so ctest sees the failure
+static int check_failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			check_failures++; \
+		} \
+	} while (0)
+
+inline double milliseconds_since(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
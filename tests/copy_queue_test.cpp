@@ -0,0 +1,140 @@
+#include "check.h"
+#include "copy_queue.h"
+
+#include <algorithm>
+
+//Lists are just the allocator slot they were opened on, the copy fence is a number the test moves forward
+struct mock_copies
+{
+	typedef int list;
+
+	bool open(int slot, list& recording)
+	{
+		opens++;
+		slots_used = std::max(slots_used, slot + 1);
+		recording = slot;
+		return true;
+	}
+
+	bool execute(list recording, uint64_t fence_value)
+	{
+		executed.push_back(recording);
+		executed_values.push_back(fence_value);
+		return true;
+	}
+
+	uint64_t completed_value()
+	{
+		return completed;
+	}
+
+	void wait(uint64_t fence_value)
+	{
+		waits.push_back(fence_value);
+	}
+
+	uint64_t completed = 0;
+	int opens = 0;
+	int slots_used = 0;
+	std::vector<int> executed;
+	std::vector<uint64_t> executed_values;
+	std::vector<uint64_t> waits;
+};
+
+//Everything recorded before a submit shares one ticket, and submitting with nothing recorded does nothing
+static void check_tickets()
+{
+	copy_scheduler<mock_copies> copies;
+	CHECK(copies.submit() && copies.backend.executed.empty());
+
+	int list;
+	CHECK(copies.record(list));
+	uint64_t first = copies.ticket();
+	CHECK(copies.record(list) && copies.ticket() == first && copies.backend.opens == 1);
+	CHECK(copies.submit() && copies.submitted == first);
+	CHECK(copies.backend.executed_values.size() == 1 && copies.backend.executed_values[0] == first);
+	CHECK(copies.ticket() == first + 1);
+}
+
+//A ticket costs the direct queue one GPU wait at most, none when the copy already finished
+static void check_acquire()
+{
+	copy_scheduler<mock_copies> copies;
+	int list;
+	copies.record(list);
+	uint64_t a = copies.ticket();
+	copies.submit();
+	copies.record(list);
+	uint64_t b = copies.ticket();
+	copies.submit();
+
+	CHECK(copies.acquire(a) && copies.backend.waits.size() == 1 && copies.backend.waits[0] == a);
+	CHECK(copies.acquire(a) && copies.backend.waits.size() == 1);
+	CHECK(copies.acquire(0) && copies.backend.waits.size() == 1);
+
+	// finished before anything asked for it, nothing to wait for, and older tickets stay covered
+	copies.backend.completed = b;
+	CHECK(copies.finished(b));
+	CHECK(copies.acquire(b) && copies.backend.waits.size() == 1);
+	CHECK(copies.acquire(a) && copies.acquire(b) && copies.backend.waits.size() == 1);
+	CHECK(copies.waits == 1);
+}
+
+//Acquiring what is still being recorded submits it first, so the wait can never be for a value never signalled
+static void check_acquire_unsubmitted()
+{
+	copy_scheduler<mock_copies> copies;
+	int list;
+	copies.record(list);
+	uint64_t ticket = copies.ticket();
+	CHECK(copies.open && copies.submitted == 0);
+	CHECK(copies.acquire(ticket));
+	CHECK(!copies.open && copies.submitted == ticket);
+	CHECK(copies.backend.executed.size() == 1);
+	CHECK(copies.backend.waits.size() == 1 && copies.backend.waits[0] == ticket);
+}
+
+//An allocator slot is reset for a new list only once the fence is past its last submit, otherwise another is made
+static void check_slot_reuse()
+{
+	copy_scheduler<mock_copies> copies;
+	int list;
+	for (int i = 0; i < 3; i++)
+	{
+		copies.record(list);
+		CHECK(list == i);
+		copies.submit();
+	}
+	CHECK(copies.backend.slots_used == 3);
+
+	copies.backend.completed = 2;
+	copies.record(list);
+	CHECK(list == 0);
+	copies.submit();
+	copies.record(list);
+	CHECK(list == 1);
+	copies.submit();
+	// slot 2 still in flight, slots 0 and 1 just went out again
+	copies.record(list);
+	CHECK(list == 3 && copies.backend.slots_used == 4);
+	copies.submit();
+
+	// a steady stream with the fence a submit behind settles on a fixed number of slots
+	for (int i = 0; i < 100; i++)
+	{
+		copies.backend.completed = copies.submitted - 1;
+		copies.record(list);
+		copies.submit();
+	}
+	CHECK(copies.backend.slots_used <= 4);
+	CHECK(copies.slot_values.size() == (size_t)copies.backend.slots_used);
+}
+
+int main()
+{
+	check_tickets();
+	check_acquire();
+	check_acquire_unsubmitted();
+	check_slot_reuse();
+	return check_failures;
+}
@@ -0,0 +1,166 @@
+#include "check.h"
+#include "descriptor_heap.h"
+
+#include <algorithm>
+#include <map>
+
+//Heaps are numbered, descriptor handles are the heap number shifted up plus the byte offset
+struct mock_heaps
+{
+	typedef int heap;
+
+	bool create_heap(int capacity, bool shader_visible, int& created, uint64_t& cpu, uint64_t& gpu)
+	{
+		created = next++;
+		live[created] = capacity;
+		cpu = (uint64_t)created << 32;
+		gpu = shader_visible ? ((uint64_t)created << 32) | ((uint64_t)1 << 63) : 0;
+		return true;
+	}
+
+	void release_heap(int released)
+	{
+		live.erase(released);
+	}
+
+	uint64_t completed_value()
+	{
+		return completed;
+	}
+
+	uint64_t completed = 0;
+	int next = 1;
+	std::map<int, int> live;
+};
+
+const int increment = 32;
+
+static void check_staging()
+{
+	descriptor_staging<mock_heaps> staging;
+	staging.initialise(increment);
+
+	// slots fill the first heap from its start, and another heap is chained on when it runs out
+	std::vector<int> slots;
+	for (int i = 0; i < descriptor_staging_heap_size + 1; i++)
+	{
+		slots.push_back(staging.allocate());
+	}
+	CHECK(slots[0] == 0 && slots[1] == 1);
+	CHECK(staging.cpu(slots[1]) == staging.pages[0].cpu + increment);
+	CHECK(staging.pages.size() == 2 && staging.backend.live.size() == 2);
+	CHECK(staging.cpu(slots.back()) == staging.pages[1].cpu);
+	std::vector<int> sorted(slots);
+	std::sort(sorted.begin(), sorted.end());
+	CHECK(std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end());
+
+	// a freed slot is the next one handed out
+	staging.free(slots[5]);
+	CHECK(staging.in_use == descriptor_staging_heap_size);
+	CHECK(staging.allocate() == slots[5]);
+	staging.release();
+	CHECK(staging.backend.live.empty() && staging.in_use == 0);
+}
+
+static void check_ring()
+{
+	const int capacity = 100;
+	descriptor_ring<mock_heaps> ring;
+	CHECK(ring.create(capacity, increment));
+	CHECK(ring.gpu(3) == ring.gpu_start + 3 * increment && ring.cpu(3) == ring.cpu_start + 3 * increment);
+
+	// frame 1 and 2 take 40 each
+	CHECK(ring.allocate(40) == 0);
+	ring.submit(1);
+	CHECK(ring.allocate(40) == 40);
+	ring.submit(2);
+
+	// 20 left at the end, 30 does not fit and nothing has been retired, so the ring is full
+	CHECK(ring.allocate(30) == -1);
+	CHECK(ring.used == 80);
+
+	// once frame 1 retires, the 20 at the end are skipped and the table starts over at 0
+	ring.backend.completed = 1;
+	CHECK(ring.allocate(30) == 0);
+	CHECK(ring.head == 30 && ring.tail == 40);
+	CHECK(ring.used == 40 + 20 + 30);
+	ring.submit(3);
+
+	// wrapped, only the 10 between head and tail are free
+	CHECK(ring.allocate(10) == 30);
+	CHECK(ring.allocate(1) == -1);
+	ring.submit(4);
+
+	// retiring frame 2 frees 40, the skipped end went out with frame 3 and stays taken until it retires
+	ring.backend.completed = 2;
+	ring.retire();
+	CHECK(ring.tail == 80 && ring.used == 60);
+	CHECK(ring.allocate(50) == -1);
+	CHECK(ring.allocate(40) == 40 && ring.used == capacity);
+	CHECK(ring.allocate(1) == -1);
+	ring.submit(5);
+
+	// everything retired, the ring starts over from 0 so the next table gets the whole of it
+	ring.backend.completed = 5;
+	ring.retire();
+	CHECK(ring.used == 0 && ring.head == 0 && ring.tail == 0 && ring.pending.empty());
+	CHECK(ring.allocate(capacity) == 0);
+	ring.submit(6);
+	CHECK(ring.allocate(1) == -1);
+
+	ring.release();
+	CHECK(ring.backend.live.empty());
+}
+
+struct run
+{
+	int first;
+	int count;
+	uint64_t fence_value;
+};
+
+//Random table sizes with the GPU a few frames behind: no two runs in flight share a descriptor
+static void check_random()
+{
+	const int capacity = 1000;
+	descriptor_ring<mock_heaps> ring;
+	ring.create(capacity, increment);
+	std::vector<run> live;
+	uint64_t seed = 7;
+	int full = 0;
+	for (uint64_t frame = 1; frame < 20000; frame++)
+	{
+		int tables = (int)(frame % 7);
+		for (int t = 0; t < tables; t++)
+		{
+			seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+			int count = 1 + (int)((seed >> 33) % 120);
+			int first = ring.allocate(count);
+			if (first < 0)
+			{
+				full++;
+				continue;
+			}
+			CHECK(first + count <= capacity);
+			for (const run& r : live)
+			{
+				bool overlap = first < r.first + r.count && r.first < first + count;
+				CHECK(!overlap);
+			}
+			live.push_back({ first, count, frame });
+		}
+		ring.submit(frame);
+		ring.backend.completed = frame > 2 ? frame - 2 : 0;
+		ring.retire();
+		live.erase(std::remove_if(live.begin(), live.end(), [&](const run& r) { return r.fence_value <= ring.backend.completed; }), live.end());
+	}
+	printf("%d tables did not fit\n", full);
+}
+
+int main()
+{
+	check_staging();
+	check_ring();
+	check_random();
+	return check_failures;
+}
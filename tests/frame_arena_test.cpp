@@ -0,0 +1,145 @@
+#include "check.h"
+#include "frame_arena.h"
+#include "radix_sort.h"
+#include "ring_queue.h"
+
+#include <cstdlib>
+#include <random>
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // the replacements below pair malloc and free themselves
+#endif
+
+//Counts every general heap allocation, the same hook debug builds of the renderer use
+static std::atomic<long long> heap_allocation_count{ 0 };
+
+void* operator new(size_t size)
+{
+	heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = malloc(size ? size : 1))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+struct sort_item
+{
+	uint64_t key;
+	int object;
+};
+
+struct fence_span
+{
+	int bytes;
+	uint64_t fence_value;
+};
+
+//Like the renderer's globals, constructed before any arena exists
+frame_vector<sort_item> global_items;
+
+int main()
+{
+	// without an arena the allocator uses the general heap, and the container can still be used and reassigned
+	global_items.push_back({ 1, 0 });
+	CHECK(global_items.size() == 1 && global_items[0].key == 1);
+
+	job_system* jobs = new job_system(2);
+	frame_arena arena;
+	ring_queue<fence_span> pending;
+	std::mt19937 random(3);
+	uint64_t fence = 0;
+	uint64_t completed = 0;
+	const int frames = 32;
+	const int warm_up = 4;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		long long heap_before = heap_allocation_count.load();
+		size_t capacity_before = pending.capacity();
+
+		// a frame's sort, as begin_frame_scratch and the draw key sort do it
+		global_items = frame_vector<sort_item>(&arena);
+		frame_vector<sort_item> scratch(&arena);
+		int count = 20000 + (int)(random() % 30000);
+		global_items.reserve(count);
+		for (int i = 0; i < count; i++)
+		{
+			global_items.push_back({ ((uint64_t)random() << 32) | random(), i });
+		}
+		radix_sort(jobs, global_items, scratch);
+		bool sorted = true;
+		for (size_t i = 1; i < global_items.size(); i++)
+		{
+			sorted = sorted && global_items[i - 1].key <= global_items[i].key;
+		}
+		CHECK(sorted);
+
+		// fence ordered spans, retired a few frames late like the upload and descriptor rings
+		fence++;
+		for (int i = 0; i < 1 + (int)(random() % 8); i++)
+		{
+			pending.push_back({ i, fence });
+		}
+		completed = fence > 3 ? fence - 3 : 0;
+		uint64_t last = 0;
+		while (!pending.empty() && pending.front().fence_value <= completed)
+		{
+			CHECK(pending.front().fence_value >= last);
+			last = pending.front().fence_value;
+			pending.pop_front();
+		}
+		CHECK(pending.empty() || pending.back().fence_value == fence);
+
+		long long heap_allocations = heap_allocation_count.load() - heap_before;
+		if (frame >= warm_up)
+		{
+			// once the arena has grown to what a frame needs, frame code stays off the general heap. The queue
+			// may still meet a bigger burst than it has seen, that costs one allocation and doubles it.
+			CHECK(arena.heap_allocations == 0);
+			CHECK(heap_allocations == (pending.capacity() != capacity_before ? 1 : 0));
+		}
+		arena.reset();
+	}
+	printf("arena peak %.1f KB in %zu blocks, queue capacity %zu\n", arena.peak / 1024.0, arena.blocks.size(), pending.capacity());
+	CHECK(pending.capacity() <= 64); // at most 32 spans are ever in flight
+
+	// wrapping and growing keep first in first out order
+	ring_queue<int> queue;
+	int next_in = 0;
+	int next_out = 0;
+	for (int round = 0; round < 1000; round++)
+	{
+		int pushes = (int)(random() % 40);
+		int pops = (int)(random() % 40);
+		for (int i = 0; i < pushes; i++)
+		{
+			queue.push_back(next_in++);
+		}
+		for (int i = 0; i < pops && !queue.empty(); i++)
+		{
+			CHECK(queue.front() == next_out);
+			next_out++;
+			queue.pop_front();
+		}
+		CHECK((int)queue.size() == next_in - next_out);
+		CHECK(queue.empty() || queue.back() == next_in - 1);
+	}
+	for (size_t i = 0; i < queue.size(); i++)
+	{
+		CHECK(queue[i] == next_out + (int)i);
+	}
+
+	global_items = frame_vector<sort_item>();
+	delete jobs;
+	return check_failures;
+}
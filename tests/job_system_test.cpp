@@ -0,0 +1,181 @@
+#include "check.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <cmath>
+
+//parallel_for has to call every index exactly once, whatever the count and grain
+static void check_parallel_for_coverage(job_system& jobs)
+{
+	const int counts[] = { 0, 1, 63, 64, 65, 1000, 4097, 100000 };
+	for (int count : counts)
+	{
+		for (int grain : { 1, 64, 1000 })
+		{
+			std::vector<std::atomic<int>> hits(count);
+			for (auto& hit : hits)
+			{
+				hit.store(0);
+			}
+			jobs.parallel_for(count, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					hits[i].fetch_add(1);
+				}
+			}, grain);
+			bool once = std::all_of(hits.begin(), hits.end(), [](const std::atomic<int>& hit) { return hit.load() == 1; });
+			CHECK(once);
+		}
+	}
+}
+
+struct tree_payload
+{
+	std::atomic<int>* counter;
+	int depth;
+};
+
+//Each job adds itself and spawns two children until depth runs out, so the root finishes after 2^depth - 1 jobs
+static job_system* tree_jobs;
+static void tree_job(job* current, const void* data)
+{
+	tree_payload payload = *static_cast<const tree_payload*>(data);
+	payload.counter->fetch_add(1);
+	if (payload.depth > 1)
+	{
+		tree_payload child = { payload.counter, payload.depth - 1 };
+		tree_jobs->run(tree_jobs->create_child_job(current, &tree_job, child));
+		tree_jobs->run(tree_jobs->create_child_job(current, &tree_job, child));
+	}
+}
+
+static void check_parent_completion(job_system& jobs)
+{
+	tree_jobs = &jobs;
+	for (int round = 0; round < 20; round++)
+	{
+		std::atomic<int> counter{ 0 };
+		tree_payload payload = { &counter, 12 };
+		job* root = jobs.create_job(&tree_job, payload);
+		jobs.run(root);
+		jobs.wait(root);
+		CHECK(jobs.is_complete(root));
+		CHECK(counter.load() == (1 << 12) - 1);
+	}
+
+	// a parent with more children than its thread's pool holds, allocation has to help run them instead of spinning
+	std::atomic<int> counter{ 0 };
+	std::atomic<int>* shared = &counter;
+	job* root = jobs.create_job([](job*, const void*) {});
+	for (int i = 0; i < job_system::jobs_per_thread * 2; i++)
+	{
+		jobs.run(jobs.create_child_job(root, [](job*, const void* data)
+		{
+			(*static_cast<std::atomic<int>* const*>(data))->fetch_add(1);
+		}, shared));
+	}
+	jobs.run(root);
+	jobs.wait(root);
+	CHECK(counter.load() == job_system::jobs_per_thread * 2);
+}
+
+//Time for a compute bound loop over 16M elements, from the calling thread alone up to one thread per core
+static void benchmark_scaling()
+{
+	const int count = 1 << 24;
+	std::vector<float> values(count);
+	for (int i = 0; i < count; i++)
+	{
+		values[i] = (float)(i & 1023);
+	}
+
+	int hardware = std::max(1, (int)std::thread::hardware_concurrency());
+	double single = 0.0;
+	for (int threads = 1; threads <= hardware; threads *= 2)
+	{
+		int workers = threads - 1;
+		job_system jobs(workers);
+		std::atomic<int> sink{ 0 };
+		double best = 1e30;
+		for (int repeat = 0; repeat < 5; repeat++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			jobs.parallel_for(count, [&](int begin, int end)
+			{
+				float sum = 0.0f;
+				for (int i = begin; i < end; i++)
+				{
+					sum += std::sqrt(values[i]) * 0.5f;
+				}
+				sink.fetch_add((int)sum & 1);
+			});
+			best = std::min(best, milliseconds_since(start));
+		}
+		if (workers == 0)
+		{
+			single = best;
+		}
+		printf("parallel_for, %2d threads: %7.2f ms, %.2fx\n", threads, best, single / best);
+	}
+}
+
+//Scheduling overhead, what create_job, run and wait cost for jobs that do nothing, one at a time and as children
+//of one root. Reported per job with the calling thread alone and with one thread per core.
+static void empty_job(job*, const void*)
+{
+}
+
+static void benchmark_overhead()
+{
+	const int count = 200000;
+	int hardware = std::max(1, (int)std::thread::hardware_concurrency());
+	int configurations[2] = { 0, std::max(1, hardware - 1) };
+	for (int workers : configurations)
+	{
+		job_system jobs(workers);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < count; i++)
+		{
+			job* single = jobs.create_job(&empty_job);
+			jobs.run(single);
+			jobs.wait(single);
+		}
+		double serial = milliseconds_since(start) * 1e6 / count;
+
+		// in batches that fit a thread's job pool
+		const int batch = job_system::jobs_per_thread / 2;
+		start = std::chrono::high_resolution_clock::now();
+		for (int done = 0; done < count; done += batch)
+		{
+			job* root = jobs.create_job(&empty_job);
+			for (int i = 0; i < batch; i++)
+			{
+				jobs.run(jobs.create_child_job(root, &empty_job));
+			}
+			jobs.run(root);
+			jobs.wait(root);
+		}
+		double batched = milliseconds_since(start) * 1e6 / count;
+		printf("empty jobs, %2d workers: %6.1f ns per create/run/wait, %6.1f ns per child job\n", workers, serial, batched);
+	}
+}
+
+int main()
+{
+	{
+		job_system jobs(3);
+		check_parallel_for_coverage(jobs);
+		check_parent_completion(jobs);
+	}
+	{
+		// with no workers every job runs on the waiting thread
+		job_system jobs(0);
+		check_parallel_for_coverage(jobs);
+		check_parent_completion(jobs);
+	}
+	benchmark_overhead();
+	benchmark_scaling();
+	return check_failures;
+}
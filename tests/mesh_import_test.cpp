@@ -0,0 +1,229 @@
+#include "check.h"
+#include "mesh_import.h"
+
+#include <string>
+
+//A triangle before any material, a quad with one, and a quad through negative indices whose material no library
+//defines
+static const char* test_obj =
+	"# test scene\n"
+	"mtllib test.mtl\n"
+	"o quad\n"
+	"v 0 0 0.5\n"
+	"v 1 0 0.5\n"
+	"v 1 1 0.5\n"
+	"v 0 1 0.5\n"
+	"vt 0 0\n"
+	"vt 1 0\n"
+	"vt 1 1\n"
+	"vt 0 1\n"
+	"vn 0 0 1\n"
+	"f 1 2 3\n"
+	"usemtl red\n"
+	"f 1/1/1 2/2/1 3/3/1 4/4/1\n"
+	"usemtl missing\n"
+	"\tf -4//-1 -3//-1 -2//-1 -1//-1   \r\n";
+
+static const char* test_mtl =
+	"newmtl red\n"
+	"Kd 1 0 0\n"
+	"map_Kd -bm 1 red.png\n"
+	"newmtl unused\n"
+	"Kd 0 1 0\n";
+
+//164 bytes: a quad's positions (z 0.5), texcoords and 16 bit indices, then the same quad unindexed
+static const char* test_buffer_base64 =
+	"AAAAAAAAAAAAAAA/AACAPwAAAAAAAAA/AACAPwAAgD8AAAA/AAAAAAAAgD8AAAA/AAAAAAAAAAAAAIA/AAAAAAAAgD8AAIA/AAAAAAAAgD8AAAEA"
+	"AgAAAAIAAwAAAAAAAAAAAAAAAAAAAIA/AAAAAAAAAAAAAIA/AACAPwAAAAAAAAAAAAAAAAAAAAAAAIA/AACAPwAAAAAAAAAAAACAPwAAAAA=";
+
+static std::string test_gltf(const std::string& uri)
+{
+	return std::string(
+		"{\n"
+		"  \"asset\": { \"version\": \"2.0\" },\n"
+		"  \"buffers\": [ { \"byteLength\": 164, \"uri\": \"") + uri + "\" } ],\n"
+		"  \"bufferViews\": [\n"
+		"    { \"buffer\": 0, \"byteOffset\": 0, \"byteLength\": 48 },\n"
+		"    { \"buffer\": 0, \"byteOffset\": 48, \"byteLength\": 32 },\n"
+		"    { \"buffer\": 0, \"byteOffset\": 80, \"byteLength\": 12 },\n"
+		"    { \"buffer\": 0, \"byteOffset\": 92, \"byteLength\": 72 }\n"
+		"  ],\n"
+		"  \"accessors\": [\n"
+		"    { \"bufferView\": 0, \"componentType\": 5126, \"count\": 4, \"type\": \"VEC3\" },\n"
+		"    { \"bufferView\": 1, \"componentType\": 5126, \"count\": 4, \"type\": \"VEC2\" },\n"
+		"    { \"bufferView\": 2, \"componentType\": 5123, \"count\": 6, \"type\": \"SCALAR\" },\n"
+		"    { \"bufferView\": 3, \"componentType\": 5126, \"count\": 6, \"type\": \"VEC3\" }\n"
+		"  ],\n"
+		"  \"materials\": [ { \"name\": \"gr\\u00fcn\", \"pbrMetallicRoughness\": { \"baseColorFactor\": [ 0, 1, 0, 0.5 ] } } ],\n"
+		"  \"meshes\": [ { \"name\": \"quad\", \"primitives\": [\n"
+		"    { \"attributes\": { \"POSITION\": 0, \"TEXCOORD_0\": 1 }, \"indices\": 2, \"material\": 0 },\n"
+		"    { \"attributes\": { \"POSITION\": 3 } },\n"
+		"    { \"attributes\": { \"POSITION\": 3 }, \"mode\": 1 }\n"
+		"  ] } ]\n"
+		"}\n";
+}
+
+static const imported_vertex& corner(const imported_mesh& mesh, int index)
+{
+	return mesh.vertices[mesh.indices[index]];
+}
+
+static void check_obj(job_system& jobs)
+{
+	imported_scene scene;
+	CHECK(import_obj(&jobs, test_obj, strlen(test_obj), scene));
+	CHECK(import_mtl(test_mtl, strlen(test_mtl), scene));
+	CHECK(scene.material_libraries.size() == 1 && scene.material_libraries[0] == "test.mtl");
+
+	// materials are created by usemtl, the library only fills in the ones it knows
+	CHECK(scene.materials.size() == 2);
+	CHECK(scene.materials[0].name == "red" && scene.materials[0].base_colour[0] == 1.0f && scene.materials[0].base_colour[1] == 0.0f);
+	CHECK(scene.materials[0].diffuse_texture == "red.png");
+	CHECK(scene.materials[1].name == "missing" && scene.materials[1].base_colour[1] == 1.0f && scene.materials[1].diffuse_texture.empty());
+
+	// one mesh per material in order of first use
+	CHECK(scene.meshes.size() == 3);
+	if (scene.meshes.size() != 3)
+	{
+		return;
+	}
+	const imported_mesh& plain = scene.meshes[0];
+	CHECK(plain.material == -1 && !plain.has_normals);
+	CHECK(plain.vertices.size() == 3 && plain.indices.size() == 3);
+
+	// the quad is fanned into two triangles that share the diagonal
+	const imported_mesh& red = scene.meshes[1];
+	CHECK(red.material == 0 && red.has_normals);
+	CHECK(red.vertices.size() == 4 && red.indices.size() == 6);
+	// z and v are flipped and the winding turned clockwise: 1 2 3 becomes 1 3 2
+	CHECK(corner(red, 0).position[0] == 0.0f && corner(red, 0).position[2] == -0.5f);
+	CHECK(corner(red, 1).position[0] == 1.0f && corner(red, 1).position[1] == 1.0f);
+	CHECK(corner(red, 2).position[0] == 1.0f && corner(red, 2).position[1] == 0.0f);
+	CHECK(corner(red, 1).texcoord[0] == 1.0f && corner(red, 1).texcoord[1] == 0.0f);
+	CHECK(corner(red, 0).normal[2] == -1.0f);
+
+	// negative indices count back from the last element read so far, texcoords left out are zero
+	const imported_mesh& missing = scene.meshes[2];
+	CHECK(missing.material == 1 && missing.has_normals);
+	CHECK(missing.vertices.size() == 4 && missing.indices.size() == 6);
+	CHECK(corner(missing, 0).position[0] == 0.0f && corner(missing, 0).position[1] == 0.0f);
+	CHECK(corner(missing, 1).position[0] == 1.0f && corner(missing, 1).position[1] == 1.0f);
+	CHECK(corner(missing, 0).texcoord[0] == 0.0f && corner(missing, 0).texcoord[1] == 0.0f);
+
+	// a face past the end of the file's vertices fails the import
+	const char* broken = "v 0 0 0\nv 1 0 0\nf 1 2 3\n";
+	imported_scene broken_scene;
+	CHECK(!import_obj(&jobs, broken, strlen(broken), broken_scene) && !broken_scene.error.empty());
+}
+
+static void check_gltf_scene(const imported_scene& scene)
+{
+	CHECK(scene.materials.size() == 1 && scene.materials[0].name == "gr\xc3\xbcn" && scene.materials[0].base_colour[3] == 0.5f);
+	// the line primitive is skipped
+	CHECK(scene.meshes.size() == 2);
+	if (scene.meshes.size() != 2)
+	{
+		return;
+	}
+	const imported_mesh& indexed = scene.meshes[0];
+	CHECK(indexed.name == "quad.0" && indexed.material == 0 && !indexed.has_normals);
+	CHECK(indexed.vertices.size() == 4 && indexed.indices.size() == 6);
+	CHECK(indexed.indices.size() == 6 && indexed.indices[0] == 0 && indexed.indices[1] == 2 && indexed.indices[2] == 1);
+	CHECK(corner(indexed, 1).position[0] == 1.0f && corner(indexed, 1).position[1] == 1.0f && corner(indexed, 1).position[2] == -0.5f);
+	CHECK(corner(indexed, 1).texcoord[0] == 1.0f && corner(indexed, 1).texcoord[1] == 1.0f);
+
+	// without indices the two triangles' shared corners are welded
+	const imported_mesh& unindexed = scene.meshes[1];
+	CHECK(unindexed.name == "quad.1" && unindexed.material == -1);
+	CHECK(unindexed.vertices.size() == 4 && unindexed.indices.size() == 6);
+}
+
+static void check_gltf(job_system& jobs)
+{
+	auto no_files = [](const std::string&, byte_view&) { return false; };
+
+	// buffer in a data uri
+	std::string embedded = test_gltf(std::string("data:application/octet-stream;base64,") + test_buffer_base64);
+	imported_scene scene;
+	CHECK(import_gltf(&jobs, reinterpret_cast<const uint8_t*>(embedded.data()), embedded.size(), no_files, scene));
+	check_gltf_scene(scene);
+
+	// the same buffer as an external file
+	std::vector<uint8_t> buffer;
+	CHECK(decode_base64(test_buffer_base64, strlen(test_buffer_base64), buffer) && buffer.size() == 164);
+	std::string external = test_gltf("quad.bin");
+	std::string requested;
+	imported_scene external_scene;
+	CHECK(import_gltf(&jobs, reinterpret_cast<const uint8_t*>(external.data()), external.size(), [&](const std::string& uri, byte_view& bytes)
+	{
+		requested = uri;
+		bytes = { buffer.data(), buffer.size() };
+		return true;
+	}, external_scene));
+	CHECK(requested == "quad.bin");
+	check_gltf_scene(external_scene);
+
+	// a buffer that cannot be loaded fails the import with a message
+	imported_scene missing_scene;
+	CHECK(!import_gltf(&jobs, reinterpret_cast<const uint8_t*>(external.data()), external.size(), no_files, missing_scene));
+	CHECK(missing_scene.error.find("quad.bin") != std::string::npos);
+}
+
+//A grid with positions, texcoords and normals written the way exporters do, every corner welds to its position
+static void benchmark_obj(job_system& jobs, int size)
+{
+	std::string text;
+	char line[128];
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			text.append(line, snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", x * 0.01f, y * 0.01f, 0.05f * sinf(x * 0.1f) * cosf(y * 0.1f)));
+			text.append(line, snprintf(line, sizeof(line), "vt %.6f %.6f\n", x / (float)size, y / (float)size));
+			text.append(line, snprintf(line, sizeof(line), "vn %.6f %.6f %.6f\n", 0.0f, 0.0f, 1.0f));
+		}
+	}
+	text += "usemtl grid\n";
+	for (int y = 0; y < size - 1; y++)
+	{
+		for (int x = 0; x < size - 1; x++)
+		{
+			int a = y * size + x + 1;
+			int b = a + 1, c = a + size + 1, d = a + size;
+			text.append(line, snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d));
+		}
+	}
+
+	double best = 1e9;
+	for (int repeat = 0; repeat < 3; repeat++)
+	{
+		imported_scene scene;
+		auto start = std::chrono::high_resolution_clock::now();
+		bool imported = import_obj(&jobs, text.data(), text.size(), scene);
+		best = std::min(best, milliseconds_since(start));
+		CHECK(imported && scene.meshes.size() == 1);
+		if (imported && scene.meshes.size() == 1)
+		{
+			CHECK(scene.meshes[0].vertices.size() == (size_t)size * size);
+			CHECK(scene.meshes[0].indices.size() == (size_t)(size - 1) * (size - 1) * 6);
+		}
+	}
+	printf("obj import, %.1f MB, %d workers: %.1f ms, %.0f MB/s\n", text.size() / 1e6, jobs.worker_count(), best, text.size() / 1e3 / best);
+}
+
+int main()
+{
+	{
+		job_system jobs(3);
+		check_obj(jobs);
+		check_gltf(jobs);
+		benchmark_obj(jobs, 400);
+	}
+	{
+		job_system jobs(0);
+		check_obj(jobs);
+		check_gltf(jobs);
+		benchmark_obj(jobs, 400);
+	}
+	return check_failures;
+}
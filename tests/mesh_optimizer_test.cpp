@@ -0,0 +1,139 @@
+#include "check.h"
+#include "mesh_optimizer.h"
+
+#include <array>
+#include <random>
+#include <set>
+
+struct test_position
+{
+	float x, y, z;
+};
+
+//id is the vertex's place in the generated grid, so triangles can be compared after the vertices are reordered
+struct test_vertex
+{
+	test_position pos;
+	int id;
+};
+
+typedef std::array<int, 3> triangle_ids;
+
+//A bumpy grid of quads, in row order or with its triangles shuffled the way an exporter might leave them
+static void build_grid(int size, bool shuffle, std::vector<test_vertex>& vertices, std::vector<int>& indices)
+{
+	vertices.clear();
+	indices.clear();
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			test_vertex vertex = { { (float)x, (float)y, 0.1f * sinf(x * 0.05f) * cosf(y * 0.07f) }, y * size + x };
+			vertices.push_back(vertex);
+		}
+	}
+	for (int y = 0; y < size - 1; y++)
+	{
+		for (int x = 0; x < size - 1; x++)
+		{
+			int a = y * size + x;
+			indices.insert(indices.end(), { a, a + 1, a + size, a + 1, a + size + 1, a + size });
+		}
+	}
+	if (shuffle)
+	{
+		int triangle_count = (int)indices.size() / 3;
+		std::vector<int> order(triangle_count);
+		for (int i = 0; i < triangle_count; i++)
+		{
+			order[i] = i;
+		}
+		std::mt19937 random(35);
+		std::shuffle(order.begin(), order.end(), random);
+		std::vector<int> shuffled(indices.size());
+		for (int i = 0; i < triangle_count; i++)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				shuffled[i * 3 + corner] = indices[order[i] * 3 + corner];
+			}
+		}
+		indices.swap(shuffled);
+	}
+}
+
+//Triangles by vertex id, rotated so the smallest id is first, which keeps the winding
+static std::multiset<triangle_ids> triangle_set(const std::vector<test_vertex>& vertices, const std::vector<int>& indices)
+{
+	std::multiset<triangle_ids> triangles;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		triangle_ids triangle = { vertices[indices[i]].id, vertices[indices[i + 1]].id, vertices[indices[i + 2]].id };
+		while (triangle[0] > triangle[1] || triangle[0] > triangle[2])
+		{
+			std::rotate(triangle.begin(), triangle.begin() + 1, triangle.end());
+		}
+		triangles.insert(triangle);
+	}
+	return triangles;
+}
+
+//Tipsify only moves whole triangles and never leaves the cache worse off than it found it
+static void check_vertex_cache(int size, bool shuffle)
+{
+	std::vector<test_vertex> vertices;
+	std::vector<int> indices;
+	build_grid(size, shuffle, vertices, indices);
+	std::multiset<triangle_ids> input = triangle_set(vertices, indices);
+	int index_count = (int)indices.size();
+	int vertex_count = (int)vertices.size();
+
+	vertex_cache_statistics before = analyze_vertex_cache(indices.data(), index_count, vertex_count);
+	std::vector<int> cluster_starts;
+	auto start = std::chrono::high_resolution_clock::now();
+	optimize_vertex_cache(indices.data(), index_count, vertex_count, cluster_starts);
+	double milliseconds = milliseconds_since(start);
+	vertex_cache_statistics after = analyze_vertex_cache(indices.data(), index_count, vertex_count);
+
+	CHECK((int)indices.size() == index_count);
+	CHECK(triangle_set(vertices, indices) == input);
+	CHECK(after.acmr <= before.acmr);
+	CHECK(!cluster_starts.empty() && cluster_starts[0] == 0);
+	printf("tipsify %s %dx%d grid: acmr %.3f -> %.3f, atvr %.3f -> %.3f, %.1f Mtri/s\n", shuffle ? "shuffled" : "ordered", size, size,
+		before.acmr, after.acmr, before.atvr, after.atvr, index_count / 3 / milliseconds / 1000.0);
+}
+
+//The whole pass also reorders vertices, the triangles have to survive that and come out the same every run
+static void check_optimize_meshes(job_system& jobs)
+{
+	std::vector<test_vertex> source_vertices;
+	std::vector<int> source_indices;
+	build_grid(300, true, source_vertices, source_indices);
+	std::multiset<triangle_ids> input = triangle_set(source_vertices, source_indices);
+
+	std::vector<test_vertex> vertices[2] = { source_vertices, source_vertices };
+	std::vector<int> indices[2] = { source_indices, source_indices };
+	std::vector<mesh_optimize_task<test_vertex>> tasks(2);
+	for (int i = 0; i < 2; i++)
+	{
+		tasks[i].vertices = &vertices[i];
+		tasks[i].indices = &indices[i];
+	}
+	optimize_meshes(&jobs, tasks);
+
+	CHECK(triangle_set(vertices[0], indices[0]) == input);
+	CHECK(indices[0] == indices[1]);
+	CHECK(tasks[0].after.acmr <= tasks[0].before.acmr);
+	// every vertex is used, so fetch order keeps all of them and the first triangle starts at vertex 0
+	CHECK(vertices[0].size() == source_vertices.size() && indices[0][0] == 0);
+}
+
+int main()
+{
+	check_vertex_cache(300, false);
+	check_vertex_cache(300, true);
+	check_vertex_cache(700, true);
+	job_system jobs(3);
+	check_optimize_meshes(jobs);
+	return check_failures;
+}
@@ -0,0 +1,148 @@
+#include "check.h"
+#include "mesh_simplify.h"
+
+struct test_float3
+{
+	float x, y, z;
+};
+
+struct test_float2
+{
+	float x, y;
+};
+
+struct test_vertex
+{
+	test_float3 pos;
+	test_float3 normal;
+	test_float2 texCoord;
+};
+
+//A UV sphere with bumps, a texture seam where the last column repeats the first and shared positions at the poles,
+//the kinds of split vertices the simplifier has to keep together
+static void build_sphere(int slices, int stacks, float bump, std::vector<test_vertex>& vertices, std::vector<int>& indices)
+{
+	const float pi = 3.14159265f;
+	for (int stack = 0; stack <= stacks; stack++)
+	{
+		for (int slice = 0; slice <= slices; slice++)
+		{
+			float theta = pi * stack / stacks;
+			float phi = 2.0f * pi * (slice % slices) / slices;
+			float radius = 1.0f + bump * sinf(phi * 5.0f) * sinf(theta * 4.0f);
+			test_vertex vertex;
+			vertex.normal = { sinf(theta) * cosf(phi), cosf(theta), -sinf(theta) * sinf(phi) };
+			vertex.pos = { radius * vertex.normal.x, radius * vertex.normal.y, radius * vertex.normal.z };
+			if (stack == 0 || stack == stacks)
+			{
+				vertex.pos = { 0.0f, stack == 0 ? radius : -radius, 0.0f };
+			}
+			vertex.texCoord = { slice / (float)slices, stack / (float)stacks };
+			vertices.push_back(vertex);
+		}
+	}
+	int row = slices + 1;
+	for (int stack = 0; stack < stacks; stack++)
+	{
+		for (int slice = 0; slice < slices; slice++)
+		{
+			int a = stack * row + slice;
+			indices.insert(indices.end(), { a, a + row, a + 1, a + 1, a + row, a + row + 1 });
+		}
+	}
+}
+
+//Whole triangles with distinct corners in range
+static bool valid_triangles(const int* indices, int index_count, int vertex_count)
+{
+	if (index_count % 3 != 0)
+	{
+		return false;
+	}
+	for (int i = 0; i < index_count; i += 3)
+	{
+		for (int corner = 0; corner < 3; corner++)
+		{
+			if (indices[i + corner] < 0 || indices[i + corner] >= vertex_count)
+			{
+				return false;
+			}
+		}
+		if (indices[i] == indices[i + 1] || indices[i + 1] == indices[i + 2] || indices[i] == indices[i + 2])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//Each call continues from the level before, it gets to its target and its error never goes down
+static void check_targets(int slices, int stacks)
+{
+	std::vector<test_vertex> vertices;
+	std::vector<int> indices;
+	build_sphere(slices, stacks, 0.1f, vertices, indices);
+	int vertex_count = (int)vertices.size();
+	int full_triangles = (int)indices.size() / 3;
+
+	mesh_simplifier simplifier;
+	auto start = std::chrono::high_resolution_clock::now();
+	simplifier.build(&vertices[0].pos.x, &vertices[0].normal.x, &vertices[0].texCoord.x, sizeof(test_vertex), vertex_count, indices.data(), (int)indices.size());
+
+	std::vector<int> level = indices;
+	float previous_error = 0.0f;
+	for (int divisor : { 2, 4, 8, 16, 32, 64 })
+	{
+		int target = full_triangles / divisor;
+		float error = simplifier.simplify(level, target * 3);
+		int triangles = (int)level.size() / 3;
+		printf("  %7d of %d triangles, target %7d, error %.5f\n", triangles, full_triangles, target, error);
+		CHECK(triangles <= target);
+		CHECK(triangles > 0);
+		CHECK(valid_triangles(level.data(), (int)level.size(), vertex_count));
+		CHECK(error >= previous_error);
+		previous_error = error;
+	}
+	double milliseconds = milliseconds_since(start);
+	CHECK(previous_error > 0.0f);
+	printf("sphere %dx%d: %d triangles down to 1/64 in %.1f ms, %.2f Mtri/s\n", slices, stacks, full_triangles, milliseconds, full_triangles / milliseconds / 1000.0);
+}
+
+//The chain the renderer uses: levels halve, sit back to back after the full detail indices and get coarser in error
+static void check_chain(job_system& jobs)
+{
+	std::vector<test_vertex> vertices;
+	std::vector<int> indices;
+	build_sphere(128, 64, 0.1f, vertices, indices);
+	int full_count = (int)indices.size();
+
+	std::vector<mesh_simplify_task<test_vertex>> tasks(1);
+	tasks[0].vertices = &vertices;
+	tasks[0].indices = &indices;
+	tasks[0].lod_count = 6;
+	simplify_meshes(&jobs, tasks);
+	const lod_chain& chain = tasks[0].lods;
+
+	CHECK(chain.count > 1 && chain.count <= 6);
+	CHECK(chain.levels[0].first_index == 0 && chain.levels[0].index_count == full_count && chain.levels[0].error == 0.0f);
+	int expected_first = full_count;
+	for (int lod = 1; lod < chain.count; lod++)
+	{
+		const mesh_lod& level = chain.levels[lod];
+		CHECK(level.first_index == expected_first);
+		CHECK(level.index_count <= (full_count / 3 >> lod) * 3);
+		CHECK(level.error >= chain.levels[lod - 1].error);
+		CHECK(valid_triangles(&indices[level.first_index], level.index_count, (int)vertices.size()));
+		expected_first += level.index_count;
+	}
+	CHECK(expected_first == (int)indices.size());
+}
+
+int main()
+{
+	check_targets(64, 32);
+	check_targets(256, 128);
+	job_system jobs(0);
+	check_chain(jobs);
+	return check_failures;
+}
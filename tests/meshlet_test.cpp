@@ -0,0 +1,191 @@
+#include "check.h"
+#include "meshlet.h"
+
+#include <random>
+
+//A UV sphere with some radial noise, so the meshlets' normal cones come in different widths. Triangles are wound
+//so that cross(b - a, c - a) points outwards, which is the winding the cone test treats as front facing.
+static void build_sphere(int rings, int segments, float noise, std::vector<float>& positions, std::vector<int>& indices)
+{
+	std::mt19937 random(36);
+	std::uniform_real_distribution<float> bump(1.0f - noise, 1.0f + noise);
+	positions.clear();
+	indices.clear();
+	for (int ring = 0; ring <= rings; ring++)
+	{
+		for (int segment = 0; segment <= segments; segment++)
+		{
+			float theta = 3.14159265f * ring / rings;
+			float phi = 6.28318531f * segment / segments;
+			float radius = ring == 0 || ring == rings ? 1.0f : bump(random);
+			positions.insert(positions.end(), { radius * sinf(theta) * cosf(phi), radius * cosf(theta), radius * sinf(theta) * sinf(phi) });
+		}
+	}
+	for (int ring = 0; ring < rings; ring++)
+	{
+		for (int segment = 0; segment < segments; segment++)
+		{
+			int a = ring * (segments + 1) + segment;
+			int c = a + segments + 1;
+			indices.insert(indices.end(), { a, c, a + 1, a + 1, c, c + 1 });
+		}
+	}
+}
+
+static void triangle_normal(const std::vector<float>& positions, const int* triangle, float normal[3])
+{
+	const float* a = &positions[triangle[0] * 3];
+	const float* b = &positions[triangle[1] * 3];
+	const float* c = &positions[triangle[2] * 3];
+	float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+	normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+	normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+//Meshlets are contiguous runs of the index buffer that stay inside both limits and cover every triangle once
+static void check_limits(const std::vector<float>& positions, const std::vector<int>& indices, const meshlet_set& set)
+{
+	int covered = 0;
+	bool in_order = true;
+	bool within_limits = true;
+	bool vertex_counts = true;
+	for (const meshlet& cluster : set.meshlets)
+	{
+		in_order &= cluster.first_index == covered && cluster.index_count > 0 && cluster.index_count % 3 == 0;
+		covered += cluster.index_count;
+		within_limits &= cluster.vertex_count <= meshlet_max_vertices && cluster.index_count <= meshlet_max_triangles * 3;
+
+		std::vector<int> used(indices.begin() + cluster.first_index, indices.begin() + cluster.first_index + cluster.index_count);
+		std::sort(used.begin(), used.end());
+		vertex_counts &= std::unique(used.begin(), used.end()) - used.begin() == cluster.vertex_count;
+	}
+	CHECK(in_order);
+	CHECK(covered == (int)indices.size());
+	CHECK(within_limits);
+	CHECK(vertex_counts);
+	// the bounds are padded to whole packets
+	CHECK(set.radius.size() % packet_width == 0 && set.radius.size() >= set.meshlets.size());
+
+	bool spheres_contain = true;
+	for (size_t m = 0; m < set.meshlets.size(); m++)
+	{
+		const meshlet& cluster = set.meshlets[m];
+		for (int i = cluster.first_index; i < cluster.first_index + cluster.index_count; i++)
+		{
+			const float* p = &positions[indices[i] * 3];
+			float dx = p[0] - set.centre[0][m], dy = p[1] - set.centre[1][m], dz = p[2] - set.centre[2][m];
+			spheres_contain &= sqrtf(dx * dx + dy * dy + dz * dz) <= set.radius[m] * 1.0001f + 1e-6f;
+		}
+	}
+	CHECK(spheres_contain);
+}
+
+//With the frustum accepting everything and the object behind the camera for the small primitive test, only the
+//normal cones cull. A culled meshlet may not contain a single triangle that faces a camera at that position.
+static void check_cone_culling(const std::vector<float>& positions, const std::vector<int>& indices, const meshlet_set& set)
+{
+	cluster_cull_view view = {};
+	for (plane& p : view.planes.planes)
+	{
+		p.distance = 1.0f;
+	}
+	view.object_to_view[3][2] = -1.0f;
+	view.radius_scale = 1.0f;
+	view.projection_x = 1000.0f;
+	view.projection_y = 1000.0f;
+	view.near_plane = 0.1f;
+
+	std::mt19937 random(360);
+	std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> distance(1.2f, 20.0f);
+	std::vector<index_range> ranges(set.meshlets.size());
+	std::vector<uint8_t> drawn(indices.size() / 3);
+	int front_facing_culled = 0;
+	long long culled = 0;
+	long long tested = 0;
+	for (int view_index = 0; view_index < 500; view_index++)
+	{
+		float d[3] = { direction(random), direction(random), direction(random) };
+		float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) + 1e-6f;
+		float scale = distance(random) / length;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			view.camera[axis] = d[axis] * scale;
+		}
+
+		int visible = 0;
+		int range_count = cull_meshlets(set, view, ranges.data(), visible);
+		std::fill(drawn.begin(), drawn.end(), 0);
+		for (int r = 0; r < range_count; r++)
+		{
+			std::fill(drawn.begin() + ranges[r].first_index / 3, drawn.begin() + (ranges[r].first_index + ranges[r].index_count) / 3, 1);
+		}
+		for (size_t t = 0; t < drawn.size(); t++)
+		{
+			tested++;
+			if (drawn[t])
+			{
+				continue;
+			}
+			culled++;
+			float normal[3];
+			triangle_normal(positions, &indices[t * 3], normal);
+			const float* a = &positions[indices[t * 3] * 3];
+			float facing = normal[0] * (a[0] - view.camera[0]) + normal[1] * (a[1] - view.camera[1]) + normal[2] * (a[2] - view.camera[2]);
+			if (facing < 0.0f)
+			{
+				front_facing_culled++;
+			}
+		}
+	}
+	CHECK(front_facing_culled == 0);
+	// from outside a closed sphere roughly half of it faces away, the cones have to find a fair share of that
+	CHECK(culled > tested / 10);
+	printf("cone culling over 500 views: %.1f%% of triangles culled, %d front facing among them\n", 100.0 * culled / tested, front_facing_culled);
+}
+
+static void check_meshlets(int rings, int segments, float noise, bool shuffle)
+{
+	std::vector<float> positions;
+	std::vector<int> indices;
+	build_sphere(rings, segments, noise, positions, indices);
+	if (shuffle)
+	{
+		// scattered triangles share few vertices, so the vertex limit ends meshlets before the triangle limit
+		int triangle_count = (int)indices.size() / 3;
+		std::mt19937 random(3600);
+		for (int t = triangle_count - 1; t > 0; t--)
+		{
+			int other = std::uniform_int_distribution<int>(0, t)(random);
+			std::swap_ranges(indices.begin() + t * 3, indices.begin() + t * 3 + 3, indices.begin() + other * 3);
+		}
+	}
+
+	meshlet_set set;
+	auto start = std::chrono::high_resolution_clock::now();
+	build_meshlets(positions.data(), 3 * sizeof(float), indices.data(), (int)indices.size(), (int)positions.size() / 3, set);
+	double milliseconds = milliseconds_since(start);
+	printf("%zu triangles%s: %zu meshlets in %.2f ms\n", indices.size() / 3, shuffle ? " shuffled" : "", set.meshlets.size(), milliseconds);
+
+	check_limits(positions, indices, set);
+	if (!shuffle)
+	{
+		check_cone_culling(positions, indices, set);
+	}
+}
+
+int main()
+{
+	check_meshlets(100, 160, 0.0f, false);
+	check_meshlets(100, 160, 0.003f, false);
+	check_meshlets(60, 80, 0.0f, true);
+	{
+		// nothing in, nothing out
+		meshlet_set set;
+		build_meshlets(nullptr, 12, nullptr, 0, 0, set);
+		CHECK(set.meshlets.empty());
+	}
+	return check_failures;
+}
@@ -0,0 +1,102 @@
+#include "check.h"
+#include "radix_sort.h"
+
+#include <random>
+
+struct sort_item
+{
+	uint64_t key;
+	int index;
+};
+
+static bool key_less(const sort_item& a, const sort_item& b)
+{
+	return a.key < b.key;
+}
+
+//Keys are masked so small masks give plenty of duplicates, which is what shows a sort is not stable
+static std::vector<sort_item> random_items(std::mt19937_64& random, int count, uint64_t mask)
+{
+	std::vector<sort_item> items(count);
+	for (int i = 0; i < count; i++)
+	{
+		items[i].key = random() & mask;
+		items[i].index = i;
+	}
+	return items;
+}
+
+static bool same_order(const std::vector<sort_item>& a, const std::vector<sort_item>& b)
+{
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (a[i].key != b[i].key || a[i].index != b[i].index)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//Every size has to come out exactly like std::stable_sort, including the order of equal keys
+static void check_matches_stable_sort(job_system& jobs)
+{
+	std::mt19937_64 random(32);
+	const uint64_t masks[] = { ~0ull, 0xffull, 0xff00000000000f00ull, 0 };
+	for (int count : { 0, 1, 2, 100, 4096, 50000 })
+	{
+		for (uint64_t mask : masks)
+		{
+			std::vector<sort_item> items = random_items(random, count, mask);
+			std::vector<sort_item> expected = items;
+			std::vector<sort_item> scratch;
+			std::stable_sort(expected.begin(), expected.end(), key_less);
+			radix_sort(&jobs, items, scratch);
+			CHECK(same_order(items, expected));
+		}
+	}
+}
+
+static void benchmark_sort(job_system& jobs)
+{
+	const int count = 100000;
+	const int repeats = 10;
+	std::mt19937_64 random(7);
+	std::vector<sort_item> source = random_items(random, count, ~0ull);
+	std::vector<sort_item> items, scratch;
+
+	double radix = 1e9;
+	double stable = 1e9;
+	for (int repeat = 0; repeat < repeats; repeat++)
+	{
+		items = source;
+		auto start = std::chrono::high_resolution_clock::now();
+		radix_sort(&jobs, items, scratch);
+		radix = std::min(radix, milliseconds_since(start));
+
+		items = source;
+		start = std::chrono::high_resolution_clock::now();
+		std::stable_sort(items.begin(), items.end(), key_less);
+		stable = std::min(stable, milliseconds_since(start));
+	}
+	printf("%d keys, %d workers: radix_sort %.3f ms, std::stable_sort %.3f ms\n", count, jobs.worker_count(), radix, stable);
+}
+
+int main()
+{
+	{
+		job_system jobs(3);
+		check_matches_stable_sort(jobs);
+		benchmark_sort(jobs);
+	}
+	{
+		job_system jobs(0);
+		check_matches_stable_sort(jobs);
+		benchmark_sort(jobs);
+	}
+	return check_failures;
+}
@@ -0,0 +1,146 @@
+#include "check.h"
+#include "tangent_space.h"
+
+struct test_float2
+{
+	float x, y;
+};
+
+struct test_float3
+{
+	float x, y, z;
+};
+
+struct test_float4
+{
+	float x, y, z, w;
+};
+
+struct test_vertex
+{
+	test_float3 pos;
+	test_float3 normal;
+	test_float2 texCoord;
+	test_float4 tangent;
+};
+
+//A flat strip in the xy plane facing -z, columns x = 0..columns and rows y = 0..rows. u runs with x up to
+//mirror_column and back down after it, the way a symmetric model shares one half of its texture.
+static void build_strip(int columns, int rows, int mirror_column, std::vector<test_vertex>& vertices, std::vector<int>& indices)
+{
+	for (int y = 0; y <= rows; y++)
+	{
+		for (int x = 0; x <= columns; x++)
+		{
+			float u = (float)(x <= mirror_column ? x : 2 * mirror_column - x);
+			test_vertex vertex = { { (float)x, (float)y, 0.0f }, { 0.0f, 0.0f, -1.0f }, { u * 0.25f, 1.0f - y * 0.25f }, { 0.0f, 0.0f, 0.0f, 0.0f } };
+			vertices.push_back(vertex);
+		}
+	}
+	int row = columns + 1;
+	for (int y = 0; y < rows; y++)
+	{
+		for (int x = 0; x < columns; x++)
+		{
+			int a = y * row + x;
+			indices.insert(indices.end(), { a, a + row, a + 1, a + 1, a + row, a + row + 1 });
+		}
+	}
+}
+
+static void tangents_for(job_system& jobs, std::vector<test_vertex>& vertices, const std::vector<int>& indices)
+{
+	compute_tangents(&jobs, &vertices[0].pos.x, &vertices[0].normal.x, &vertices[0].texCoord.x, &vertices[0].tangent.x, sizeof(test_vertex),
+		(int)vertices.size(), indices.data(), (int)indices.size());
+}
+
+//The seam column is shared by both halves. Split, each half gets its own copy of it with a tangent along its own +u,
+//where summing both would have cancelled to nothing.
+static void check_mirror_seam(job_system& jobs)
+{
+	const int columns = 4, rows = 3, mirror_column = 2;
+	std::vector<test_vertex> vertices;
+	std::vector<int> indices;
+	build_strip(columns, rows, mirror_column, vertices, indices);
+	int original_count = (int)vertices.size();
+
+	split_mirrored_vertices(vertices, indices);
+	CHECK((int)vertices.size() == original_count + rows + 1);
+	tangents_for(jobs, vertices, indices);
+
+	// every vertex is now used by one side only, and its tangent and handedness match that side
+	bool one_side = true;
+	bool along_u = true;
+	for (size_t t = 0; t < indices.size() / 3; t++)
+	{
+		const float* uv0 = &vertices[indices[t * 3]].texCoord.x;
+		const float* uv1 = &vertices[indices[t * 3 + 1]].texCoord.x;
+		const float* uv2 = &vertices[indices[t * 3 + 2]].texCoord.x;
+		bool mirrored = texcoord_signed_area(uv0, uv1, uv2) < 0.0f;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			const test_vertex& vertex = vertices[indices[t * 3 + corner]];
+			one_side &= vertex.tangent.w == (mirrored ? -1.0f : 1.0f);
+			along_u &= std::fabs(vertex.tangent.x - (mirrored ? -1.0f : 1.0f)) < 1e-5f;
+		}
+	}
+	CHECK(one_side);
+	CHECK(along_u);
+	// the copies keep everything else of the vertex they were split from
+	for (int copy = original_count; copy < (int)vertices.size(); copy++)
+	{
+		int source = (copy - original_count) * (columns + 1) + mirror_column;
+		CHECK(vertices[copy].pos.x == vertices[source].pos.x && vertices[copy].pos.y == vertices[source].pos.y);
+		CHECK(vertices[copy].texCoord.x == vertices[source].texCoord.x && vertices[copy].normal.z == vertices[source].normal.z);
+	}
+}
+
+//Nothing to split without a mirror, or where the only other triangle has no texture area
+static void check_no_split(job_system& jobs)
+{
+	std::vector<test_vertex> vertices;
+	std::vector<int> indices;
+	build_strip(4, 2, 4, vertices, indices);
+	std::vector<int> original = indices;
+	split_mirrored_vertices(vertices, indices);
+	CHECK(vertices.size() == 15 && indices == original);
+	tangents_for(jobs, vertices, indices);
+	bool along_x = true;
+	for (const test_vertex& vertex : vertices)
+	{
+		along_x &= std::fabs(vertex.tangent.x - 1.0f) < 1e-5f && vertex.tangent.w == 1.0f;
+	}
+	CHECK(along_x);
+
+	// a sliver whose texture coordinates collapse to a point takes no side
+	test_vertex sliver = vertices[0];
+	sliver.pos.z = -1.0f;
+	vertices.push_back(sliver);
+	vertices.push_back(sliver);
+	indices.insert(indices.end(), { 0, 15, 16 });
+	split_mirrored_vertices(vertices, indices);
+	CHECK(vertices.size() == 17);
+}
+
+static void benchmark_tangents(job_system& jobs)
+{
+	std::vector<test_vertex> vertices;
+	std::vector<int> indices;
+	build_strip(1000, 500, 500, vertices, indices);
+	auto start = std::chrono::high_resolution_clock::now();
+	split_mirrored_vertices(vertices, indices);
+	double split = milliseconds_since(start);
+	start = std::chrono::high_resolution_clock::now();
+	tangents_for(jobs, vertices, indices);
+	double tangents = milliseconds_since(start);
+	printf("%zu triangles: split %.2f ms, tangents %.2f ms, %d workers\n", indices.size() / 3, split, tangents, jobs.worker_count());
+}
+
+int main()
+{
+	job_system jobs(3);
+	check_mirror_seam(jobs);
+	check_no_split(jobs);
+	benchmark_tangents(jobs);
+	return check_failures;
+}
@@ -0,0 +1,126 @@
+#include "check.h"
+#include "tlsf.h"
+
+#include <map>
+#include <random>
+
+const uint64_t kilobyte = 1024;
+const uint64_t megabyte = 1024 * kilobyte;
+const uint64_t heap_size = 256 * megabyte;
+const uint64_t granularity = 64 * kilobyte; // D3D12's placement alignment for buffers and most textures
+
+//Every block is in one piece again once everything has been freed
+static void check_coalesced(const tlsf_allocator& heap)
+{
+	CHECK(heap.allocations == 0);
+	CHECK(heap.used_bytes() == 0);
+	CHECK(heap.free_bytes() == heap.size_bytes());
+	CHECK(heap.largest_free_bytes() == heap.size_bytes());
+	CHECK(heap.fragmentation() == 0.0f);
+}
+
+static void check_basics()
+{
+	tlsf_allocator heap;
+	heap.initialise(heap_size, granularity);
+	CHECK(heap.size_bytes() == heap_size);
+	check_coalesced(heap);
+
+	// sizes round up to whole granules
+	uint64_t a_offset, b_offset, c_offset;
+	int a = heap.allocate(1, granularity, a_offset);
+	int b = heap.allocate(granularity + 1, granularity, b_offset);
+	CHECK(a >= 0 && b >= 0 && a_offset != b_offset);
+	CHECK(heap.used_bytes() == 3 * granularity);
+
+	// a 4MB aligned block (MSAA targets) leaves the padding in front of it free
+	int c = heap.allocate(megabyte, 4 * megabyte, c_offset);
+	CHECK(c >= 0 && c_offset % (4 * megabyte) == 0);
+	CHECK(heap.used_bytes() == 3 * granularity + megabyte);
+
+	// freed out of order, neighbours merge from either side
+	heap.free(b);
+	heap.free(c);
+	heap.free(a);
+	check_coalesced(heap);
+
+	// the whole heap in one block, then nothing fits
+	uint64_t offset;
+	int whole = heap.allocate(heap_size, granularity, offset);
+	CHECK(whole >= 0 && offset == 0 && heap.free_bytes() == 0);
+	CHECK(heap.allocate(1, granularity, offset) < 0);
+	heap.free(whole);
+	CHECK(heap.allocate(heap_size + 1, granularity, offset) < 0);
+	check_coalesced(heap);
+}
+
+struct live_block
+{
+	uint64_t size;
+	int handle;
+};
+
+//Random sizes at 64KB and 4MB alignment against a map of what is live: no two blocks overlap, none runs past the
+//heap, and freeing the survivors in random order leaves a single free block
+static void check_random()
+{
+	tlsf_allocator heap;
+	heap.initialise(heap_size, granularity);
+	std::mt19937 random(1);
+	std::map<uint64_t, live_block> live; // by offset
+	int failed = 0;
+	for (int step = 0; step < 200000; step++)
+	{
+		if (live.empty() || random() % 3 != 0)
+		{
+			uint64_t size = 1 + random() % (4 * megabyte);
+			uint64_t alignment = random() % 8 == 0 ? 4 * megabyte : granularity;
+			uint64_t offset;
+			int handle = heap.allocate(size, alignment, offset);
+			if (handle < 0)
+			{
+				failed++;
+				continue;
+			}
+			CHECK(offset % alignment == 0);
+			CHECK(offset + size <= heap_size);
+			auto next = live.lower_bound(offset);
+			CHECK(next == live.end() || next->first >= offset + size);
+			if (next != live.begin())
+			{
+				auto previous = std::prev(next);
+				CHECK(previous->first + previous->second.size <= offset);
+			}
+			live[offset] = { size, handle };
+		}
+		else
+		{
+			auto victim = live.begin();
+			std::advance(victim, random() % live.size());
+			heap.free(victim->second.handle);
+			live.erase(victim);
+		}
+		CHECK(heap.allocations == (int)live.size());
+	}
+	printf("%zu live blocks, %.1f MB used, fragmentation %.3f, %d allocations did not fit\n",
+		live.size(), heap.used_bytes() / (double)megabyte, heap.fragmentation(), failed);
+
+	std::vector<int> handles;
+	for (auto& entry : live)
+	{
+		handles.push_back(entry.second.handle);
+	}
+	std::shuffle(handles.begin(), handles.end(), random);
+	for (int handle : handles)
+	{
+		heap.free(handle);
+	}
+	check_coalesced(heap);
+}
+
+int main()
+{
+	check_basics();
+	check_random();
+	return check_failures;
+}
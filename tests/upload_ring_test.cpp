@@ -0,0 +1,184 @@
+#include "check.h"
+#include "upload_ring.h"
+
+#include <cstdlib>
+#include <map>
+
+//Pages are plain vectors and the fence is a number the test moves forward
+struct mock_pages
+{
+	typedef int resource;
+
+	bool create_page(uint64_t size, int& memory, uint8_t*& cpu, uint64_t& gpu)
+	{
+		memory = next++;
+		live[memory] = std::vector<uint8_t>(size);
+		cpu = live[memory].data();
+		gpu = (uint64_t)memory << 40;
+		return true;
+	}
+
+	void release_page(int memory)
+	{
+		live.erase(memory);
+	}
+
+	uint64_t completed_value()
+	{
+		return completed;
+	}
+
+	uint64_t completed = 0;
+	int next = 1;
+	std::map<int, std::vector<uint8_t>> live;
+};
+
+const uint64_t megabyte = 1 << 20;
+
+//Allocations walk the page and wrap to its start once the tail has moved past the space needed
+static void check_wrap()
+{
+	upload_ring<mock_pages> ring;
+	upload_allocation<int> a, b, c;
+	CHECK(ring.allocate(3 * megabyte, 256, a) && a.offset == 0);
+	ring.submit(1);
+	CHECK(ring.allocate(megabyte / 2, 256, b) && b.offset == 3 * megabyte);
+	ring.submit(2);
+
+	// nothing retired, 2MB fits neither the end nor the start, so a page is chained on
+	CHECK(ring.allocate(2 * megabyte, 256, c) && c.memory != a.memory);
+	CHECK(ring.pages.size() == 2);
+	ring.submit(3);
+
+	ring.backend.completed = 1;
+	ring.retire();
+	CHECK(ring.pages[0].tail == 3 * megabyte);
+	// the first page's end is too short, its start is free again
+	ring.current = 0;
+	CHECK(ring.allocate(2 * megabyte, 256, c) && c.memory == a.memory && c.offset == 0);
+	CHECK(c.cpu == ring.backend.live[c.memory].data());
+	// the skipped end counts as used until the allocation that skipped it retires
+	CHECK(ring.pages[0].used == megabyte / 2 + (upload_page_size - 3 * megabyte - megabyte / 2) + 2 * megabyte);
+	// a full page refuses what does not fit between head and tail
+	CHECK(!ring.allocate(2 * megabyte, 256, c) || c.memory != a.memory);
+	ring.release();
+	CHECK(ring.backend.live.empty());
+}
+
+//Pages double as they are chained on, one bigger than that is sized to fit
+static void check_growth()
+{
+	upload_ring<mock_pages> ring;
+	upload_allocation<int> a;
+	CHECK(ring.allocate(upload_page_size, 16, a));
+	CHECK(ring.allocate(1, 16, a) && ring.pages.size() == 2 && ring.pages[1].size == upload_page_size * 2);
+	CHECK(ring.allocate(40 * megabyte + 1, 16, a) && ring.pages.size() == 3);
+	CHECK(ring.pages[2].size == 40 * megabyte + upload_page_alignment);
+	CHECK(ring.capacity() == upload_page_size * 3 + 40 * megabyte + upload_page_alignment);
+	ring.release();
+}
+
+//Space comes back only once the fence passes the submit it went out with, and idle pages are handed back
+static void check_retirement()
+{
+	upload_ring<mock_pages> ring;
+	upload_allocation<int> a;
+	for (uint64_t fence = 1; fence <= 3; fence++)
+	{
+		CHECK(ring.allocate(megabyte, 16, a));
+		ring.submit(fence);
+	}
+	CHECK(ring.in_flight() == 3 * megabyte);
+	ring.backend.completed = 2;
+	ring.retire();
+	CHECK(ring.in_flight() == megabyte);
+	ring.backend.completed = 3;
+	ring.retire();
+	CHECK(ring.in_flight() == 0);
+	CHECK(ring.pages[0].head == 0 && ring.pages[0].tail == 0);
+
+	// a burst chains on a second page, it goes once it has sat empty long enough
+	CHECK(ring.allocate(upload_page_size, 16, a) && ring.allocate(upload_page_size, 16, a));
+	CHECK(ring.backend.live.size() == 2);
+	ring.submit(4);
+	ring.backend.completed = 4;
+	for (uint64_t fence = 5; fence < 5 + upload_page_idle_submits + 2; fence++)
+	{
+		ring.current = 0;
+		CHECK(ring.allocate(1024, 16, a) && a.memory == ring.pages[0].memory);
+		ring.submit(fence);
+		ring.backend.completed = fence;
+		ring.retire();
+	}
+	CHECK(ring.backend.live.size() == 1);
+	ring.release();
+}
+
+struct record
+{
+	int memory;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t fence_value;
+};
+
+//Random sizes and alignments, with the GPU lagging a few submits behind: nothing in flight is ever handed out twice
+static void check_random()
+{
+	upload_ring<mock_pages> ring;
+	std::vector<record> live;
+	srand(1);
+	uint64_t fence = 0;
+	for (int frame = 0; frame < 20000; frame++)
+	{
+		int count = rand() % 20;
+		for (int i = 0; i < count; i++)
+		{
+			uint64_t size = frame % 5000 < 50 ? rand() % (3 << 20) : rand() % 70000;
+			uint64_t alignment = 1ull << (rand() % 10);
+			upload_allocation<int> a;
+			if (!ring.allocate(size, alignment, a))
+			{
+				CHECK(false);
+				continue;
+			}
+			CHECK(a.offset % alignment == 0);
+			CHECK(a.offset + size <= ring.backend.live[a.memory].size());
+			CHECK(a.cpu == ring.backend.live[a.memory].data() + a.offset);
+			for (const record& r : live)
+			{
+				bool overlap = r.memory == a.memory && a.offset < r.offset + r.size && r.offset < a.offset + size;
+				CHECK(!overlap);
+			}
+			live.push_back({ a.memory, a.offset, size, fence + 1 });
+		}
+		fence++;
+		ring.submit(fence);
+		uint64_t lag = rand() % 4;
+		if (fence > lag)
+		{
+			ring.backend.completed = std::max(ring.backend.completed, fence - lag);
+		}
+		ring.retire();
+		std::vector<record> kept;
+		for (const record& r : live)
+		{
+			if (r.fence_value > ring.backend.completed)
+			{
+				kept.push_back(r);
+			}
+		}
+		live.swap(kept);
+	}
+	ring.release();
+	CHECK(ring.backend.live.empty());
+}
+
+int main()
+{
+	check_wrap();
+	check_growth();
+	check_retirement();
+	check_random();
+	return check_failures;
+}